@@ -0,0 +1,385 @@
+//
+// PTLsim: Cycle Accurate x86-64 Simulator
+// Userspace Checkpoints
+//
+// Copyright 2008 Matt T. Yourst <yourst@yourst.com>
+//
+
+#include <globals.h>
+#include <superstl.h>
+#include <mm.h>
+#include <ptlsim.h>
+#include <kernel.h>
+#include <checkpoint.h>
+
+#define __INSIDE_PTLSIM__
+#include <ptlcalls.h>
+
+static bitvec<CHECKPOINT_MAX_FDS> ptlsim_fds;
+
+void capture_ptlsim_fds() {
+  ptlsim_fds.reset();
+
+  foreach (fd, CHECKPOINT_MAX_FDS) {
+    if (sys_seek(fd, 0, SEEK_CUR) != (W64)-EBADF) ptlsim_fds[fd] = 1;
+  }
+}
+
+//
+// PTLsim's own memory (its image, its private pages on /dev/zero and
+// the thunk page) and the kernel's special mappings are never saved,
+// restored or unmapped.
+//
+static bool ptlsim_owned_extent(const MemoryMapExtent& map) {
+  Waddr start = (Waddr)map.start;
+  Waddr end = start + map.length;
+
+  if (map.flags & (MAP_ZERO|MAP_VDSO|MAP_KERNEL)) return true;
+  if ((W64)start >= (W64)ADDRESS_SPACE_SIZE) return true;
+  if ((start < (PTL_IMAGE_BASE + PTL_IMAGE_SIZE)) && (end > PTL_IMAGE_BASE)) return true;
+  if ((start < (PTLSIM_THUNK_PAGE + 4*PAGE_SIZE)) && (end > PTLSIM_THUNK_PAGE)) return true;
+  return false;
+}
+
+static bool write_fully(int fd, const void* p, W64 bytes) {
+  const byte* bp = (const byte*)p;
+  while (bytes) {
+    int n = sys_write(fd, bp, min(bytes, (W64)(64*1024*1024)));
+    if (n <= 0) return false;
+    bp += n;
+    bytes -= n;
+  }
+  return true;
+}
+
+static bool read_fully(int fd, void* p, W64 bytes) {
+  byte* bp = (byte*)p;
+  while (bytes) {
+    int n = sys_read(fd, bp, min(bytes, (W64)(64*1024*1024)));
+    if (n <= 0) return false;
+    bp += n;
+    bytes -= n;
+  }
+  return true;
+}
+
+//
+// Find the regular files the user process has open. Pipes, sockets,
+// devices and anything PTLsim opened itself are skipped.
+//
+static int find_open_files(dynarray<CheckpointFile>& files) {
+  foreach (fd, CHECKPOINT_MAX_FDS) {
+    if (ptlsim_fds[fd]) continue;
+
+    stringbuf sb;
+    sb << "/proc/self/fd/", fd;
+
+    CheckpointFile f;
+    setzero(f);
+    int n = sys_readlink(sb, f.path, sizeof(f.path)-1);
+    if (n <= 0) continue;
+    f.path[n] = 0;
+
+    if ((f.path[0] != '/') || (!strncmp(f.path, "/dev/", 5)) || (!strncmp(f.path, "/proc/", 6))) {
+      logfile << "save_checkpoint: skipping fd ", fd, " (", f.path, "): not a regular file", endl;
+      continue;
+    }
+
+    sb.reset();
+    sb << "/proc/self/fdinfo/", fd;
+    int infofd = sys_open(sb, O_RDONLY, 0);
+    if (infofd < 0) continue;
+    char info[256];
+    n = sys_read(infofd, info, sizeof(info)-1);
+    sys_close(infofd);
+    if (n <= 0) continue;
+    info[n] = 0;
+
+    W64 pos = 0;
+    W64 flags = 0;
+    if (sscanf(info, "pos: %llu flags: %llo", &pos, &flags) != 2) continue;
+
+    f.fd = fd;
+    f.pos = pos;
+    f.flags = flags;
+    files.push(f);
+  }
+
+  return files.length;
+}
+
+bool save_checkpoint(const char* filename) {
+  MemoryMapExtent* mapstart = (MemoryMapExtent*)ptl_mm_alloc_private_pages(MAX_MAPS_PER_PROCESS * sizeof(MemoryMapExtent));
+  int n = mqueryall(mapstart, MAX_MAPS_PER_PROCESS);
+
+  dynarray<CheckpointRegion> regions;
+  dynarray<CheckpointFile> files;
+
+  foreach (i, n) {
+    const MemoryMapExtent& map = mapstart[i];
+    if (ptlsim_owned_extent(map)) continue;
+
+    CheckpointRegion r;
+    r.start = (Waddr)map.start;
+    r.length = map.length;
+    r.prot = map.prot;
+    r.flags = map.flags;
+    r.offset = 0;
+    regions.push(r);
+  }
+
+  ptl_mm_free_private_pages(mapstart, MAX_MAPS_PER_PROCESS * sizeof(MemoryMapExtent));
+
+  find_open_files(files);
+
+  CheckpointHeader header;
+  setzero(header);
+  header.magic = CheckpointHeader::MAGIC;
+  header.version = CheckpointHeader::VERSION;
+  header.contextsize = sizeof(Context);
+  header.regioncount = regions.length;
+  header.filecount = files.length;
+  header.brkbase = (Waddr)asp.brkbase;
+  header.brk = (Waddr)asp.brk;
+  header.stack_min_addr = stack_min_addr;
+  header.stack_max_addr = stack_max_addr;
+  header.fsbase = ctx.seg[SEGID_FS].base;
+  header.gsbase = ctx.seg[SEGID_GS].base;
+
+  // Lay out the page aligned region data after the tables:
+  W64 offset = ceil(sizeof(CheckpointHeader) + sizeof(Context) + (regions.length * sizeof(CheckpointRegion)) + (files.length * sizeof(CheckpointFile)), PAGE_SIZE);
+  W64 databytes = 0;
+
+  foreach (i, regions.length) {
+    CheckpointRegion& r = regions.data[i];
+    // Pages we cannot read (e.g. guard pages) have no contents worth saving
+    if (!(r.prot & PROT_READ)) continue;
+    r.offset = offset;
+    offset += r.length;
+    databytes += r.length;
+  }
+
+  int fd = sys_open(filename, O_WRONLY|O_CREAT|O_TRUNC, 0644);
+  if (fd < 0) {
+    logfile << "save_checkpoint: cannot open ", filename, " for writing (rc ", fd, ")", endl, flush;
+    return false;
+  }
+
+  bool ok = write_fully(fd, &header, sizeof(header)) &&
+    write_fully(fd, &ctx, sizeof(Context)) &&
+    write_fully(fd, regions.data, regions.length * sizeof(CheckpointRegion)) &&
+    write_fully(fd, files.data, files.length * sizeof(CheckpointFile));
+
+  foreach (i, regions.length) {
+    if (!ok) break;
+    const CheckpointRegion& r = regions.data[i];
+    if (!r.offset) continue;
+
+    sys_seek(fd, r.offset, SEEK_SET);
+    //
+    // File mappings may extend past the end of the file. The kernel
+    // refuses to write those pages, so they are left as a hole in the
+    // checkpoint and read back as zeros, like they would be natively.
+    //
+    if (!write_fully(fd, (const void*)(Waddr)r.start, r.length)) {
+      logfile << "save_checkpoint: region ", (void*)(Waddr)r.start, " is only partially readable; saving the rest as zeros", endl;
+    }
+  }
+
+  // Make sure the file covers the last region even if it ended in a hole
+  if (ok && (sys_seek(fd, 0, SEEK_END) < offset)) {
+    byte zero = 0;
+    sys_seek(fd, offset - 1, SEEK_SET);
+    ok = write_fully(fd, &zero, 1);
+  }
+
+  sys_close(fd);
+
+  if (!ok) {
+    logfile << "save_checkpoint: error while writing ", filename, endl, flush;
+    return false;
+  }
+
+  logfile << "Saved checkpoint of user process at rip ", (void*)(Waddr)ctx.commitarf[REG_rip], " to ", filename, ": ",
+    regions.length, " regions (", (databytes >> 10), " KB), ", files.length, " open files", endl;
+
+  foreach (i, files.length) {
+    const CheckpointFile& f = files.data[i];
+    logfile << "  fd ", intstring(f.fd, 4), ": ", f.path, " at offset ", f.pos, " (flags 0x", hexstring(f.flags, 32), ")", endl;
+  }
+
+  logfile << flush;
+  return true;
+}
+
+static bool overlaps(W64 start, W64 length, const MemoryMapExtent* maps, int n) {
+  foreach (i, n) {
+    const MemoryMapExtent& map = maps[i];
+    if (!ptlsim_owned_extent(map)) continue;
+    if ((start < ((Waddr)map.start + map.length)) && ((start + length) > (Waddr)map.start)) return true;
+  }
+  return false;
+}
+
+static void restore_open_files(const CheckpointFile* files, int count) {
+  foreach (i, count) {
+    const CheckpointFile& f = files[i];
+
+    if (sys_seek(f.fd, 0, SEEK_CUR) != (W64)-EBADF) {
+      logfile << "restore_checkpoint: fd ", f.fd, " (", f.path, ") is already in use; not restored", endl;
+      continue;
+    }
+
+    int fd = sys_open(f.path, f.flags & ~(O_CREAT|O_TRUNC|O_EXCL), 0);
+    if (fd < 0) {
+      logfile << "restore_checkpoint: cannot reopen ", f.path, " for fd ", f.fd, " (rc ", fd, ")", endl;
+      continue;
+    }
+
+    if (fd != (int)f.fd) {
+      sys_dup2(fd, f.fd);
+      sys_close(fd);
+    }
+
+    sys_seek(f.fd, f.pos, SEEK_SET);
+  }
+}
+
+bool restore_checkpoint(const char* filename) {
+  int fd = sys_open(filename, O_RDONLY, 0);
+  if (fd < 0) {
+    logfile << "restore_checkpoint: cannot open ", filename, " (rc ", fd, ")", endl, flush;
+    return false;
+  }
+
+  CheckpointHeader header;
+  if ((!read_fully(fd, &header, sizeof(header))) || (header.magic != CheckpointHeader::MAGIC) ||
+      (header.version != CheckpointHeader::VERSION) || (header.contextsize != sizeof(Context))) {
+    logfile << "restore_checkpoint: ", filename, " is not a checkpoint from this PTLsim build", endl, flush;
+    sys_close(fd);
+    return false;
+  }
+
+  Context* savedctx = (Context*)ptl_mm_alloc_private_pages(sizeof(Context));
+  CheckpointRegion* regions = (CheckpointRegion*)ptl_mm_alloc_private_pages(header.regioncount * sizeof(CheckpointRegion));
+  CheckpointFile* files = (CheckpointFile*)ptl_mm_alloc_private_pages(header.filecount * sizeof(CheckpointFile) + 1);
+
+  bool ok = read_fully(fd, savedctx, sizeof(Context)) &&
+    read_fully(fd, regions, header.regioncount * sizeof(CheckpointRegion)) &&
+    read_fully(fd, files, header.filecount * sizeof(CheckpointFile));
+
+  MemoryMapExtent* mapstart = (MemoryMapExtent*)ptl_mm_alloc_private_pages(MAX_MAPS_PER_PROCESS * sizeof(MemoryMapExtent));
+  int n = mqueryall(mapstart, MAX_MAPS_PER_PROCESS);
+
+  //
+  // Never map anything on top of PTLsim itself: if the address space
+  // layout changed (e.g. with ASLR), give up before touching anything.
+  //
+  foreach (i, header.regioncount) {
+    if (!ok) break;
+    const CheckpointRegion& r = regions[i];
+    if (overlaps(r.start, r.length, mapstart, n)) {
+      logfile << "restore_checkpoint: region ", (void*)(Waddr)r.start, " to ", (void*)(Waddr)(r.start + r.length),
+        " overlaps PTLsim's own memory; try running with address space randomization disabled (setarch -R)", endl, flush;
+      ok = false;
+    }
+  }
+
+  if (!ok) {
+    ptl_mm_free_private_pages(mapstart, MAX_MAPS_PER_PROCESS * sizeof(MemoryMapExtent));
+    ptl_mm_free_private_pages(savedctx, sizeof(Context));
+    ptl_mm_free_private_pages(regions, header.regioncount * sizeof(CheckpointRegion));
+    ptl_mm_free_private_pages(files, header.filecount * sizeof(CheckpointFile) + 1);
+    sys_close(fd);
+    return false;
+  }
+
+  // Throw away the freshly loaded program, interpreter and stack:
+  foreach (i, n) {
+    const MemoryMapExtent& map = mapstart[i];
+    if (ptlsim_owned_extent(map)) continue;
+    sys_munmap(map.start, map.length);
+  }
+
+  ptl_mm_free_private_pages(mapstart, MAX_MAPS_PER_PROCESS * sizeof(MemoryMapExtent));
+
+  //
+  // Move the kernel's brk to where it was, so later brk calls extend the
+  // restored heap. This only works if the new heap would start below the
+  // old break; otherwise the heap is still restored but cannot grow in place.
+  //
+  if (header.brk) {
+    void* newbrk = sys_brk((void*)(Waddr)header.brk);
+    if ((Waddr)newbrk != header.brk) {
+      logfile << "restore_checkpoint: warning: cannot move brk to ", (void*)(Waddr)header.brk, " (kernel brk is ", newbrk, ")", endl;
+    }
+  }
+
+  W64 databytes = 0;
+
+  foreach (i, header.regioncount) {
+    const CheckpointRegion& r = regions[i];
+    void* start = (void*)(Waddr)r.start;
+    void* p;
+
+    if (!r.offset) {
+      p = sys_mmap(start, r.length, r.prot, MAP_PRIVATE|MAP_FIXED|MAP_ANONYMOUS, -1, 0);
+    } else if (r.flags & MAP_STACK) {
+      //
+      // The stack must stay anonymous so the kernel can still grow it
+      // down; it is usually small, so just read it in right away.
+      //
+      p = sys_mmap(start, r.length, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_FIXED|MAP_ANONYMOUS|MAP_GROWSDOWN, -1, 0);
+      if (!mmap_invalid(p)) {
+        sys_seek(fd, r.offset, SEEK_SET);
+        if (!read_fully(fd, start, r.length)) ok = false;
+        sys_mprotect(start, r.length, r.prot);
+      }
+    } else {
+      p = sys_mmap(start, r.length, r.prot, MAP_PRIVATE|MAP_FIXED, fd, r.offset);
+    }
+
+    if (mmap_invalid(p) || (p != start)) {
+      logfile << "restore_checkpoint: cannot map region ", start, " (", r.length, " bytes): rc ", p, endl, flush;
+      ok = false;
+      break;
+    }
+
+    databytes += (r.offset) ? r.length : 0;
+  }
+
+  // Mapped regions keep their own reference to the checkpoint file:
+  sys_close(fd);
+
+  if (!ok) {
+    //
+    // The original program is already gone, so there is nothing
+    // sensible we can return to:
+    //
+    logfile << "restore_checkpoint: cannot recover from partially restored address space", endl, flush;
+    return false;
+  }
+
+  restore_open_files(files, header.filecount);
+
+  stack_min_addr = header.stack_min_addr;
+  stack_max_addr = header.stack_max_addr;
+  asp.brkbase = (void*)(Waddr)header.brkbase;
+  asp.brk = (void*)(Waddr)header.brk;
+
+  memcpy(&ctx, savedctx, sizeof(Context));
+  ctx.commitarf[REG_ctx] = (Waddr)&ctx;
+  ctx.commitarf[REG_fpstack] = (Waddr)&ctx.fpstack;
+  ctx.running = 1;
+  set_fs_gs_base(header.fsbase, header.gsbase);
+  ctx.update_shadow_segment_descriptors();
+
+  logfile << "Restored checkpoint ", filename, " at rip ", (void*)(Waddr)ctx.commitarf[REG_rip], ": ",
+    header.regioncount, " regions (", (databytes >> 10), " KB mapped on demand), ", header.filecount, " open files", endl, flush;
+
+  ptl_mm_free_private_pages(savedctx, sizeof(Context));
+  ptl_mm_free_private_pages(regions, header.regioncount * sizeof(CheckpointRegion));
+  ptl_mm_free_private_pages(files, header.filecount * sizeof(CheckpointFile) + 1);
+
+  return true;
+}
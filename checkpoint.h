@@ -0,0 +1,86 @@
+// -*- c++ -*-
+//
+// PTLsim: Cycle Accurate x86-64 Simulator
+// Userspace Checkpoints
+//
+// Copyright 2008 Matt T. Yourst <yourst@yourst.com>
+//
+
+#ifndef _CHECKPOINT_H_
+#define _CHECKPOINT_H_
+
+#include <globals.h>
+#include <superstl.h>
+
+//
+// A checkpoint captures the architectural state of the user process
+// at the point where it switched into simulation mode, so later runs
+// can start simulating from that point without re-executing the whole
+// prefix natively or in sequential mode.
+//
+// File format:
+//
+//   CheckpointHeader
+//   Context
+//   CheckpointRegion[header.regioncount]
+//   CheckpointFile[header.filecount]
+//   (padding to the next page boundary)
+//   region data, page aligned, in the same order as the region table
+//
+// Region data is mapped straight back from the checkpoint file with
+// MAP_PRIVATE, so pages are only read in when the restored process
+// touches them. The checkpoint file must therefore not be modified
+// while a restored process is still running.
+//
+// Only a process with the same executable and the same PTLsim build
+// can be restored, and the vdso and PTLsim's own memory must not move
+// between the two runs: running both the save and the restore under
+// "setarch -R" (no address space randomization) guarantees this.
+// Signal handlers, threads, pipes and sockets are not captured.
+//
+
+struct CheckpointHeader {
+  W64 magic;
+  W32 version;
+  W32 contextsize;
+  W32 regioncount;
+  W32 filecount;
+  W64 brkbase;
+  W64 brk;
+  W64 stack_min_addr;
+  W64 stack_max_addr;
+  W64 fsbase;
+  W64 gsbase;
+
+  static const W64 MAGIC = 0x3130706b434c5450ULL; // 'PTLCkp01'
+  static const W32 VERSION = 1;
+};
+
+struct CheckpointRegion {
+  W64 start;
+  W64 length;
+  W32 prot;
+  W32 flags;     // MAP_xxx flags from mqueryall()
+  W64 offset;    // offset of data in checkpoint file, or 0 if not saved
+};
+
+struct CheckpointFile {
+  W32 fd;
+  W32 flags;     // O_xxx flags the file was opened with
+  W64 pos;
+  char path[1024];
+};
+
+// Highest file descriptor we check for open files
+static const int CHECKPOINT_MAX_FDS = 1024;
+
+//
+// Remember which file descriptors PTLsim itself has open before
+// the user process starts, so they are excluded from checkpoints
+//
+void capture_ptlsim_fds();
+
+bool save_checkpoint(const char* filename);
+bool restore_checkpoint(const char* filename);
+
+#endif // _CHECKPOINT_H_
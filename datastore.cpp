@@ -852,6 +852,7 @@ void DataStoreNodeTemplate::init(const char* name, int type, int count, const ch
   this->count = count;
 
   parent = null;
+  size = 0;
 
   subcount = 0;
   summable = 0;
@@ -1024,8 +1025,18 @@ DataStoreNodeTemplate::DataStoreNodeTemplate(idstream& is) {
 
   subnodes.resize(subcount);
 
+  size = 0;
   foreach (i, subcount) {
     subnodes[i] = new DataStoreNodeTemplate(is);
+    size += subnodes[i]->size;
+  }
+
+  switch (type) {
+  case DS_NODE_TYPE_INT:
+  case DS_NODE_TYPE_FLOAT:
+    size = count * sizeof(W64); break;
+  case DS_NODE_TYPE_STRING:
+    size = count * limit; break;
   }
 }
 
@@ -1105,6 +1116,33 @@ DataStoreNode* DataStoreNodeTemplate::reconstruct(const W64*& p) const {
   return ds;
 }
 
+DataStoreNode* DataStoreNodeTemplate::reconstruct(const W64* p, const dynarray<char*>* paths, const dynarray<int>& active, int depth) const {
+  bool whole = (type != DS_NODE_TYPE_NULL) | summable;
+  foreach (i, active.length) whole |= (depth >= paths[active[i]].length);
+
+  if (whole) return reconstruct(p);
+
+  DataStoreNode* ds = new DataStoreNode(name);
+  ds->summable = summable;
+  ds->identical_subtrees = identical_subtrees;
+
+  dynarray<int> subactive;
+
+  foreach (i, subnodes.length) {
+    const DataStoreNodeTemplate* sub = subnodes[i];
+
+    subactive.clear();
+    foreach (j, active.length) {
+      if (strequal(sub->name, paths[active[j]][depth])) subactive.push(active[j]);
+    }
+
+    if (subactive.length) ds->add(sub->reconstruct(p, paths, subactive, depth+1));
+    p = (const W64*)(((const byte*)p) + sub->size);
+  }
+
+  return ds;
+}
+
 //
 // Subtract two arrays of words representing the tree in depth first
 // traversal order, in a format identical to the C struct generated
@@ -1147,13 +1185,16 @@ void DataStoreNodeTemplate::subtract(W64*& p, W64*& psub) const {
 //
 // StatsFileWriter
 //
-void StatsFileWriter::open(const char* filename, const void* dst, size_t dstsize, int record_size) {
+void StatsFileWriter::open(const char* filename, const void* dst, size_t dstsize, int record_size, W64 keyframe_interval) {
   close();
   os.open(filename);
 
   namelist = null;
 
-  header.magic = StatsFileHeader::MAGIC;
+  // Deltas are computed a word at a time
+  if unlikely (record_size % sizeof(W64)) keyframe_interval = 0;
+
+  header.magic = (keyframe_interval) ? StatsFileHeader::MAGIC_DELTA : StatsFileHeader::MAGIC;
   header.template_offset = sizeof(StatsFileHeader);
   header.template_size = dstsize;
   header.record_offset = ceil(header.template_offset + header.template_size, PAGE_SIZE);
@@ -1161,12 +1202,52 @@ void StatsFileWriter::open(const char* filename, const void* dst, size_t dstsize
   header.record_count = 0; // filled in later
   header.index_offset = 0; // filled in later
   header.index_count = 0; // filled in later
+  header.keyframe_interval = keyframe_interval;
+  header.record_table_offset = 0; // filled in later
   os << header;
 
   os.seek(header.template_offset);
   os.write(dst, dstsize);
 
   os.seek(header.record_offset);
+
+  if (keyframe_interval) {
+    int words = record_size / sizeof(W64);
+    prev = new byte[record_size];
+    deltabuf = new W32[2*words + 2*(words+1)];
+    record_offsets.clear();
+  }
+}
+
+//
+// Encode the words of record that differ from prev as runs of
+// unchanged and changed words (see datastore.h); returns the size
+// in bytes
+//
+size_t StatsFileWriter::encode_delta(const W64* record, const W64* prev, W32* out) const {
+  int words = header.record_size / sizeof(W64);
+  W32* p = out;
+  int i = 0;
+
+  while (i < words) {
+    int unchanged = 0;
+    while ((i < words) && (record[i] == prev[i])) { i++; unchanged++; }
+
+    W32* run = p;
+    p += 2;
+    int changed = 0;
+    while ((i < words) && (record[i] != prev[i])) {
+      *(W64*)p = record[i] ^ prev[i];
+      p += 2;
+      i++;
+      changed++;
+    }
+
+    run[0] = unchanged;
+    run[1] = changed;
+  }
+
+  return (p - out) * sizeof(W32);
 }
 
 void StatsFileWriter::write(const void* record, const char* name) {
@@ -1178,7 +1259,19 @@ void StatsFileWriter::write(const void* record, const char* name) {
     header.index_count++;
   }
 
-  os.write(record, header.record_size);
+  if (header.keyframe_interval) {
+    record_offsets.push(os.where());
+    if ((header.record_count % header.keyframe_interval) == 0) {
+      os.write(record, header.record_size);
+    } else {
+      size_t size = encode_delta((const W64*)record, (const W64*)prev, deltabuf);
+      os.write(deltabuf, size);
+    }
+    memcpy(prev, record, header.record_size);
+  } else {
+    os.write(record, header.record_size);
+  }
+
   header.record_count++;
 }
 
@@ -1186,7 +1279,7 @@ void StatsFileWriter::flush() {
   if (!os.ok()) return;
 
   header.index_offset = os.where();
-  assert(header.index_offset == (header.record_offset + (header.record_count * header.record_size)));
+  if (!header.keyframe_interval) assert(header.index_offset == (header.record_offset + (header.record_count * header.record_size)));
 
   StatsIndexRecordLink* namelink = namelist;
   int n = 0;
@@ -1202,10 +1295,16 @@ void StatsFileWriter::flush() {
 
   assert(n == header.index_count);
 
+  if (header.keyframe_interval) {
+    header.record_table_offset = os.where();
+    os.write(record_offsets.data, record_offsets.length * sizeof(W64));
+  }
+
   os.seek(0);
   os << header;
 
-  os.seek(header.record_offset + (header.record_count * header.record_size));
+  // The next record overwrites the index, which is rewritten at the next flush
+  os.seek(header.index_offset);
 }
 
 void StatsFileWriter::close() {
@@ -1228,6 +1327,10 @@ void StatsFileWriter::close() {
   assert(n == header.index_count);
   namelist = null;
 
+  if (prev) { delete[] prev; prev = null; }
+  if (deltabuf) { delete[] deltabuf; deltabuf = null; }
+  record_offsets.clear();
+
   os.flush();
   os.close();
 }
@@ -1253,7 +1356,11 @@ bool StatsFileReader::open(const char* filename) {
     return false;
   }
 
-  if (header.magic != StatsFileHeader::MAGIC) {
+  if (header.magic == StatsFileHeader::MAGIC) {
+    // PTLdst01 headers end before these fields
+    header.keyframe_interval = 0;
+    header.record_table_offset = 0;
+  } else if (header.magic != StatsFileHeader::MAGIC_DELTA) {
     cerr << "StatsFileReader: header magic or version mismatch", endl;
     close();
     return false;
@@ -1262,6 +1369,28 @@ bool StatsFileReader::open(const char* filename) {
   buf = new byte[header.record_size];
   bufsub = new byte[header.record_size];
 
+  // Fall back to reading records if the file can't be mapped
+  mapsize = is.size();
+  map = (const byte*)is.mmap(mapsize);
+  if (!map) mapsize = 0;
+
+  if (header.keyframe_interval) {
+    int words = header.record_size / sizeof(W64);
+    cache = new byte[header.record_size];
+    deltabuf = new W32[2*words + 2*(words+1)];
+    cached_uuid = -1;
+
+    // One more offset marks the end of the last record
+    record_offsets.resize(header.record_count + 1);
+    is.seek(header.record_table_offset);
+    if (is.read(record_offsets.data, header.record_count * sizeof(W64)) != (header.record_count * sizeof(W64))) {
+      cerr << "StatsFileReader: error reading record table", endl;
+      close();
+      return false;
+    }
+    record_offsets[header.record_count] = header.index_offset;
+  }
+
   is.seek(header.template_offset);
   dst = new DataStoreNodeTemplate(is);
 
@@ -1296,31 +1425,115 @@ bool StatsFileReader::open(const char* filename) {
   return true;
 }
 
-DataStoreNode* StatsFileReader::get(W64 uuid) {
-  if unlikely (uuid >= header.record_count) return null;
-  W64 offset = header.record_offset + (header.record_size * uuid);
+//
+// Read the full record for uuid, rebuilding delta records from
+// the last keyframe (or from the previously read record, so
+// reading records in order only applies one delta each)
+//
+bool StatsFileReader::read(W64 uuid, byte* record) {
+  if unlikely (uuid >= header.record_count) return false;
+
+  if likely (!header.keyframe_interval) return fetch(header.record_offset + (header.record_size * uuid), record, header.record_size);
+
+  W64 keyframe = uuid - (uuid % header.keyframe_interval);
+  W64 next = keyframe;
+
+  if ((cached_uuid >= (W64s)keyframe) && (cached_uuid <= (W64s)uuid)) {
+    next = cached_uuid + 1;
+  } else {
+    if unlikely (!fetch(record_offsets[keyframe], cache, header.record_size)) { cached_uuid = -1; return false; }
+    next = keyframe + 1;
+  }
+
+  int words = header.record_size / sizeof(W64);
+  W64* p = (W64*)cache;
+
+  for (W64 i = next; i <= uuid; i++) {
+    W64 size = record_offsets[i+1] - record_offsets[i];
+    cached_uuid = -1;
+
+    if unlikely (size > ((2*words + 2*(words+1)) * sizeof(W32))) return false;
+    if unlikely (!fetch(record_offsets[i], deltabuf, size)) return false;
+
+    const W32* d = deltabuf;
+    const W32* end = (const W32*)((const byte*)deltabuf + size);
+    int w = 0;
+
+    while (d < end) {
+      w += d[0];
+      int changed = d[1];
+      d += 2;
+      if unlikely ((w + changed) > words) return false;
+      foreach (j, changed) {
+        p[w++] ^= *(const W64*)d;
+        d += 2;
+      }
+    }
+  }
+
+  cached_uuid = uuid;
+  memcpy(record, cache, header.record_size);
+  return true;
+}
+
+bool StatsFileReader::fetch(W64 offset, void* p, W64 size) {
+  if likely (map) {
+    if unlikely ((offset + size) > mapsize) return false;
+    memcpy(p, map + offset, size);
+    return true;
+  }
 
   is.seek(offset);
+  return (is.read(p, size) == size);
+}
 
-  if unlikely (is.read(buf, header.record_size) != header.record_size) return null;
+//
+// Full records can be used in place when the file is mapped
+//
+const W64* StatsFileReader::record(W64 uuid) {
+  if likely (map && (!header.keyframe_interval) && (uuid < header.record_count)) {
+    W64 offset = header.record_offset + (header.record_size * uuid);
+    if unlikely ((offset + header.record_size) > mapsize) return null;
+    return (const W64*)(map + offset);
+  }
 
-  const W64* p = (const W64*)buf;
-  DataStoreNode* dsn = dst->reconstruct(p);
+  return (read(uuid, buf)) ? (const W64*)buf : null;
+}
+
+DataStoreNode* StatsFileReader::reconstruct(const W64* p, const char* path) {
+  if (!path) return dst->reconstruct(p);
+
+  char* pbase = strdup(path);
+  dynarray<char*> pathlist;
+  pathlist.tokenize(pbase, ",");
+
+  dynarray<char*>* paths = new dynarray<char*>[pathlist.length];
+  dynarray<int> active;
 
+  foreach (i, pathlist.length) {
+    char* pathname = pathlist[i];
+    if (pathname[0] == '/') pathname++;
+    paths[i].tokenize(pathname, "/.");
+    active.push(i);
+  }
+
+  DataStoreNode* dsn = dst->reconstruct(p, paths, active);
+
+  delete[] paths;
+  free(pbase);
   return dsn;
 }
 
-DataStoreNode* StatsFileReader::getdelta(W64 uuid, W64 uuidsub) {
-  if unlikely (uuid >= header.record_count) return null;
-  if unlikely (uuidsub >= header.record_count) return null;
-  W64 offset = header.record_offset + (header.record_size * uuid);
-  W64 offsetsub = header.record_offset + (header.record_size * uuidsub);
+DataStoreNode* StatsFileReader::get(W64 uuid, const char* path) {
+  const W64* p = record(uuid);
+  if unlikely (!p) return null;
 
-  is.seek(offset);
-  if unlikely (is.read(buf, header.record_size) != header.record_size) return null;
+  return reconstruct(p, path);
+}
 
-  is.seek(offsetsub);
-  if unlikely (is.read(bufsub, header.record_size) != header.record_size) return null;
+DataStoreNode* StatsFileReader::getdelta(W64 uuid, W64 uuidsub, const char* path) {
+  if unlikely (!read(uuid, buf)) return null;
+  if unlikely (!read(uuidsub, bufsub)) return null;
 
   const W64* p = (const W64*)buf;
   W64* porig = (W64*)p;
@@ -1328,9 +1541,7 @@ DataStoreNode* StatsFileReader::getdelta(W64 uuid, W64 uuidsub) {
 
   dst->subtract(porig, psub);
 
-  DataStoreNode* dsn = dst->reconstruct(p);
-
-  return dsn;
+  return reconstruct(p, path);
 }
 
 W64s StatsFileReader::uuid_of_name(const char* name) {
@@ -1353,23 +1564,29 @@ W64s StatsFileReader::uuid_of_name(const char* name) {
   return uuid;
 }
 
-DataStoreNode* StatsFileReader::get(const char* name) {
+DataStoreNode* StatsFileReader::get(const char* name, const char* path) {
   W64s uuid = uuid_of_name(name);
   if unlikely (uuid < 0) return null;
-  return get(uuid);
+  return get(uuid, path);
 }
 
-DataStoreNode* StatsFileReader::getdelta(const char* name, const char* namesub) {
+DataStoreNode* StatsFileReader::getdelta(const char* name, const char* namesub, const char* path) {
   W64s uuid = uuid_of_name(name);
   W64s uuidsub = uuid_of_name(namesub);
   if unlikely ((uuid < 0) || (uuidsub < 0)) return null;
-  return getdelta(uuid, uuidsub);
+  return getdelta(uuid, uuidsub, path);
 }
 
 void StatsFileReader::close() {
   if (dst) { delete dst; dst = null; }
   if (buf) { delete[] buf; buf = null; }
   if (bufsub) { delete[] bufsub; bufsub = null; }
+  if (cache) { delete[] cache; cache = null; }
+  if (deltabuf) { delete[] deltabuf; deltabuf = null; }
+  record_offsets.clear();
+  cached_uuid = -1;
+
+  if (map) { sys_munmap((void*)map, mapsize); map = null; mapsize = 0; }
 
   name_to_uuid.clear();
 
@@ -1391,6 +1608,10 @@ ostream& StatsFileReader::print(ostream& os) const {
   os << "  Records at:   ", intstring(header.record_offset, 16), ", ", intstring(header.record_size, 16), " bytes", endl;
   os << "  Index at:     ", intstring(header.index_offset, 16), ", ", intstring(header.index_count, 16), " entries", endl;
   os << "  Record count: ", intstring(header.record_count, 16), " records", endl;
+  if (header.keyframe_interval) {
+    os << "  Deltas:       ", intstring(header.keyframe_interval, 16), " records per keyframe", endl;
+    os << "  Offsets at:   ", intstring(header.record_table_offset, 16), endl;
+  }
   os << endl;
   os << "Index:", endl;
   os << name_to_uuid;
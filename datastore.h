@@ -502,6 +502,7 @@ struct DataStoreNodeTemplate: public DataStoreNodeTemplateBase {
   dynarray<DataStoreNodeTemplate*> subnodes;
   char** labels;
   DataStoreNodeTemplate* parent;
+  W64 size; // bytes of raw data in this subtree (templates read from a stats file only)
 
   enum NodeType { DS_NODE_TYPE_NULL, DS_NODE_TYPE_INT, DS_NODE_TYPE_FLOAT, DS_NODE_TYPE_NODE, DS_NODE_TYPE_STRING, DS_NODE_TYPE_LABELED_HISTOGRAM };
 
@@ -582,6 +583,16 @@ struct DataStoreNodeTemplate: public DataStoreNodeTemplateBase {
   //
   DataStoreNode* reconstruct(const W64*& p) const;
 
+  //
+  // Reconstruct only the nodes along the given paths (each already
+  // split into node names; only the paths listed in active are still
+  // being followed) below this one, plus the entire subtree at the end
+  // of each path. Other subtrees are skipped using their template sizes,
+  // except under summable nodes, which are kept whole so percentages
+  // of the toplevel summable node still come out the same.
+  //
+  DataStoreNode* reconstruct(const W64* p, const dynarray<char*>* paths, const dynarray<int>& active, int depth = 0) const;
+
   //
   // Subtract two arrays of words representing the tree in depth first
   // traversal order, in a format identical to the C struct generated
@@ -600,6 +611,18 @@ static inline ostream& operator <<(ostream& os, const DataStoreNodeTemplate& nod
   return node.generate_struct_def(os);
 }
 
+//
+// Stats files normally hold every snapshot as a full copy of the
+// stats structure. With a non-zero keyframe interval K (PTLdst02),
+// only every Kth snapshot is stored in full; the others store the
+// 64-bit words that differ from the previous snapshot, XORed with
+// their old values, as runs of:
+//
+//   W32 unchanged_words, W32 changed_words, W64 xorvalue[changed_words]
+//
+// and a table of record offsets follows the name index, so any
+// snapshot can be rebuilt from its keyframe in at most K-1 steps.
+//
 struct StatsFileHeader {
   W64 magic;
   W64 template_offset;
@@ -609,8 +632,11 @@ struct StatsFileHeader {
   W64 record_count;
   W64 index_offset;
   W64 index_count;
+  W64 keyframe_interval;       // PTLdst02 only
+  W64 record_table_offset;     // PTLdst02 only
 
   static const W64 MAGIC = 0x31307473644c5450ULL; // 'PTLdst01'
+  static const W64 MAGIC_DELTA = 0x32307473644c5450ULL; // 'PTLdst02'
 };
 
 struct StatsIndexRecordLink: public selflistlink {
@@ -630,9 +656,14 @@ struct StatsFileWriter {
   StatsFileHeader header;
   StatsIndexRecordLink* namelist;
 
-  StatsFileWriter() { }
+  // Delta encoding state (keyframe_interval > 0 only)
+  byte* prev;
+  W32* deltabuf;
+  dynarray<W64> record_offsets;
+
+  StatsFileWriter() { prev = null; deltabuf = null; }
 
-  void open(const char* filename, const void* dst, size_t dstsize, int record_size);
+  void open(const char* filename, const void* dst, size_t dstsize, int record_size, W64 keyframe_interval = 0);
 
   operator bool() const { return os.ok(); }
   W64 next_uuid() const { return header.record_count; }
@@ -640,6 +671,9 @@ struct StatsFileWriter {
   void write(const void* record, const char* name = null);
   void flush();
   void close();
+
+protected:
+  size_t encode_delta(const W64* record, const W64* prev, W32* out) const;
 };
 
 struct StatsFileReader {
@@ -650,7 +684,17 @@ struct StatsFileReader {
   DataStoreNodeTemplate* dst;
   Hashtable<const char*, W64, 256> name_to_uuid;
 
-  StatsFileReader() { dst = null; buf = null; bufsub = null; }
+  // Delta decoding state (keyframe_interval > 0 only)
+  dynarray<W64> record_offsets;
+  byte* cache;
+  W64s cached_uuid;
+  W32* deltabuf;
+
+  // The whole file is mapped read only where possible
+  const byte* map;
+  W64 mapsize;
+
+  StatsFileReader() { dst = null; buf = null; bufsub = null; cache = null; deltabuf = null; cached_uuid = -1; map = null; mapsize = 0; }
 
   bool open(const char* filename);
 
@@ -658,13 +702,25 @@ struct StatsFileReader {
 
   W64s uuid_of_name(const char* name);
 
-  DataStoreNode* get(W64 uuid);
-  DataStoreNode* getdelta(W64 uuid, W64 uuidsub);
+  bool read(W64 uuid, byte* record);
 
-  DataStoreNode* get(const char* name);
-  DataStoreNode* getdelta(const char* name, const char* namesub);
+  //
+  // If path is given (one or more comma separated paths), only the
+  // nodes needed to search for those paths from the root are
+  // reconstructed (see DataStoreNodeTemplate::reconstruct())
+  //
+  DataStoreNode* get(W64 uuid, const char* path = null);
+  DataStoreNode* getdelta(W64 uuid, W64 uuidsub, const char* path = null);
+
+  DataStoreNode* get(const char* name, const char* path = null);
+  DataStoreNode* getdelta(const char* name, const char* namesub, const char* path = null);
 
   ostream& print(ostream& os) const;
+
+protected:
+  bool fetch(W64 offset, void* p, W64 size);
+  const W64* record(W64 uuid);
+  DataStoreNode* reconstruct(const W64* p, const char* path);
 };
 
 static inline ostream& print(ostream& os, const StatsFileReader& reader) {
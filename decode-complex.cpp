@@ -181,12 +181,24 @@ static const char cpuid_description[48+1] = "Intel(R) Xeon(TM) CPU 2.00 GHz
 #define X86_EXT_FEATURE_DSCPL	(1 <<  4) // CPL Qualified Debug Store
 #define X86_EXT_FEATURE_EST		(1 <<  7) // Enhanced SpeedStep
 #define X86_EXT_FEATURE_TM2		(1 <<  8) // Thermal Monitor 2
+#define X86_EXT_FEATURE_SSSE3	(1 <<  9) // Supplemental Streaming SIMD Extensions-3
 #define X86_EXT_FEATURE_CID		(1 << 10) // Context ID
 #define X86_EXT_FEATURE_CX16	(1 << 13) // CMPXCHG16B
 #define X86_EXT_FEATURE_XTPR	(1 << 14) // Send Task Priority Messages
+#define X86_EXT_FEATURE_SSE41	(1 << 19) // Streaming SIMD Extensions 4.1
+#define X86_EXT_FEATURE_SSE42	(1 << 20) // Streaming SIMD Extensions 4.2
+#define X86_EXT_FEATURE_XSAVE	(1 << 26) // XSAVE/XRSTOR
+#define X86_EXT_FEATURE_OSXSAVE	(1 << 27) // XSAVE enabled by the OS
+#define X86_EXT_FEATURE_AVX		(1 << 28) // Advanced Vector Extensions
 
-#define PTLSIM_X86_EXT_FEATURE (\
-  X86_EXT_FEATURE_XMM3 | X86_EXT_FEATURE_CX16)
+//
+// SSE4.2 is only partly decoded (no crc32, popcnt or string compares),
+// and there is neither VEX decoding nor 256-bit register state for AVX,
+// so neither is advertised: libraries then pick their SSE4.1 or older
+// code paths, which run as on real hardware.
+//
+#define PTLSIM_X86_EXT_FEATURE \
+  (X86_EXT_FEATURE_XMM3 | X86_EXT_FEATURE_SSSE3 | X86_EXT_FEATURE_SSE41 | X86_EXT_FEATURE_CX16)
 
 //
 // CPUID level 0x80000001, result in %edx
@@ -267,8 +279,8 @@ void assist_cpuid(Context& ctx) {
     // Model and capability information
     rax = PTLSIM_X86_MODEL_INFO; // model
     rbx = PTLSIM_X86_MISC_INFO | (ctx.vcpuid << 24);
-    rcx = PTLSIM_X86_EXT_FEATURE;
-    rdx = PTLSIM_X86_FEATURE;
+    rcx = PTLSIM_X86_EXT_FEATURE & config.cpuid_ecx_mask;
+    rdx = PTLSIM_X86_FEATURE & config.cpuid_edx_mask;
     break;
   }
 
@@ -287,7 +299,7 @@ void assist_cpuid(Context& ctx) {
     rax = PTLSIM_X86_MODEL_INFO;
     rbx = 0; // brand ID
     rcx = PTLSIM_X86_VENDOR_EXT_FEATURE;
-    rdx = PTLSIM_X86_VENDOR_FEATURE;
+    rdx = PTLSIM_X86_VENDOR_FEATURE & (config.cpuid_edx_mask | ~0x1ffffff);
     break;
   }
 
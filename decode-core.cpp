@@ -34,6 +34,290 @@ BasicBlockPageCache bbpages;
 CycleTimer translate_timer("translate");
 
 odstream bbcache_dump_file;
+bool decode_vec128_uops = 0;
+bool decode_optimize_uops = 0;
+bool decode_fuse_cmp_jcc = 0;
+
+//
+// Decodes on the background translation thread (TraceDecoder::speculative)
+// count here, since only the main thread may update stats.decoder
+//
+struct PTLsimStats::decoder speculative_decoder_stats;
+#define decoderstats ((speculative) ? speculative_decoder_stats : stats.decoder)
+
+//
+// Background translation (-speculative-translate)
+//
+// After a basic block cache miss, the main thread queues the taken and
+// not taken successors of the new block (and the return site of calls)
+// on a helper thread, which decodes them into a small direct mapped
+// staging area outside the basic block cache. When a fetch later misses
+// on one of these blocks, translate() publishes the staged copy instead
+// of decoding it again.
+//
+// The helper thread only runs the decoder and the uop optimizer on
+// bytes the main thread has already copied out of guest memory, and
+// writes only its own slot and speculative_decoder_stats. Everything
+// else (guest memory, allocation, logging, the cache and page lists)
+// stays on the main thread. Each slot is owned by one thread at a time,
+// as given by its state:
+//
+//   FREE:   main thread; may be filled and queued
+//   QUEUED: waiting for the helper; the main thread may cancel it
+//   BUSY:   the helper is decoding it
+//   DONE:   main thread; holds a translated block
+//
+// Staged blocks are not on the page lists, so invalidate_page() and
+// flush() mark them stale instead (whatever their state), and take()
+// also checks the SMC dirty bits of both pages before publishing.
+//
+struct BasicBlockStagingSlot {
+  enum { FREE, QUEUED, BUSY, DONE };
+
+  W32 state;
+  // Only touched by the main thread
+  bool stale;
+
+  RIPVirtPhys rip;
+  int valid_byte_count;
+  PageFaultErrorCode pfec;
+  Waddr faultaddr;
+  Level1PTE ptelo;
+  Level1PTE ptehi;
+  byte insnbuf[MAX_BB_BYTES];
+
+  BasicBlock bb;
+};
+
+struct BasicBlockStagingArea {
+  static const int SIZE = 64;
+  static const int STACK_SIZE = 1024*1024;
+
+  BasicBlockStagingSlot slots[SIZE];
+  // Bumped for every queued slot; the helper sleeps on it
+  W32 requests;
+  int thread;
+  bool disabled;
+
+  BasicBlockStagingArea() {
+    foreach (i, SIZE) slots[i].state = BasicBlockStagingSlot::FREE;
+    requests = 0;
+    thread = -1;
+    disabled = 0;
+  }
+
+  static int slotof(W64 rip) { return (rip ^ (rip >> 6)) & (SIZE-1); }
+
+  bool start();
+  void queue(Context& ctx, const RIPVirtPhys& rvp);
+  BasicBlock* take(const RIPVirtPhys& rvp);
+  void invalidate_page(Waddr mfn);
+  void flush();
+
+  static void decode(BasicBlockStagingSlot& slot);
+  static void helper(void* arg);
+};
+
+BasicBlockStagingArea bbstaging;
+
+//
+// Helper thread side: decode the slot's prefetched bytes exactly as
+// translate() would, then copy the block into the slot
+//
+void BasicBlockStagingArea::decode(BasicBlockStagingSlot& slot) {
+  TraceDecoder trans(slot.rip);
+  trans.speculative = 1;
+  trans.fillbuf_prefetched(slot.insnbuf, sizeof(slot.insnbuf), slot.valid_byte_count, slot.pfec, slot.faultaddr, slot.ptelo, slot.ptehi);
+
+  for (;;) {
+    if (!trans.translate()) break;
+  }
+
+  if (decode_optimize_uops) optimize_basic_block(trans.bb, true);
+
+  trans.bb.hitcount = 0;
+  trans.bb.predcount = 0;
+
+  memcpy(&slot.bb, &trans.bb, sizeof(BasicBlockBase));
+  foreach (i, trans.bb.count) slot.bb.transops[i] = trans.bb.transops[i];
+}
+
+void BasicBlockStagingArea::helper(void* arg) {
+  BasicBlockStagingArea& area = *(BasicBlockStagingArea*)arg;
+
+  for (;;) {
+    W32 seen = area.requests;
+    barrier();
+
+    bool found = 0;
+    foreach (i, SIZE) {
+      BasicBlockStagingSlot& slot = area.slots[i];
+      if (cmpxchg(slot.state, (W32)BasicBlockStagingSlot::BUSY, (W32)BasicBlockStagingSlot::QUEUED) != BasicBlockStagingSlot::QUEUED) continue;
+      decode(slot);
+      barrier();
+      slot.state = BasicBlockStagingSlot::DONE;
+      found = 1;
+    }
+
+    // Sleeps only if nothing was queued since we started scanning
+    if (!found) helper_thread_wait(area.requests, seen);
+  }
+}
+
+//
+// Make sure the helper thread is running in this process. A forked
+// child inherits the slots but not the thread, so it throws away any
+// work in flight and starts its own. If no thread can be started
+// (32-bit builds, PTLxen), speculation stays off.
+//
+bool BasicBlockStagingArea::start() {
+  if likely ((thread >= 0) && helper_thread_running(thread)) return true;
+  if unlikely (disabled) return false;
+
+  foreach (i, SIZE) slots[i].state = BasicBlockStagingSlot::FREE;
+
+  thread = start_helper_thread(helper, this, STACK_SIZE);
+  if unlikely (thread < 0) {
+    logfile << "Warning: cannot start the background translation thread; -speculative-translate is disabled", endl;
+    disabled = 1;
+    return false;
+  }
+
+  return true;
+}
+
+//
+// Main thread side: copy the code bytes for rvp into its slot and hand
+// it to the helper, unless the block is already cached or staged
+//
+void BasicBlockStagingArea::queue(Context& ctx, const RIPVirtPhys& rvp) {
+  // Never speculate into pages that would fault or that are about to be invalidated
+  if unlikely ((rvp.mfnlo == RIPVirtPhys::INVALID) | (rvp.mfnhi == RIPVirtPhys::INVALID)) return;
+  if unlikely (smc_isdirty(rvp.mfnlo) | smc_isdirty(rvp.mfnhi)) return;
+  if (bbcache.get(rvp)) return;
+
+  BasicBlockStagingSlot& slot = slots[slotof(rvp.rip)];
+
+  switch (slot.state) {
+  case BasicBlockStagingSlot::FREE:
+    break;
+  case BasicBlockStagingSlot::QUEUED:
+    if ((slot.rip == rvp) && (!slot.stale)) return;
+    // Lost the race: the helper has it now
+    if (cmpxchg(slot.state, (W32)BasicBlockStagingSlot::FREE, (W32)BasicBlockStagingSlot::QUEUED) != BasicBlockStagingSlot::QUEUED) return;
+    stats.decoder.speculation.cancelled++;
+    break;
+  case BasicBlockStagingSlot::BUSY:
+    return;
+  case BasicBlockStagingSlot::DONE:
+    if ((slot.rip == rvp) && (!slot.stale)) return;
+    slot.state = BasicBlockStagingSlot::FREE;
+    stats.decoder.speculation.discarded++;
+    break;
+  }
+
+  slot.rip = rvp;
+  slot.stale = 0;
+  slot.faultaddr = 0;
+  slot.pfec = 0;
+  slot.valid_byte_count = ctx.copy_from_user(slot.insnbuf, rvp.rip, sizeof(slot.insnbuf), slot.pfec, slot.faultaddr, true, slot.ptelo, slot.ptehi);
+
+  barrier();
+  slot.state = BasicBlockStagingSlot::QUEUED;
+  xadd(requests, (W32)1);
+  helper_thread_wake(requests);
+  stats.decoder.speculation.queued++;
+}
+
+//
+// Remove and return a clone of the staged block for rvp, if there is
+// one and its code has not changed since it was copied. A block still
+// waiting for the helper is cancelled (the caller decodes it anyway),
+// while one being decoded right now is waited for.
+//
+BasicBlock* BasicBlockStagingArea::take(const RIPVirtPhys& rvp) {
+  BasicBlockStagingSlot& slot = slots[slotof(rvp.rip)];
+
+  if likely (slot.state == BasicBlockStagingSlot::FREE) return null;
+  if (!(slot.rip == rvp)) return null;
+
+  if (slot.state == BasicBlockStagingSlot::QUEUED) {
+    if (cmpxchg(slot.state, (W32)BasicBlockStagingSlot::FREE, (W32)BasicBlockStagingSlot::QUEUED) == BasicBlockStagingSlot::QUEUED) {
+      stats.decoder.speculation.cancelled++;
+      return null;
+    }
+  }
+
+  if (slot.state == BasicBlockStagingSlot::BUSY) {
+    stats.decoder.speculation.waited++;
+    while (slot.state == BasicBlockStagingSlot::BUSY) cpu_pause();
+  }
+
+  barrier();
+
+  if unlikely (slot.stale | smc_isdirty(rvp.mfnlo) | smc_isdirty(rvp.mfnhi)) {
+    slot.state = BasicBlockStagingSlot::FREE;
+    stats.decoder.speculation.discarded++;
+    return null;
+  }
+
+  BasicBlock* bb = slot.bb.clone();
+  slot.state = BasicBlockStagingSlot::FREE;
+  stats.decoder.speculation.published++;
+  return bb;
+}
+
+void BasicBlockStagingArea::invalidate_page(Waddr mfn) {
+  foreach (i, SIZE) {
+    BasicBlockStagingSlot& slot = slots[i];
+    if likely (slot.state == BasicBlockStagingSlot::FREE) continue;
+    if ((slot.rip.mfnlo == mfn) | (slot.rip.mfnhi == mfn)) slot.stale = 1;
+  }
+}
+
+void BasicBlockStagingArea::flush() {
+  foreach (i, SIZE) slots[i].stale = 1;
+}
+
+//
+// Queue the successors of a newly translated block for the helper.
+// Blocks ending in assists may change modes and indirect branches
+// have no known target, so these are skipped.
+//
+static void translate_successors(Context& ctx, const BasicBlock& bb) {
+  W64 successors[2];
+  int n = 0;
+
+  switch (bb.type) {
+  case BB_TYPE_COND:
+    successors[n++] = bb.rip_not_taken;
+    successors[n++] = bb.rip_taken;
+    break;
+  case BB_TYPE_UNCOND:
+    successors[n++] = bb.rip_taken;
+    // Calls return to the next instruction sooner or later
+    if (bb.call) successors[n++] = bb.rip_not_taken;
+    break;
+  default:
+    return;
+  }
+
+  foreach (i, n) {
+    RIPVirtPhys rvp(successors[i]);
+    rvp.update(ctx);
+    bbstaging.queue(ctx, rvp);
+  }
+}
+
+// The basic block pool (ptlhwdef.cpp) keeps its own counters
+static void update_bbpool_stats() {
+  stats.decoder.bbpool.allocs = bbpool_stats.allocs;
+  stats.decoder.bbpool.reuses = bbpool_stats.reuses;
+  stats.decoder.bbpool.recycled = bbpool_stats.recycled;
+  stats.decoder.bbpool.frees = bbpool_stats.frees;
+  stats.decoder.bbpool.trimmed = bbpool_stats.trimmed;
+  stats.decoder.bbpool.free_blocks = bbpool_stats.free_blocks;
+}
 
 //
 // Calling convention:
@@ -423,6 +707,89 @@ static const byte insn_is_simple[512] = {
   /*       -------------------------------        */
   /*       0 1 2 3 4 5 6 7 8 9 a b c d e f        */
 };
+
+//
+// Predecoder immediate sizes for one and two byte opcodes:
+//
+//   b = imm8, w = imm16, z = imm16/imm32 (by operand size),
+//   v = imm16/imm32/imm64 (mov reg,imm), m = moffs (by address size),
+//   e = enter (imm16 + imm8), p = far pointer (z + selector),
+//   j = rel16/rel32 (always rel32 in 64-bit mode),
+//   g = test in group 3 (b or z only for /0 and /1)
+//
+enum {
+  PREDECODE_IMM_NONE, PREDECODE_IMM_B, PREDECODE_IMM_W, PREDECODE_IMM_Z, PREDECODE_IMM_V,
+  PREDECODE_IMM_MOFFS, PREDECODE_IMM_ENTER, PREDECODE_IMM_FAR, PREDECODE_IMM_REL,
+  PREDECODE_IMM_GROUP3B, PREDECODE_IMM_GROUP3Z,
+};
+
+#define b PREDECODE_IMM_B
+#define w PREDECODE_IMM_W
+#define z PREDECODE_IMM_Z
+#define v PREDECODE_IMM_V
+#define m PREDECODE_IMM_MOFFS
+#define e PREDECODE_IMM_ENTER
+#define p PREDECODE_IMM_FAR
+#define j PREDECODE_IMM_REL
+#define g PREDECODE_IMM_GROUP3B
+#define G PREDECODE_IMM_GROUP3Z
+
+static const byte onebyte_immediate[256] = {
+  /*       0 1 2 3 4 5 6 7 8 9 a b c d e f        */
+  /*       -------------------------------        */
+  /* 00 */ _,_,_,_,b,z,_,_,_,_,_,_,b,z,_,_, /* 00 */
+  /* 10 */ _,_,_,_,b,z,_,_,_,_,_,_,b,z,_,_, /* 10 */
+  /* 20 */ _,_,_,_,b,z,_,_,_,_,_,_,b,z,_,_, /* 20 */
+  /* 30 */ _,_,_,_,b,z,_,_,_,_,_,_,b,z,_,_, /* 30 */
+  /* 40 */ _,_,_,_,_,_,_,_,_,_,_,_,_,_,_,_, /* 40 */
+  /* 50 */ _,_,_,_,_,_,_,_,_,_,_,_,_,_,_,_, /* 50 */
+  /* 60 */ _,_,_,_,_,_,_,_,z,z,b,b,_,_,_,_, /* 60 */
+  /* 70 */ b,b,b,b,b,b,b,b,b,b,b,b,b,b,b,b, /* 70 */
+  /* 80 */ b,z,b,b,_,_,_,_,_,_,_,_,_,_,_,_, /* 80 */
+  /* 90 */ _,_,_,_,_,_,_,_,_,_,p,_,_,_,_,_, /* 90 */
+  /* a0 */ m,m,m,m,_,_,_,_,b,z,_,_,_,_,_,_, /* a0 */
+  /* b0 */ b,b,b,b,b,b,b,b,v,v,v,v,v,v,v,v, /* b0 */
+  /* c0 */ b,b,w,_,_,_,b,z,e,_,w,_,_,b,_,_, /* c0 */
+  /* d0 */ _,_,_,_,b,b,_,_,_,_,_,_,_,_,_,_, /* d0 */
+  /* e0 */ b,b,b,b,b,b,b,b,j,j,p,b,_,_,_,_, /* e0 */
+  /* f0 */ _,_,_,_,_,_,g,G,_,_,_,_,_,_,_,_  /* f0 */
+  /*       -------------------------------        */
+  /*       0 1 2 3 4 5 6 7 8 9 a b c d e f        */
+};
+
+static const byte twobyte_immediate[256] = {
+  /*       0 1 2 3 4 5 6 7 8 9 a b c d e f        */
+  /*       -------------------------------        */
+  /* 00 */ _,_,_,_,_,_,_,_,_,_,_,_,_,_,_,b, /* 0f */
+  /* 10 */ _,_,_,_,_,_,_,_,_,_,_,_,_,_,_,_, /* 1f */
+  /* 20 */ _,_,_,_,_,_,_,_,_,_,_,_,_,_,_,_, /* 2f */
+  /* 30 */ _,_,_,_,_,_,_,_,_,_,_,_,_,_,_,_, /* 3f */
+  /* 40 */ _,_,_,_,_,_,_,_,_,_,_,_,_,_,_,_, /* 4f */
+  /* 50 */ _,_,_,_,_,_,_,_,_,_,_,_,_,_,_,_, /* 5f */
+  /* 60 */ _,_,_,_,_,_,_,_,_,_,_,_,_,_,_,_, /* 6f */
+  /* 70 */ b,b,b,b,_,_,_,_,_,_,_,_,_,_,_,_, /* 7f */
+  /* 80 */ j,j,j,j,j,j,j,j,j,j,j,j,j,j,j,j, /* 8f */
+  /* 90 */ _,_,_,_,_,_,_,_,_,_,_,_,_,_,_,_, /* 9f */
+  /* a0 */ _,_,_,_,b,_,_,_,_,_,_,_,b,_,_,_, /* af */
+  /* b0 */ _,_,_,_,_,_,_,_,_,_,b,_,_,_,_,_, /* bf */
+  /* c0 */ _,_,b,_,b,b,b,_,_,_,_,_,_,_,_,_, /* cf */
+  /* d0 */ _,_,_,_,_,_,_,_,_,_,_,_,_,_,_,_, /* df */
+  /* e0 */ _,_,_,_,_,_,_,_,_,_,_,_,_,_,_,_, /* ef */
+  /* f0 */ _,_,_,_,_,_,_,_,_,_,_,_,_,_,_,_  /* ff */
+  /*       -------------------------------        */
+  /*       0 1 2 3 4 5 6 7 8 9 a b c d e f        */
+};
+
+#undef b
+#undef w
+#undef z
+#undef v
+#undef m
+#undef e
+#undef p
+#undef j
+#undef g
+#undef G
 #undef _
 
 static int transop_histogram[MAX_TRANSOPS_PER_USER_INSN+1];
@@ -449,6 +816,10 @@ void TraceDecoder::reset() {
   join_with_prev_insn = 0;
   outcome = DECODE_OUTCOME_OK;
   stop_at_rip = limits<W64>::max;
+  predecoded_starts = 0;
+  predecode_window_end = 0;
+  length_changing_prefix = 0;
+  speculative = 0;
 }
 
 TraceDecoder::TraceDecoder(const RIPVirtPhys& rvp) {
@@ -522,7 +893,7 @@ bool TraceDecoder::flush() {
   bool overflow = (transbufcount >= ((MAX_BB_UOPS-2) - bb.count));
 
   if unlikely (overflow) {
-    if (logable(5)) {
+    if (logable(5) & (!speculative)) {
       logfile << "Basic block overflowed (too many uops) during decode of ", bb.rip, " (ripstart ", (void*)ripstart,
         "): req ", transbufcount, " uops but only have ", ((MAX_BB_UOPS-2) - bb.count), " free", endl;
     }
@@ -532,6 +903,11 @@ bool TraceDecoder::flush() {
     split_before();
   }
 
+  if unlikely (fuse_with_prev_insn()) {
+    transbufcount = 0;
+    return true;
+  }
+
   if unlikely (join_with_prev_insn) {
     //
     // Reopen the previous instruction
@@ -611,6 +987,7 @@ bool TraceDecoder::flush() {
     transop.bbindex = bb.count;
     transop.is_x87 = is_x87;
     transop.is_sse = is_sse;
+    transop.lcp = length_changing_prefix;
     transop.final_insn_in_bb = contains_branch;
     transop.final_arch_in_insn = (transop.rd < ARCHREG_COUNT) && (final_archreg_writer[transop.rd] == i);
     transop.final_flags_in_insn = (final_flags_writer == i);
@@ -630,13 +1007,13 @@ bool TraceDecoder::flush() {
     if (transop.rc < ARCHREG_COUNT) setbit(bb.usedregs, transop.rc);
   }
 
-  stats.decoder.throughput.uops += transbufcount;
+  decoderstats.throughput.uops += transbufcount;
 
   if (!join_with_prev_insn) {
     bb.user_insn_count++;
     bb.bytes += bytes;
-    stats.decoder.throughput.x86_insns++;
-    stats.decoder.throughput.bytes += bytes;
+    decoderstats.throughput.x86_insns++;
+    decoderstats.throughput.bytes += bytes;
   }
 
   transbufcount = 0;
@@ -644,6 +1021,70 @@ bool TraceDecoder::flush() {
   return (!overflow);
 }
 
+//
+// Macro-op fusion: if this insn is a lone jcc and the previous insn in
+// the basic block ended with a flags-only cmp or test (sub or and into
+// temp0 that sets all flags), fold the branch into that uop to form a
+// single br.sub or br.and. The fused uop keeps the rip of the cmp, and
+// its byte count covers both insns so the branch predictor still sees
+// the end of the jcc as the branch address; commit counts it as two
+// x86 insns.
+//
+bool TraceDecoder::fuse_with_prev_insn() {
+  if likely ((transbufcount != 1) || (transbuf[0].opcode != OP_br)) return false;
+
+  const TransOp& br = transbuf[0];
+  int bytes = (rip - ripstart);
+
+  TransOp* prev = (bb.count > 0) ? &bb.transops[bb.count-1] : null;
+
+  bool fusable = decode_fuse_cmp_jcc && (!join_with_prev_insn) && prev &&
+    prev->eom && prev->final_flags_in_insn && (!prev->nouserflags) &&
+    ((prev->opcode == OP_sub) | (prev->opcode == OP_and)) &&
+    (prev->rd == REG_temp0) && (prev->rc == REG_zero) &&
+    (prev->setflags == FLAGS_DEFAULT_ALU) &&
+    ((prev->bytes + bytes) <= 15);
+
+  if likely (!fusable) {
+    decoderstats.fusion.not_fused++;
+    return false;
+  }
+
+  decoderstats.fusion.cmp_jcc += (prev->opcode == OP_sub);
+  decoderstats.fusion.test_jcc += (prev->opcode == OP_and);
+
+  prev->opcode = (prev->opcode == OP_sub) ? OP_br_sub : OP_br_and;
+  prev->rd = REG_rip;
+  prev->cond = br.cond;
+  prev->extshift = br.extshift;
+  prev->riptaken = br.riptaken;
+  prev->ripseq = br.ripseq;
+  prev->fused = 1;
+  prev->final_arch_in_insn = 1;
+
+  // Every uop in the cmp insn now belongs to the final insn in the BB
+  for (int i = bb.count-1; i >= 0; i--) {
+    TransOp& op = bb.transops[i];
+    op.bytes += bytes;
+    op.final_insn_in_bb = 1;
+    if (op.som) break;
+  }
+
+  bb.type = BB_TYPE_COND;
+  bb.call = 0;
+  bb.ret = 0;
+  bb.rip_taken = br.riptaken;
+  bb.rip_not_taken = br.ripseq;
+  setbit(bb.usedregs, REG_rip);
+
+  bb.user_insn_count++;
+  bb.bytes += bytes;
+  decoderstats.throughput.x86_insns++;
+  decoderstats.throughput.bytes += bytes;
+
+  return true;
+}
+
 ostream& DecodedOperand::print(ostream& os) const {
   switch (type) {
   case OPTYPE_REG:
@@ -1327,6 +1768,178 @@ void TraceDecoder::decode_prefixes() {
   }
 }
 
+//
+// Bitmask of the bytes at p that may be prefixes (bit i for p[i]),
+// classifying 16 bytes at a time with SSE2 where the buffer allows.
+//
+W32 predecode_prefix_mask(const byte* p, int avail, bool use64) {
+  if unlikely (avail < 32) {
+    const W16* prefix_map = (use64) ? prefix_map_x86_64 : prefix_map_x86;
+    W32 mask = 0;
+    foreach (i, min(avail, 32)) mask |= (prefix_map[p[i]] != 0) << i;
+    return mask;
+  }
+
+  static const byte legacy_prefixes[] = {0x26, 0x2e, 0x36, 0x3e, 0x64, 0x65, 0x66, 0x67, 0x9b, 0xf0, 0xf2, 0xf3};
+
+  W32 mask = 0;
+
+  foreach (half, 2) {
+    vec16b bytes = x86_sse_ldvbu((const vec16b*)(p + half*16));
+    vec16b match = x86_sse_zerob();
+
+    foreach (i, lengthof(legacy_prefixes)) {
+      match = x86_sse_porb(match, x86_sse_pcmpeqb(bytes, x86_sse_dupb(legacy_prefixes[i])));
+    }
+
+    // REX prefixes are 0x40-0x4f in 64-bit mode
+    if (use64) match = x86_sse_porb(match, x86_sse_pcmpeqb(x86_sse_pandb(bytes, x86_sse_dupb(0xf0)), x86_sse_dupb(0x40)));
+
+    mask |= x86_sse_pmovmskb(match) << (half*16);
+  }
+
+  return mask;
+}
+
+//
+// Find the prefixes and total length of the instruction at insn from
+// the opcode, ModRM, SIB and immediate tables alone, without decoding
+// it. prefixmask comes from predecode_prefix_mask(). Returns the
+// length, or 0 if the instruction does not fit in avail bytes (or is
+// longer than the 15 byte x86 limit).
+//
+int predecode_insn(PredecodedInsn& pd, const byte* insn, int avail, W32 prefixmask, bool use64) {
+  setzero(pd);
+
+  avail = min(avail, 15);
+  int n = (~prefixmask) ? lsbindex(~prefixmask) : 32;
+  if unlikely (n >= avail) return 0;
+
+  const W16* prefix_map = (use64) ? prefix_map_x86_64 : prefix_map_x86;
+
+  // Same rules as decode_prefixes()
+  foreach (i, n) {
+    W32 prefix = prefix_map[insn[i]];
+    if (pd.rex) {
+      pd.rex = 0;
+      pd.prefixes &= ~PFX_REX;
+    }
+    pd.prefixes |= prefix;
+    if (prefix == PFX_REX) pd.rex = insn[i];
+  }
+
+  pd.prefixbytes = n;
+
+  bool opsize = ((pd.prefixes & PFX_DATA) != 0);
+  bool addrsize = ((pd.prefixes & PFX_ADDR) != 0);
+  bool rexw = bit(pd.rex, 3);
+
+  int i = n;
+  byte op = insn[i++];
+  bool has_modrm;
+  int immclass;
+
+  if (op == 0x0f) {
+    if unlikely (i >= avail) return 0;
+    op = insn[i++];
+
+    if ((op == 0x38) | (op == 0x3a)) {
+      i++;
+      has_modrm = 1;
+      immclass = (op == 0x3a) ? PREDECODE_IMM_B : PREDECODE_IMM_NONE;
+    } else {
+      has_modrm = twobyte_has_modrm[op];
+      immclass = twobyte_immediate[op];
+    }
+  } else {
+    has_modrm = onebyte_has_modrm[op];
+    immclass = onebyte_immediate[op];
+  }
+
+  if (has_modrm) {
+    if unlikely (i >= avail) return 0;
+    byte modrm = insn[i++];
+    int mod = bits(modrm, 6, 2);
+    int rm = bits(modrm, 0, 3);
+
+    // Only test (/0 and /1) in group 3 has an immediate
+    if ((immclass == PREDECODE_IMM_GROUP3B) | (immclass == PREDECODE_IMM_GROUP3Z)) {
+      immclass = (bits(modrm, 3, 3) >= 2) ? PREDECODE_IMM_NONE :
+        (immclass == PREDECODE_IMM_GROUP3B) ? PREDECODE_IMM_B : PREDECODE_IMM_Z;
+    }
+
+    if (mod != 3) {
+      if unlikely ((!use64) & addrsize) {
+        // 16-bit addressing: no SIB byte
+        i += (mod == 1) ? 1 : (mod == 2) ? 2 : (rm == 6) ? 2 : 0;
+      } else {
+        if (rm == 4) {
+          if unlikely (i >= avail) return 0;
+          byte sib = insn[i++];
+          if ((mod == 0) & (lowbits(sib, 3) == 5)) i += 4;
+        }
+        i += (mod == 1) ? 1 : (mod == 2) ? 4 : (rm == 5) ? 4 : 0;
+      }
+    }
+
+    pd.lcp = (addrsize & (!use64));
+  }
+
+  int immbytes = 0;
+  int z = ((opsize) & (!rexw)) ? 2 : 4;
+
+  switch (immclass) {
+  case PREDECODE_IMM_B: immbytes = 1; break;
+  case PREDECODE_IMM_W: immbytes = 2; break;
+  case PREDECODE_IMM_Z: immbytes = z; pd.lcp |= opsize; break;
+  case PREDECODE_IMM_V: immbytes = (rexw) ? 8 : z; pd.lcp |= opsize; break;
+  case PREDECODE_IMM_MOFFS: immbytes = ((use64) ? 8 : 4) >> addrsize; pd.lcp |= addrsize; break;
+  case PREDECODE_IMM_ENTER: immbytes = 3; break;
+  case PREDECODE_IMM_FAR: immbytes = z + 2; pd.lcp |= opsize; break;
+  case PREDECODE_IMM_REL: immbytes = (use64) ? 4 : z; pd.lcp |= (opsize & (!use64)); break;
+  }
+
+  i += immbytes;
+  if unlikely (i > avail) return 0;
+
+  pd.length = i;
+  return i;
+}
+
+//
+// Return the predecoded prefixes and length of the instruction at rip,
+// predecoding the rest of its 16-byte fetch window first if need be.
+// As in the hardware, one prefix classification covers every
+// instruction starting in the window.
+//
+const PredecodedInsn& TraceDecoder::predecode() {
+  int slot = lowbits(rip, 4);
+
+  if likely ((byteoffset < predecode_window_end) && bit(predecoded_starts, slot)) return predecoded[slot];
+
+  // The decoder found a different length than the predecoder
+  if unlikely (byteoffset < predecode_window_end) decoderstats.predecode.mismatches++;
+
+  int avail = insnbytes_bufsize - byteoffset;
+  W32 prefixmask = predecode_prefix_mask(insnbytes + byteoffset, avail, use64);
+
+  predecode_window_end = byteoffset + (PREDECODE_WINDOW_SIZE - slot);
+  predecoded_starts = 0;
+  decoderstats.predecode.windows++;
+
+  for (int offset = 0; (byteoffset + offset) < predecode_window_end; ) {
+    PredecodedInsn& pd = predecoded[slot + offset];
+    setbit(predecoded_starts, slot + offset);
+    int n = predecode_insn(pd, insnbytes + byteoffset + offset, avail - offset, prefixmask >> offset, use64);
+    if unlikely (!n) break;
+    decoderstats.predecode.insns++;
+    decoderstats.predecode.lcp += pd.lcp;
+    offset += n;
+  }
+
+  return predecoded[slot];
+}
+
 void TraceDecoder::split(bool after) {
   Waddr target = (after) ? rip : ripstart;
   if (!after) assert(!first_insn_in_bb());
@@ -1406,6 +2019,7 @@ bool BasicBlockCache::invalidate(BasicBlock* bb, int reason) {
   stats.decoder.bbcache.invalidates[reason]++;
 
   bb->free();
+  update_bbpool_stats();
   return true;
 }
 
@@ -1445,6 +2059,8 @@ bool BasicBlockCache::invalidate_page(Waddr mfn, int reason) {
   if (logable(3) | log_code_page_ops) logfile << "Invalidate page mfn ", mfn, ": pagelist ", pagelist, " has ", (pagelist ? pagelist->count() : 0), " entries (dirty? ", smc_isdirty(mfn), ")", endl;
 
   smc_cleardirty(mfn);
+  bbstaging.invalidate_page(mfn);
+  PTLsimMachine::invalidate_code_page_all(mfn);
 
   if unlikely (!pagelist) return 0;
 
@@ -1602,6 +2218,8 @@ void BasicBlockCache::flush() {
 
   stats.decoder.reclaim_rounds++;
 
+  bbstaging.flush();
+
   {
     Iterator iter(this);
     BasicBlock* bb;
@@ -1677,7 +2295,7 @@ bool TraceDecoder::invalidate() {
 #else
     int mfn = 0;
 #endif
-    if (logable(3)) {
+    if (logable(3) & (!speculative)) {
       logfile << "Translation crosses into invalid page (mfn ", mfn, "): ripstart ", (void*)ripstart, ", rip ", (void*)rip,
         ", faultaddr ", (void*)faultaddr, "; expected ", (rip - ripstart), " bytes but only got ", valid_byte_count, 
         " (next page ", (void*)(Waddr)ceil(ripstart, 4096), ")", endl;
@@ -1695,7 +2313,7 @@ bool TraceDecoder::invalidate() {
       return false;
     } else {
       outcome = (faultaddr == bb.rip.rip) ? DECODE_OUTCOME_ENTRY_PAGE_FAULT : DECODE_OUTCOME_OVERLAP_PAGE_FAULT;
-      print_invalid_insns(op, (const byte*)ripstart, (const byte*)rip, valid_byte_count, pfec, faultaddr);
+      if (!speculative) print_invalid_insns(op, (const byte*)ripstart, (const byte*)rip, valid_byte_count, pfec, faultaddr);
       abs_code_addr_immediate(REG_ar1, 3, faultaddr);
       immediate(REG_ar2, 3, pfec);
       microcode_assist(ASSIST_EXEC_PAGE_FAULT, ripstart, faultaddr);
@@ -1704,8 +2322,10 @@ bool TraceDecoder::invalidate() {
     // The instruction-specific decoder may have already set the outcome type
     if (outcome == DECODE_OUTCOME_OK) outcome = DECODE_OUTCOME_INVALID_OPCODE;
 
-    logfile << "Invalid opcode at ", (void*)ripstart, ": split_invalid_basic_blocks ", split_invalid_basic_blocks, ", first_insn_in_bb? ", first_insn_in_bb(), endl;
-    print_invalid_insns(op, (const byte*)ripstart, (const byte*)rip, valid_byte_count, 0, faultaddr);
+    if likely (!speculative) {
+      logfile << "Invalid opcode at ", (void*)ripstart, ": split_invalid_basic_blocks ", split_invalid_basic_blocks, ", first_insn_in_bb? ", first_insn_in_bb(), endl;
+      print_invalid_insns(op, (const byte*)ripstart, (const byte*)rip, valid_byte_count, 0, faultaddr);
+    }
 
     if likely (split_invalid_basic_blocks && (!first_insn_in_bb())) {
       //
@@ -1822,6 +2442,24 @@ int TraceDecoder::fillbuf(Context& ctx, byte* insnbytes, int insnbytes_bufsize)
   return valid_byte_count;
 }
 
+//
+// Use instruction bytes the main thread already copied from guest memory
+// (as fillbuf does), along with the fault state copy_from_user returned,
+// so the background translation thread never touches guest memory.
+//
+int TraceDecoder::fillbuf_prefetched(byte* insnbytes, int insnbytes_bufsize, int valid_byte_count, const PageFaultErrorCode& pfec, Waddr faultaddr, Level1PTE ptelo, Level1PTE ptehi) {
+  this->insnbytes = insnbytes;
+  this->insnbytes_bufsize = insnbytes_bufsize;
+  byteoffset = 0;
+  invalid = 0;
+  this->valid_byte_count = valid_byte_count;
+  this->pfec = pfec;
+  this->faultaddr = faultaddr;
+  this->ptelo = ptelo;
+  this->ptehi = ptehi;
+  return valid_byte_count;
+}
+
 #ifdef PTLSIM_HYPERVISOR
 int TraceDecoder::fillbuf_phys_prechecked(byte* insnbytes, int insnbytes_bufsize, Level1PTE ptelo, Level1PTE ptehi) {
   this->insnbytes = insnbytes;
@@ -1846,7 +2484,18 @@ bool TraceDecoder::translate() {
   first_uop_in_insn = 1;
   ripstart = rip;
 
-  decode_prefixes();
+  const PredecodedInsn& pd = predecode();
+  length_changing_prefix = pd.lcp;
+
+  if likely (pd.length) {
+    prefixes = pd.prefixes;
+    rex = pd.rex;
+    byteoffset += pd.prefixbytes;
+    rip += pd.prefixbytes;
+  } else {
+    // Truncated or too long: decode it the slow way to find out exactly where
+    decode_prefixes();
+  }
 
 #if 0
   logfile << "prefixes = ", prefixes, ":";
@@ -1865,7 +2514,17 @@ bool TraceDecoder::translate() {
     op = fetch1();
     need_modrm = twobyte_has_modrm[op];
 
-    if (twobyte_uses_SSE_prefix[op]) {
+    if ((op == 0x38) | (op == 0x3a)) {
+      //
+      // Three byte opcode maps (SSSE3, SSE4.1, SSE4.2): 0F 38 xx maps
+      // to 0x7xx and 0F 3A xx (which all take an imm8) to 0x8xx. The
+      // 0x66 prefix selects the xmm form (otherwise the MMX form, for
+      // SSSE3 only); decode_sse() checks it.
+      //
+      uses_sse = 1;
+      need_modrm = 1;
+      op = ((op == 0x38) ? 0x700 : 0x800) | fetch1();
+    } else if (twobyte_uses_SSE_prefix[op]) {
       uses_sse = 1;
       if (prefixes & PFX_DATA) // prefix byte 0x66, typically OPpd
         op |= 0x500;
@@ -1916,10 +2575,10 @@ bool TraceDecoder::translate() {
     if (iscomplex) rc = decode_complex();
 
     if unlikely (used_microcode_assist) {
-      stats.decoder.x86_decode_type[DECODE_TYPE_ASSIST]++;
+      decoderstats.x86_decode_type[DECODE_TYPE_ASSIST]++;
     } else {
-      stats.decoder.x86_decode_type[DECODE_TYPE_FAST] += (!iscomplex);
-      stats.decoder.x86_decode_type[DECODE_TYPE_COMPLEX] += iscomplex;
+      decoderstats.x86_decode_type[DECODE_TYPE_FAST] += (!iscomplex);
+      decoderstats.x86_decode_type[DECODE_TYPE_COMPLEX] += iscomplex;
     }
 
     break;
@@ -1928,10 +2587,12 @@ bool TraceDecoder::translate() {
   case 3:
   case 4:
   case 5:
-    stats.decoder.x86_decode_type[DECODE_TYPE_SSE]++;
+  case 7:
+  case 8:
+    decoderstats.x86_decode_type[DECODE_TYPE_SSE]++;
     rc = decode_sse(); break;
   case 6:
-    stats.decoder.x86_decode_type[DECODE_TYPE_X87]++;
+    decoderstats.x86_decode_type[DECODE_TYPE_X87]++;
     rc = decode_x87(); break;
   default: {
     assert(false);
@@ -1946,8 +2607,8 @@ bool TraceDecoder::translate() {
 
   if (end_of_block) {
     // Block ended with a branch: close the uop and exit
-    stats.decoder.bb_decode_type.all_insns_fast += (!some_insns_complex);
-    stats.decoder.bb_decode_type.some_complex_insns += some_insns_complex;
+    decoderstats.bb_decode_type.all_insns_fast += (!some_insns_complex);
+    decoderstats.bb_decode_type.some_complex_insns += some_insns_complex;
     flush();
     return false;
   } else {
@@ -1957,15 +2618,15 @@ bool TraceDecoder::translate() {
         ((rip - bb.rip) >= valid_byte_count) ||
         (user_insn_count >= MAX_BB_X86_INSNS) ||
         (rip == stop_at_rip)) {
-      if (logable(5)) logfile << "Basic block ", (void*)(Waddr)bb.rip, " too long: cutting at ", bb.count, " transops (", transbufcount, " currently in buffer)", endl;
+      if (logable(5) & (!speculative)) logfile << "Basic block ", (void*)(Waddr)bb.rip, " too long: cutting at ", bb.count, " transops (", transbufcount, " currently in buffer)", endl;
       // bb.rip_taken and bb.rip_not_taken were already filled out for the last instruction.
       if unlikely (!last_flags_update_was_atomic) {
-        if (logable(5)) logfile << "Basic block ", (void*)(Waddr)bb.rip, " had non-atomic flags update: adding collcc", endl;
+        if (logable(5) & (!speculative)) logfile << "Basic block ", (void*)(Waddr)bb.rip, " had non-atomic flags update: adding collcc", endl;
         this << TransOp(OP_collcc, REG_temp0, REG_zf, REG_cf, REG_of, 3, 0, 0, FLAGS_DEFAULT_ALU);
       }
       split_after();
-      stats.decoder.bb_decode_type.all_insns_fast += (!some_insns_complex);
-      stats.decoder.bb_decode_type.some_complex_insns += some_insns_complex;
+      decoderstats.bb_decode_type.all_insns_fast += (!some_insns_complex);
+      decoderstats.bb_decode_type.some_complex_insns += some_insns_complex;
       flush();
       return false;
     } else {
@@ -2016,27 +2677,40 @@ BasicBlock* BasicBlockCache::translate(Context& ctx, const RIPVirtPhys& rvp) {
 
   translate_timer.start();
 
-  byte insnbuf[MAX_BB_BYTES];
+  bool speculate = (config.speculative_translate && bbstaging.start());
+  bb = (speculate) ? bbstaging.take(rvp) : null;
 
-  TraceDecoder trans(rvp);
-  trans.fillbuf(ctx, insnbuf, sizeof(insnbuf));
+  if (bb) {
+    if (logable(5) | log_code_page_ops) {
+      logfile << "Publishing staged ", rvp, " at ", sim_cycle, " cycles, ", total_user_insns_committed, " commits", endl;
+    }
+  } else {
+    byte insnbuf[MAX_BB_BYTES];
 
-  if (logable(5) | log_code_page_ops) {
-    logfile << "Translating ", rvp, " (", trans.valid_byte_count, " bytes valid) at ", sim_cycle, " cycles, ", total_user_insns_committed, " commits", endl;
-  }
+    TraceDecoder trans(rvp);
+    trans.fillbuf(ctx, insnbuf, sizeof(insnbuf));
 
-  if (rvp.mfnlo == RIPVirtPhys::INVALID) {
-    assert(trans.valid_byte_count == 0);
-  }
+    if (logable(5) | log_code_page_ops) {
+      logfile << "Translating ", rvp, " (", trans.valid_byte_count, " bytes valid) at ", sim_cycle, " cycles, ", total_user_insns_committed, " commits", endl;
+    }
 
-  for (;;) {
-    // if (DEBUG) logfile << "rip ", (void*)trans.rip, ", relrip = ", (void*)(trans.rip - trans.bb.rip), endl;
-    if (!trans.translate()) break;
+    if (rvp.mfnlo == RIPVirtPhys::INVALID) {
+      assert(trans.valid_byte_count == 0);
+    }
+
+    for (;;) {
+      // if (DEBUG) logfile << "rip ", (void*)trans.rip, ", relrip = ", (void*)(trans.rip - trans.bb.rip), endl;
+      if (!trans.translate()) break;
+    }
+
+    if (decode_optimize_uops) optimize_basic_block(trans.bb);
+
+    trans.bb.hitcount = 0;
+    trans.bb.predcount = 0;
+    bb = trans.bb.clone();
+    stats.decoder.throughput.basic_blocks++;
   }
 
-  trans.bb.hitcount = 0;
-  trans.bb.predcount = 0;
-  bb = trans.bb.clone();
   //
   // Acquire a reference to the new basic block right away,
   // since we make allocations below that might reclaim it
@@ -2048,8 +2722,6 @@ BasicBlock* BasicBlockCache::translate(Context& ctx, const RIPVirtPhys& rvp) {
   stats.decoder.bbcache.count = this->count;
   stats.decoder.bbcache.inserts++;
 
-  stats.decoder.throughput.basic_blocks++;
-
   BasicBlockChunkList* pagelist;
 
   //smc_cleardirty(bb->rip.mfnlo);
@@ -2097,12 +2769,15 @@ BasicBlock* BasicBlockCache::translate(Context& ctx, const RIPVirtPhys& rvp) {
   if (logable(5)) {
     logfile << "=====================================================================", endl;
     logfile << *bb, endl;
-    logfile << "End of basic block: rip ", trans.bb.rip, " -> taken rip 0x", (void*)(Waddr)trans.bb.rip_taken, ", not taken rip 0x", (void*)(Waddr)trans.bb.rip_not_taken, endl;
+    logfile << "End of basic block: rip ", bb->rip, " -> taken rip 0x", (void*)(Waddr)bb->rip_taken, ", not taken rip 0x", (void*)(Waddr)bb->rip_not_taken, endl;
   }
 
+  if (speculate) translate_successors(ctx, *bb);
+
   translate_timer.stop();
 
   bb->release();
+  update_bbpool_stats();
 
   return bb;
 }
@@ -2205,6 +2880,8 @@ ostream& BasicBlockCache::print(ostream& os) {
 
 void bbcache_reclaim(size_t bytes, int urgency) {
   bbcache.reclaim(bytes, urgency);
+  trim_basic_block_pool();
+  update_bbpool_stats();
 }
 
 void init_decode() {
@@ -2213,5 +2890,7 @@ void init_decode() {
 
 void shutdown_decode() {
   bbcache.flush();
+  trim_basic_block_pool();
+  update_bbpool_stats();
   if (bbcache_dump_file) bbcache_dump_file.close();
 }
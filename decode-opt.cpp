@@ -0,0 +1,266 @@
+//
+// PTLsim: Cycle Accurate x86-64 Simulator
+// Basic block uop optimizer
+//
+// Copyright 2008 Matt T. Yourst <yourst@yourst.com>
+//
+
+#include <decode.h>
+#include <stats.h>
+
+//
+// The decoder translates each x86 instruction in isolation, so a basic
+// block carries temporaries that only feed a mov, flags an instruction
+// sets in one uop and then sets again (or never reads), and uops whose
+// results are overwritten before use. With -optimize-uops (on by default
+// for the sequential core) or -ooo-optimize-uops, each block gets three
+// passes before it goes into the basic block cache:
+//
+// 1. Copy propagation: reads of a register that was last written by a
+//    full width mov (which copies both the value and its attached flags)
+//    are redirected to the mov's source, so the mov itself often dies.
+//
+// 2. Flag liveness: the ZF, CF and OF groups a uop sets are dropped if
+//    a later uop of the same x86 instruction sets them again before any
+//    uop reads REG_zf/cf/of (or REG_flags) and the attached flags of its
+//    result can't be consumed.
+//
+// 3. Dead uop elimination: uops with no side effects whose results
+//    (value and flags) are all dead are removed. Every x86 instruction
+//    keeps at least one uop (a nop if need be) so it still commits.
+//
+// A block can stop after any of its instructions: a load, store, divide
+// or assist may fault, and the sequential core stops mid-block at
+// -stopinsns or -stoprip before switching cores. So every
+// architectural register and flag group is live at each instruction
+// boundary, and passes 2 and 3 only remove work within an instruction.
+// Copy propagation only renames reads of equal values, so it still
+// works across instructions.
+//
+
+static inline bool is_flag_reg(int r) {
+  return ((r == REG_zf) | (r == REG_cf) | (r == REG_of));
+}
+
+static inline int flag_groups_read_by(int r) {
+  switch (r) {
+  case REG_zf: return SETFLAG_ZF;
+  case REG_cf: return SETFLAG_CF;
+  case REG_of: return SETFLAG_OF;
+  case REG_flags: return SETFLAG_ZF|SETFLAG_CF|SETFLAG_OF;
+  default: return 0;
+  }
+}
+
+// Registers holding values we track (not flags, REG_zero or operand placeholders)
+static inline bool is_value_reg(int r) {
+  return ((r < TRANSREG_COUNT) && (r != REG_zero) && (r != REG_imm) && (r != REG_mem) && (!is_flag_reg(r)));
+}
+
+//
+// A pure copy: full width, flags and value copied from rb unchanged
+//
+static inline bool is_copy(const TransOp& uop) {
+  return ((uop.opcode == OP_mov) && (uop.size == 3) && (!uop.setflags) && (!uop.vec128) &&
+          is_value_reg(uop.rd) && is_value_reg(uop.rb) && (uop.rd != uop.rb));
+}
+
+//
+// Uops that can fault or otherwise see the whole architectural state
+//
+static inline bool may_fault(const TransOp& uop) {
+  switch (uop.opcode) {
+  case OP_div: case OP_rem: case OP_divs: case OP_rems:
+    return true;
+  }
+
+  return isclass(uop.opcode, OPCLASS_LOAD|OPCLASS_STORE|OPCLASS_BARRIER|OPCLASS_CHECK);
+}
+
+//
+// Uops without side effects or exceptions, which can go if their results are dead
+//
+static inline bool is_removable(const TransOp& uop) {
+  if (may_fault(uop)) return false;
+
+  return isclass(uop.opcode, OPCLASS_LOGIC|OPCLASS_ADD|OPCLASS_SELECT|OPCLASS_COMPARE|OPCLASS_SIMPLE_SHIFT|
+                 OPCLASS_SHIFTROT|OPCLASS_MULTIPLY|OPCLASS_BITSCAN|OPCLASS_FLAGS|OPCLASS_VEC_ALU);
+}
+
+static void propagate_copies(BasicBlock& bb, struct PTLsimStats::decoder& decstats) {
+  W8s copyof[TRANSREG_COUNT];
+  foreach (r, TRANSREG_COUNT) copyof[r] = -1;
+
+  foreach (i, bb.count) {
+    TransOp& uop = bb.transops[i];
+
+    // Temporaries aren't read across x86 instructions, so don't propagate through them
+    if (uop.som) {
+      for (int r = ARCHREG_COUNT; r < TRANSREG_COUNT; r++) copyof[r] = -1;
+    }
+
+    if (!uop.vec128) {
+      byte* operands[3] = {&uop.ra, &uop.rb, &uop.rc};
+      foreach (j, 3) {
+        int r = *operands[j];
+        if (is_value_reg(r) && (copyof[r] >= 0)) {
+          *operands[j] = copyof[r];
+          decstats.optimizer.copies_propagated++;
+        }
+      }
+    }
+
+    if (isclass(uop.opcode, OPCLASS_BARRIER|OPCLASS_CHECK)) {
+      foreach (r, TRANSREG_COUNT) copyof[r] = -1;
+      continue;
+    }
+
+    // Anything copied from or into the registers written here is now stale
+    foreach (w, (uop.vec128) ? 2 : 1) {
+      int rd = uop.rd + w;
+      if (!is_value_reg(rd)) continue;
+      copyof[rd] = -1;
+      foreach (r, TRANSREG_COUNT) {
+        if (copyof[r] == rd) copyof[r] = -1;
+      }
+    }
+
+    if (is_copy(uop)) copyof[uop.rd] = uop.rb;
+  }
+}
+
+static void eliminate_dead_uops(BasicBlock& bb, byte* dead, struct PTLsimStats::decoder& decstats) {
+  // Values read later on (or at the end of the block)
+  byte live[TRANSREG_COUNT];
+  // Values whose attached flags may be read later on
+  byte flagsread[TRANSREG_COUNT];
+  int liveflags = SETFLAG_ZF|SETFLAG_CF|SETFLAG_OF;
+
+  foreach (r, TRANSREG_COUNT) {
+    live[r] = (r < ARCHREG_COUNT);
+    flagsread[r] = 0;
+  }
+
+  for (int i = bb.count-1; i >= 0; i--) {
+    TransOp& uop = bb.transops[i];
+    dead[i] = 0;
+
+    // The state after each x86 instruction must be exact (see above)
+    if (uop.eom) {
+      foreach (r, ARCHREG_COUNT) {
+        live[r] = 1;
+        flagsread[r] = 0;
+      }
+      liveflags = SETFLAG_ZF|SETFLAG_CF|SETFLAG_OF;
+    }
+
+    // Likewise at anything that can fault partway through an instruction
+    if (may_fault(uop)) {
+      foreach (r, ARCHREG_COUNT) live[r] = 1;
+      liveflags = SETFLAG_ZF|SETFLAG_CF|SETFLAG_OF;
+    }
+
+    int writes = (uop.vec128) ? 2 : 1;
+    bool rdlive = 0;
+    bool rdflagsread = 0;
+    if (is_value_reg(uop.rd)) {
+      foreach (w, writes) {
+        rdlive |= live[uop.rd + w];
+        rdflagsread |= flagsread[uop.rd + w];
+      }
+    }
+
+    if (is_removable(uop) && (!uop.nouserflags)) {
+      if ((uop.setflags & ~liveflags) && (!rdflagsread)) {
+        uop.setflags &= liveflags;
+        decstats.optimizer.flag_sets_pruned++;
+      }
+
+      if ((!rdlive) && (!uop.setflags)) {
+        dead[i] = 1;
+        continue;
+      }
+    }
+
+    if (is_value_reg(uop.rd)) {
+      foreach (w, writes) {
+        live[uop.rd + w] = 0;
+        flagsread[uop.rd + w] = 0;
+      }
+    }
+
+    // A write to REG_flags itself doesn't define the groups read through REG_zf/cf/of
+    if (!uop.nouserflags) liveflags &= ~uop.setflags;
+
+    byte operands[5] = {uop.ra, uop.rb, uop.rc, REG_zero, REG_zero};
+    if (uop.vec128) {
+      operands[3] = uop.ra + 1;
+      operands[4] = uop.rb + 1;
+    }
+
+    foreach (j, 5) {
+      int r = operands[j];
+      liveflags |= flag_groups_read_by(r);
+      if (is_value_reg(r)) {
+        live[r] = 1;
+        flagsread[r] = 1;
+      }
+    }
+  }
+}
+
+void optimize_basic_block(BasicBlock& bb, bool speculative) {
+  byte dead[MAX_BB_UOPS*2];
+  struct PTLsimStats::decoder& decstats = (speculative) ? speculative_decoder_stats : stats.decoder;
+
+  decstats.optimizer.blocks++;
+  decstats.optimizer.uops_in += bb.count;
+
+  propagate_copies(bb, decstats);
+  eliminate_dead_uops(bb, dead, decstats);
+
+  // Keep at least one uop per x86 instruction so it still commits and advances rip
+  int start = 0;
+  foreach (i, bb.count) {
+    if (bb.transops[i].som) start = i;
+    if (!bb.transops[i].eom) continue;
+
+    bool any = 0;
+    for (int j = start; j <= i; j++) any |= (!dead[j]);
+    if (any) continue;
+
+    TransOp& uop = bb.transops[i];
+    dead[i] = 0;
+    uop.opcode = OP_nop;
+    uop.rd = REG_zero; uop.ra = REG_zero; uop.rb = REG_zero; uop.rc = REG_zero;
+    uop.rbimm = 0; uop.rcimm = 0;
+    uop.setflags = 0;
+    uop.vec128 = 0;
+  }
+
+  // usedregs stays as it was: a superset is harmless
+  int n = 0;
+  bool som = 0;
+
+  foreach (i, bb.count) {
+    TransOp uop = bb.transops[i];
+
+    som |= uop.som;
+
+    if (dead[i]) {
+      decstats.optimizer.dead_uops++;
+      // There is always an earlier survivor in the same instruction
+      if (uop.eom) bb.transops[n-1].eom = 1;
+      continue;
+    }
+
+    uop.som = som;
+    som = 0;
+    uop.bbindex = n;
+    bb.transops[n++] = uop;
+  }
+
+  bb.tagcount -= (bb.count - n);
+  bb.count = n;
+  decstats.optimizer.uops_out += n;
+}
@@ -1,6 +1,6 @@
 //
 // PTLsim: Cycle Accurate x86-64 Simulator
-// Decoder for SSE/SSE2/SSE3/MMX and misc instructions
+// Decoder for SSE/SSE2/SSE3/SSSE3/SSE4/MMX and misc instructions
 //
 // Copyright 1999-2008 Matt T. Yourst <yourst@yourst.com>
 //
@@ -9,6 +9,32 @@
 
 static const byte sse_float_datatype_to_ptl_datatype[4] = {DATATYPE_FLOAT, DATATYPE_VEC_FLOAT, DATATYPE_DOUBLE, DATATYPE_VEC_DOUBLE};
 
+//
+// The MMX registers alias the x87 register file: mmN is fpstack[N].
+// Writing one resets the x87 stack top to 0 and tags every register
+// as valid, as on real hardware.
+//
+void TraceDecoder::mmx_load(int destreg, int mmreg) {
+  is_x87 = 1;
+  TransOp ldp(OP_ld, destreg, REG_fpstack, REG_imm, REG_zero, 3, mmreg * 8); ldp.internal = 1; this << ldp;
+}
+
+void TraceDecoder::mmx_store(int mmreg, int srcreg) {
+  is_x87 = 1;
+  TransOp stp(OP_st, REG_mem, REG_fpstack, REG_imm, srcreg, 3, mmreg * 8); stp.internal = 1; this << stp;
+  this << TransOp(OP_mov, REG_fptos, REG_zero, REG_zero, REG_zero, 3);
+  immediate(REG_fptags, 3, 0x0101010101010101ULL);
+}
+
+void TraceDecoder::mmx_load_operand(int destreg, DecodedOperand& ra) {
+  if (ra.type == OPTYPE_MEM) {
+    ra.mem.size = 3;
+    operand_load(destreg, ra, OP_ld, DATATYPE_VEC_64BIT);
+  } else {
+    mmx_load(destreg, modrm.rm);
+  }
+}
+
 bool TraceDecoder::decode_sse() {
   DecodedOperand rd;
   DecodedOperand ra;
@@ -153,6 +179,15 @@ bool TraceDecoder::decode_sse() {
       break;
     }
 
+    if (packed && decode_vec128_uops && get_synthcode_for_vec128_uop(uop, isclass(uop, OPCLASS_LOGIC) ? 3 : sizetype, imm.imm.imm)) {
+      TransOp vecop(uop, rdreg, rareg, rbreg, REG_zero, isclass(uop, OPCLASS_LOGIC) ? 3 : sizetype);
+      vecop.cond = imm.imm.imm;
+      vecop.datatype = datatype;
+      vecop.vec128 = 1;
+      this << vecop;
+      break;
+    }
+
     TransOp lowop(uop, rdreg+0, rareg+0, rbreg+0, REG_zero, isclass(uop, OPCLASS_LOGIC) ? 3 : sizetype);
     lowop.cond = imm.imm.imm;
     lowop.datatype = datatype;
@@ -244,6 +279,14 @@ bool TraceDecoder::decode_sse() {
 
     bool isshift = (uop == OP_vshr) | (uop == OP_vsar) | (uop == OP_vshl);
 
+    // 128-bit shifts also take their count from the low 64 bits of rb
+    if (decode_vec128_uops && get_synthcode_for_vec128_uop(uop, sizeshift, 0)) {
+      TransOp vecop(uop, rdreg, rdreg, rareg, REG_zero, sizeshift);
+      vecop.vec128 = 1;
+      this << vecop;
+      break;
+    }
+
     this << TransOp(uop, rdreg+0, rdreg+0, rareg+0, REG_zero, sizeshift);
     this << TransOp(uop, rdreg+1, rdreg+1, rareg+(!isshift), REG_zero, sizeshift);
     break;
@@ -511,8 +554,9 @@ bool TraceDecoder::decode_sse() {
       rareg = arch_pseudo_reg_to_arch_reg[ra.reg.reg];
     }
 
+    // The high half reads ra, which may be rd itself, so only write rd afterwards
     int uop = (op == 0x57d) ? OP_fsub : OP_fadd;
-    TransOp lowop(uop, rdreg+0, rdreg+0, rdreg+1, REG_zero, 3);
+    TransOp lowop(uop, REG_temp2, rdreg+0, rdreg+1, REG_zero, 3);
     lowop.datatype = DATATYPE_VEC_DOUBLE;
     this << lowop;
 
@@ -520,6 +564,8 @@ bool TraceDecoder::decode_sse() {
     highop.datatype = DATATYPE_VEC_DOUBLE;
     this << highop;
 
+    this << TransOp(OP_mov, rdreg+0, REG_zero, REG_temp2, REG_zero, 3);
+
     break;
   }
 
@@ -1284,6 +1330,691 @@ bool TraceDecoder::decode_sse() {
     break;
   }
 
+  //
+  // SSSE3, SSE4.1 and SSE4.2 (three byte opcode maps). These need the
+  // 0x66 prefix, except for the SSSE3 ops, which operate on the MMX
+  // registers without it.
+  //
+  // 0x7xx = 0F 38 xx:
+  //
+  //        0        1        2        3        4          5         6         7          8           9           a          b        c           d           e          f
+  // 0x700: pshufb   phaddw   phaddd   phaddsw  pmaddubsw  phsubw    phsubd    phsubsw    psignb      psignw      psignd     pmulhrsw --------    --------    --------   --------
+  // 0x710: pblendvb -------- -------- -------- blendvps   blendvpd  --------  ptest      --------    --------    --------   -------- pabsb       pabsw       pabsd      --------
+  // 0x720: pmovsxbw pmovsxbd pmovsxbq pmovsxwd pmovsxwq   pmovsxdq  --------  --------   pmuldq      pcmpeqq     movntdqa   packusdw --------    --------    --------   --------
+  // 0x730: pmovzxbw pmovzxbd pmovzxbq pmovzxwd pmovzxwq   pmovzxdq  --------  pcmpgtq    pminsb      pminsd      pminuw     pminud   pmaxsb      pmaxsd      pmaxuw     pmaxud
+  // 0x740: pmulld   phminposuw
+  //
+  // Not implemented (decoded as invalid): crc32 and the SSE4.2 string
+  // compares.
+  //
+  case 0x700 ... 0x70b:
+  case 0x729:
+  case 0x737 ... 0x740: {
+    DECODE(gform, rd, x_mode);
+    DECODE(eform, ra, x_mode);
+
+    static const byte x86_opcode_to_ptl_opcode[0x41] = {
+      // 0x700:
+      OP_vshufb, OP_vhadd, OP_vhadd, OP_vhadd_ss, OP_vmaddubs, OP_vhsub, OP_vhsub, OP_vhsub_ss, OP_vsign, OP_vsign, OP_vsign, OP_vmulhrs, 0, 0, 0, 0,
+      // 0x710:
+      0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+      // 0x720:
+      0, 0, 0, 0, 0, 0, 0, 0, 0, OP_vcmp, 0, 0, 0, 0, 0, 0,
+      // 0x730:
+      0, 0, 0, 0, 0, 0, 0, OP_vcmp, OP_vmin_s, OP_vmin_s, OP_vmin, OP_vmin, OP_vmax_s, OP_vmax_s, OP_vmax, OP_vmax,
+      // 0x740:
+      OP_vmull,
+    };
+#define B 0
+#define W 1
+#define D 2
+#define Q 3
+    static const byte x86_opcode_to_sizeshift[0x41] = {
+      // 0x700:
+      B, W, D, W, W, W, D, W, B, W, D, W, 0, 0, 0, 0,
+      // 0x710:
+      0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+      // 0x720:
+      0, 0, 0, 0, 0, 0, 0, 0, 0, Q, 0, 0, 0, 0, 0, 0,
+      // 0x730:
+      0, 0, 0, 0, 0, 0, 0, Q, B, D, W, D, B, D, W, D,
+      // 0x740:
+      D,
+    };
+#undef B
+#undef W
+#undef D
+#undef Q
+
+    int uop = x86_opcode_to_ptl_opcode[lowbits(op, 8)];
+    int sizeshift = x86_opcode_to_sizeshift[lowbits(op, 8)];
+
+    // Without the 0x66 prefix, only the SSSE3 ops exist (on mm registers)
+    bool mmx = (!(prefixes & PFX_DATA));
+    if ((!uop) | (mmx & (op > 0x70b))) MakeInvalid();
+    EndOfDecode();
+
+    if (mmx) {
+      mmx_load(REG_temp2, modrm.reg);
+      mmx_load_operand(REG_temp3, ra);
+      if (uop == OP_vshufb)
+        this << TransOp(OP_vshufb, REG_temp2, REG_temp2, REG_temp2, REG_temp3, 3);
+      else this << TransOp(uop, REG_temp2, REG_temp2, REG_temp3, REG_zero, sizeshift);
+      mmx_store(modrm.reg, REG_temp2);
+      break;
+    }
+
+    int rdreg = arch_pseudo_reg_to_arch_reg[rd.reg.reg];
+    int rareg;
+
+    if (ra.type == OPTYPE_MEM) {
+      rareg = REG_temp0;
+      operand_load(REG_temp0, ra, OP_ld, DATATYPE_VEC_128BIT);
+      ra.mem.offset += 8;
+      operand_load(REG_temp1, ra, OP_ld, DATATYPE_VEC_128BIT);
+    } else {
+      rareg = arch_pseudo_reg_to_arch_reg[ra.reg.reg];
+    }
+
+    switch (uop) {
+    case OP_vshufb: {
+      // Both halves index all 16 bytes of rd, so build the result in temporaries
+      this << TransOp(OP_vshufb, REG_temp2, rdreg+0, rdreg+1, rareg+0, 3);
+      this << TransOp(OP_vshufb, REG_temp3, rdreg+0, rdreg+1, rareg+1, 3);
+      this << TransOp(OP_mov, rdreg+0, REG_zero, REG_temp2, REG_zero, 3);
+      this << TransOp(OP_mov, rdreg+1, REG_zero, REG_temp3, REG_zero, 3);
+      break;
+    }
+    case OP_vhadd:
+    case OP_vhsub:
+    case OP_vhadd_ss:
+    case OP_vhsub_ss: {
+      // The low half comes from rd and the high half from ra, which may be rd
+      this << TransOp(uop, REG_temp2, rdreg+0, rdreg+1, REG_zero, sizeshift);
+      this << TransOp(uop, rdreg+1, rareg+0, rareg+1, REG_zero, sizeshift);
+      this << TransOp(OP_mov, rdreg+0, REG_zero, REG_temp2, REG_zero, 3);
+      break;
+    }
+    case OP_vcmp: {
+      int cond = (op == 0x737) ? COND_nle : COND_e;
+      TransOp lo(OP_vcmp, rdreg+0, rdreg+0, rareg+0, REG_zero, sizeshift);
+      lo.cond = cond; this << lo;
+      TransOp hi(OP_vcmp, rdreg+1, rdreg+1, rareg+1, REG_zero, sizeshift);
+      hi.cond = cond; this << hi;
+      break;
+    }
+    default: {
+      this << TransOp(uop, rdreg+0, rdreg+0, rareg+0, REG_zero, sizeshift);
+      this << TransOp(uop, rdreg+1, rdreg+1, rareg+1, REG_zero, sizeshift);
+      break;
+    }
+    }
+    break;
+  }
+
+  case 0x71c ... 0x71e: { // pabsb pabsw pabsd
+    DECODE(gform, rd, x_mode);
+    DECODE(eform, ra, x_mode);
+    EndOfDecode();
+
+    int sizeshift = op - 0x71c;
+
+    if (!(prefixes & PFX_DATA)) {
+      mmx_load_operand(REG_temp3, ra);
+      this << TransOp(OP_vabs, REG_temp2, REG_zero, REG_temp3, REG_zero, sizeshift);
+      mmx_store(modrm.reg, REG_temp2);
+      break;
+    }
+
+    int rdreg = arch_pseudo_reg_to_arch_reg[rd.reg.reg];
+    int rareg;
+
+    if (ra.type == OPTYPE_MEM) {
+      rareg = REG_temp0;
+      operand_load(REG_temp0, ra, OP_ld, DATATYPE_VEC_128BIT);
+      ra.mem.offset += 8;
+      operand_load(REG_temp1, ra, OP_ld, DATATYPE_VEC_128BIT);
+    } else {
+      rareg = arch_pseudo_reg_to_arch_reg[ra.reg.reg];
+    }
+
+    this << TransOp(OP_vabs, rdreg+0, REG_zero, rareg+0, REG_zero, sizeshift);
+    this << TransOp(OP_vabs, rdreg+1, REG_zero, rareg+1, REG_zero, sizeshift);
+    break;
+  }
+
+  case 0x72b: { // packusdw
+    DECODE(gform, rd, x_mode);
+    DECODE(eform, ra, x_mode);
+    if (!(prefixes & PFX_DATA)) MakeInvalid();
+    EndOfDecode();
+
+    int rdreg = arch_pseudo_reg_to_arch_reg[rd.reg.reg];
+    int rareg;
+
+    if (ra.type == OPTYPE_MEM) {
+      rareg = REG_temp0;
+      operand_load(REG_temp0, ra, OP_ld, DATATYPE_VEC_128BIT);
+      ra.mem.offset += 8;
+      operand_load(REG_temp1, ra, OP_ld, DATATYPE_VEC_128BIT);
+    } else {
+      rareg = arch_pseudo_reg_to_arch_reg[ra.reg.reg];
+    }
+
+    // As with phaddw: ra may be rd, so build the low half in a temporary
+    this << TransOp(OP_vpack_us, REG_temp2, rdreg+0, rdreg+1, REG_zero, 1);
+    this << TransOp(OP_vpack_us, rdreg+1, rareg+0, rareg+1, REG_zero, 1);
+    this << TransOp(OP_mov, rdreg+0, REG_zero, REG_temp2, REG_zero, 3);
+    break;
+  }
+
+  case 0x710: // pblendvb
+  case 0x714: // blendvps
+  case 0x715: { // blendvpd
+    DECODE(gform, rd, x_mode);
+    DECODE(eform, ra, x_mode);
+    if (!(prefixes & PFX_DATA)) MakeInvalid();
+    EndOfDecode();
+
+    int sizeshift = (op == 0x710) ? 0 : (op == 0x714) ? 2 : 3;
+    int rdreg = arch_pseudo_reg_to_arch_reg[rd.reg.reg];
+    int rareg;
+
+    if (ra.type == OPTYPE_MEM) {
+      rareg = REG_temp0;
+      operand_load(REG_temp0, ra, OP_ld, DATATYPE_VEC_128BIT);
+      ra.mem.offset += 8;
+      operand_load(REG_temp1, ra, OP_ld, DATATYPE_VEC_128BIT);
+    } else {
+      rareg = arch_pseudo_reg_to_arch_reg[ra.reg.reg];
+    }
+
+    // The selector is implicitly xmm0
+    this << TransOp(OP_vsel, rdreg+0, rdreg+0, rareg+0, REG_xmml0, sizeshift);
+    this << TransOp(OP_vsel, rdreg+1, rdreg+1, rareg+1, REG_xmmh0, sizeshift);
+    break;
+  }
+
+  case 0x717: { // ptest
+    DECODE(gform, rd, x_mode);
+    DECODE(eform, ra, x_mode);
+    if (!(prefixes & PFX_DATA)) MakeInvalid();
+    EndOfDecode();
+
+    int rdreg = arch_pseudo_reg_to_arch_reg[rd.reg.reg];
+    int rareg;
+
+    if (ra.type == OPTYPE_MEM) {
+      rareg = REG_temp0;
+      operand_load(REG_temp0, ra, OP_ld, DATATYPE_VEC_128BIT);
+      ra.mem.offset += 8;
+      operand_load(REG_temp1, ra, OP_ld, DATATYPE_VEC_128BIT);
+    } else {
+      rareg = arch_pseudo_reg_to_arch_reg[ra.reg.reg];
+    }
+
+    //
+    // ZF = ((ra & rd) == 0)
+    // CF = ((ra & ~rd) == 0)
+    //
+    this << TransOp(OP_and, REG_temp2, rdreg+0, rareg+0, REG_zero, 3);
+    this << TransOp(OP_and, REG_temp3, rdreg+1, rareg+1, REG_zero, 3);
+    this << TransOp(OP_or, REG_temp2, REG_temp2, REG_temp3, REG_zero, 3);
+    this << TransOp(OP_andnot, REG_temp3, rdreg+0, rareg+0, REG_zero, 3);
+    this << TransOp(OP_andnot, REG_temp4, rdreg+1, rareg+1, REG_zero, 3);
+    this << TransOp(OP_or, REG_temp3, REG_temp3, REG_temp4, REG_zero, 3);
+    this << TransOp(OP_vtest, REG_temp2, REG_temp2, REG_temp3, REG_zero, 3, 0, 0, FLAGS_DEFAULT_ALU);
+    break;
+  }
+
+  case 0x720 ... 0x725: // pmovsxXX
+  case 0x730 ... 0x735: { // pmovzxXX
+    DECODE(gform, rd, x_mode);
+    DECODE(eform, ra, x_mode);
+    if (!(prefixes & PFX_DATA)) MakeInvalid();
+    EndOfDecode();
+
+    //                                  bw bd bq wd wq dq
+    static const byte srcsizeshift[6] = {0, 0, 0, 1, 1, 2};
+    static const byte destsizeshift[6] = {1, 2, 3, 2, 3, 3};
+
+    bool sx = (bits(op, 4, 4) == 0x2);
+    int s = srcsizeshift[lowbits(op, 4)];
+    int d = destsizeshift[lowbits(op, 4)];
+
+    int rdreg = arch_pseudo_reg_to_arch_reg[rd.reg.reg];
+    int rareg;
+
+    if (ra.type == OPTYPE_MEM) {
+      // Only the packed source elements are loaded (8, 4 or 2 bytes)
+      rareg = REG_temp0;
+      ra.mem.size = 4 - (d - s);
+      operand_load(REG_temp0, ra, OP_ld, DATATYPE_VEC_128BIT);
+    } else {
+      rareg = arch_pseudo_reg_to_arch_reg[ra.reg.reg];
+    }
+
+    //
+    // Spread the source elements into each half with permb, filling
+    // the other bytes from REG_zero (bytes 8-15). For sign extension,
+    // each element goes in the top bytes of its slot and is then
+    // shifted down arithmetically. The high half is done first, since
+    // only the low half can overwrite the source register.
+    //
+    int srcbytes = (1 << s);
+    int destbytes = (1 << d);
+    int offset = (sx) ? (destbytes - srcbytes) : 0;
+
+    for (int h = 1; h >= 0; h--) {
+      W32 ctl = 0;
+      foreach (p, 8) {
+        int k = (h * (8 >> d)) + (p >> d);
+        int b = p & (destbytes-1);
+        int sel = ((b >= offset) & (b < (offset + srcbytes))) ? ((k * srcbytes) + (b - offset)) : 8;
+        ctl |= (sel << (p*4));
+      }
+
+      this << TransOp(OP_permb, rdreg+h, rareg+0, REG_zero, REG_imm, 3, 0, ctl);
+
+      if (sx) {
+        int shift = (destbytes - srcbytes) * 8;
+        if (d == 3)
+          this << TransOp(OP_sar, rdreg+h, rdreg+h, REG_imm, REG_zero, 3, shift);
+        else this << TransOp(OP_vsar, rdreg+h, rdreg+h, REG_imm, REG_zero, d, shift);
+      }
+    }
+    break;
+  }
+
+  case 0x72a: { // movntdqa load
+    DECODE(gform, rd, x_mode);
+    DECODE(eform, ra, x_mode);
+    if ((ra.type != OPTYPE_MEM) | (!(prefixes & PFX_DATA))) MakeInvalid();
+    EndOfDecode();
+
+    int rdreg = arch_pseudo_reg_to_arch_reg[rd.reg.reg];
+    operand_load(rdreg+0, ra, OP_ld, DATATYPE_VEC_128BIT);
+    ra.mem.offset += 8;
+    operand_load(rdreg+1, ra, OP_ld, DATATYPE_VEC_128BIT);
+    break;
+  }
+
+  case 0x728: // pmuldq
+  case 0x741: { // phminposuw
+    DECODE(gform, rd, x_mode);
+    DECODE(eform, ra, x_mode);
+    if (!(prefixes & PFX_DATA)) MakeInvalid();
+    EndOfDecode();
+
+    int rdreg = arch_pseudo_reg_to_arch_reg[rd.reg.reg];
+    int rareg;
+
+    if (ra.type == OPTYPE_MEM) {
+      rareg = REG_temp0;
+      operand_load(REG_temp0, ra, OP_ld, DATATYPE_VEC_128BIT);
+      ra.mem.offset += 8;
+      operand_load(REG_temp1, ra, OP_ld, DATATYPE_VEC_128BIT);
+    } else {
+      rareg = arch_pseudo_reg_to_arch_reg[ra.reg.reg];
+    }
+
+    if (op == 0x728) {
+      // Signed 64-bit product of the low dword of each quadword
+      foreach (h, 2) {
+        TransOp sxd(OP_maskb, REG_temp2, REG_zero, rdreg+h, REG_imm, 3, 0, MaskControlInfo(0, 32, 0)); sxd.cond = 2; this << sxd;
+        TransOp sxa(OP_maskb, REG_temp3, REG_zero, rareg+h, REG_imm, 3, 0, MaskControlInfo(0, 32, 0)); sxa.cond = 2; this << sxa;
+        this << TransOp(OP_mull, rdreg+h, REG_temp2, REG_temp3, REG_zero, 3);
+      }
+    } else {
+      this << TransOp(OP_vminpos, rdreg+0, rareg+0, rareg+1, REG_zero, 1);
+      this << TransOp(OP_mov, rdreg+1, REG_zero, REG_zero, REG_zero, 3);
+    }
+    break;
+  }
+
+  //
+  // 0x8xx = 0F 3A xx (all take an imm8):
+  //
+  //        0        1        2        3        4          5         6         7          8           9           a          b        c           d           e          f
+  // 0x800: -------- -------- -------- -------- --------   --------  --------  --------   roundps     roundpd     roundss    roundsd  blendps     blendpd     pblendw    palignr
+  // 0x810: -------- -------- -------- -------- pextrb     pextrw    pextrd/q  extractps  --------    --------    --------   -------- --------    --------    --------   --------
+  // 0x820: pinsrb   insertps pinsrd/q
+  // 0x840: dpps     dppd     mpsadbw
+  //
+  // Not implemented (decoded as invalid): the SSE4.2 string compares.
+  // Only palignr has an MMX form.
+  //
+  case 0x80c: // blendps
+  case 0x80d: // blendpd
+  case 0x80e: { // pblendw
+    DECODE(gform, rd, x_mode);
+    DECODE(eform, ra, x_mode);
+    DecodedOperand imm;
+    DECODE(iform, imm, b_mode);
+    if (!(prefixes & PFX_DATA)) MakeInvalid();
+    EndOfDecode();
+
+    int rdreg = arch_pseudo_reg_to_arch_reg[rd.reg.reg];
+    int rareg;
+
+    if (ra.type == OPTYPE_MEM) {
+      rareg = REG_temp0;
+      operand_load(REG_temp0, ra, OP_ld, DATATYPE_VEC_128BIT);
+      ra.mem.offset += 8;
+      operand_load(REG_temp1, ra, OP_ld, DATATYPE_VEC_128BIT);
+    } else {
+      rareg = arch_pseudo_reg_to_arch_reg[ra.reg.reg];
+    }
+
+    int sizeshift = (op == 0x80c) ? 2 : (op == 0x80d) ? 3 : 1;
+    int perhalf = (8 >> sizeshift);
+
+    // Each element comes from rd (bytes 0-7) or ra (bytes 8-15) of the same half
+    foreach (h, 2) {
+      W32 ctl = 0;
+      foreach (p, 8) {
+        bool fromra = bit(imm.imm.imm, (h * perhalf) + (p >> sizeshift));
+        ctl |= ((p + (fromra * 8)) << (p*4));
+      }
+      this << TransOp(OP_permb, rdreg+h, rdreg+h, rareg+h, REG_imm, 3, 0, ctl);
+    }
+    break;
+  }
+
+  case 0x80f: { // palignr
+    DECODE(gform, rd, x_mode);
+    DECODE(eform, ra, x_mode);
+    DecodedOperand imm;
+    DECODE(iform, imm, b_mode);
+    EndOfDecode();
+
+    if (!(prefixes & PFX_DATA)) {
+      // MMX form: bytes imm to imm+7 of the 16 byte value mm:src
+      mmx_load(REG_temp2, modrm.reg);
+      mmx_load_operand(REG_temp3, ra);
+      int quads[4] = {REG_temp3, REG_temp2, REG_zero, REG_zero};
+      int shift = min((int)lowbits(imm.imm.imm, 8), 16);
+      int offset = lowbits(shift, 3);
+      W32 ctl = 0;
+      foreach (p, 8) ctl |= ((offset + p) << (p*4));
+      int q = (shift >> 3);
+      this << TransOp(OP_permb, REG_temp4, quads[q], quads[q+1], REG_imm, 3, 0, ctl);
+      mmx_store(modrm.reg, REG_temp4);
+      break;
+    }
+
+    int rdreg = arch_pseudo_reg_to_arch_reg[rd.reg.reg];
+    int rareg;
+
+    if (ra.type == OPTYPE_MEM) {
+      rareg = REG_temp0;
+      operand_load(REG_temp0, ra, OP_ld, DATATYPE_VEC_128BIT);
+      ra.mem.offset += 8;
+      operand_load(REG_temp1, ra, OP_ld, DATATYPE_VEC_128BIT);
+    } else {
+      rareg = arch_pseudo_reg_to_arch_reg[ra.reg.reg];
+    }
+
+    //
+    // The result is bytes imm to imm+15 of the 32 byte value rd:ra,
+    // i.e. of the quadwords {ra.lo, ra.hi, rd.lo, rd.hi, 0, 0}:
+    // each half is a permb of two adjacent quadwords.
+    //
+    int quads[6] = {rareg+0, rareg+1, rdreg+0, rdreg+1, REG_zero, REG_zero};
+    int shift = min((int)lowbits(imm.imm.imm, 8), 32);
+    int offset = lowbits(shift, 3);
+    W32 ctl = 0;
+    foreach (p, 8) ctl |= ((offset + p) << (p*4));
+
+    foreach (h, 2) {
+      int q = min((int)((shift >> 3) + h), 4);
+      this << TransOp(OP_permb, REG_temp2 + h, quads[q], quads[q+1], REG_imm, 3, 0, ctl);
+    }
+    this << TransOp(OP_mov, rdreg+0, REG_zero, REG_temp2, REG_zero, 3);
+    this << TransOp(OP_mov, rdreg+1, REG_zero, REG_temp3, REG_zero, 3);
+    break;
+  }
+
+  case 0x808: // roundps
+  case 0x809: // roundpd
+  case 0x80a: // roundss
+  case 0x80b: { // roundsd
+    DECODE(gform, rd, x_mode);
+    DECODE(eform, ra, x_mode);
+    DecodedOperand imm;
+    DECODE(iform, imm, b_mode);
+    if (!(prefixes & PFX_DATA)) MakeInvalid();
+    EndOfDecode();
+
+    // Same size encoding as the other FP uops: ss, ps, sd, pd
+    static const byte opcode_to_sizetype[4] = {1, 3, 0, 2};
+    int sizetype = opcode_to_sizetype[op - 0x808];
+    bool packed = bit(sizetype, 0);
+    int datatype = sse_float_datatype_to_ptl_datatype[sizetype];
+
+    int rdreg = arch_pseudo_reg_to_arch_reg[rd.reg.reg];
+    int rareg;
+
+    if (ra.type == OPTYPE_MEM) {
+      rareg = REG_temp0;
+      if (op == 0x80a) ra.mem.size = 2;
+      operand_load(REG_temp0, ra, OP_ld, datatype);
+      if (packed) {
+        ra.mem.offset += 8;
+        operand_load(REG_temp1, ra, OP_ld, datatype);
+      }
+    } else {
+      rareg = arch_pseudo_reg_to_arch_reg[ra.reg.reg];
+    }
+
+    // ra is the destination so roundss keeps the high dword of rd
+    foreach (h, (packed) ? 2 : 1) {
+      TransOp roundop(OP_fround, rdreg+h, rdreg+h, rareg+h, REG_zero, sizetype);
+      roundop.cond = lowbits(imm.imm.imm, 3);
+      roundop.datatype = datatype;
+      this << roundop;
+    }
+    break;
+  }
+
+  case 0x840: // dpps
+  case 0x841: // dppd
+  case 0x842: { // mpsadbw
+    DECODE(gform, rd, x_mode);
+    DECODE(eform, ra, x_mode);
+    DecodedOperand imm;
+    DECODE(iform, imm, b_mode);
+    if (!(prefixes & PFX_DATA)) MakeInvalid();
+    EndOfDecode();
+
+    int rdreg = arch_pseudo_reg_to_arch_reg[rd.reg.reg];
+    int rareg;
+
+    if (ra.type == OPTYPE_MEM) {
+      rareg = REG_temp0;
+      operand_load(REG_temp0, ra, OP_ld, DATATYPE_VEC_128BIT);
+      ra.mem.offset += 8;
+      operand_load(REG_temp1, ra, OP_ld, DATATYPE_VEC_128BIT);
+    } else {
+      rareg = arch_pseudo_reg_to_arch_reg[ra.reg.reg];
+    }
+
+    W64 control = lowbits(imm.imm.imm, 8);
+
+    //
+    // Element masks for dpps (one bit per single in each half) and
+    // dppd (one bit per half): unselected elements become +0.0.
+    //
+    static const W64 single_masks[4] = {0, 0x00000000ffffffffULL, 0xffffffff00000000ULL, 0xffffffffffffffffULL};
+
+    if (op == 0x840) {
+      // Sum the products selected by imm[7:4] within each half...
+      foreach (h, 2) {
+        int m = bits(control, 4 + (h*2), 2);
+        if (!m) {
+          this << TransOp(OP_mov, REG_temp2+h, REG_zero, REG_zero, REG_zero, 3);
+          continue;
+        }
+        TransOp mul(OP_fmul, REG_temp2+h, rdreg+h, rareg+h, REG_zero, 1);
+        mul.datatype = DATATYPE_VEC_FLOAT;
+        this << mul;
+        if (m != 3) this << TransOp(OP_and, REG_temp2+h, REG_temp2+h, REG_imm, REG_zero, 3, single_masks[m]);
+        this << TransOp(OP_shr, REG_temp4, REG_temp2+h, REG_imm, REG_zero, 3, 32);
+        TransOp add(OP_fadd, REG_temp2+h, REG_temp2+h, REG_temp4, REG_zero, 0);
+        add.datatype = DATATYPE_FLOAT;
+        this << add;
+      }
+
+      // ...then add the two sums and broadcast to the elements selected by imm[3:0]
+      TransOp add(OP_fadd, REG_temp4, REG_temp2, REG_temp3, REG_zero, 0);
+      add.datatype = DATATYPE_FLOAT;
+      this << add;
+      this << TransOp(OP_and, REG_temp4, REG_temp4, REG_imm, REG_zero, 3, 0xffffffffULL);
+      this << TransOp(OP_shl, REG_temp5, REG_temp4, REG_imm, REG_zero, 3, 32);
+      this << TransOp(OP_or, REG_temp4, REG_temp4, REG_temp5, REG_zero, 3);
+
+      foreach (h, 2) {
+        int m = bits(control, h*2, 2);
+        if (m == 3)
+          this << TransOp(OP_mov, rdreg+h, REG_zero, REG_temp4, REG_zero, 3);
+        else this << TransOp(OP_and, rdreg+h, REG_temp4, REG_imm, REG_zero, 3, single_masks[m]);
+      }
+    } else if (op == 0x841) {
+      foreach (h, 2) {
+        if (bit(control, 4 + h)) {
+          TransOp mul(OP_fmul, REG_temp2+h, rdreg+h, rareg+h, REG_zero, 3);
+          mul.datatype = DATATYPE_VEC_DOUBLE;
+          this << mul;
+        } else {
+          this << TransOp(OP_mov, REG_temp2+h, REG_zero, REG_zero, REG_zero, 3);
+        }
+      }
+
+      TransOp add(OP_fadd, REG_temp4, REG_temp2, REG_temp3, REG_zero, 3);
+      add.datatype = DATATYPE_VEC_DOUBLE;
+      this << add;
+
+      foreach (h, 2) {
+        this << TransOp(OP_mov, rdreg+h, REG_zero, (bit(control, h)) ? REG_temp4 : REG_zero, REG_zero, 3);
+      }
+    } else {
+      //
+      // Result words 0-3 compare the 4 byte windows starting at bytes
+      // 0-3 of rd (or 4-7 if imm[2] is set); words 4-7 start 4 bytes
+      // later. The window bytes straddling both halves come from a
+      // permb of rd bytes 4-11. The source dword is selected by imm[1:0].
+      //
+      int block = lowbits(control, 2);
+      int srcreg = rareg + (block >> 1);
+      if (block & 1) {
+        this << TransOp(OP_shr, REG_temp4, srcreg, REG_imm, REG_zero, 3, 32);
+        srcreg = REG_temp4;
+      }
+
+      W32 ctl = 0;
+      foreach (p, 8) ctl |= ((4 + p) << (p*4));
+      this << TransOp(OP_permb, REG_temp5, rdreg+0, rdreg+1, REG_imm, 3, 0, ctl);
+
+      bool upper = bit(control, 2);
+      this << TransOp(OP_vmpsad, REG_temp2, (upper) ? REG_temp5 : rdreg+0, srcreg, REG_zero, 0);
+      this << TransOp(OP_vmpsad, rdreg+1, (upper) ? rdreg+1 : REG_temp5, srcreg, REG_zero, 0);
+      this << TransOp(OP_mov, rdreg+0, REG_zero, REG_temp2, REG_zero, 3);
+    }
+    break;
+  }
+
+  case 0x814: // pextrb
+  case 0x815: // pextrw
+  case 0x816: // pextrd, pextrq
+  case 0x817: { // extractps
+    DECODE(eform, rd, (op == 0x816) ? v_mode : d_mode);
+    DECODE(gform, ra, x_mode);
+    DecodedOperand imm;
+    DECODE(iform, imm, b_mode);
+    if (!(prefixes & PFX_DATA)) MakeInvalid();
+    EndOfDecode();
+
+    int rareg = arch_pseudo_reg_to_arch_reg[ra.reg.reg];
+    int sizeshift = 
+      (op == 0x814) ? 0 :
+      (op == 0x815) ? 1 :
+      ((op == 0x816) && rex.mode64) ? 3 : 2;
+
+    int index = lowbits(imm.imm.imm, 4 - sizeshift);
+    int which = index >> (3 - sizeshift);
+    int shift = lowbits(index << (3 + sizeshift), 6);
+    int destreg = (rd.type == OPTYPE_MEM) ? REG_temp0 : arch_pseudo_reg_to_arch_reg[rd.reg.reg];
+
+    // Register destinations are zero extended
+    if (sizeshift == 3)
+      this << TransOp(OP_mov, destreg, REG_zero, rareg + which, REG_zero, 3);
+    else this << TransOp(OP_maskb, destreg, REG_zero, rareg + which, REG_imm, 3, 0, MaskControlInfo(0, (8 << sizeshift), shift));
+
+    if (rd.type == OPTYPE_MEM) {
+      rd.mem.size = sizeshift;
+      result_store(REG_temp0, REG_temp1, rd);
+    }
+    break;
+  }
+
+  case 0x820: // pinsrb
+  case 0x821: // insertps
+  case 0x822: { // pinsrd, pinsrq
+    DECODE(gform, rd, x_mode);
+    DECODE(eform, ra, (op == 0x822) ? v_mode : (op == 0x821) ? x_mode : d_mode);
+    DecodedOperand imm;
+    DECODE(iform, imm, b_mode);
+    if (!(prefixes & PFX_DATA)) MakeInvalid();
+    EndOfDecode();
+
+    int rdreg = arch_pseudo_reg_to_arch_reg[rd.reg.reg];
+    int sizeshift = 
+      (op == 0x820) ? 0 :
+      ((op == 0x822) && rex.mode64) ? 3 : 2;
+    int srcreg;
+
+    if (op == 0x821) {
+      //
+      // insertps: imm[7:6] selects the source dword (register form
+      // only), imm[5:4] the destination dword and imm[3:0] the dwords
+      // of the result to clear.
+      //
+      if (ra.type == OPTYPE_MEM) {
+        ra.mem.size = 2;
+        operand_load(REG_temp0, ra, OP_ld, DATATYPE_VEC_FLOAT);
+      } else {
+        int rareg = arch_pseudo_reg_to_arch_reg[ra.reg.reg];
+        int src = bits(imm.imm.imm, 6, 2);
+        this << TransOp(OP_maskb, REG_temp0, REG_zero, rareg + (src >> 1), REG_imm, 3, 0, MaskControlInfo(0, 32, (src & 1) * 32));
+      }
+      srcreg = REG_temp0;
+    } else if (ra.type == OPTYPE_MEM) {
+      ra.mem.size = sizeshift;
+      operand_load(REG_temp0, ra, OP_ld, DATATYPE_VEC_128BIT);
+      srcreg = REG_temp0;
+    } else {
+      srcreg = arch_pseudo_reg_to_arch_reg[ra.reg.reg];
+    }
+
+    int index = (op == 0x821) ? bits(imm.imm.imm, 4, 2) : lowbits(imm.imm.imm, 4 - sizeshift);
+    int which = index >> (3 - sizeshift);
+    int shift = lowbits(index << (3 + sizeshift), 6);
+
+    if (sizeshift == 3)
+      this << TransOp(OP_mov, rdreg + which, REG_zero, srcreg, REG_zero, 3);
+    else this << TransOp(OP_maskb, rdreg + which, rdreg + which, srcreg, REG_imm, 3, 0, MaskControlInfo(lowbits(64 - shift, 6), (8 << sizeshift), lowbits(64 - shift, 6)));
+
+    if (op == 0x821) {
+      foreach (h, 2) {
+        int zmask = bits(imm.imm.imm, h*2, 2);
+        if (!zmask) continue;
+        W64 keep = ((zmask & 1) ? 0 : 0x00000000ffffffffULL) | ((zmask & 2) ? 0 : 0xffffffff00000000ULL);
+        this << TransOp(OP_and, rdreg+h, rdreg+h, REG_imm, REG_zero, 3, keep);
+      }
+    }
+    break;
+  }
+
   default: {
     MakeInvalid();
     break;
@@ -436,7 +436,7 @@ bool TraceDecoder::decode_x87() {
       x87_pop_stack();
     }
 
-    check_warned_about_x87();
+    if (!speculative) check_warned_about_x87();
 
     break;
   }
@@ -842,7 +842,7 @@ bool TraceDecoder::decode_x87() {
         x87_store_stack(REG_fptos, REG_temp0);
       }
 
-      check_warned_about_x87();
+      if (!speculative) check_warned_about_x87();
     }
     break;
   }
@@ -149,6 +149,27 @@ enum {
   DECODE_OUTCOME_GP_FAULT           = 4,
 };
 
+//
+// Predecoder: prefixes and lengths of every instruction starting in a
+// 16-byte fetch window, found from lookup tables without decoding the
+// operands (see TraceDecoder::predecode()). The decoders take the
+// prefixes from here, and the out of order core's -predecode-model
+// uses the length changing prefix bit (an 0x66 or 0x67 prefix that
+// changes the size of the immediate or ModRM operand).
+//
+static const int PREDECODE_WINDOW_SIZE = 16;
+
+struct PredecodedInsn {
+  W32 prefixes;
+  byte rex;
+  byte prefixbytes;
+  byte length;
+  byte lcp;
+};
+
+W32 predecode_prefix_mask(const byte* p, int avail, bool use64);
+int predecode_insn(PredecodedInsn& pd, const byte* insn, int avail, W32 prefixmask, bool use64);
+
 struct TraceDecoder {
   BasicBlock bb;
   TransOp transbuf[MAX_TRANSOPS_PER_USER_INSN];
@@ -185,12 +206,20 @@ struct TraceDecoder {
   Level1PTE ptelo;
   Level1PTE ptehi;
 
+  // Predecoded instructions in the current fetch window, by rip offset within the window
+  PredecodedInsn predecoded[PREDECODE_WINDOW_SIZE];
+  W32 predecoded_starts;
+  int predecode_window_end;
+  bool length_changing_prefix;
+
   // Configuration options
   bool split_basic_block_at_locks_and_fences;
   bool split_invalid_basic_blocks;
   bool no_partial_flag_updates_per_insn;
   bool fast_length_decode_only;
   W64 stop_at_rip;
+  // Running on the background translation thread: no logging, separate stats
+  bool speculative;
 
   TraceDecoder(const RIPVirtPhys& rvp);
   TraceDecoder(Context& ctx, Waddr rip);
@@ -198,6 +227,7 @@ struct TraceDecoder {
 
   void reset();
   void decode_prefixes();
+  const PredecodedInsn& predecode();
   void immediate(int rdreg, int sizeshift, W64s imm, bool issigned = true);
   void abs_code_addr_immediate(int rdreg, int sizeshift, W64 imm);
   int bias_by_segreg(int basereg);
@@ -209,10 +239,14 @@ struct TraceDecoder {
 
   void move_reg_or_mem(const DecodedOperand& rd, const DecodedOperand& ra, int force_rd = REG_zero);
   void signext_reg_or_mem(const DecodedOperand& rd, DecodedOperand& ra, int rasize, bool zeroext = false);
+  void mmx_load(int destreg, int mmreg);
+  void mmx_store(int mmreg, int srcreg);
+  void mmx_load_operand(int destreg, DecodedOperand& ra);
   void microcode_assist(int assistid, Waddr selfrip, Waddr nextrip);
   bool memory_fence_if_locked(bool end_of_x86_insn = 0, int type = MF_TYPE_LFENCE|MF_TYPE_SFENCE);
 
   int fillbuf(Context& ctx, byte* insnbytes_, int insnbytes_bufsize_);
+  int fillbuf_prefetched(byte* insnbytes_, int insnbytes_bufsize_, int valid_byte_count_, const PageFaultErrorCode& pfec_, Waddr faultaddr_, Level1PTE ptelo_, Level1PTE ptehi_);
 #ifdef PTLSIM_HYPERVISOR
   int fillbuf_phys_prechecked(byte* insnbytes_, int insnbytes_bufsize_, Level1PTE ptelo, Level1PTE ptehi);
 #endif
@@ -233,6 +267,7 @@ struct TraceDecoder {
   bool translate();
   void put(const TransOp& transop);
   bool flush();
+  bool fuse_with_prev_insn();
   void split(bool after);
   void split_before() { split(0); }
   void split_after() { split(1); }
@@ -550,6 +585,26 @@ extern BasicBlockCache bbcache;
 
 extern odstream bbcache_dump_file;
 
+//
+// Decode packed SSE instructions into single 128-bit uops (TransOp::vec128)
+// where uopimpl.cpp has a 128-bit implementation. Only the sequential
+// core executes these, so this is only set while it is running.
+//
+extern bool decode_vec128_uops;
+
+//
+// Run the uop optimizer (decode-opt.cpp) on each basic block before it
+// goes into the basic block cache (-optimize-uops, -ooo-optimize-uops)
+//
+extern bool decode_optimize_uops;
+void optimize_basic_block(BasicBlock& bb, bool speculative = false);
+
+//
+// Fuse cmp or test with a following jcc into one br.sub or br.and
+// uop (-fuse-cmp-jcc)
+//
+extern bool decode_fuse_cmp_jcc;
+
 //
 // This part is used when parsing stats.h to build the
 // data store template; these must be in sync with the
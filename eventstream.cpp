@@ -0,0 +1,420 @@
+//
+// PTLsim: Cycle Accurate x86-64 Simulator
+// Binary Event Stream
+//
+// Copyright 2008 Matt T. Yourst <yourst@yourst.com>
+//
+
+#include <globals.h>
+#include <superstl.h>
+#include <eventstream.h>
+
+extern ostream logfile;
+
+EventStreamWriter eventstream;
+
+//
+// LZ77 compressor: literal runs are encoded as a control byte
+// (run length - 1, from 0 to 31) followed by the literals; matches
+// are encoded as a control byte with the length (minus 2) in the top
+// 3 bits and the high bits of the backwards offset in the low 5 bits,
+// an optional extra length byte (if the top 3 bits were all 1), then
+// the low 8 bits of the offset.
+//
+static const int LZ_HASH_BITS = 14;
+static const int LZ_MAX_OFFSET = (1 << 13);
+static const int LZ_MAX_MATCH = 7 + 255 + 2;
+static const int LZ_MAX_LITERALS = 32;
+
+static W32 lz_hashtable[1 << LZ_HASH_BITS];
+
+static inline W32 lz_hash(const byte* p) {
+  W32 v = (p[0] << 16) | (p[1] << 8) | p[2];
+  return lowbits((v * 2654435761U) >> (32 - LZ_HASH_BITS), LZ_HASH_BITS);
+}
+
+int lz_compress(const byte* in, int inlen, byte* out, int outlen) {
+  const byte* ip = in;
+  const byte* inend = in + inlen;
+  byte* op = out;
+  byte* outend = out + outlen;
+
+  setzero(lz_hashtable);
+
+  if unlikely (outlen < 1) return 0;
+  byte* litp = op++;
+  int lit = 0;
+
+  while (ip < inend) {
+    // Worst case for one iteration: match terminating a literal run plus the next run's control byte
+    if unlikely ((op + 5) > outend) return 0;
+
+    if likely ((ip + 3) <= inend) {
+      W32 h = lz_hash(ip);
+      const byte* ref = in + lz_hashtable[h];
+      lz_hashtable[h] = ip - in;
+      W32 off = ip - ref - 1;
+
+      if ((ref < ip) && (off < LZ_MAX_OFFSET) && (ref[0] == ip[0]) && (ref[1] == ip[1]) && (ref[2] == ip[2])) {
+        int maxlen = min((int)(inend - ip), LZ_MAX_MATCH);
+        int len = 3;
+        while ((len < maxlen) && (ref[len] == ip[len])) len++;
+
+        // Terminate the pending literal run (or reclaim its unused control byte)
+        if (lit) *litp = lit - 1; else op--;
+
+        int l = len - 2;
+        if (l < 7) {
+          *op++ = (l << 5) | (off >> 8);
+        } else {
+          *op++ = (7 << 5) | (off >> 8);
+          *op++ = l - 7;
+        }
+        *op++ = off & 0xff;
+
+        ip += len;
+        litp = op++;
+        lit = 0;
+        continue;
+      }
+    }
+
+    *op++ = *ip++;
+    lit++;
+    if unlikely (lit == LZ_MAX_LITERALS) {
+      *litp = lit - 1;
+      litp = op++;
+      lit = 0;
+    }
+  }
+
+  if (lit) *litp = lit - 1; else op--;
+
+  return op - out;
+}
+
+int lz_decompress(const byte* in, int inlen, byte* out, int outlen) {
+  const byte* ip = in;
+  const byte* inend = in + inlen;
+  byte* op = out;
+  byte* outend = out + outlen;
+
+  while (ip < inend) {
+    W32 c = *ip++;
+
+    if (c < LZ_MAX_LITERALS) {
+      int n = c + 1;
+      if unlikely (((op + n) > outend) | ((ip + n) > inend)) return 0;
+      memcpy(op, ip, n);
+      op += n;
+      ip += n;
+    } else {
+      int len = c >> 5;
+      if (len == 7) {
+        if unlikely (ip >= inend) return 0;
+        len += *ip++;
+      }
+      len += 2;
+      if unlikely (ip >= inend) return 0;
+      const byte* ref = op - (((c & 0x1f) << 8) | *ip++) - 1;
+      if unlikely ((ref < out) | ((op + len) > outend)) return 0;
+      // Byte by byte since the source and destination may overlap
+      foreach (i, len) *op++ = *ref++;
+    }
+  }
+
+  return op - out;
+}
+
+static bool write_fully(int fd, const void* p, size_t count) {
+  const byte* b = (const byte*)p;
+  while (count) {
+    ssize_t rc = sys_write(fd, b, count);
+    if unlikely (rc <= 0) return false;
+    b += rc;
+    count -= rc;
+  }
+  return true;
+}
+
+//
+// Compress the block if that makes it smaller, then write it out.
+// This runs in the helper process if there is one, or inline if not.
+//
+static bool compress_and_write_block(int fd, EventStreamBlockHeader block, const byte* data, byte* cbuf, bool compress) {
+  if likely (compress) {
+    int n = lz_compress(data, block.rawsize, cbuf, block.rawsize - 1);
+    if likely (n > 0) {
+      block.storedsize = n;
+      data = cbuf;
+    }
+  }
+
+  if unlikely (!write_fully(fd, &block, sizeof(block))) return false;
+  return write_fully(fd, data, block.storedsize);
+}
+
+#ifndef PTLSIM_HYPERVISOR
+static bool read_fully(int fd, void* p, size_t count) {
+  byte* b = (byte*)p;
+  while (count) {
+    ssize_t rc = sys_read(fd, b, count);
+    if unlikely (rc <= 0) return false;
+    b += rc;
+    count -= rc;
+  }
+  return true;
+}
+
+//
+// The compressor runs in a forked helper process fed through a pipe,
+// so the simulator only pays for a memcpy into the pipe per block.
+// The helper has its own copy of the buffers allocated before the fork.
+//
+static void event_stream_helper(int infd, int outfd, byte* buf, byte* cbuf) {
+  EventStreamBlockHeader block;
+
+  for (;;) {
+    if unlikely (!read_fully(infd, &block, sizeof(block))) break;
+    if unlikely (block.rawsize > EventStreamWriter::BUFSIZE) break;
+    if unlikely (!read_fully(infd, buf, block.rawsize)) break;
+    if unlikely (!compress_and_write_block(outfd, block, buf, cbuf, true)) break;
+  }
+
+  sys_close(infd);
+  sys_close(outfd);
+  sys_exit(0);
+}
+#endif
+
+void EventStreamWriter::start_helper(int outfd) {
+  fd = outfd;
+  helperpid = -1;
+
+#ifndef PTLSIM_HYPERVISOR
+  //
+  // If the helper cannot be started, we just compress inline.
+  // There is no helper under Xen: PTLsim/X has no processes.
+  //
+  int fds[2];
+  if unlikely (sys_pipe(fds) < 0) return;
+
+  pid_t pid = sys_fork();
+
+  if unlikely (pid < 0) {
+    sys_close(fds[0]);
+    sys_close(fds[1]);
+    return;
+  }
+
+  if (!pid) {
+    sys_close(fds[1]);
+    event_stream_helper(fds[0], outfd, buf, cbuf);
+  }
+
+  sys_close(fds[0]);
+  sys_close(outfd);
+  fd = fds[1];
+  helperpid = pid;
+#endif
+}
+
+bool EventStreamWriter::open(const char* filename, bool compress) {
+  close();
+
+  int outfd = sys_open(filename, O_WRONLY | O_CREAT | O_TRUNC | O_LARGEFILE, 0644);
+  if unlikely (outfd < 0) {
+    logfile << "EventStreamWriter: cannot open '", filename, "' for writing", endl;
+    return false;
+  }
+
+  EventStreamHeader header;
+  setzero(header);
+  header.magic = EventStreamHeader::MAGIC;
+  header.version = EventStreamHeader::VERSION;
+  header.flags = (compress) ? EVENT_STREAM_FLAG_COMPRESSED : 0;
+
+  if unlikely (!write_fully(outfd, &header, sizeof(header))) {
+    logfile << "EventStreamWriter: cannot write header to '", filename, "'", endl;
+    sys_close(outfd);
+    return false;
+  }
+
+  this->compress = compress;
+  buf = new byte[BUFSIZE];
+  cbuf = (compress) ? new byte[BUFSIZE] : null;
+  used = 0;
+  type = EVENT_STREAM_BLOCK_INVALID;
+  recordsize = 0;
+  count = 0;
+  records_written = 0;
+  raw_bytes_written = 0;
+
+  if (compress) start_helper(outfd); else fd = outfd;
+
+  return true;
+}
+
+void EventStreamWriter::close() {
+  if (!enabled()) return;
+
+  flush();
+  sys_close(fd);
+  fd = -1;
+
+#ifndef PTLSIM_HYPERVISOR
+  // Wait for the helper to drain the pipe and finish writing the file
+  if (helperpid > 0) {
+    int status;
+    sys_wait4(helperpid, &status, 0, null);
+  }
+#endif
+  helperpid = -1;
+
+  logfile << "EventStreamWriter: wrote ", records_written, " events (", raw_bytes_written, " bytes before compression)", endl;
+
+  delete[] buf;
+  if (cbuf) delete[] cbuf;
+  buf = null;
+  cbuf = null;
+}
+
+void EventStreamWriter::flush() {
+  if unlikely ((!enabled()) | (!used)) return;
+
+  EventStreamBlockHeader block;
+  block.type = type;
+  block.recordsize = recordsize;
+  block.count = count;
+  block.rawsize = used;
+  block.storedsize = used;
+
+  if (helperpid > 0) {
+    // Helper compresses the block
+    write_fully(fd, &block, sizeof(block));
+    write_fully(fd, buf, used);
+  } else {
+    compress_and_write_block(fd, block, buf, cbuf, compress);
+  }
+
+  raw_bytes_written += used;
+  used = 0;
+  count = 0;
+}
+
+void EventStreamWriter::write(int type, const void* records, int n, int recordsize) {
+  if unlikely (!enabled()) return;
+  assert(recordsize <= BUFSIZE);
+
+  if unlikely ((type != this->type) | (recordsize != this->recordsize)) {
+    flush();
+    this->type = type;
+    this->recordsize = recordsize;
+  }
+
+  const byte* p = (const byte*)records;
+
+  while (n) {
+    int space = (BUFSIZE - used) / recordsize;
+    if unlikely (!space) {
+      flush();
+      continue;
+    }
+
+    int k = min(space, n);
+    memcpy(buf + used, p, k * recordsize);
+    used += k * recordsize;
+    count += k;
+    records_written += k;
+    p += k * recordsize;
+    n -= k;
+  }
+}
+
+void EventStreamWriter::add_symbol(W64 value, const char* name) {
+  if unlikely (!enabled()) return;
+
+  int namelen = strlen(name) + 1;
+  int bytes = sizeof(W64) + namelen;
+
+  if unlikely ((type != EVENT_STREAM_BLOCK_SYMBOLS) | ((used + bytes) > BUFSIZE)) {
+    flush();
+    type = EVENT_STREAM_BLOCK_SYMBOLS;
+    recordsize = 0;
+  }
+
+  memcpy(buf + used, &value, sizeof(W64));
+  memcpy(buf + used + sizeof(W64), name, namelen);
+  used += bytes;
+  count++;
+}
+
+bool EventStreamReader::open(const char* filename) {
+  close();
+
+  is.open(filename);
+  if unlikely (!is) {
+    cerr << "EventStreamReader: cannot open '", filename, "'", endl;
+    return false;
+  }
+
+  if unlikely ((is.read(&header, sizeof(header)) != sizeof(header)) || (header.magic != EventStreamHeader::MAGIC)) {
+    cerr << "EventStreamReader: '", filename, "' is not a PTLsim event stream", endl;
+    is.close();
+    return false;
+  }
+
+  if unlikely (header.version != EventStreamHeader::VERSION) {
+    cerr << "EventStreamReader: '", filename, "' has version ", header.version, " (expected ", (int)EventStreamHeader::VERSION, ")", endl;
+    is.close();
+    return false;
+  }
+
+  return true;
+}
+
+void EventStreamReader::close() {
+  if (is) is.close();
+  if (buf) delete[] buf;
+  if (cbuf) delete[] cbuf;
+  buf = null;
+  cbuf = null;
+  bufsize = 0;
+  cbufsize = 0;
+}
+
+const byte* EventStreamReader::next(EventStreamBlockHeader& block) {
+  if unlikely (!is) return null;
+  if unlikely (is.read(&block, sizeof(block)) != sizeof(block)) return null;
+
+  if unlikely (block.storedsize > block.rawsize) {
+    cerr << "EventStreamReader: corrupt block header at offset ", (is.where() - sizeof(block)), endl;
+    return null;
+  }
+
+  if unlikely (block.rawsize > bufsize) {
+    if (buf) delete[] buf;
+    bufsize = block.rawsize;
+    buf = new byte[bufsize];
+  }
+
+  if likely (block.storedsize == block.rawsize) {
+    if unlikely (is.read(buf, block.rawsize) != block.rawsize) return null;
+    return buf;
+  }
+
+  if unlikely (block.storedsize > cbufsize) {
+    if (cbuf) delete[] cbuf;
+    cbufsize = block.storedsize;
+    cbuf = new byte[cbufsize];
+  }
+
+  if unlikely (is.read(cbuf, block.storedsize) != block.storedsize) return null;
+
+  if unlikely (lz_decompress(cbuf, block.storedsize, buf, block.rawsize) != block.rawsize) {
+    cerr << "EventStreamReader: corrupt compressed block at offset ", (is.where() - block.storedsize), endl;
+    return null;
+  }
+
+  return buf;
+}
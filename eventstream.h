@@ -0,0 +1,125 @@
+// -*- c++ -*-
+//
+// PTLsim: Cycle Accurate x86-64 Simulator
+// Binary Event Stream
+//
+// Copyright 2008 Matt T. Yourst <yourst@yourst.com>
+//
+
+#ifndef _EVENTSTREAM_H_
+#define _EVENTSTREAM_H_
+
+#include <globals.h>
+#include <superstl.h>
+
+//
+// Formatting every core event as text when the event log ring buffer
+// is flushed slows down the simulation by one to two orders of magnitude.
+// When an event stream is open, the cores instead append the raw event
+// records to the stream, and the ptlevents tool later decodes, filters
+// and prints them in the same text format used by the event log.
+//
+// File format:
+//
+//   EventStreamHeader
+//   { EventStreamBlockHeader, byte payload[block.storedsize] }*
+//
+// Each block holds fixed size records of a single type. If storedsize
+// is less than rawsize, the payload was compressed with lz_compress().
+// Symbol blocks hold { W64 value; char name[]; } pairs (NUL terminated)
+// used to resolve addresses that differ from run to run (e.g. assists).
+//
+
+struct EventStreamHeader {
+  W64 magic;
+  W32 version;
+  W32 flags;
+
+  static const W64 MAGIC = 0x31307376454c5450ULL; // 'PTLEvs01'
+  static const W32 VERSION = 1;
+};
+
+enum {
+  EVENT_STREAM_FLAG_COMPRESSED = (1 << 0),
+};
+
+enum {
+  EVENT_STREAM_BLOCK_INVALID = 0,
+  EVENT_STREAM_BLOCK_OOOCORE = 1,  // OutOfOrderModel::OutOfOrderCoreEvent records
+  EVENT_STREAM_BLOCK_SEQCORE = 2,  // SequentialCoreEvent records
+  EVENT_STREAM_BLOCK_SYMBOLS = 3,  // string table
+  EVENT_STREAM_BLOCK_COUNT,
+};
+
+struct EventStreamBlockHeader {
+  W16 type;
+  W16 recordsize;
+  W32 count;
+  W32 rawsize;
+  W32 storedsize;
+};
+
+//
+// Simple LZ77 byte oriented compressor (LZF style encoding):
+// fast enough to keep up with the simulator, and usually shrinks
+// event records by 4-8x since most fields repeat from one record
+// to the next. Both return the output size, or 0 if it won't fit.
+//
+int lz_compress(const byte* in, int inlen, byte* out, int outlen);
+int lz_decompress(const byte* in, int inlen, byte* out, int outlen);
+
+struct EventStreamWriter {
+  static const int BUFSIZE = 1024*1024;
+
+  int fd;
+  int helperpid;
+  bool compress;
+
+  byte* buf;
+  byte* cbuf;
+  int used;
+  int type;
+  int recordsize;
+  int count;
+
+  W64 records_written;
+  W64 raw_bytes_written;
+
+  EventStreamWriter() { fd = -1; helperpid = -1; buf = null; cbuf = null; }
+
+  bool open(const char* filename, bool compress = true);
+  void close();
+  bool enabled() const { return (fd >= 0); }
+
+  void write(int type, const void* records, int count, int recordsize);
+  void add_symbol(W64 value, const char* name);
+  void flush();
+
+protected:
+  void start_helper(int outfd);
+};
+
+struct EventStreamReader {
+  idstream is;
+  EventStreamHeader header;
+  byte* buf;
+  byte* cbuf;
+  int bufsize;
+  int cbufsize;
+
+  EventStreamReader() { buf = null; cbuf = null; bufsize = 0; cbufsize = 0; }
+  ~EventStreamReader() { close(); }
+
+  bool open(const char* filename);
+  void close();
+
+  //
+  // Returns the decompressed payload of the next block,
+  // or null at the end of the stream (or if it is corrupt)
+  //
+  const byte* next(EventStreamBlockHeader& block);
+};
+
+extern EventStreamWriter eventstream;
+
+#endif // _EVENTSTREAM_H_
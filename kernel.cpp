@@ -22,6 +22,8 @@
 #include <stats.h>
 #include <kernel.h>
 #include <loader.h>
+#include <checkpoint.h>
+#include <syscalllog.h>
 
 #define __INSIDE_PTLSIM__
 #include <ptlcalls.h>
@@ -43,6 +45,129 @@ static inline W64 do_syscall_64bit(W64 syscallid, W64 arg1, W64 arg2, W64 arg3,
   return rc;
 }
 
+//
+// Host helper threads
+//
+// Helpers are clone()d tasks sharing our address space and file table,
+// each on its own PTLsim-allocated stack. There is no TLS to tell them
+// apart (the guest owns %fs and %gs), so current_thread_id() looks up
+// which helper stack, if any, the stack pointer is in; everything else
+// is the VCPU thread.
+//
+// A helper is not in our thread group: it has no exit signal (so the
+// guest's wait() calls never see it), blocks all signals, and is killed
+// when the thread that started it exits. Only the forking thread exists
+// in the child of a fork(), so helpers check which process owns them.
+//
+struct HelperThread {
+  Waddr stack;
+  Waddr stacksize;
+  int ownerpid;
+  helper_thread_func_t func;
+  void* arg;
+};
+
+HelperThread helper_threads[MAX_HELPER_THREADS];
+int helper_thread_count = 0;
+
+int current_thread_id() {
+  if likely (!helper_thread_count) return current_vcpuid();
+
+  Waddr sp = (Waddr)__builtin_frame_address(0);
+
+  foreach (i, helper_thread_count) {
+    const HelperThread& t = helper_threads[i];
+    if (inrange(sp, t.stack, t.stack + t.stacksize - 1)) return MAX_CONTEXTS + i;
+  }
+
+  return current_vcpuid();
+}
+
+bool helper_thread_running(int id) {
+  return (inrange(id, 0, helper_thread_count-1) && (helper_threads[id].ownerpid == sys_getpid()));
+}
+
+#ifdef __x86_64__
+
+#define HELPER_CLONE_FLAGS (0x100 | 0x200 | 0x400) // CLONE_VM | CLONE_FS | CLONE_FILES, no exit signal
+#define HELPER_PR_SET_PDEATHSIG 1
+#define HELPER_FUTEX_WAIT 0
+#define HELPER_FUTEX_WAKE 1
+
+extern "C" void helper_thread_entry(HelperThread* t) {
+  do_syscall_64bit(__NR_prctl, HELPER_PR_SET_PDEATHSIG, SIGKILL, 0, 0, 0, 0);
+  // Our creator may have exited before we asked to follow it
+  if likely (sys_getppid() == t->ownerpid) t->func(t->arg);
+  for (;;) do_syscall_64bit(__NR_exit, 0, 0, 0, 0, 0, 0);
+}
+
+int start_helper_thread(helper_thread_func_t func, void* arg, Waddr stacksize) {
+  if unlikely (helper_thread_count == MAX_HELPER_THREADS) return -1;
+
+  byte* stack = (byte*)ptl_mm_alloc_private_pages(stacksize);
+  if unlikely (!stack) return -1;
+
+  int id = helper_thread_count;
+  HelperThread& t = helper_threads[id];
+  t.stack = (Waddr)stack;
+  t.stacksize = stacksize;
+  t.ownerpid = sys_getpid();
+  t.func = func;
+  t.arg = arg;
+  // Visible to current_thread_id() before the helper can run
+  helper_thread_count++;
+  barrier();
+
+  // The helper inherits this mask, so no signal can reach it even briefly
+  W64 allsigs = W64(-1);
+  W64 oldsigs;
+  do_syscall_64bit(__NR_rt_sigprocmask, SIG_BLOCK, (W64)&allsigs, (W64)&oldsigs, sizeof(W64), 0, 0);
+
+  W64* sp = (W64*)(stack + stacksize);
+  *--sp = 0; // keeps the stack 16-byte aligned at the call
+  *--sp = (W64)&t;
+
+  W64 rc;
+  asm volatile ("syscall\n"
+                "test %%rax,%%rax\n"
+                "jnz 1f\n"
+                // In the helper, on its new stack:
+                "pop %%rdi\n"
+                "call helper_thread_entry\n"
+                "hlt\n"
+                "1:\n"
+                : "=a" (rc)
+                : "0" ((W64)__NR_clone), "D" ((W64)HELPER_CLONE_FLAGS), "S" (sp), "d" (0)
+                : "r11", "rcx", "memory");
+
+  do_syscall_64bit(__NR_rt_sigprocmask, SIG_SETMASK, (W64)&oldsigs, 0, sizeof(W64), 0, 0);
+
+  if unlikely ((W64s)rc < 0) {
+    helper_thread_count--;
+    ptl_mm_free_private_pages(stack, stacksize);
+    return -1;
+  }
+
+  return id;
+}
+
+void helper_thread_wait(volatile W32& word, W32 value) {
+  do_syscall_64bit(__NR_futex, (W64)&word, HELPER_FUTEX_WAIT, value, 0, 0, 0);
+}
+
+void helper_thread_wake(volatile W32& word) {
+  do_syscall_64bit(__NR_futex, (W64)&word, HELPER_FUTEX_WAKE, 1, 0, 0, 0);
+}
+
+#else
+
+// The 32-bit build has no helper thread support: callers fall back to doing the work inline
+int start_helper_thread(helper_thread_func_t func, void* arg, Waddr stacksize) { return -1; }
+void helper_thread_wait(volatile W32& word, W32 value) { }
+void helper_thread_wake(volatile W32& word) { }
+
+#endif
+
 struct user_desc_32bit {
   W32 entry_number;
   W32 base_addr;
@@ -85,6 +210,11 @@ Waddr get_gs_base() {
   }
 }
 
+void set_fs_gs_base(Waddr fsbase, Waddr gsbase) {
+  assert(sys_arch_prctl(ARCH_SET_FS, (void*)fsbase) == 0);
+  assert(sys_arch_prctl(ARCH_SET_GS, (void*)gsbase) == 0);
+}
+
 #else
 // We need this here because legacy x86 readily runs out of registers:
 static W32 tempsysid;
@@ -116,6 +246,25 @@ Waddr get_gs_base() {
   return (rc) ? 0 : ud.base_addr;
 }
 
+static void set_tls_base(W16 selector, Waddr base) {
+  if (!(selector >> 3)) return;
+
+  user_desc_32bit ud;
+  memset(&ud, 0, sizeof(ud));
+  ud.entry_number = selector >> 3;
+  ud.base_addr = base;
+  ud.limit = 0xfffff;
+  ud.seg_32bit = 1;
+  ud.limit_in_pages = 1;
+  ud.useable = 1;
+  if (!sys_set_thread_area((user_desc*)&ud)) ldt_seg_base_cache[ud.entry_number] = base;
+}
+
+void set_fs_gs_base(Waddr fsbase, Waddr gsbase) {
+  set_tls_base(ctx.seg[SEGID_FS].selector, fsbase);
+  set_tls_base(ctx.seg[SEGID_GS].selector, gsbase);
+}
+
 #endif // !__x86_64__
 
 int Context::write_segreg(unsigned int segid, W16 selector) {
@@ -318,6 +467,8 @@ void AddressSpace::reset() {
   itlbmap  = allocmap();
   transmap = allocmap();
   dirtymap = allocmap();
+
+  ctx.flush_soft_tlb();
 }
 
 void AddressSpace::setattr(void* start, Waddr length, int prot) {
@@ -331,6 +482,8 @@ void AddressSpace::setattr(void* start, Waddr length, int prot) {
       ((prot & PROT_READ) ? 'r' : '-'), ((prot & PROT_WRITE) ? 'w' : '-'), ((prot & PROT_EXEC) ? 'x' : '-'), endl;
   }
 
+  ctx.flush_soft_tlb();
+
   if (prot & PROT_READ)
     allow_read(start, length);
   else disallow_read(start, length);
@@ -456,48 +609,6 @@ void* AddressSpace::setbrk(void* reqbrk) {
 Waddr stack_min_addr;
 Waddr stack_max_addr;
 
-/*
- * Memory map query support
- *
- * The prot field supports the same PROT_READ, PROT_WRITE, PROT_EXEC bits
- * used in the mmap() system call.
- *
- * The flags field may have the following standard mmap()-style bits set:
- *
- * MAP_SHARED       Shared (writes to map update the file)
- * MAP_PRIVATE      Private copy on write
- * MAP_ANONYMOUS    Anonymous (no file) mapping
- * MAP_GROWSDOWN    Stack
- *
- * Additionally, these additional bits may be present:
- *
- * MAP_ZERO         Inheritable shared memory on /dev/zero
- * MAP_HEAP         Heap terminated by brk
- * MAP_VDSO         VDSO (vsyscall) gateway page
- * MAP_KERNEL       special mapping reserved by kernel
- *
- */
-
-#define MAP_STACK   MAP_GROWSDOWN
-#define MAP_ZERO    0x01000000
-#define MAP_HEAP    0x02000000
-#define MAP_VDSO    0x04000000
-
-struct MemoryMapExtent {
-  void* start;
-  unsigned long length;
-  unsigned int prot;
-  unsigned int flags;
-  unsigned long long offset;
-  unsigned long long inode;
-  unsigned short devmajor;
-  unsigned short devminor;
-};
-
-int mqueryall(MemoryMapExtent* startmap, size_t count);
-
-ostream& operator <<(ostream& os, const MemoryMapExtent& map);
-
 int mqueryall(MemoryMapExtent* startmap, size_t count) {
   MemoryMapExtent* map = startmap;
 
@@ -591,7 +702,8 @@ int mqueryall(MemoryMapExtent* startmap, size_t count) {
       (stack ? MAP_STACK : 0) |
       ((pattr && strequal(pattr, "[heap]")) ? MAP_HEAP : 0) |
       ((pfilename && strequal(pfilename, "/zero (deleted)")) ? MAP_ZERO : 0) |
-      (vdso ? MAP_VDSO : 0);
+      (vdso ? MAP_VDSO : 0) |
+      ((pattr && (strequal(pattr, "[vsyscall]") || strequal(pattr, "[vvar]"))) ? MAP_KERNEL : 0);
 
     if (vdso) map->length = PAGE_SIZE;
 
@@ -636,8 +748,6 @@ ostream& operator <<(ostream& os, const MemoryMapExtent& map) {
   return os;
 }
 
-#define MAX_MAPS_PER_PROCESS 65536
-
 void AddressSpace::resync_with_process_maps() {
   bool DEBUG = 1;
 
@@ -994,6 +1104,39 @@ extern "C" void save_context_switch_to_sim() {
 
   asp.resync_with_process_maps();
 
+  static bool checkpoint_saved = false;
+  if unlikely (config.save_checkpoint_filename.set() && (!checkpoint_saved)) {
+    checkpoint_saved = true;
+    if (!save_checkpoint(config.save_checkpoint_filename)) {
+      cerr << "ptlsim: cannot save checkpoint to ", config.save_checkpoint_filename, endl, flush;
+    }
+  }
+
+  PTLsimThunkPagePrivate* thunkpage = (PTLsimThunkPagePrivate*)PTLSIM_THUNK_PAGE;
+  thunkpage->call_code_addr = (Waddr)&thunkpage->call_within_sim_thunk;
+  thunkpage->simulated = 1;
+
+  switch_to_sim();
+}
+
+//
+// Replace the freshly started user process with the one saved in a
+// checkpoint, then go straight into simulation mode
+//
+void switch_to_sim_from_checkpoint(const char* filename) {
+  if (!restore_checkpoint(filename)) {
+    cerr << "ptlsim: cannot restore checkpoint ", filename, " (see log file for details)", endl, flush;
+    logfile.flush();
+    sys_exit(1);
+  }
+
+  logfile << endl, "=== Switching to simulation mode at rip ", (void*)(Waddr)ctx.commitarf[REG_rip], " (from checkpoint) ===", endl, endl, flush;
+
+  // The resync starts the heap at the current break; keep the restored heap base
+  void* brkbase = asp.brkbase;
+  asp.resync_with_process_maps();
+  asp.brkbase = brkbase;
+
   PTLsimThunkPagePrivate* thunkpage = (PTLsimThunkPagePrivate*)PTLSIM_THUNK_PAGE;
   thunkpage->call_code_addr = (Waddr)&thunkpage->call_within_sim_thunk;
   thunkpage->simulated = 1;
@@ -1027,6 +1170,21 @@ void Context::propagate_x86_exception(byte exception, W32 errorcode, Waddr virta
 const char* syscall_names_64bit[] = {
   "read", "write", "open", "close", "stat", "fstat", "lstat", "poll", "lseek", "mmap", "mprotect", "munmap", "brk", "rt_sigaction", "rt_sigprocmask", "rt_sigreturn", "ioctl", "pread64", "pwrite64", "readv", "writev", "access", "pipe", "select", "sched_yield", "mremap", "msync", "mincore", "madvise", "shmget", "shmat", "shmctl", "dup", "dup2", "pause", "nanosleep", "getitimer", "alarm", "setitimer", "getpid", "sendfile", "socket", "connect", "accept", "sendto", "recvfrom", "sendmsg", "recvmsg", "shutdown", "bind", "listen", "getsockname", "getpeername", "socketpair", "setsockopt", "getsockopt", "clone", "fork", "vfork", "execve", "exit", "wait4", "kill", "uname", "semget", "semop", "semctl", "shmdt", "msgget", "msgsnd", "msgrcv", "msgctl", "fcntl", "flock", "fsync", "fdatasync", "truncate", "ftruncate", "getdents", "getcwd", "chdir", "fchdir", "rename", "mkdir", "rmdir", "creat", "link", "unlink", "symlink", "readlink", "chmod", "fchmod", "chown", "fchown", "lchown", "umask", "gettimeofday", "getrlimit", "getrusage", "sysinfo", "times", "ptrace", "getuid", "syslog", "getgid", "setuid", "setgid", "geteuid", "getegid", "setpgid", "getppid", "getpgrp", "setsid", "setreuid", "setregid", "getgroups", "setgroups", "setresuid", "getresuid", "setresgid", "getresgid", "getpgid", "setfsuid", "setfsgid", "getsid", "capget", "capset", "rt_sigpending", "rt_sigtimedwait", "rt_sigqueueinfo", "rt_sigsuspend", "sigaltstack", "utime", "mknod", "uselib", "personality", "ustat", "statfs", "fstatfs", "sysfs", "getpriority", "setpriority", "sched_setparam", "sched_getparam", "sched_setscheduler", "sched_getscheduler", "sched_get_priority_max", "sched_get_priority_min", "sched_rr_get_interval", "mlock", "munlock", "mlockall", "munlockall", "vhangup", "modify_ldt", "pivot_root", "_sysctl", "prctl", "arch_prctl", "adjtimex", "setrlimit", "chroot", "sync", "acct", "settimeofday", "mount", "umount2", "swapon", "swapoff", "reboot", "sethostname", "setdomainname", "iopl", "ioperm", "create_module", "init_module", "delete_module", "get_kernel_syms", "query_module", "quotactl", "nfsservctl", "getpmsg", "putpmsg", "afs_syscall", "tuxcall", "security", "gettid", "readahead", "setxattr", "lsetxattr", "fsetxattr", "getxattr", "lgetxattr", "fgetxattr", "listxattr", "llistxattr", "flistxattr", "removexattr", "lremovexattr", "fremovexattr", "tkill", "time", "futex", "sched_setaffinity", "sched_getaffinity", "set_thread_area", "io_setup", "io_destroy", "io_getevents", "io_submit", "io_cancel", "get_thread_area", "lookup_dcookie", "epoll_create", "epoll_ctl_old", "epoll_wait_old", "remap_file_pages", "getdents64", "set_tid_address", "restart_syscall", "semtimedop", "fadvise64", "timer_create", "timer_settime", "timer_gettime", "timer_getoverrun", "timer_delete", "clock_settime", "clock_gettime", "clock_getres", "clock_nanosleep", "exit_group", "epoll_wait", "epoll_ctl", "tgkill", "utimes", "vserver", "vserver", "mbind", "set_mempolicy", "get_mempolicy", "mq_open", "mq_unlink", "mq_timedsend", "mq_timedreceive", "mq_notify", "mq_getsetattr", "kexec_load", "waitid"};
 
+//
+// Forward a syscall to the host, or satisfy it from the
+// syscall log when replaying (see syscalllog.h)
+//
+static W64 do_logged_syscall_64bit(int syscallid, W64 arg1, W64 arg2, W64 arg3, W64 arg4, W64 arg5, W64 arg6) {
+  W64 args[6] = {arg1, arg2, arg3, arg4, arg5, arg6};
+  bool passthrough = SyscallLog::passthrough(SYSCALL_ABI_64BIT, syscallid, args);
+  if unlikely (syscalllog.replaying() && (!passthrough)) return syscalllog.replay(SYSCALL_ABI_64BIT, syscallid, args);
+
+  W64 rc = do_syscall_64bit(syscallid, arg1, arg2, arg3, arg4, arg5, arg6);
+  if unlikely (syscalllog.replaying()) syscalllog.replay_passthrough(SYSCALL_ABI_64BIT, syscallid, args, rc);
+  if unlikely (syscalllog.recording()) syscalllog.record(SYSCALL_ABI_64BIT, syscallid, args, rc);
+  return rc;
+}
+
 //
 // SYSCALL instruction from x86-64 mode
 //
@@ -1114,7 +1272,7 @@ void handle_syscall_64bit() {
     break;
   }
   default:
-    ctx.commitarf[REG_rax] = do_syscall_64bit(syscallid, arg1, arg2, arg3, arg4, arg5, arg6);
+    ctx.commitarf[REG_rax] = do_logged_syscall_64bit(syscallid, arg1, arg2, arg3, arg4, arg5, arg6);
     break;
   }
   //ctx.commitarf[REG_rax] = -EINVAL;
@@ -1136,6 +1294,17 @@ struct old_mmap32_arg_struct {
 
 const char* syscall_names_32bit[] = {"restart_syscall", "exit", "fork", "read", "write", "open", "close", "waitpid", "creat", "link", "unlink", "execve", "chdir", "time", "mknod", "chmod", "lchown", "break", "oldstat", "lseek", "getpid", "mount", "umount", "setuid", "getuid", "stime", "ptrace", "alarm", "oldfstat", "pause", "utime", "stty", "gtty", "access", "nice", "ftime", "sync", "kill", "rename", "mkdir", "rmdir", "dup", "pipe", "times", "prof", "brk", "setgid", "getgid", "signal", "geteuid", "getegid", "acct", "umount2", "lock", "ioctl", "fcntl", "mpx", "setpgid", "ulimit", "oldolduname", "umask", "chroot", "ustat", "dup2", "getppid", "getpgrp", "setsid", "sigaction", "sgetmask", "ssetmask", "setreuid", "setregid", "sigsuspend", "sigpending", "sethostname", "setrlimit", "getrlimit", "getrusage", "gettimeofday", "settimeofday", "getgroups", "setgroups", "select", "symlink", "oldlstat", "readlink", "uselib", "swapon", "reboot", "readdir", "mmap", "munmap", "truncate", "ftruncate", "fchmod", "fchown", "getpriority", "setpriority", "profil", "statfs", "fstatfs", "ioperm", "socketcall", "syslog", "setitimer", "getitimer", "stat", "lstat", "fstat", "olduname", "iopl", "vhangup", "idle", "vm86old", "wait4", "swapoff", "sysinfo", "ipc", "fsync", "sigreturn", "clone", "setdomainname", "uname", "modify_ldt", "adjtimex", "mprotect", "sigprocmask", "create_module", "init_module", "delete_module", "get_kernel_syms", "quotactl", "getpgid", "fchdir", "bdflush", "sysfs", "personality", "afs_syscall", "setfsuid", "setfsgid", "_llseek", "getdents", "_newselect", "flock", "msync", "readv", "writev", "getsid", "fdatasync", "_sysctl", "mlock", "munlock", "mlockall", "munlockall", "sched_setparam", "sched_getparam", "sched_setscheduler", "sched_getscheduler", "sched_yield", "sched_get_priority_max", "sched_get_priority_min", "sched_rr_get_interval", "nanosleep", "mremap", "setresuid", "getresuid", "vm86", "query_module", "poll", "nfsservctl", "setresgid", "getresgid", "prctl", "rt_sigreturn", "rt_sigaction", "rt_sigprocmask", "rt_sigpending", "rt_sigtimedwait", "rt_sigqueueinfo", "rt_sigsuspend", "pread64", "pwrite64", "chown", "getcwd", "capget", "capset", "sigaltstack", "sendfile", "getpmsg", "putpmsg", "vfork", "ugetrlimit", "mmap2", "truncate64", "ftruncate64", "stat64", "lstat64", "fstat64", "lchown32", "getuid32", "getgid32", "geteuid32", "getegid32", "setreuid32", "setregid32", "getgroups32", "setgroups32", "fchown32", "setresuid32", "getresuid32", "setresgid32", "getresgid32", "chown32", "setuid32", "setgid32", "setfsuid32", "setfsgid32", "pivot_root", "mincore", "madvise", "madvise1", "getdents64", "fcntl64", "<unused>", "<unused>", "gettid", "readahead", "setxattr", "lsetxattr", "fsetxattr", "getxattr", "lgetxattr", "fgetxattr", "listxattr", "llistxattr", "flistxattr", "removexattr", "lremovexattr", "fremovexattr", "tkill", "sendfile64", "futex", "sched_setaffinity", "sched_getaffinity", "set_thread_area", "get_thread_area", "io_setup", "io_destroy", "io_getevents", "io_submit", "io_cancel", "fadvise64", "<unused>", "exit_group", "lookup_dcookie", "epoll_create", "epoll_ctl", "epoll_wait", "remap_file_pages", "set_tid_address", "timer_create", "statfs64", "fstatfs64", "tgkill", "utimes", "fadvise64_64", "vserver", "mbind", "get_mempolicy", "set_mempolicy", "mq_open", "sys_kexec_load", "waitid"};
 
+static W32 do_logged_syscall_32bit(int syscallid, W32 arg1, W32 arg2, W32 arg3, W32 arg4, W32 arg5, W32 arg6) {
+  W64 args[6] = {arg1, arg2, arg3, arg4, arg5, arg6};
+  bool passthrough = SyscallLog::passthrough(SYSCALL_ABI_32BIT, syscallid, args);
+  if unlikely (syscalllog.replaying() && (!passthrough)) return syscalllog.replay(SYSCALL_ABI_32BIT, syscallid, args);
+
+  W32 rc = do_syscall_32bit(syscallid, arg1, arg2, arg3, arg4, arg5, arg6);
+  if unlikely (syscalllog.replaying()) syscalllog.replay_passthrough(SYSCALL_ABI_32BIT, syscallid, args, rc);
+  if unlikely (syscalllog.recording()) syscalllog.record(SYSCALL_ABI_32BIT, syscallid, args, rc);
+  return rc;
+}
+
 W32 sysenter_retaddr = 0;
 
 W32 get_sysenter_retaddr(W32 end_of_sysenter_insn) {
@@ -1323,7 +1492,7 @@ void handle_syscall_32bit(int semantics) {
     break;
   }
   default:
-    ctx.commitarf[REG_rax] = do_syscall_32bit(syscallid, arg1, arg2, arg3, arg4, arg5, arg6);
+    ctx.commitarf[REG_rax] = do_logged_syscall_32bit(syscallid, arg1, arg2, arg3, arg4, arg5, arg6);
     break;
   }
   ctx.commitarf[REG_rip] = retaddr;
@@ -2232,6 +2401,7 @@ void user_process_terminated(int rc) {
   logfile << "user_process_terminated(rc = ", rc, "): initiating shutdown at ", sim_cycle, " cycles, ", total_user_insns_committed, " commits...", endl, flush;
   capture_stats_snapshot("final");
   flush_stats();
+  syscalllog.close();
   logfile << "PTLsim exiting...", endl, flush;
   shutdown_subsystems();
   logfile.close();
@@ -2347,6 +2517,13 @@ int main(int argc, char** argv) {
 
   logfile << "loader: interp_entry ", interp_entry, ", program_entry ", program_entry, endl, flush;
 
+  if (config.syscall_record_filename.set()) syscalllog.open_record(config.syscall_record_filename);
+  if (config.syscall_replay_filename.set()) syscalllog.open_replay(config.syscall_replay_filename);
+
+  capture_ptlsim_fds();
+
+  if (config.restore_checkpoint_filename.set()) switch_to_sim_from_checkpoint(config.restore_checkpoint_filename);
+
   if (!config.trigger_mode) {
     if (config.start_at_rip != INVALIDRIP)
       set_switch_to_sim_breakpoint((void*)(Waddr)config.start_at_rip);
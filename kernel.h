@@ -56,6 +56,7 @@ native_auxv_t* find_auxv_entry(int type);
 void switch_stack_and_jump_32_or_64(void* code, void* stack, bool use64);
 void switch_to_native_restore_context();
 void set_switch_to_sim_breakpoint(void* addr);
+void set_fs_gs_base(Waddr fsbase, Waddr gsbase);
 void enable_ptlsim_call_gate();
 void disable_ptlsim_call_gate();
 
@@ -234,13 +235,73 @@ public:
 
 extern AddressSpace asp;
 
+/*
+ * Memory map query support
+ *
+ * The prot field supports the same PROT_READ, PROT_WRITE, PROT_EXEC bits
+ * used in the mmap() system call.
+ *
+ * The flags field may have the following standard mmap()-style bits set:
+ *
+ * MAP_SHARED       Shared (writes to map update the file)
+ * MAP_PRIVATE      Private copy on write
+ * MAP_ANONYMOUS    Anonymous (no file) mapping
+ * MAP_GROWSDOWN    Stack
+ *
+ * Additionally, these additional bits may be present:
+ *
+ * MAP_ZERO         Inheritable shared memory on /dev/zero
+ * MAP_HEAP         Heap terminated by brk
+ * MAP_VDSO         VDSO (vsyscall) gateway page
+ * MAP_KERNEL       special mapping reserved by kernel
+ *
+ */
+
+#define MAP_STACK   MAP_GROWSDOWN
+#define MAP_ZERO    0x01000000
+#define MAP_HEAP    0x02000000
+#define MAP_VDSO    0x04000000
+#define MAP_KERNEL  0x08000000
+
+struct MemoryMapExtent {
+  void* start;
+  unsigned long length;
+  unsigned int prot;
+  unsigned int flags;
+  unsigned long long offset;
+  unsigned long long inode;
+  unsigned short devmajor;
+  unsigned short devminor;
+};
+
+#define MAX_MAPS_PER_PROCESS 65536
+
+int mqueryall(MemoryMapExtent* startmap, size_t count);
+
+ostream& operator <<(ostream& os, const MemoryMapExtent& map);
+
+extern Waddr stack_min_addr;
+extern Waddr stack_max_addr;
+
 static inline bool smc_istrans(Waddr mfn) { return asp.istrans(mfn); }
 static inline void smc_settrans(Waddr mfn) { asp.settrans(mfn); }
 static inline void smc_cleartrans(Waddr mfn) { asp.cleartrans(mfn); }
 
 static inline bool smc_isdirty(Waddr mfn) { return asp.isdirty(mfn); }
-static inline void smc_setdirty(Waddr mfn) { asp.setdirty(mfn); }
-static inline void smc_cleardirty(Waddr mfn) { asp.cleardirty(mfn); }
+
+// Every committed store lands here, so skip pages we know are already dirty
+static inline void smc_setdirty(Waddr mfn) {
+  W64& tag = ctx.soft_tlb_dirty[lowbits(mfn, log2(Context::SOFT_TLB_SIZE))];
+  if likely (tag == mfn) return;
+  asp.setdirty(mfn);
+  tag = mfn;
+}
+
+static inline void smc_cleardirty(Waddr mfn) {
+  W64& tag = ctx.soft_tlb_dirty[lowbits(mfn, log2(Context::SOFT_TLB_SIZE))];
+  if (tag == mfn) tag = W64(-1);
+  asp.cleardirty(mfn);
+}
 
 // Only one VCPU in userspace PTLsim:
 static inline Context& contextof(int vcpu) { return ctx; }
@@ -249,6 +310,10 @@ static inline Context& contextof(int vcpu) { return ctx; }
 
 #define MAX_CONTEXTS 1
 
+// Host helper threads (see start_helper_thread()) come after the VCPUs:
+#define MAX_HELPER_THREADS 2
+#define MAX_THREADS (MAX_CONTEXTS + MAX_HELPER_THREADS)
+
 // virtual == physical in userspace PTLsim:
 static inline void* phys_to_mapped_virt(Waddr rawphys) {
   return (void*)rawphys;
@@ -354,6 +419,11 @@ inline Waddr Context::check_and_translate(Waddr virtaddr, int sizeshift, bool st
     return virtaddr;
   }
 
+  // Virtual == physical here, so a software TLB hit is all it takes
+  W64 page = virtaddr >> log2(PAGE_SIZE);
+  W64& tag = ((store) ? soft_tlb_write : soft_tlb_read)[lowbits(page, log2(SOFT_TLB_SIZE))];
+  if likely (tag == page) return virtaddr;
+
   AddressSpace::spat_t top = (store) ? asp.writemap : asp.readmap;
 
   if unlikely (!asp.fastcheck(virtaddr, top)) {
@@ -364,6 +434,7 @@ inline Waddr Context::check_and_translate(Waddr virtaddr, int sizeshift, bool st
     return null;
   }
 
+  tag = page;
   return virtaddr;
 }
 
@@ -0,0 +1,101 @@
+//
+// PTLsim: Cycle Accurate x86-64 Simulator
+// Memory Access Traces
+//
+// Copyright 2008 Matt T. Yourst <yourst@yourst.com>
+//
+
+#include <globals.h>
+#include <superstl.h>
+#include <memtrace.h>
+
+const char* memtrace_type_names[MEMTRACE_TYPE_COUNT] = {"load", "store", "fetch"};
+
+MemoryTraceWriter memtrace;
+
+bool MemoryTraceWriter::open(const char* filename) {
+  close();
+
+  os.open(filename);
+  if unlikely (!os) {
+    cerr << "MemoryTraceWriter: cannot open '", filename, "' for writing", endl;
+    return false;
+  }
+
+  MemoryTraceHeader header;
+  setzero(header);
+  header.magic = MemoryTraceHeader::MAGIC;
+  header.version = MemoryTraceHeader::VERSION;
+  os << header;
+
+  pred.reset();
+  records = 0;
+  return true;
+}
+
+void MemoryTraceWriter::close() {
+  if (os) os.close();
+}
+
+bool MemoryTraceReader::open(const char* filename) {
+  if unlikely (!is.open(filename)) {
+    cerr << "MemoryTraceReader: cannot open '", filename, "'", endl;
+    return false;
+  }
+
+  MemoryTraceHeader header;
+  if unlikely ((is.read(&header, sizeof(header)) != sizeof(header)) ||
+               (header.magic != MemoryTraceHeader::MAGIC) || (header.version != MemoryTraceHeader::VERSION)) {
+    cerr << "MemoryTraceReader: '", filename, "' is not a memory trace (or has the wrong version)", endl;
+    is.close();
+    return false;
+  }
+
+  pred.reset();
+  return true;
+}
+
+bool MemoryTraceReader::get(W64& delta) {
+  W64 v = 0;
+  int shift = 0;
+
+  for (;;) {
+    char c;
+    if unlikely (!is.getc(c)) return false;
+    v |= (W64)(c & 0x7f) << shift;
+    if likely (!(c & 0x80)) break;
+    shift += 7;
+    if unlikely (shift >= 64) return false;
+  }
+
+  delta = (v >> 1) ^ (-(W64s)(v & 1));
+  return true;
+}
+
+bool MemoryTraceReader::next(MemoryTraceRecord& rec) {
+  char info;
+  if unlikely (!is.getc(info)) return false;
+
+  rec.type = bits(info, 0, 2);
+  rec.sizeshift = bits(info, 2, 2);
+  if unlikely (rec.type >= MEMTRACE_TYPE_COUNT) return false;
+
+  W64 delta;
+  if unlikely (!get(delta)) return false;
+  pred.lastvirt[rec.type] += delta;
+
+  if (bit(info, 4)) {
+    if unlikely (!get(delta)) return false;
+    pred.physoffset += delta;
+  }
+
+  if (bit(info, 5)) {
+    if unlikely (!get(delta)) return false;
+    pred.rip += delta;
+  }
+
+  rec.virtaddr = pred.lastvirt[rec.type];
+  rec.physaddr = rec.virtaddr + pred.physoffset;
+  rec.rip = pred.rip;
+  return true;
+}
@@ -0,0 +1,146 @@
+// -*- c++ -*-
+//
+// PTLsim: Cycle Accurate x86-64 Simulator
+// Memory Access Traces
+//
+// Copyright 2008 Matt T. Yourst <yourst@yourst.com>
+//
+
+#ifndef _MEMTRACE_H_
+#define _MEMTRACE_H_
+
+#include <globals.h>
+#include <superstl.h>
+
+//
+// Cache design sweeps don't need the out of order core at all: the
+// sequential core can write every load, store and instruction fetch
+// to a memory trace (-memtrace), which the ptlcachesim tool then
+// replays through the cache hierarchy far faster than simulating
+// the program again.
+//
+// File format:
+//
+//   MemoryTraceHeader
+//   { byte info; varint fields[] }*
+//
+// Every field is stored as the zigzag encoded difference from the
+// same field in the previous record of the same type (loads, stores
+// and fetches each walk their own address streams), using 7 bits per
+// byte with the high bit set on all but the last byte. Fields equal
+// to the predicted value are omitted entirely:
+//
+//   info bits 0-1: type (MEMTRACE_LOAD, MEMTRACE_STORE, MEMTRACE_FETCH)
+//   info bits 2-3: log2 of access size in bytes
+//   info bit 4:    set if physaddr - virtaddr differs from the previous record
+//   info bit 5:    set if rip differs from the previous record
+//
+// virtaddr delta is always present; then the physical offset delta
+// (if bit 4), then the rip delta (if bit 5). Traces from userspace
+// PTLsim (where physical == virtual) and from loops touching one page
+// therefore take 2-3 bytes per access.
+//
+
+struct MemoryTraceHeader {
+  W64 magic;
+  W32 version;
+  W32 reserved;
+
+  static const W64 MAGIC = 0x313072744d4c5450ULL; // 'PTLMtr01'
+  static const W32 VERSION = 1;
+};
+
+enum {
+  MEMTRACE_LOAD  = 0,
+  MEMTRACE_STORE = 1,
+  MEMTRACE_FETCH = 2,
+  MEMTRACE_TYPE_COUNT,
+};
+
+extern const char* memtrace_type_names[MEMTRACE_TYPE_COUNT];
+
+struct MemoryTraceRecord {
+  W64 virtaddr;
+  W64 physaddr;
+  W64 rip;
+  byte type;
+  byte sizeshift;
+};
+
+struct MemoryTracePredictor {
+  W64 lastvirt[MEMTRACE_TYPE_COUNT];
+  W64 physoffset;
+  W64 rip;
+
+  void reset() { setzero(*this); }
+  MemoryTracePredictor() { reset(); }
+};
+
+struct MemoryTraceWriter {
+  odstream os;
+  MemoryTracePredictor pred;
+  W64 records;
+
+  MemoryTraceWriter() { records = 0; }
+
+  bool open(const char* filename);
+  void close();
+  bool enabled() const { return os.ok(); }
+
+  void add(int type, W64 rip, W64 virtaddr, W64 physaddr, int sizeshift) {
+    byte buf[1 + 3*10];
+    byte* p = buf + 1;
+    byte info = (type & 3) | ((sizeshift & 3) << 2);
+
+    p = put(p, virtaddr - pred.lastvirt[type]);
+    pred.lastvirt[type] = virtaddr;
+
+    W64 physoffset = physaddr - virtaddr;
+    if unlikely (physoffset != pred.physoffset) {
+      info |= (1 << 4);
+      p = put(p, physoffset - pred.physoffset);
+      pred.physoffset = physoffset;
+    }
+
+    if (rip != pred.rip) {
+      info |= (1 << 5);
+      p = put(p, rip - pred.rip);
+      pred.rip = rip;
+    }
+
+    buf[0] = info;
+    os.write(buf, p - buf);
+    records++;
+  }
+
+protected:
+  static byte* put(byte* p, W64 delta) {
+    W64 v = (delta << 1) ^ (W64)((W64s)delta >> 63);
+    while (v >= 0x80) {
+      *p++ = (v & 0x7f) | 0x80;
+      v >>= 7;
+    }
+    *p++ = v;
+    return p;
+  }
+};
+
+struct MemoryTraceReader {
+  idstream is;
+  MemoryTracePredictor pred;
+
+  bool open(const char* filename);
+  void close() { is.close(); }
+
+  //
+  // Returns false at the end of the trace (or if it is corrupt)
+  //
+  bool next(MemoryTraceRecord& rec);
+
+protected:
+  bool get(W64& delta);
+};
+
+extern MemoryTraceWriter memtrace;
+
+#endif // _MEMTRACE_H_
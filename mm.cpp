@@ -73,7 +73,187 @@ void ptl_mm_flush_logging() {
   mm_event_buffer_tail = mm_event_buffer_head;
 }
 
+//
+// Heap profiler (-mm-profile)
+//
+// Aggregates the slab and general allocator events by caller (the
+// return address passed into ptl_mm_alloc(), or of whoever called new
+// or malloc), so we can see which subsystem is growing. Each caller
+// gets a site with its allocation and free counts, live bytes, peak
+// live bytes and total bytes ever allocated. Live objects are mapped
+// back to their site on free through an open addressed object table.
+//
+// Both tables are fixed size and allocated straight from pages when
+// profiling is enabled, since the profiler runs inside the allocator
+// and must not allocate itself. Objects allocated before profiling
+// started, or once the object table is 3/4 full, aren't tracked and
+// count as untracked allocs and frees; callers beyond the site table
+// all go into the overflow site (caller 0).
+//
+static const int MM_PROFILE_SITES = 4096;
+static const int MM_PROFILE_OBJECTS = 1 << 20;
+static const int MM_PROFILE_REPORT_SITES = 64;
+
+struct HeapProfileSite {
+  Waddr caller;
+  W64 allocs;
+  W64 frees;
+  W64 live_bytes;
+  W64 peak_live_bytes;
+  W64 total_bytes;
+};
+
+struct HeapProfileObject {
+  void* address;
+  W32 site;
+  W32 bytes;
+};
+
+struct HeapProfiler {
+  HeapProfileSite* sites;
+  HeapProfileObject* objects;
+  int sitecount;
+  int objcount;
+  W64 untracked_allocs;
+  W64 untracked_frees;
+  Spinlock lock;
+
+  bool enabled() const { return (sites != null); }
+
+  static W32 hash(Waddr key, int size) {
+    return (W32)((key * 0x9e3779b97f4a7c15ULL) >> 40) & (size-1);
+  }
+
+  int site_for(Waddr caller) {
+    // The last slot is reserved for the overflow site
+    const int slots = MM_PROFILE_SITES-1;
+    W32 i = hash(caller, MM_PROFILE_SITES) % slots;
+    foreach (probe, slots) {
+      HeapProfileSite& site = sites[i];
+      if (site.caller == caller) return i;
+      if (!site.allocs) {
+        site.caller = caller;
+        sitecount++;
+        return i;
+      }
+      i = (i + 1) % slots;
+    }
+    return slots;
+  }
+
+  void alloc(void* p, W32 bytes, void* caller) {
+    lock.acquire();
+    int s = (objcount < (MM_PROFILE_OBJECTS / 4) * 3) ? site_for((Waddr)caller) : -1;
+
+    if likely (s >= 0) {
+      HeapProfileSite& site = sites[s];
+      site.allocs++;
+      site.live_bytes += bytes;
+      site.total_bytes += bytes;
+      site.peak_live_bytes = max(site.peak_live_bytes, site.live_bytes);
+
+      W32 i = hash((Waddr)p, MM_PROFILE_OBJECTS);
+      while (objects[i].address) i = (i + 1) & (MM_PROFILE_OBJECTS-1);
+      objects[i].address = p;
+      objects[i].site = s;
+      objects[i].bytes = bytes;
+      objcount++;
+    } else {
+      untracked_allocs++;
+    }
+    lock.release();
+  }
+
+  void free(void* p) {
+    lock.acquire();
+    W32 i = hash((Waddr)p, MM_PROFILE_OBJECTS);
+    while (objects[i].address && (objects[i].address != p)) i = (i + 1) & (MM_PROFILE_OBJECTS-1);
+
+    if unlikely (!objects[i].address) {
+      untracked_frees++;
+      lock.release();
+      return;
+    }
+
+    HeapProfileSite& site = sites[objects[i].site];
+    site.frees++;
+    site.live_bytes -= min(site.live_bytes, (W64)objects[i].bytes);
+
+    //
+    // Backward shift deletion: move up any later entries in the
+    // probe sequence that could have used the slot we just freed
+    //
+    W32 hole = i;
+    for (;;) {
+      i = (i + 1) & (MM_PROFILE_OBJECTS-1);
+      if (!objects[i].address) break;
+      W32 home = hash((Waddr)objects[i].address, MM_PROFILE_OBJECTS);
+      if (((i - home) & (MM_PROFILE_OBJECTS-1)) < ((i - hole) & (MM_PROFILE_OBJECTS-1))) continue;
+      objects[hole] = objects[i];
+      hole = i;
+    }
+    objects[hole].address = null;
+    objcount--;
+    lock.release();
+  }
+
+  // Copy out the sites with the most live bytes, largest first
+  int top_sites(HeapProfileSite* list, int limit) {
+    int n = 0;
+    lock.acquire();
+    foreach (i, MM_PROFILE_SITES) {
+      const HeapProfileSite& site = sites[i];
+      if (!site.allocs) continue;
+      int j = min(n, limit);
+      while ((j > 0) && (list[j-1].live_bytes < site.live_bytes)) {
+        if (j < limit) list[j] = list[j-1];
+        j--;
+      }
+      if (j < limit) list[j] = site;
+      n = min(n + 1, limit);
+    }
+    lock.release();
+    return n;
+  }
+};
+
+HeapProfiler heapprof;
+
+void ptl_mm_set_profiling(bool enable) {
+  if ((!enable) | heapprof.enabled()) return;
+
+  heapprof.sites = ptl_mm_alloc_and_zero_private_pages_for_objects<HeapProfileSite>(MM_PROFILE_SITES);
+  heapprof.objects = ptl_mm_alloc_and_zero_private_pages_for_objects<HeapProfileObject>(MM_PROFILE_OBJECTS);
+  heapprof.sitecount = 0;
+  heapprof.objcount = 0;
+  heapprof.untracked_allocs = 0;
+  heapprof.untracked_frees = 0;
+}
+
+void ptl_mm_dump_profile(ostream& os) {
+  if likely (!heapprof.enabled()) return;
+
+  HeapProfileSite list[MM_PROFILE_REPORT_SITES];
+  int n = heapprof.top_sites(list, MM_PROFILE_REPORT_SITES);
+
+  os << "Heap profile: ", heapprof.sitecount, " sites, ", heapprof.objcount, " live objects tracked (",
+    heapprof.untracked_allocs, " allocs and ", heapprof.untracked_frees, " frees untracked)", endl;
+  os << "  ", padstring("caller", -18), " ", padstring("live", 14), " ", padstring("peak", 14), " ",
+    padstring("total", 16), " ", padstring("allocs", 12), " ", padstring("frees", 12), endl;
+
+  foreach (i, n) {
+    const HeapProfileSite& site = list[i];
+    os << "  0x", hexstring(site.caller, 64), " ", intstring(site.live_bytes, 14), " ", intstring(site.peak_live_bytes, 14), " ",
+      intstring(site.total_bytes, 16), " ", intstring(site.allocs, 12), " ", intstring(site.frees, 12), endl;
+  }
+}
+
 void ptl_mm_add_event(int event, int pool, void* caller, void* address, W32 bytes, int slab = 0) {
+  if unlikely (heapprof.enabled() && address && ((pool == PTL_MM_POOL_SLAB) | (pool == PTL_MM_POOL_GENERAL))) {
+    if (event == PTL_MM_EVENT_ALLOC) heapprof.alloc(address, bytes, caller);
+    else if (event == PTL_MM_EVENT_FREE) heapprof.free(address);
+  }
+
   if likely (!mm_event_buffer_head) return;
 
   MemoryManagerEvent* e = mm_event_buffer_tail;
@@ -103,6 +283,9 @@ void ptl_mm_add_event(int event, int pool, void* caller, void* address, W32 byte
 //
 bitvec<PTL_PAGE_POOL_SIZE> page_is_slab_bitmap;
 
+void* ptl_mm_alloc_slab_page();
+void ptl_mm_free_slab_page(void* addr);
+
 struct AddressSizeSpan {
   void* address;
   Waddr size;
@@ -856,7 +1039,7 @@ struct SlabAllocator {
     // We need the pages in the low 2 GB of the address space so we can use
     // page_is_slab_bitmap to find out if it's a slab or genalloc page:
     //
-    byte* rawpage = (byte*)ptl_mm_alloc_private_32bit_page();
+    byte* rawpage = (byte*)ptl_mm_alloc_slab_page();
     if unlikely (!rawpage) return null;
 
     PageHeader* page = PageHeader::headerof(rawpage);
@@ -966,7 +1149,7 @@ struct SlabAllocator {
       page_is_slab_bitmap[pfn] = 0;
 
       page->magic = 0;
-      ptl_mm_free_private_page((void*)page->getbase());
+      ptl_mm_free_slab_page((void*)page->getbase());
       page_frees++;
       if likely (current_pages_allocated > 0) current_pages_allocated--;
       n++;
@@ -1128,6 +1311,117 @@ static const int SLAB_ALLOC_SLOT_COUNT = (SLAB_ALLOC_LARGE_OBJ_THRESH / SlabAllo
 
 SlabAllocator slaballoc[SLAB_ALLOC_SLOT_COUNT];
 
+//
+// Locking: the slab allocators and genalloc (the shared depot) are
+// protected by mm_depot_lock, and pagealloc by mm_page_lock, which
+// may be taken while holding mm_depot_lock but never the other way
+// around. The depot lock is recursive since a slab page allocation
+// may run the reclaim handlers, which free memory back into it.
+//
+RecursiveMutex mm_depot_lock;
+Spinlock mm_page_lock;
+
+//
+// Per-thread slab caches
+//
+// Each host thread keeps a small stack of free objects for every slab
+// size class, so most allocations and frees never touch the depot or
+// its lock. When a thread's stack runs empty (or full), BATCH objects move
+// from (or to) the depot at once. The depot's statistics count objects
+// held in thread caches as allocated.
+//
+// Threads are identified by current_thread_id(), as is the owner of
+// the recursive mm_depot_lock, since there is no TLS (the guest owns
+// %fs and %gs): VCPU threads come first, then any host helper threads
+// (which userspace PTLsim tells apart by their stacks).
+//
+// Reclaim handlers run on whichever thread ran out of memory, and
+// most of them (e.g. the basic block cache) are not thread safe, so
+// helper threads should only allocate with ptl_mm_try_alloc().
+//
+struct SlabThreadCache {
+  static const int SIZE = 16;
+  static const int BATCH = 8;
+
+  void* objs[SLAB_ALLOC_SLOT_COUNT][SIZE];
+  byte count[SLAB_ALLOC_SLOT_COUNT];
+
+  W64 hits;
+  W64 refills;
+  W64 returns;
+  W64 flushes;
+
+  void reset() {
+    foreach (i, SLAB_ALLOC_SLOT_COUNT) count[i] = 0;
+    hits = 0;
+    refills = 0;
+    returns = 0;
+    flushes = 0;
+  }
+
+  void* alloc(int slot) {
+    if likely (count[slot]) {
+      hits++;
+      return objs[slot][--count[slot]];
+    }
+
+    refills++;
+
+    //
+    // Keep count[slot] current as we go: allocating a slab page may
+    // run the reclaim handlers, which can free objects into this very
+    // cache or flush it back to the depot (ptl_mm_cleanup).
+    //
+    mm_depot_lock.acquire();
+    while (count[slot] < BATCH) {
+      void* p = slaballoc[slot].alloc();
+      if unlikely (!p) break;
+      objs[slot][count[slot]++] = p;
+    }
+    mm_depot_lock.release();
+
+    return (count[slot]) ? objs[slot][--count[slot]] : null;
+  }
+
+  void free(int slot, void* p) {
+    if unlikely (count[slot] == SIZE) {
+      // Return the least recently freed objects, keeping the hot ones
+      returns++;
+      mm_depot_lock.acquire();
+      foreach (i, BATCH) slaballoc[slot].free(objs[slot][i]);
+      mm_depot_lock.release();
+
+      foreach (i, SIZE - BATCH) objs[slot][i] = objs[slot][i + BATCH];
+      count[slot] -= BATCH;
+    }
+
+    objs[slot][count[slot]++] = p;
+  }
+
+  // Return everything to the depot (the caller holds mm_depot_lock)
+  void flush() {
+    flushes++;
+    foreach (slot, SLAB_ALLOC_SLOT_COUNT) {
+      foreach (i, count[slot]) slaballoc[slot].free(objs[slot][i]);
+      count[slot] = 0;
+    }
+  }
+
+  W64 cached_objs() const {
+    W64 n = 0;
+    foreach (i, SLAB_ALLOC_SLOT_COUNT) n += count[i];
+    return n;
+  }
+};
+
+SlabThreadCache slab_thread_cache[MAX_THREADS];
+
+static inline SlabThreadCache& current_slab_thread_cache() {
+  int threadid = current_thread_id();
+  assert(inrange(threadid, 0, MAX_THREADS-1));
+  return slab_thread_cache[threadid];
+}
+
 W64 ptl_mm_dump_free_bytes(ostream& os) {
   W64 slaballoc_free_bytes = 0;
   foreach (i, SLAB_ALLOC_SLOT_COUNT) {
@@ -1163,6 +1457,8 @@ void ptl_mm_dump(ostream& os) {
     slaballoc[i].print(os);
   }
 
+  ptl_mm_dump_profile(os);
+
   os << "End of memory dump", endl;
   os << flush;
 }
@@ -1175,7 +1471,9 @@ extern ostream logfile;
 // Full-system PTLsim running on the bare hardware:
 //
 void* ptl_mm_try_alloc_private_pages(Waddr bytecount, int prot, Waddr base, void* caller) {
+  mm_page_lock.acquire();
   void* p = pagealloc.alloc(bytecount);
+  mm_page_lock.release();
   ptl_mm_add_event(PTL_MM_EVENT_ALLOC, PTL_MM_POOL_PAGES, caller, p, bytecount);
   return p;
 }
@@ -1210,13 +1508,31 @@ void* ptl_mm_alloc_private_32bit_pages(Waddr bytecount, int prot, Waddr base) {
 void ptl_mm_free_private_pages(void* addr, Waddr bytecount) {
   assert(addr);
   ptl_mm_add_event(PTL_MM_EVENT_FREE, PTL_MM_POOL_PAGES, getcaller(), addr, bytecount);
+  mm_page_lock.acquire();
   pagealloc.free(floorptr(addr, PAGE_SIZE), ceil(bytecount, PAGE_SIZE));
+  mm_page_lock.release();
 }
 
 void ptl_mm_zero_private_pages(void* addr, Waddr bytecount) {
   memset(addr, 0, bytecount);
 }
 
+//
+// PTLsim/X builds its own page tables for the page pool, so the
+// host huge page options don't apply there:
+//
+bool ptl_mm_set_huge_pages(bool enable) {
+  return (!enable);
+}
+
+void* ptl_mm_alloc_slab_page() {
+  return ptl_mm_alloc_private_32bit_page();
+}
+
+void ptl_mm_free_slab_page(void* addr) {
+  ptl_mm_free_private_page(addr);
+}
+
 #else
 
 void* ptl_mm_try_alloc_private_pages(Waddr bytecount, int prot, Waddr base, void* caller) {
@@ -1226,9 +1542,11 @@ void* ptl_mm_try_alloc_private_pages(Waddr bytecount, int prot, Waddr base, void
   void* addr = sys_mmap((void*)base, ceil(bytecount, PAGE_SIZE), prot, flags, 0, 0);
   ptl_mm_add_event(PTL_MM_EVENT_ALLOC, PTL_MM_POOL_PAGES, caller, addr, bytecount);
   if (addr) {
+    mm_page_lock.acquire();
     pagealloc.allocs++;
     pagealloc.current_bytes_allocated += ceil(bytecount, PAGE_SIZE);
     pagealloc.peak_bytes_allocated = max(pagealloc.peak_bytes_allocated, pagealloc.current_bytes_allocated);
+    mm_page_lock.release();
   }
 
   return addr;
@@ -1247,9 +1565,11 @@ void* ptl_mm_alloc_private_32bit_pages(Waddr bytecount, int prot, Waddr base) {
   void* addr = sys_mmap((void*)base, ceil(bytecount, PAGE_SIZE), prot, flags, 0, 0);  
   ptl_mm_add_event(PTL_MM_EVENT_ALLOC, PTL_MM_POOL_PAGES, getcaller(), addr, bytecount);
   if (addr) {
+    mm_page_lock.acquire();
     pagealloc.allocs++;
     pagealloc.current_bytes_allocated += ceil(bytecount, PAGE_SIZE);
     pagealloc.peak_bytes_allocated = max(pagealloc.peak_bytes_allocated, pagealloc.current_bytes_allocated);
+    mm_page_lock.release();
   }
 
   return addr;
@@ -1258,8 +1578,10 @@ void* ptl_mm_alloc_private_32bit_pages(Waddr bytecount, int prot, Waddr base) {
 void ptl_mm_free_private_pages(void* addr, Waddr bytecount) {
   bytecount = ceil(bytecount, PAGE_SIZE);
 
+  mm_page_lock.acquire();
   pagealloc.frees++;
   pagealloc.current_bytes_allocated -= min(pagealloc.current_bytes_allocated, (W64)bytecount);
+  mm_page_lock.release();
   sys_munmap(addr, bytecount);
   ptl_mm_add_event(PTL_MM_EVENT_FREE, PTL_MM_POOL_PAGES, getcaller(), addr, bytecount);
 }
@@ -1268,6 +1590,186 @@ void ptl_mm_zero_private_pages(void* addr, Waddr bytecount) {
   sys_madvise((void*)floor((Waddr)addr, PAGE_SIZE), bytecount, MADV_DONTNEED);
 }
 
+//
+// Huge pages (-huge-pages)
+//
+// The slab and genalloc pools are normally built from 4 KB mappings
+// scattered around the address space, as is everything allocated with
+// new (the out of order cores, their cache hierarchies, basic blocks),
+// so the simulator's working set touches far more host pages than the
+// host DTLB covers. With huge pages enabled:
+//
+// - genalloc grows in 2 MB aligned chunks, which the host kernel is
+//   asked to back with transparent huge pages (MADV_HUGEPAGE);
+//
+// - slab pages are carved out of 2 MB aligned arenas in the low 2 GB
+//   (which page_is_slab_bitmap requires) instead of being mapped one
+//   at a time. Arena pages are never unmapped (that would split the
+//   huge page); freed ones are kept on a list for the next slab page;
+//
+// - the PTLsim image's .bss, home of the statically allocated core
+//   models and the basic block cache, is advised the same way.
+//
+// Explicit hugetlbfs pages aren't used: they must be reserved by the
+// administrator beforehand, and MAP_HUGETLB can't be combined with
+// MAP_32BIT. The huge-pages stats node shows how much of the heap the
+// host actually backs with huge pages.
+//
+static const Waddr HUGE_PAGE_SIZE = 2*1024*1024;
+
+extern "C" byte __bss_start[];
+extern "C" byte _end[];
+
+bool ptl_mm_use_huge_pages = false;
+bitvec<PTL_PAGE_POOL_SIZE> page_is_huge_arena_bitmap;
+
+struct HugeSlabArena {
+  byte* next;
+  byte* end;
+  void* freelist;
+
+  W64 regions;
+  W64 region_bytes;
+  W64 pages;
+  W64 reuses;
+};
+
+HugeSlabArena huge_slab_arena;
+
+static void ptl_mm_advise_huge_pages(void* addr, Waddr bytecount) {
+  Waddr start = ceil((Waddr)addr, HUGE_PAGE_SIZE);
+  Waddr end = floor((Waddr)addr + bytecount, HUGE_PAGE_SIZE);
+  if likely (end > start) sys_madvise((void*)start, end - start, MADV_HUGEPAGE);
+}
+
+//
+// Map a 2 MB aligned region by over-allocating and trimming
+// the unaligned head and tail:
+//
+static void* ptl_mm_map_huge_region(Waddr bytecount, int prot, int flags) {
+  bytecount = ceil(bytecount, HUGE_PAGE_SIZE);
+  byte* raw = (byte*)sys_mmap(null, bytecount + HUGE_PAGE_SIZE, prot, flags, 0, 0);
+  if unlikely (mmap_invalid(raw)) return null;
+
+  byte* addr = (byte*)ceil((Waddr)raw, HUGE_PAGE_SIZE);
+  Waddr head = addr - raw;
+  if (head) sys_munmap(raw, head);
+  if (head < HUGE_PAGE_SIZE) sys_munmap(addr + bytecount, HUGE_PAGE_SIZE - head);
+
+  sys_madvise(addr, bytecount, MADV_HUGEPAGE);
+
+  mm_page_lock.acquire();
+  pagealloc.allocs++;
+  pagealloc.current_bytes_allocated += bytecount;
+  pagealloc.peak_bytes_allocated = max(pagealloc.peak_bytes_allocated, pagealloc.current_bytes_allocated);
+  mm_page_lock.release();
+
+  return addr;
+}
+
+bool ptl_mm_set_huge_pages(bool enable) {
+  if (enable == ptl_mm_use_huge_pages) return true;
+  ptl_mm_use_huge_pages = enable;
+  if (enable) ptl_mm_advise_huge_pages(__bss_start, _end - __bss_start);
+  return true;
+}
+
+void* ptl_mm_alloc_slab_page() {
+  if likely (!ptl_mm_use_huge_pages) return ptl_mm_alloc_private_32bit_page();
+
+  HugeSlabArena& arena = huge_slab_arena;
+  void* p = null;
+
+  mm_page_lock.acquire();
+
+  if (arena.freelist) {
+    p = arena.freelist;
+    arena.freelist = *(void**)p;
+    arena.reuses++;
+  } else {
+    if unlikely (arena.next == arena.end) {
+      mm_page_lock.release();
+#ifdef __x86_64__
+      int flags = MAP_PRIVATE|MAP_ANONYMOUS|MAP_NORESERVE|MAP_32BIT;
+#else
+      int flags = MAP_PRIVATE|MAP_ANONYMOUS|MAP_NORESERVE;
+#endif
+      byte* region = (byte*)ptl_mm_map_huge_region(HUGE_PAGE_SIZE, PROT_READ|PROT_WRITE|PROT_EXEC, flags);
+      // Fall back to a single 4 KB page if we're short on 2 MB holes
+      if unlikely (!region) return ptl_mm_alloc_private_32bit_page();
+      mm_page_lock.acquire();
+
+      // If another thread refilled the arena in the meantime, keep the rest of its region too
+      while (arena.next < arena.end) {
+        *(void**)arena.next = arena.freelist;
+        arena.freelist = arena.next;
+        arena.next += PAGE_SIZE;
+      }
+
+      Waddr pfn = (Waddr(region) - PTL_PAGE_POOL_BASE) >> 12;
+      assert((pfn + (HUGE_PAGE_SIZE >> 12)) <= PTL_PAGE_POOL_SIZE);
+      foreach (i, HUGE_PAGE_SIZE >> 12) page_is_huge_arena_bitmap[pfn + i] = 1;
+
+      arena.next = region;
+      arena.end = region + HUGE_PAGE_SIZE;
+      arena.regions++;
+      arena.region_bytes += HUGE_PAGE_SIZE;
+    }
+
+    p = arena.next;
+    arena.next += PAGE_SIZE;
+  }
+
+  arena.pages++;
+  mm_page_lock.release();
+
+  ptl_mm_add_event(PTL_MM_EVENT_ALLOC, PTL_MM_POOL_PAGES, getcaller(), p, PAGE_SIZE);
+  return p;
+}
+
+void ptl_mm_free_slab_page(void* addr) {
+  Waddr pfn = (Waddr(addr) - PTL_PAGE_POOL_BASE) >> 12;
+
+  if likely ((pfn >= PTL_PAGE_POOL_SIZE) || (!page_is_huge_arena_bitmap[pfn])) {
+    ptl_mm_free_private_page(addr);
+    return;
+  }
+
+  HugeSlabArena& arena = huge_slab_arena;
+  ptl_mm_add_event(PTL_MM_EVENT_FREE, PTL_MM_POOL_PAGES, getcaller(), addr, PAGE_SIZE);
+
+  mm_page_lock.acquire();
+  *(void**)addr = arena.freelist;
+  arena.freelist = addr;
+  arena.pages--;
+  mm_page_lock.release();
+}
+
+//
+// Sum a field like "AnonHugePages:  2048 kB" over our own mappings
+//
+static W64 ptl_mm_host_smaps_bytes(const char* field) {
+  static char buf[4096];
+
+  int fd = sys_open("/proc/self/smaps_rollup", O_RDONLY, 0);
+  if unlikely (fd < 0) return 0;
+  int n = sys_read(fd, buf, sizeof(buf)-1);
+  sys_close(fd);
+  if unlikely (n <= 0) return 0;
+  buf[n] = 0;
+
+  int len = strlen(field);
+  const char* p = buf;
+  while (*p && strncmp(p, field, len)) p++;
+  if unlikely (!*p) return 0;
+  p += len;
+  while (*p == ' ') p++;
+
+  W64 kb = 0;
+  while ((*p >= '0') && (*p <= '9')) kb = (kb * 10) + (*p++ - '0');
+  return kb * 1024;
+}
+
 #endif
 
 void* ptl_mm_alloc_private_page() {
@@ -1305,6 +1807,10 @@ void ptl_mm_init(byte* heap_start, byte* heap_end) {
     slaballoc[i].reset((i+1) * SlabAllocator::GRANULARITY);
   }
 
+  foreach (i, MAX_THREADS) slab_thread_cache[i].reset();
+  mm_depot_lock.reset();
+  mm_page_lock.reset();
+
 #ifdef ENABLE_MM_LOGGING
   mm_event_buffer_head = mm_event_buffer;
   mm_event_buffer_end = mm_event_buffer_head + mm_event_buffer_size;
@@ -1339,11 +1845,12 @@ void* ptl_mm_alloc(size_t bytes, void* caller) {
     bytes = ceil(bytes, SlabAllocator::GRANULARITY);
     int slot = (bytes >> log2(SlabAllocator::GRANULARITY))-1;
     assert(slot < SLAB_ALLOC_SLOT_COUNT);
-    void* p = slaballoc[slot].alloc();
+    SlabThreadCache& cache = current_slab_thread_cache();
+    void* p = cache.alloc(slot);
     if unlikely (!p) {
       ptl_mm_add_event(PTL_MM_EVENT_ALLOC, PTL_MM_POOL_SLAB, caller, null, bytes, slot);
       ptl_mm_reclaim(bytes);
-      p = slaballoc[slot].alloc();
+      p = cache.alloc(slot);
     }
     ptl_mm_add_event(PTL_MM_EVENT_ALLOC, PTL_MM_POOL_SLAB, caller, p, bytes, slot);
     return p;
@@ -1356,7 +1863,10 @@ void* ptl_mm_alloc(size_t bytes, void* caller) {
     //
     bytes = ceil(bytes + 16, 16);
 
+    mm_depot_lock.acquire();
     W64* p = (W64*)genalloc.alloc(bytes);
+    mm_depot_lock.release();
+
     if unlikely (!p) {
       ptl_mm_add_event(PTL_MM_EVENT_ALLOC, PTL_MM_POOL_GENERAL, caller, null, bytes);
 
@@ -1369,7 +1879,17 @@ void* ptl_mm_alloc(size_t bytes, void* caller) {
       // page tables and can put the entire page pool in one 2 GB aligned block.
       //
       int prot = PROT_READ|PROT_WRITE|PROT_EXEC;
-      void* newpool = ptl_mm_try_alloc_private_pages(pagebytes, prot, 0, getcaller());
+      void* newpool = null;
+#ifndef PTLSIM_HYPERVISOR
+      if (ptl_mm_use_huge_pages) {
+        pagebytes = ceil(pagebytes, HUGE_PAGE_SIZE);
+        newpool = ptl_mm_map_huge_region(pagebytes, prot, MAP_ANONYMOUS|MAP_NORESERVE|((inside_ptlsim) ? MAP_SHARED : MAP_PRIVATE));
+        if likely (newpool) ptl_mm_add_event(PTL_MM_EVENT_ALLOC, PTL_MM_POOL_PAGES, caller, newpool, pagebytes);
+        else pagebytes = max((Waddr)ceil(bytes, PAGE_SIZE), (Waddr)GEN_ALLOC_CHUNK_SIZE);
+      }
+      if likely (!newpool)
+#endif
+      newpool = ptl_mm_try_alloc_private_pages(pagebytes, prot, 0, getcaller());
       if unlikely (!newpool) {
         size_t largest_free_extent = pagealloc.largest_free_extent_bytes();
         logfile << "mm: attempted to allocate ", bytes, " bytes: failed allocation of new gen pool chunk (",
@@ -1399,9 +1919,10 @@ void* ptl_mm_alloc(size_t bytes, void* caller) {
         cerr << genalloc, flush;
         assert(false);
       }
+      mm_depot_lock.acquire();
       genalloc.add_to_free_pool(newpool, pagebytes);
-
       p = (W64*)genalloc.alloc(bytes);
+      mm_depot_lock.release();
       assert(p);
     }
 
@@ -1436,7 +1957,7 @@ void* ptl_mm_try_alloc(size_t bytes) {
     bytes = ceil(bytes, SlabAllocator::GRANULARITY);
     int slot = (bytes >> log2(SlabAllocator::GRANULARITY))-1;
     assert(slot < SLAB_ALLOC_SLOT_COUNT);
-    void* p = slaballoc[slot].alloc();
+    void* p = current_slab_thread_cache().alloc(slot);
     ptl_mm_add_event(PTL_MM_EVENT_ALLOC, PTL_MM_POOL_SLAB, getcaller(), p, bytes, slot);
     return p;
   } else {
@@ -1448,7 +1969,10 @@ void* ptl_mm_try_alloc(size_t bytes) {
     //
     bytes = ceil(bytes + 16, 16);
 
+    mm_depot_lock.acquire();
     W64* p = (W64*)genalloc.alloc(bytes);
+    mm_depot_lock.release();
+
     if unlikely (!p) {
       ptl_mm_add_event(PTL_MM_EVENT_ALLOC, PTL_MM_POOL_GENERAL, getcaller(), null, bytes);
       return null;
@@ -1480,11 +2004,12 @@ void* ptl_mm_alloc_aligned(int alignbits) {
   bytes = ceil(bytes, SlabAllocator::GRANULARITY);
   int slot = (bytes >> log2(SlabAllocator::GRANULARITY))-1;
   assert(slot < SLAB_ALLOC_SLOT_COUNT);
-  void* p = slaballoc[slot].alloc();
+  SlabThreadCache& cache = current_slab_thread_cache();
+  void* p = cache.alloc(slot);
   if unlikely (!p) {
     ptl_mm_add_event(PTL_MM_EVENT_ALLOC, PTL_MM_POOL_SLAB, getcaller(), null, bytes, slot);
     ptl_mm_reclaim(bytes);
-    p = slaballoc[slot].alloc();
+    p = cache.alloc(slot);
   }
 
   assert(lowbits(Waddr(p), alignbits) == 0);
@@ -1516,7 +2041,7 @@ void ptl_mm_free(void* p, void* caller) {
     // From slab allocation pool: all objects on a given page are the same size
     //
     ptl_mm_add_event(PTL_MM_EVENT_FREE, PTL_MM_POOL_SLAB, caller, p, sa->objsize, sa - slaballoc);
-    sa->free(p);
+    current_slab_thread_cache().free(sa - slaballoc, p);
   } else {
     //
     // Pointer is in the general allocation pool.
@@ -1528,7 +2053,9 @@ void ptl_mm_free(void* p, void* caller) {
     Waddr bytes = *pp;
 
     ptl_mm_add_event(PTL_MM_EVENT_FREE, PTL_MM_POOL_GENERAL, caller, p, bytes);
+    mm_depot_lock.acquire();
     genalloc.free(pp, bytes);
+    mm_depot_lock.release();
   }
 }
 
@@ -1576,6 +2103,14 @@ bool ptl_mm_register_reclaim_handler(mm_reclaim_handler_t handler) {
 void ptl_mm_cleanup() {
   ptl_mm_add_event(PTL_MM_EVENT_CLEANUP, PTL_MM_POOL_ALL, getcaller(), null, 0);
 
+  mm_depot_lock.acquire();
+
+  //
+  // Only the calling thread's cache can be flushed here: other
+  // threads own theirs, and flush them when they clean up.
+  //
+  current_slab_thread_cache().flush();
+
   foreach (i, SLAB_ALLOC_SLOT_COUNT) {
     slaballoc[i].reclaim();
   }
@@ -1591,6 +2126,8 @@ void ptl_mm_cleanup() {
       ptl_mm_free_private_pages(ass[i].address, ass[i].size);
     }
   }
+
+  mm_depot_lock.release();
 }
 
 //
@@ -1626,7 +2163,61 @@ DataStoreNode& ptl_mm_capture_stats(DataStoreNode& root) {
       slaballoc[i].capture_stats(slab(sizestr));
     }
   }
+  DataStoreNode& cache = root("slab-thread-cache"); {
+    W64 hits = 0, refills = 0, returns = 0, flushes = 0, cached = 0;
+    foreach (i, MAX_THREADS) {
+      const SlabThreadCache& c = slab_thread_cache[i];
+      hits += c.hits;
+      refills += c.refills;
+      returns += c.returns;
+      flushes += c.flushes;
+      cached += c.cached_objs();
+    }
+    cache.add("hits", hits);
+    cache.add("refills", refills);
+    cache.add("returns", returns);
+    cache.add("flushes", flushes);
+    cache.add("cached-objs", cached);
+  }
+  DataStoreNode& huge = root("huge-pages"); {
+    huge.add("enabled", (W64)ptl_mm_use_huge_pages);
+    huge.add("slab-arenas", huge_slab_arena.regions);
+    huge.add("slab-arena-bytes", huge_slab_arena.region_bytes);
+    huge.add("slab-arena-pages", huge_slab_arena.pages);
+    huge.add("slab-arena-reuses", huge_slab_arena.reuses);
+    // What the host kernel actually backs with 2 MB pages right now
+    huge.add("host-anon-huge-bytes", ptl_mm_host_smaps_bytes("AnonHugePages:"));
+    huge.add("host-shmem-huge-bytes", ptl_mm_host_smaps_bytes("ShmemPmdMapped:"));
+  }
 #endif
+
+  if unlikely (heapprof.enabled()) {
+    // Copy the sites out first: adding nodes allocates, which the profiler sees
+    HeapProfileSite list[MM_PROFILE_REPORT_SITES];
+    int n = heapprof.top_sites(list, MM_PROFILE_REPORT_SITES);
+
+    DataStoreNode& prof = root("heap-profile"); {
+      prof.add("sites", (W64)heapprof.sitecount);
+      prof.add("live-objects", (W64)heapprof.objcount);
+      prof.add("untracked-allocs", heapprof.untracked_allocs);
+      prof.add("untracked-frees", heapprof.untracked_frees);
+      DataStoreNode& callers = prof("callers"); {
+        callers.summable = 1;
+        callers.identical_subtrees = 1;
+        foreach (i, n) {
+          const HeapProfileSite& site = list[i];
+          stringbuf callerstr; callerstr << "0x", hexstring(site.caller, 64);
+          DataStoreNode& node = callers(callerstr);
+          node.add("live-bytes", site.live_bytes);
+          node.add("peak-live-bytes", site.peak_live_bytes);
+          node.add("total-bytes", site.total_bytes);
+          node.add("allocs", site.allocs);
+          node.add("frees", site.frees);
+        }
+      }
+    }
+  }
+
   return root;
 }
 
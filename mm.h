@@ -55,6 +55,9 @@ void ptl_mm_dump(ostream& os);
 void ptl_mm_validate();
 void ptl_mm_set_logging(const char* mm_log_filename, int mm_log_buffer_size, bool enable_inline_mm_logging);
 void ptl_mm_set_validate(bool enable_mm_validate);
+bool ptl_mm_set_huge_pages(bool enable);
+void ptl_mm_set_profiling(bool enable);
+void ptl_mm_dump_profile(ostream& os);
 void ptl_mm_flush_logging();
 
 #ifdef __x86_64__
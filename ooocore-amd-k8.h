@@ -78,17 +78,7 @@ namespace OutOfOrderModel {
 
   static const int LOAD_FU_COUNT = 2;
 
-  const char* fu_names[FU_COUNT] = {
-    "alu1",
-    "aluc",
-    "alu2",
-    "lsu1",
-    "alu3",
-    "lsu2",
-    "fadd",
-    "fmul",
-    "fcvt",
-  };
+  extern const char* fu_names[FU_COUNT];
 
   //
   // Opcodes and properties
@@ -278,6 +268,20 @@ namespace OutOfOrderModel {
     {OP_vsad,           4, ANYFPU},
     {OP_vpack_us,       2, ANYFPU},
     {OP_vpack_ss,       2, ANYFPU},
+    {OP_vabs,           1, ANYFPU},
+    {OP_vsign,          1, ANYFPU},
+    {OP_vhadd,          2, ANYFPU},
+    {OP_vhsub,          2, ANYFPU},
+    {OP_vhadd_ss,       2, ANYFPU},
+    {OP_vhsub_ss,       2, ANYFPU},
+    {OP_vmaddubs,       4, ANYFPU},
+    {OP_vmulhrs,        4, ANYFPU},
+    {OP_vshufb,         1, ANYFPU},
+    {OP_vsel,           1, ANYFPU},
+    {OP_vtest,          1, ANYFPU},
+    {OP_vminpos,        2, ANYFPU},
+    {OP_vmpsad,         4, ANYFPU},
+    {OP_fround,         6, ANYFPU},
   };
 
 #undef A
@@ -726,7 +730,7 @@ namespace OutOfOrderModel {
     issueq_tag_t get_tag();
   };
 
-  void decode_tag(issueq_tag_t tag, int& threadid, int& idx) {
+  static inline void decode_tag(issueq_tag_t tag, int& threadid, int& idx) {
     threadid = tag >> MAX_ROB_IDX_BIT;
     int mask = ((1 << (MAX_ROB_IDX_BIT + MAX_THREADS_BIT)) - 1) >> MAX_THREADS_BIT;
     idx = tag & mask;
@@ -1659,6 +1663,18 @@ namespace OutOfOrderModel {
   extern CycleTimer ctcommit;
 
 #ifdef DECLARE_STRUCTURES
+  const char* fu_names[FU_COUNT] = {
+    "alu1",
+    "aluc",
+    "alu2",
+    "lsu1",
+    "alu3",
+    "lsu2",
+    "fadd",
+    "fmul",
+    "fcvt",
+  };
+
   //
   // The following configuration has two integer/store clusters with a single cycle
   // latency between them, but both clusters can access the load pseudo-cluster with
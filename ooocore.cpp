@@ -19,6 +19,7 @@
 #define DECLARE_STRUCTURES
 #include <ooocore.h>
 #include <stats.h>
+#include <eventstream.h>
 
 #ifndef ENABLE_CHECKS
 #undef assert
@@ -101,6 +102,11 @@ void ThreadContext::reset() {
   waiting_for_icache_fill_physaddr = 0;
   fetch_uuid = 0;
   current_icache_block = 0;
+  current_uop_cache_window = 0;
+  uop_cache_hit = 0;
+  uop_cache_miss_delay = 0;
+  lcp_stall_delay = 0;
+  lcp_stall_rip = limits<W64>::max;
   loads_in_flight = 0;
   stores_in_flight = 0;
   prev_interrupts_pending = false;
@@ -114,6 +120,8 @@ void ThreadContext::reset() {
   chk_recovery_rip = 0;
   unaligned_ldst_buf.reset();
   consecutive_commits_inside_spinlock = 0;
+  refill_reason = REFILL_REASON_NONE;
+  rename_stall = RENAME_STALL_NONE;
 
   total_uops_committed = 0;
   total_insns_committed = 0;
@@ -151,6 +159,7 @@ void OutOfOrderCore::reset() {
   round_robin_reg_file_offset = 0;
   caches.reset();
   caches.callback = &cache_callbacks;
+  uopcache.reset();
   setzero(robs_on_fu);
   foreach_issueq(reset(coreid));
   
@@ -629,6 +638,7 @@ void ReorderBufferEntry::reset() {
   no_branches_between_renamings = 0;
 #endif
   issued = 0;
+  branch_mispredicted = 0;
 }
 
 bool ReorderBufferEntry::ready_to_issue() const {
@@ -1101,21 +1111,6 @@ void PhysicalRegister::fill_operand_info(PhysicalRegisterOperandInfo& opinfo) {
   }
 }
 
-ostream& OutOfOrderModel::operator <<(ostream& os, const PhysicalRegisterOperandInfo& opinfo) {
-  os << "[r", opinfo.physreg, " ", short_physreg_state_names[opinfo.state], " ";
-  switch (opinfo.state) {
-  case PHYSREG_WAITING:
-  case PHYSREG_BYPASS:
-  case PHYSREG_WRITTEN:
-    os << "rob ", opinfo.rob, " uuid ", opinfo.uuid; break;
-  case PHYSREG_ARCH:
-  case PHYSREG_PENDINGFREE:
-    os << arch_reg_names[opinfo.archreg]; break;
-  };
-  os << "]";
-  return os;
-}
-
 bool EventLog::init(size_t bufsize) {
   reset();
   size_t bytes = bufsize * sizeof(OutOfOrderCoreEvent);
@@ -1139,6 +1134,25 @@ void EventLog::reset() {
 }
 
 void EventLog::flush(bool only_to_tail) {
+  //
+  // Stream the raw records if possible: formatting them as text is very slow.
+  // The ring itself is left intact so it can still be dumped on errors.
+  //
+  if unlikely (eventstream.enabled()) {
+    OutOfOrderCoreEvent* p = (only_to_tail) ? start : tail;
+    size_t n = (only_to_tail) ? (tail - start) : (end - start);
+    if unlikely ((p + n) > end) {
+      // Wrapped around: p is at the oldest record
+      size_t part = end - p;
+      eventstream.write(EVENT_STREAM_BLOCK_OOOCORE, p, part, sizeof(OutOfOrderCoreEvent));
+      p = start;
+      n -= part;
+    }
+    eventstream.write(EVENT_STREAM_BLOCK_OOOCORE, p, n, sizeof(OutOfOrderCoreEvent));
+    tail = start;
+    return;
+  }
+
   if likely (!logable(6)) return;
   if unlikely (!logfile) return;
   if unlikely (!logfile->ok()) return;
@@ -1179,487 +1193,6 @@ ostream& EventLog::print(ostream& os, bool only_to_tail) {
   return os;
 }
 
-ostream& OutOfOrderCoreEvent::print(ostream& os) const {
-  bool ld = isload(uop.opcode);
-  bool st = isstore(uop.opcode);
-  bool br = isbranch(uop.opcode);
-  W32 exception = LO32(commit.state.reg.rddata);
-  W32 error_code = HI32(commit.state.reg.rddata);
-
-  stringbuf uopname;
-  nameof(uopname, uop);
-
-  os << intstring(uuid, 20), " t", threadid, " ";
-  switch (type) {
-    //
-    // Fetch Events
-    //
-  case EVENT_FETCH_STALLED:
-    os <<  "fetch  frontend stalled"; break;
-  case EVENT_FETCH_ICACHE_WAIT:
-    os <<  "fetch  rip ", rip, ": wait for icache fill"; break;
-  case EVENT_FETCH_FETCHQ_FULL:
-    os <<  "fetch  rip ", rip, ": fetchq full"; break;
-  case EVENT_FETCH_IQ_QUOTA_FULL:
-    os <<  "fetch  rip ", rip, ": issue queue quota full = ", issueq_count, " "; break;
-  case EVENT_FETCH_BOGUS_RIP:
-    os <<  "fetch  rip ", rip, ": bogus RIP or decode failed"; break;
-  case EVENT_FETCH_ICACHE_MISS:
-    os <<  "fetch  rip ", rip, ": wait for icache fill of phys ", (void*)(Waddr)((rip.mfnlo << 12) + lowbits(rip.rip, 12)), " on missbuf ", fetch.missbuf; break;
-  case EVENT_FETCH_SPLIT:
-    os <<  "fetch  rip ", rip, ": split unaligned load or store ", uop; break;
-  case EVENT_FETCH_ASSIST:
-    os <<  "fetch  rip ", rip, ": branch into assist microcode: ", uop; break;
-  case EVENT_FETCH_TRANSLATE:
-    os <<  "xlate  rip ", rip, ": ", fetch.bb_uop_count, " uops"; break;
-  case EVENT_FETCH_OK: {
-    os <<  "fetch  rip ", rip, ": ", uop, 
-      " (uopid ", uop.bbindex;
-    if (uop.som) os << "; SOM";
-    if (uop.eom) os << "; EOM ", uop.bytes, " bytes";
-    os << ")";
-    if (uop.eom && fetch.predrip) os << " -> pred ", (void*)fetch.predrip;
-    if (isload(uop.opcode) | isstore(uop.opcode)) {
-      os << "; unaligned pred slot ", OutOfOrderCore::hash_unaligned_predictor_slot(rip), " -> ", uop.unaligned;
-    }
-    break;
-  }
-    //
-    // Rename Events
-    //
-  case EVENT_RENAME_FETCHQ_EMPTY:
-    os << "rename fetchq empty"; break;
-  case EVENT_RENAME_ROB_FULL:
-    os <<  "rename ROB full"; break;
-  case EVENT_RENAME_PHYSREGS_FULL:
-    os <<  "rename physical register file full"; break;
-  case EVENT_RENAME_LDQ_FULL:
-    os <<  "rename load queue full"; break;
-  case EVENT_RENAME_STQ_FULL:
-    os <<  "rename store queue full"; break;
-  case EVENT_RENAME_MEMQ_FULL:
-    os <<  "rename memory queue full"; break;
-  case EVENT_RENAME_OK: {
-    os <<  "rename rob ", intstring(rob, -3), "(",padstring(uopname,-5),")", " r", intstring(physreg, -3), "@", phys_reg_file_names[rfid];
-    if (ld|st) os << " lsq", lsq;
-    os << " = ";
-    foreach (i, MAX_OPERANDS) os << rename.opinfo[i], ((i < MAX_OPERANDS-1) ? " " : "");
-    os << "; renamed";
-    os << " ", arch_reg_names[uop.rd], " (old r", rename.oldphys, ")";
-    if unlikely (!uop.nouserflags) {
-      if likely (uop.setflags & SETFLAG_ZF) os << " zf (old r", rename.oldzf, ")";
-      if likely (uop.setflags & SETFLAG_CF) os << " cf (old r", rename.oldcf, ")";
-      if likely (uop.setflags & SETFLAG_OF) os << " of (old r", rename.oldof, ")";
-    }
-    break;
-  }
-  case EVENT_FRONTEND:
-    os <<  "front  rob ", intstring(rob, -3), "(",padstring(uopname,-5),")", " frontend stage ", (FRONTEND_STAGES - frontend.cycles_left), " of ", FRONTEND_STAGES;
-    break;
-  case EVENT_CLUSTER_NO_CLUSTER:
-  case EVENT_CLUSTER_OK: {
-    os << ((type == EVENT_CLUSTER_OK) ? "clustr" : "noclus"), " rob ", intstring(rob, -3), "(",padstring(uopname,-5),")", " allowed FUs = ", 
-      bitstring(fuinfo[uop.opcode].fu, FU_COUNT, true), " -> clusters ",
-      bitstring(select_cluster.allowed_clusters, MAX_CLUSTERS, true), " avail";
-    foreach (i, MAX_CLUSTERS) os << " ", select_cluster.iq_avail[i];
-    os << "-> ";
-    if (type == EVENT_CLUSTER_OK) os << "cluster ", clusters[cluster].name; else os << "-> none"; break;
-    break;
-  }
-  case EVENT_DISPATCH_NO_CLUSTER:
-  case EVENT_DISPATCH_OK: {
-    os << ((type == EVENT_DISPATCH_OK) ? "disptc" : "nodisp"),  " rob ", intstring(rob, -3), "(",padstring(uopname,-5),")", " operands ";
-    foreach (i, MAX_OPERANDS) os << dispatch.opinfo[i], ((i < MAX_OPERANDS-1) ? " " : "");
-    if (type == EVENT_DISPATCH_OK) os << " -> cluster ", clusters[cluster].name; else os << " -> none";
-    break;
-  }
-  case EVENT_ISSUE_NO_FU: {
-    os << "issue  rob ", intstring(rob, -3), "(",padstring(uopname,-5),")";
-    os << "no FUs available in cluster ", clusters[cluster].name, ": ",
-      "fu_avail = ", bitstring(issue.fu_avail, FU_COUNT, true), ", ",
-      "op_fu = ", bitstring(fuinfo[uop.opcode].fu, FU_COUNT, true), ", "
-      "fu_cl_mask = ", bitstring(clusters[cluster].fu_mask, FU_COUNT, true);
-    break;
-  }
-  case EVENT_ISSUE_OK: {
-    stringbuf sb;
-    sb << "issue  rob ", intstring(rob, -3), "(",padstring(uopname,-5),")";
-    sb << " on ", padstring(fu_names[fu], -4), " in ", padstring(cluster_names[cluster], -4), ": r", intstring(physreg, -3), "@", phys_reg_file_names[rfid];
-    sb << " "; print_value_and_flags(sb, issue.state.reg.rddata, issue.state.reg.rdflags); sb << " =";
-    sb << " "; print_value_and_flags(sb, issue.operand_data[RA], issue.operand_flags[RA]); sb << ", ";
-    sb << " "; print_value_and_flags(sb, issue.operand_data[RB], issue.operand_flags[RB]); sb << ", ";
-    sb << " "; print_value_and_flags(sb, issue.operand_data[RC], issue.operand_flags[RC]);
-    sb << " (", issue.cycles_left, " cycles left)";
-    if (issue.mispredicted) sb << "; mispredicted (real ", (void*)(Waddr)issue.state.reg.rddata, " vs expected ", (void*)(Waddr)issue.predrip, ")";
-    os << sb;
-    break;
-  }
-  case EVENT_REPLAY: {
-    os << "replay rob ", intstring(rob, -3), "(",padstring(uopname,-5),")", " r", intstring(physreg, -3), "@", phys_reg_file_names[rfid],
-      " on cluster ", clusters[cluster].name, ": waiting on";
-    foreach (i, MAX_OPERANDS) {
-      if (!bit(replay.ready, i)) os << " ", replay.opinfo[i];
-    }
-    break;
-  }
-  case EVENT_STORE_WAIT: {
-    os << "store", (loadstore.load_store_second_phase ? "2" : " "), " rob ", intstring(rob, -3), "(",padstring(uopname,-5),")", " stq ", lsq,
-      " r", intstring(physreg, -3), " on ", padstring(fu_names[fu], -4), " @ ",
-      (void*)(Waddr)loadstore.virtaddr, " (phys ", (void*)(Waddr)(loadstore.sfr.physaddr << 3), "): ";
-    os << "wait on ";
-    if (!loadstore.rcready) os << " rc";
-    if (loadstore.inherit_sfr_used) {
-      os << ((loadstore.rcready) ? "" : " and "), loadstore.inherit_sfr,
-        " (uuid ", loadstore.inherit_sfr_uuid, ", stq ", loadstore.inherit_sfr_lsq,
-        ", rob ", loadstore.inherit_sfr_rob, ", r", loadstore.inherit_sfr_physreg, ")";
-    }
-    break;
-  }
-  case EVENT_STORE_PARALLEL_FORWARDING_MATCH: {
-    os << "store", (loadstore.load_store_second_phase ? "2" : " "), " rob ", intstring(rob, -3), "(",padstring(uopname,-5),")", " stq ", lsq,
-      " r", intstring(physreg, -3), " on ", padstring(fu_names[fu], -4), " @ ",
-      (void*)(Waddr)loadstore.virtaddr, " (phys ", (void*)(Waddr)(loadstore.sfr.physaddr << 3), "): ";
-    os << "ignored parallel forwarding match with ldq ", loadstore.inherit_sfr_lsq,
-      " (uuid ", loadstore.inherit_sfr_uuid, " rob", loadstore.inherit_sfr_rob,
-      " r", loadstore.inherit_sfr_physreg, ")";
-    break;
-  }
-  case EVENT_STORE_ALIASED_LOAD: {
-    os << "store", (loadstore.load_store_second_phase ? "2" : " "), " rob ", intstring(rob, -3), "(",padstring(uopname,-5),")", " stq ", lsq,
-      " r", intstring(physreg, -3), " on ", padstring(fu_names[fu], -4), " @ ",
-      (void*)(Waddr)loadstore.virtaddr, " (phys ", (void*)(Waddr)(loadstore.sfr.physaddr << 3), "): ";
-    os << "aliased with ldbuf ", loadstore.inherit_sfr_lsq, " (uuid ", loadstore.inherit_sfr_uuid,
-      " rob", loadstore.inherit_sfr_rob, " r", loadstore.inherit_sfr_physreg, ");",
-      " (add colliding load rip ", (void*)(Waddr)loadstore.inherit_sfr_rip, "; replay from rip ", rip, ")";
-    break;
-  }
-  case EVENT_STORE_ISSUED: {
-    os << "store", (loadstore.load_store_second_phase ? "2" : " "), " rob ", intstring(rob, -3), "(",padstring(uopname,-5),")", " stq ", lsq,
-      " r", intstring(physreg, -3), " on ", padstring(fu_names[fu], -4), " @ ",
-      (void*)(Waddr)loadstore.virtaddr, " (phys ", (void*)(Waddr)(loadstore.sfr.physaddr << 3), "): ";
-    if (loadstore.inherit_sfr_used) {
-      os << "inherit from ", loadstore.inherit_sfr, " (uuid ", loadstore.inherit_sfr_uuid,
-        ", rob", loadstore.inherit_sfr_rob, ", lsq ", loadstore.inherit_sfr_lsq,
-        ", r", loadstore.inherit_sfr_physreg, ");";
-    }
-    os << " <= ", hexstring(loadstore.data_to_store, 8*(1<<uop.size)), " = ", loadstore.sfr;
-    break;
-  }
-  case EVENT_STORE_LOCK_RELEASED: {
-    os << "lk-rel", " rob ", intstring(rob, -3), "(",padstring(uopname,-5),")", " stq ", lsq,
-      " r", intstring(physreg, -3), " on ", padstring(fu_names[fu], -4), " @ ",
-      (void*)(Waddr)loadstore.virtaddr, " (phys ", (void*)(Waddr)(loadstore.sfr.physaddr << 3), "): ",
-      "lock released (original ld.acq uuid ", loadstore.locking_uuid, " rob ", loadstore.locking_rob, " on vcpu ", loadstore.locking_vcpuid, ")";
-    break;
-  }
-  case EVENT_STORE_LOCK_ANNULLED: {
-    os << "lk-anl", " rob ", intstring(rob, -3), "(",padstring(uopname,-5),")", " stq ", lsq,
-      " r", intstring(physreg, -3), " on ", padstring(fu_names[fu], -4), " @ ",
-      (void*)(Waddr)loadstore.virtaddr, " (phys ", (void*)(Waddr)(loadstore.sfr.physaddr << 3), "): ",
-      "lock annulled (original ld.acq uuid ", loadstore.locking_uuid, " rob ", loadstore.locking_rob, " on vcpu ", loadstore.locking_vcpuid, ")";
-    break;
-  }
-  case EVENT_STORE_LOCK_REPLAY: {
-    os << "store", (loadstore.load_store_second_phase ? "2" : " "), " rob ", intstring(rob, -3), "(",padstring(uopname,-5),")", " stq ", lsq,
-      " r", intstring(physreg, -3), " on ", padstring(fu_names[fu], -4), " @ ",
-      (void*)(Waddr)loadstore.virtaddr, " (phys ", (void*)(Waddr)(loadstore.sfr.physaddr << 3), "): ",
-      "replay because vcpuid ", loadstore.locking_vcpuid, " uop uuid ", loadstore.locking_uuid, " has lock";
-    break;
-  }
-
-  case EVENT_LOAD_WAIT: {
-    os << (loadstore.load_store_second_phase ? "load2 " : "load  "), " rob ", intstring(rob, -3), "(",padstring(uopname,-5),")", " ldq ", lsq,
-      " r", intstring(physreg, -3), " on ", padstring(fu_names[fu], -4), " @ ",
-      (void*)(Waddr)loadstore.virtaddr, " (phys ", (void*)(Waddr)(loadstore.sfr.physaddr << 3), "): ";
-    os << "wait on sfr ", loadstore.inherit_sfr,
-      " (uuid ", loadstore.inherit_sfr_uuid, ", stq ", loadstore.inherit_sfr_lsq,
-      ", rob ", loadstore.inherit_sfr_rob, ", r", loadstore.inherit_sfr_physreg, ")";
-    if (loadstore.predicted_alias) os << "; stalled by predicted aliasing";
-    break;
-  }
-  case EVENT_LOAD_HIT: 
-  case EVENT_LOAD_MISS: {
-    if (type == EVENT_LOAD_HIT)
-      os << (loadstore.load_store_second_phase ? "load2 " : "load  ");
-    else os << (loadstore.load_store_second_phase ? "ldmis2" : "ldmiss");
-
-    os << " rob ", intstring(rob, -3), "(",padstring(uopname,-5),")", " ldq ", lsq,
-      " r", intstring(physreg, -3), " on ", padstring(fu_names[fu], -4), " @ ",
-      (void*)(Waddr)loadstore.virtaddr, " (phys ", (void*)(Waddr)(loadstore.sfr.physaddr << 3), "): ";
-    if (loadstore.inherit_sfr_used) {
-      os << "inherit from ", loadstore.inherit_sfr, " (uuid ", loadstore.inherit_sfr_uuid,
-        ", rob", loadstore.inherit_sfr_rob, ", lsq ", loadstore.inherit_sfr_lsq,
-        ", r", loadstore.inherit_sfr_physreg, "); ";
-    }
-    if (type == EVENT_LOAD_HIT)
-      os << "hit L1: value 0x", hexstring(loadstore.sfr.data, 64);
-    else os << "missed L1 (lfrqslot ", lfrqslot, ") [value would be 0x", hexstring(loadstore.sfr.data, 64), "]";
-    break;
-  }
-  case EVENT_LOAD_BANK_CONFLICT: {
-    os << "ldbank", " rob ", intstring(rob, -3), "(",padstring(uopname,-5),")", " ldq ", lsq,
-      " r", intstring(physreg, -3), " on ", padstring(fu_names[fu], -4), " @ ",
-      (void*)(Waddr)loadstore.virtaddr, " (phys ", (void*)(Waddr)(loadstore.sfr.physaddr << 3), "): ",
-      "L1 bank conflict over bank ", lowbits(loadstore.sfr.physaddr, log2(CacheSubsystem::L1_DCACHE_BANKS));
-    break;
-  }
-  case EVENT_LOAD_TLB_MISS: {
-    os << (loadstore.load_store_second_phase ? "ldtlb2" : "ldtlb ");  
-    os << " rob ", intstring(rob, -3), "(",padstring(uopname,-5),")", " ldq ", lsq,
-      " r", intstring(physreg, -3), " on ", padstring(fu_names[fu], -4), " @ ",
-      (void*)(Waddr)loadstore.virtaddr, " (phys ", (void*)(Waddr)(loadstore.sfr.physaddr << 3), "): ";
-    if (loadstore.inherit_sfr_used) {
-      os << "inherit from ", loadstore.inherit_sfr, " (uuid ", loadstore.inherit_sfr_uuid,
-        ", rob", loadstore.inherit_sfr_rob, ", lsq ", loadstore.inherit_sfr_lsq,
-        ", r", loadstore.inherit_sfr_physreg, "); ";
-    }
-    else os << "DTLB miss", " [value would be 0x", hexstring(loadstore.sfr.data, 64), "]";
-    break;
-  }
-  case EVENT_LOAD_LOCK_REPLAY: {
-    os << (loadstore.load_store_second_phase ? "load2 " : "load  "), " rob ", intstring(rob, -3), "(",padstring(uopname,-5),")", " ldq ", lsq,
-      " r", intstring(physreg, -3), " on ", padstring(fu_names[fu], -4), " @ ",
-      (void*)(Waddr)loadstore.virtaddr, " (phys ", (void*)(Waddr)(loadstore.sfr.physaddr << 3), "): ",
-      "replay because vcpuid ", loadstore.locking_vcpuid, " uop uuid ", loadstore.locking_uuid, " has lock";
-    break;
-  }
-  case EVENT_LOAD_LOCK_OVERFLOW: {
-    os << (loadstore.load_store_second_phase ? "load2 " : "load  "), " rob ", intstring(rob, -3), "(",padstring(uopname,-5),")", " ldq ", lsq,
-      " r", intstring(physreg, -3), " on ", padstring(fu_names[fu], -4), " @ ",
-      (void*)(Waddr)loadstore.virtaddr, " (phys ", (void*)(Waddr)(loadstore.sfr.physaddr << 3), "): ",
-      "replay because locking required but no free interlock buffers", endl;
-    break;
-  }
-  case EVENT_LOAD_LOCK_ACQUIRED: {
-    os << "lk-acq", " rob ", intstring(rob, -3), "(",padstring(uopname,-5),")", " ldq ", lsq,
-      " r", intstring(physreg, -3), " on ", padstring(fu_names[fu], -4), " @ ",
-      (void*)(Waddr)loadstore.virtaddr, " (phys ", (void*)(Waddr)(loadstore.sfr.physaddr << 3), "): ",
-      "lock acquired";
-    break;
-  }
-  case EVENT_LOAD_LFRQ_FULL:
-    os << "load   rob ", intstring(rob, -3), "(",padstring(uopname,-5),")", " ldq ", lsq, " r", intstring(physreg, -3), ": LFRQ or miss buffer full; replaying"; break;
-  case EVENT_LOAD_HIGH_ANNULLED: {
-    os << (loadstore.load_store_second_phase ? "load2 " : "load  "), " rob ", intstring(rob, -3), "(",padstring(uopname,-5),")", " ldq ", lsq,
-      " r", intstring(physreg, -3), " on ", padstring(fu_names[fu], -4), " @ ",
-      (void*)(Waddr)loadstore.virtaddr, " (phys ", (void*)(Waddr)(loadstore.sfr.physaddr << 3), "): ";
-    os << "load was annulled (high unaligned load)";
-    break;
-  }
-  case EVENT_LOAD_WAKEUP:
-    os << "ldwake rob ", intstring(rob, -3), "(",padstring(uopname,-5),")", " ldq ", lsq, " r", intstring(physreg, -3), " wakeup load via lfrq slot ", lfrqslot; break;
-  case EVENT_TLBWALK_HIT: {
-    os << "wlkhit rob ", intstring(rob, -3), "(",padstring(uopname,-5),")", " ldq ", lsq, " r", intstring(physreg, -3), " page table walk (level ",
-      loadstore.tlb_walk_level, "): hit for PTE at phys ", (void*)loadstore.virtaddr; break;
-    break;
-  }
-  case EVENT_TLBWALK_MISS: {
-    os << "wlkmis rob ", intstring(rob, -3), "(",padstring(uopname,-5),")", " ldq ", lsq, " r", intstring(physreg, -3), " page table walk (level ",
-      loadstore.tlb_walk_level, "): miss for PTE at phys ", (void*)loadstore.virtaddr, ": lfrq ", lfrqslot; break;
-    break;
-  }
-  case EVENT_TLBWALK_WAKEUP: {
-    os << "wlkwak rob ", intstring(rob, -3), "(",padstring(uopname,-5),")", " ldq ", lsq, " r", intstring(physreg, -3), " page table walk (level ",
-      loadstore.tlb_walk_level, "): wakeup from cache miss for phys ", (void*)loadstore.virtaddr, ": lfrq ", lfrqslot; break;
-    break;
-  }
-  case EVENT_TLBWALK_NO_LFRQ_MB: {
-    os << "wlknml rob ", intstring(rob, -3), "(",padstring(uopname,-5),")", " ldq ", lsq, " r", intstring(physreg, -3), " page table walk (level ",
-      loadstore.tlb_walk_level, "): no LFRQ or MB for PTE at phys ", (void*)loadstore.virtaddr, ": lfrq ", lfrqslot; break;
-    break;
-  }
-  case EVENT_TLBWALK_COMPLETE: {
-    os << "wlkhit rob ", intstring(rob, -3), "(",padstring(uopname,-5),")", " ldq ", lsq, " r", intstring(physreg, -3), " page table walk (level ",
-      loadstore.tlb_walk_level, "): complete!"; break;
-    break;
-  }
-  case EVENT_LOAD_EXCEPTION: {
-    os << (loadstore.load_store_second_phase ? "load2 " : "load  "), " rob ", intstring(rob, -3), "(",padstring(uopname,-5),")", " stq ", lsq,
-      " r", intstring(physreg, -3), " on ", padstring(fu_names[fu], -4), " @ ",
-      (void*)(Waddr)loadstore.virtaddr, ": exception ", exception_name(exception), ", pfec ", PageFaultErrorCode(error_code);
-    break;
-  }
-  case EVENT_STORE_EXCEPTION: {
-    os << "store", (loadstore.load_store_second_phase ? "2" : " "), " rob ", intstring(rob, -3), "(",padstring(uopname,-5),")", " stq ", lsq,
-      " r", intstring(physreg, -3), " on ", padstring(fu_names[fu], -4), " @ ",
-      (void*)(Waddr)loadstore.virtaddr, ": exception ", exception_name(exception), ", pfec ", PageFaultErrorCode(error_code);
-    break;
-  }
-  case EVENT_ALIGNMENT_FIXUP:
-    os << "algnfx", " rip ", rip, ": set unaligned bit for uop ", uop.bbindex, " (unaligned predictor slot ", OutOfOrderCore::hash_unaligned_predictor_slot(rip), ") and refetch"; break;
-  case EVENT_FENCE_ISSUED:
-    os << "mfence rob ", intstring(rob, -3), "(",padstring(uopname,-5),")", " lsq ", lsq, " r", intstring(physreg, -3), ": memory fence (", uop, ")"; break;
-  case EVENT_ANNUL_NO_FUTURE_UOPS:
-    os << "misspc rob ", intstring(rob, -3), "(",padstring(uopname,-5),")", ": SOM rob ", annul.somidx, ", EOM rob ", annul.eomidx, ": no future uops to annul"; break;
-  case EVENT_ANNUL_MISSPECULATION: {
-    os << "misspc rob ", intstring(rob, -3), "(",padstring(uopname,-5),")", ": SOM rob ", annul.somidx, 
-      ", EOM rob ", annul.eomidx, ": annul from rob ", annul.startidx, " to rob ", annul.endidx;
-    break;
-  }
-  case EVENT_ANNUL_EACH_ROB: {
-    os << "annul  rob ", intstring(rob, -3), "(",padstring(uopname,-5),")", ": annul rip ", rip;
-    os << (uop.som ? " SOM" : "    "); os << (uop.eom ? " EOM" : "    ");
-    os << ": free";
-    os << " r", physreg;
-    if (ld|st) os << " lsq", lsq;
-    if (lfrqslot >= 0) os << " lfrq", lfrqslot;
-    if (annul.annulras) os << " ras";
-    break;
-  }
-  case EVENT_ANNUL_PSEUDOCOMMIT: {
-    os << "pseucm rob ", intstring(rob, -3), "(",padstring(uopname,-5),")", ": r", physreg, " rebuild rrt:";
-    os << " arch ", arch_reg_names[uop.rd];
-    if likely (!uop.nouserflags) {
-      if (uop.setflags & SETFLAG_ZF) os << " zf";
-      if (uop.setflags & SETFLAG_CF) os << " cf";
-      if (uop.setflags & SETFLAG_OF) os << " of";
-    }
-    os << " = r", physreg;
-    break;
-  }
-  case EVENT_ANNUL_FETCHQ_RAS:
-    os << "anlras rip ", rip, ": annul RAS update still in fetchq"; break;
-  case EVENT_ANNUL_FLUSH:
-    os << "flush  rob ", intstring(rob, -3), "(",padstring(uopname,-5),")", " rip ", rip; break;
-  case EVENT_REDISPATCH_DEPENDENTS:
-    os << "redisp rob ", intstring(rob, -3), "(",padstring(uopname,-5),")", " find all dependents"; break;
-  case EVENT_REDISPATCH_DEPENDENTS_DONE:
-    os << "redisp rob ", intstring(rob, -3), "(",padstring(uopname,-5),")", " redispatched ", (redispatch.count - 1), " dependent uops"; break;
-  case EVENT_REDISPATCH_EACH_ROB: {
-    os << "redisp rob ", intstring(rob, -3), "(",padstring(uopname,-5),")", " from state ", redispatch.current_state_list->name, ": dep on ";
-    if (!redispatch.dependent_operands) {
-      os << " [self]";
-    } else {
-      foreach (i, MAX_OPERANDS) {
-        if (bit(redispatch.dependent_operands, i)) os << " ", redispatch.opinfo[i];
-      }
-    }
-
-    os << "; redispatch ";
-    os << " [rob ", rob, "]";
-    os << " [physreg ", physreg, "]";
-    if (ld|st) os << " [lsq ", lsq, "]";
-    if (redispatch.iqslot) os << " [iqslot]";
-    if (lfrqslot >= 0) os << " [lfrqslot ", lfrqslot, "]";
-    if (redispatch.opinfo[RS].physreg != PHYS_REG_NULL) os << " [inheritsfr ", redispatch.opinfo[RS], "]";
-
-    break;
-  }
-  case EVENT_COMPLETE:
-    os << "complt rob ", intstring(rob, -3), "(",padstring(uopname,-5),")", " on ", padstring(fu_names[fu], -4), ": r", intstring(physreg, -3); break;
-  case EVENT_FORWARD: {
-    os << "forwd", forwarding.forward_cycle, " rob ", intstring(rob, -3), "(",padstring(uopname,-5),")", 
-      " (", clusters[cluster].name, ") r", intstring(physreg, -3), 
-      " => ", "uuid ", forwarding.target_uuid, " rob ", forwarding.target_rob,
-      " (", clusters[forwarding.target_cluster].name, ") r", forwarding.target_physreg,
-      " operand ", forwarding.operand;
-    if (forwarding.target_st) os << " => st", forwarding.target_lsq;
-    os << " [still waiting?";
-    foreach (i, MAX_OPERANDS) { if (!bit(forwarding.target_operands_ready, i)) os << " r", (char)('a' + i); }
-    if (forwarding.target_all_operands_ready) os << " READY";
-    os << "]";
-    break;
-  }
-  case EVENT_BROADCAST: {
-    os << "brcst", forwarding.forward_cycle, " rob ", intstring(rob, -3), "(",padstring(uopname,-5),")", 
-      " from cluster ", clusters[cluster].name, " to cluster ", clusters[forwarding.target_cluster].name,
-      " on forwarding cycle ", forwarding.forward_cycle;
-    break;
-  }
-  case EVENT_WRITEBACK: {
-    os << "write  rob ", intstring(rob, -3), "(",padstring(uopname,-5),")", " (cluster ", clusters[cluster].name, ") r", intstring(physreg, -3), "@", phys_reg_file_names[rfid], " = 0x", hexstring(writeback.data, 64), " ", flagstring(writeback.flags);
-    if (writeback.transient) os << " (transient)";
-    os << " (", writeback.consumer_count, " consumers";
-    if (writeback.all_consumers_sourced_from_bypass) os << ", all from bypass";
-    if (writeback.no_branches_between_renamings) os << ", no intervening branches";
-    if (writeback.dest_renamed_before_writeback) os << ", dest renamed before writeback";
-    os << ")";
-    break;
-  }
-  case EVENT_COMMIT_FENCE_COMPLETED:
-    os << "mfcmit rob ", intstring(rob, -3), "(",padstring(uopname,-5),")", " fence committed: wake up waiting memory uops"; break;
-  case EVENT_COMMIT_EXCEPTION_DETECTED:
-    os << "detect rob ", intstring(rob, -3), "(",padstring(uopname,-5),")", " exception ", exception_name(exception), " (", exception, "), error code ", hexstring(error_code, 16), ", origvirt ", (void*)(Waddr)commit.origvirt; break;
-  case EVENT_COMMIT_EXCEPTION_ACKNOWLEDGED:
-    os << "except rob ", intstring(rob, -3), "(",padstring(uopname,-5),")", " exception ", exception_name(exception), " [EOM #", commit.total_user_insns_committed, "]"; break;
-  case EVENT_COMMIT_SKIPBLOCK:
-    os << "skipbk rob ", intstring(rob, -3), "(",padstring(uopname,-5),")", " skip block: advance rip by ", uop.bytes, " to ", (void*)(Waddr)(rip.rip + uop.bytes), " [EOM #", commit.total_user_insns_committed, "]"; break;
-  case EVENT_COMMIT_SMC_DETECTED:
-    os << "smcdet rob ", intstring(rob, -3), "(",padstring(uopname,-5),")", " self-modifying code at rip ", rip, " detected (mfn was dirty); invalidate and retry [EOM #", commit.total_user_insns_committed, "]"; break;
-  case EVENT_COMMIT_MEM_LOCKED:
-    os << "waitlk rob ", intstring(rob, -3), "(",padstring(uopname,-5),")", " wait for lock on physaddr ", (void*)(commit.state.st.physaddr << 3), " to be released"; break;
-  case EVENT_COMMIT_OK: {
-    os << "commit rob ", intstring(rob, -3), "(",padstring(uopname,-5),")";
-    if likely (archdest_can_commit[uop.rd])
-                os << " [rrt ", arch_reg_names[uop.rd], " = r", physreg, " 0x", hexstring(commit.state.reg.rddata, 64), "]";
-
-    if ((!uop.nouserflags) && uop.setflags) {
-      os << " [flags ", ((uop.setflags & SETFLAG_ZF) ? "z" : ""), 
-        ((uop.setflags & SETFLAG_CF) ? "c" : ""), ((uop.setflags & SETFLAG_OF) ? "o" : ""),
-        " -> ", flagstring(commit.state.reg.rdflags), "]";
-    }
-
-    if (uop.eom) os << " [rip = ", (void*)(Waddr)commit.target_rip, "]";
-
-    if unlikely (st && (commit.state.st.bytemask != 0))
-                  os << " [mem ", (void*)(Waddr)(commit.state.st.physaddr << 3), " = ", bytemaskstring((const byte*)&commit.state.st.data, commit.state.st.bytemask, 8), " mask ", bitstring(commit.state.st.bytemask, 8, true), "]";
-
-    if unlikely (commit.pteupdate.a | commit.pteupdate.d | commit.pteupdate.ptwrite) {
-      os << " [pte:";
-      if (commit.pteupdate.a) os << " a";
-      if (commit.pteupdate.d) os << " d";
-      if (commit.pteupdate.ptwrite) os << " w";
-      os << "]";
-    }
-        
-    if unlikely (ld|st) {
-      os << " [lsq ", lsq, "]";
-      os << " [upslot ", OutOfOrderCore::hash_unaligned_predictor_slot(rip), " = ", commit.ld_st_truly_unaligned, "]";
-    }
-        
-    if likely (commit.oldphysreg > 0) {
-      if unlikely (commit.oldphysreg_refcount) {
-        os << " [pending free old r", commit.oldphysreg, " ref by";
-        os << " refcount ", commit.oldphysreg_refcount;
-        os << "]";
-      } else {
-        os << " [free old r", commit.oldphysreg, "]";
-      }
-    }
-
-    os << " [commit r", physreg, "]";
-
-    foreach (i, MAX_OPERANDS) {
-      if unlikely (commit.operand_physregs[i] != PHYS_REG_NULL) os << " [unref r", commit.operand_physregs[i], "]";
-    }
-
-    if unlikely (br) {
-      os << " [brupdate", (commit.taken ? " tk" : " nt"), (commit.predtaken ? " pt" : " np"), ((commit.taken == commit.predtaken) ? " ok" : " MP"), "]";
-    }
-        
-    if (uop.eom) os << " [EOM #", commit.total_user_insns_committed, "]";
-    break;
-  }
-  case EVENT_COMMIT_ASSIST: {
-    os << "assist rob ", intstring(rob, -3), " calling assist ", (void*)rip.rip, " (#",
-      assist_index((assist_func_t)rip.rip), ": ", assist_name((assist_func_t)rip.rip), ")";
-    break;
-  }
-  case EVENT_RECLAIM_PHYSREG:
-    os << "free   r", physreg, " no longer referenced; moving to free state"; break;
-  case EVENT_RELEASE_MEM_LOCK: {
-    os << "unlkcm", " phys ", (void*)(loadstore.sfr.physaddr << 3), ": lock release committed";
-    break;
-  }
-  default:
-    os << "?????? unknown event type ", type;
-    break;
-  }
-
-  os << endl;
-  return os;
-}
-
 OutOfOrderMachine::OutOfOrderMachine(const char* name) {
   // Add to the list of available core types
   addmachine(name, this);
@@ -1806,6 +1339,9 @@ int OutOfOrderMachine::run(PTLsimConfig& config) {
   // Flush everything to remove any remaining refs to basic blocks
   flush_all_pipelines();
 
+  // Push any events still in the ring buffer out to the event stream
+  if unlikely (eventstream.enabled()) core.eventlog.flush(true);
+
   return exiting;
 }
 
@@ -1834,6 +1370,22 @@ void OutOfOrderCore::flush_tlb(Context& ctx, int threadid, bool selective, Waddr
   }
 }
 
+//
+// Self modifying code, or a dirty page being retranslated, discards
+// the basic blocks on page <mfn>, so the uop cache windows holding
+// code from that page must go too.
+//
+void OutOfOrderCore::invalidate_code_page(Waddr mfn) {
+  Waddr base = mfn << 12;
+  for (Waddr window = base; window < (base + PAGE_SIZE); window += UOP_CACHE_WINDOW_SIZE) uopcache.invalidate(window);
+
+  // Make fetch probe again rather than trusting its last lookup
+  foreach (i, threadcount) {
+    ThreadContext* thread = threads[i];
+    if unlikely ((thread->current_uop_cache_window >> 12) == mfn) thread->current_uop_cache_window = 0;
+  }
+}
+
 void OutOfOrderMachine::flush_tlb(Context& ctx) {
   // This assumes all VCPUs are mapped as threads in a single SMT core
   int coreid = 0;
@@ -1848,6 +1400,12 @@ void OutOfOrderMachine::flush_tlb_virt(Context& ctx, Waddr virtaddr) {
   cores[coreid]->flush_tlb(ctx, threadid, true, virtaddr);
 }
 
+void OutOfOrderMachine::invalidate_code_page(Waddr mfn) {
+  foreach (i, MAX_SMT_CORES) {
+    if (cores[i]) cores[i]->invalidate_code_page(mfn);
+  }
+}
+
 void OutOfOrderMachine::dump_state(ostream& os) {
   os << " dump_state include event if -ringbuf enabled: ",endl;
   //  foreach (i, contextcount) {
@@ -78,16 +78,7 @@ namespace OutOfOrderModel {
 
   static const int LOAD_FU_COUNT = 2;
 
-  const char* fu_names[FU_COUNT] = {
-    "ldu0",
-    "stu0",
-    "ldu1",
-    "stu1",
-    "alu0",
-    "fpu0",
-    "alu1",
-    "fpu1",
-  };
+  extern const char* fu_names[FU_COUNT];
 
   //
   // Opcodes and properties
@@ -282,6 +273,20 @@ namespace OutOfOrderModel {
     {OP_vsad,           4, ANYFPU},
     {OP_vpack_us,       2, ANYFPU},
     {OP_vpack_ss,       2, ANYFPU},
+    {OP_vabs,           1, ANYFPU},
+    {OP_vsign,          1, ANYFPU},
+    {OP_vhadd,          2, ANYFPU},
+    {OP_vhsub,          2, ANYFPU},
+    {OP_vhadd_ss,       2, ANYFPU},
+    {OP_vhsub_ss,       2, ANYFPU},
+    {OP_vmaddubs,       4, ANYFPU},
+    {OP_vmulhrs,        4, ANYFPU},
+    {OP_vshufb,         1, ANYFPU},
+    {OP_vsel,           1, ANYFPU},
+    {OP_vtest,          1, ANYFPU},
+    {OP_vminpos,        2, ANYFPU},
+    {OP_vmpsad,         4, ANYFPU},
+    {OP_fround,         6, ANYFPU},
   };
 
 #undef A
@@ -685,6 +690,9 @@ namespace OutOfOrderModel {
     PTEUpdate pteupdate;
     Waddr origvirt; // original virtual address, with low bits
     Waddr virtpage; // virtual page number actually accessed by the load or store
+    W64 load_miss_cycle; // cycle a missed load was sent to the cache hierarchy (for the RIP profiler)
+    byte load_miss_level; // 2 = missed L1 but hit L2, 3 = missed L2 (for the CPI stack)
+    byte branch_mispredicted; // the branch went against its prediction when it issued (for the RIP profiler)
     byte entry_valid:1, load_store_second_phase:1, all_consumers_off_bypass:1, dest_renamed_before_writeback:1, no_branches_between_renamings:1, transient:1, lock_acquired:1, issued:1;
     byte tlb_walk_level;
 
@@ -739,7 +747,7 @@ namespace OutOfOrderModel {
     issueq_tag_t get_tag();
   };
 
-  void decode_tag(issueq_tag_t tag, int& threadid, int& idx) {
+  static inline void decode_tag(issueq_tag_t tag, int& threadid, int& idx) {
     threadid = tag >> MAX_ROB_IDX_BIT;
     int mask = ((1 << (MAX_ROB_IDX_BIT + MAX_THREADS_BIT)) - 1) >> MAX_THREADS_BIT;
     idx = tag & mask;
@@ -969,6 +977,24 @@ namespace OutOfOrderModel {
     COMMIT_RESULT_STOP = 6    // stop processor model (shutdown)
   };
 
+  //
+  // Why the ROB is empty and refilling, for CPI stack accounting:
+  //
+  enum {
+    REFILL_REASON_NONE = 0,      // fetch and decode simply cannot keep up
+    REFILL_REASON_MISPREDICT = 1, // redirected after a branch mispredict
+    REFILL_REASON_FLUSH = 2,     // pipeline flushed (exception, barrier, SMC, ...)
+  };
+
+  //
+  // Why rename last stopped allocating before the ROB was full:
+  //
+  enum {
+    RENAME_STALL_NONE = 0,
+    RENAME_STALL_PHYSREGS = 1,
+    RENAME_STALL_LSQ = 2,
+  };
+
   // Branch predictor outcomes:
   enum { MISPRED = 0, CORRECT = 1 };
 
@@ -1096,6 +1122,8 @@ namespace OutOfOrderModel {
     EVENT_COMMIT_OK,
     EVENT_RECLAIM_PHYSREG,
     EVENT_RELEASE_MEM_LOCK,
+    // New events go here so existing event logs keep their numbering
+    EVENT_FETCH_UOPCACHE_MISS,
   };
 
   //
@@ -1375,6 +1403,42 @@ namespace OutOfOrderModel {
   // Size of unaligned predictor Bloom filter
   static const int UNALIGNED_PREDICTOR_SIZE = 4096;
 
+  //
+  // Decoded uop cache (enabled with -uop-cache), indexed by the physical
+  // address of each UOP_CACHE_WINDOW_SIZE byte window of x86 code. Windows
+  // that hit bypass the I-cache and legacy decoders and supply the full
+  // FETCH_WIDTH uops per cycle. Misses go through the legacy decoders,
+  // which take UOP_CACHE_MISS_PENALTY extra cycles to start and deliver at
+  // most LEGACY_DECODE_WIDTH uops per cycle while they fill the line.
+  // Windows that decode into more than UOP_CACHE_MAX_UOPS_PER_WINDOW uops
+  // cannot be cached and always use the legacy decoders.
+  //
+  static const int UOP_CACHE_SETS = 32;
+  static const int UOP_CACHE_WAYS = 8;
+  static const int UOP_CACHE_WINDOW_SIZE = 32;
+  static const int UOP_CACHE_MAX_UOPS_PER_WINDOW = 18;
+  static const int UOP_CACHE_MISS_PENALTY = 2;
+  static const int LEGACY_DECODE_WIDTH = 3;
+
+  //
+  // Predecoder (enabled with -predecode-model): instructions not supplied
+  // by the uop cache have their boundaries marked in one ICACHE_FETCH_GRANULARITY
+  // byte window per cycle, at most PREDECODE_WIDTH instructions at a time.
+  // An instruction with a length changing prefix (0x66 or 0x67 changing
+  // the immediate or ModRM length) stalls the predecoder for LCP_STALL_CYCLES.
+  //
+  static const int PREDECODE_WIDTH = 6;
+  static const int LCP_STALL_CYCLES = 6;
+
+  struct UopCacheLine {
+    W16 uops;
+
+    void reset() { uops = 0; }
+    ostream& print(ostream& os, W64 tag) const { return os << uops, " uops"; }
+  };
+
+  typedef AssociativeArray<W64, UopCacheLine, UOP_CACHE_SETS, UOP_CACHE_WAYS, UOP_CACHE_WINDOW_SIZE> UopCache;
+
   struct ThreadContext {
     OutOfOrderCore& core;
     OutOfOrderCore& getcore() const { return core; }
@@ -1423,6 +1487,13 @@ namespace OutOfOrderModel {
 
     // Last block in icache we fetched into our buffer
     W64 current_icache_block;
+    // Uop cache window we are fetching from, and whether it hit
+    W64 current_uop_cache_window;
+    bool uop_cache_hit;
+    int uop_cache_miss_delay;
+    // Predecoder stall on a length changing prefix, and the rip that caused it
+    int lcp_stall_delay;
+    W64 lcp_stall_rip;
     W64 fetch_uuid;
     int loads_in_flight;
     int stores_in_flight;
@@ -1442,6 +1513,10 @@ namespace OutOfOrderModel {
 
     W64 consecutive_commits_inside_spinlock;
 
+    // CPI stack accounting:
+    byte refill_reason;
+    byte rename_stall;
+
     // statistics:
     W64 total_uops_committed;
     W64 total_insns_committed;
@@ -1463,6 +1538,7 @@ namespace OutOfOrderModel {
     }
 
     int commit();
+    void account_lost_commit_slots(int rc, int committed);
     int writeback(int cluster);
     int transfer(int cluster);
     int complete(int cluster);
@@ -1470,6 +1546,9 @@ namespace OutOfOrderModel {
     void frontend();
     void rename();
     bool fetch();
+    bool access_uop_cache(Waddr physaddr, int legacy_uops);
+    bool predecode(Waddr physaddr, const TransOp& transop, W64& window, int& insns);
+    void fill_uop_cache();
     void tlbwalk();
 
     bool handle_barrier();
@@ -1629,10 +1708,15 @@ namespace OutOfOrderModel {
     ReorderBufferEntry* robs_on_fu[FU_COUNT];
     CacheSubsystem::CacheHierarchy caches;
     OutOfOrderCoreCacheCallbacks cache_callbacks;
+    UopCache uopcache;
 
     // Unaligned load/store predictor
     bitvec<UNALIGNED_PREDICTOR_SIZE> unaligned_predictor;
-    static int hash_unaligned_predictor_slot(const RIPVirtPhysBase& rvp);
+    static int hash_unaligned_predictor_slot(const RIPVirtPhysBase& rvp) {
+      W32 h = rvp.rip ^ rvp.mfnlo;
+      return lowbits(h, log2(UNALIGNED_PREDICTOR_SIZE));
+    }
+
     bool get_unaligned_hint(const RIPVirtPhysBase& rvp) const;
     void set_unaligned_hint(const RIPVirtPhysBase& rvp, bool value);
 
@@ -1651,6 +1735,7 @@ namespace OutOfOrderModel {
 
     // Callbacks
     void flush_tlb(Context& ctx, int threadid, bool selective = false, Waddr virtaddr = 0);
+    void invalidate_code_page(Waddr mfn);
 
     // Debugging
     void dump_smt_state(ostream& os);
@@ -1671,6 +1756,7 @@ namespace OutOfOrderModel {
     virtual void update_stats(PTLsimStats& stats);
     virtual void flush_tlb(Context& ctx);
     virtual void flush_tlb_virt(Context& ctx, Waddr virtaddr);
+    virtual void invalidate_code_page(Waddr mfn);
     void flush_all_pipelines();
   };
 
@@ -1689,6 +1775,17 @@ namespace OutOfOrderModel {
   extern CycleTimer ctcommit;
 
 #ifdef DECLARE_STRUCTURES
+  const char* fu_names[FU_COUNT] = {
+    "ldu0",
+    "stu0",
+    "ldu1",
+    "stu1",
+    "alu0",
+    "fpu0",
+    "alu1",
+    "fpu1",
+  };
+
   //
   // The following configuration has two integer/store clusters with a single cycle
   // latency between them, but both clusters can access the load pseudo-cluster with
@@ -1726,6 +1823,42 @@ namespace OutOfOrderModel {
   const byte intercluster_bandwidth_map[MAX_CLUSTERS][MAX_CLUSTERS] = {{64}};
 #endif // multi_issueq
 
+  const byte archdest_is_visible[TRANSREG_COUNT] = {
+    // Integer registers
+    1, 1, 1, 1, 1, 1, 1, 1,
+    1, 1, 1, 1, 1, 1, 1, 1,
+    // SSE registers, low 64 bits
+    1, 1, 1, 1, 1, 1, 1, 1,
+    1, 1, 1, 1, 1, 1, 1, 1,
+    // SSE registers, high 64 bits
+    1, 1, 1, 1, 1, 1, 1, 1,
+    1, 1, 1, 1, 1, 1, 1, 1,
+    // x87 FP / MMX / special
+    1, 1, 1, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0,
+    // The following are ONLY used during the translation and renaming process:
+    0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0,
+  };
+
+  const byte archdest_can_commit[TRANSREG_COUNT] = {
+    // Integer registers
+    1, 1, 1, 1, 1, 1, 1, 1,
+    1, 1, 1, 1, 1, 1, 1, 1,
+    // SSE registers, low 64 bits
+    1, 1, 1, 1, 1, 1, 1, 1,
+    1, 1, 1, 1, 1, 1, 1, 1,
+    // SSE registers, high 64 bits
+    1, 1, 1, 1, 1, 1, 1, 1,
+    1, 1, 1, 1, 1, 1, 1, 1,
+    // x87 FP / MMX / special
+    1, 1, 1, 1, 1, 1, 1, 1,
+    1, 1, 1, 1, 1, 1, 1, 0,
+    // The following are ONLY used during the translation and renaming process:
+    1, 1, 1, 1, 1, 1, 1, 1,
+    1, 1, 1, 1, 1, 1, 1, 1,
+  };
+
 #endif // DECLARE_STRUCTURES
 
 #endif // INSIDE_OOOCORE
@@ -1755,12 +1888,23 @@ struct PerContextOutOfOrderCoreStats { // rootnode:
       W64 microcode_assist;
       W64 branch_taken;
       W64 full_width;
+      W64 uop_cache_miss;
+      W64 decode_width;
+      W64 predecode_width;
+      W64 lcp_stall;
     } stop;
     W64 opclass[OPCLASS_COUNT]; // label: opclass_names
     W64 width[OutOfOrderModel::FETCH_WIDTH+1]; // histo: 0, OutOfOrderModel::FETCH_WIDTH, 1
     W64 blocks;
     W64 uops;
     W64 user_insns;
+    struct uopcache { // node: summable
+      W64 hits;
+      W64 misses;
+      W64 uncacheable;
+      W64 uops_from_cache;
+      W64 uops_from_decoders;
+    } uopcache;
   } fetch;
 
   struct frontend {
@@ -1821,6 +1965,7 @@ struct PerContextOutOfOrderCoreStats { // rootnode:
   struct commit {
     W64 uops;
     W64 insns;
+    W64 fused; // cmp/test + jcc pairs committed as one uop (see -fuse-cmp-jcc)
     double uipc;
     double ipc;
 
@@ -1843,6 +1988,35 @@ struct PerContextOutOfOrderCoreStats { // rootnode:
     W64 opclass[OPCLASS_COUNT]; // label: opclass_names
   } commit;
 
+  //
+  // Top-down CPI stack: in every cycle, each of the COMMIT_WIDTH commit
+  // slots either commits a uop or is charged to whatever prevented the
+  // oldest uop in the ROB (or an empty ROB) from committing.
+  //
+  struct cpistack { // node: summable
+    W64 committed;
+    struct frontend { // node: summable
+      W64 icache_miss;
+      W64 decode;
+      W64 fetch;
+    } frontend;
+    W64 branch_mispredict;
+    struct memory { // node: summable
+      W64 L1;
+      W64 L2;
+      W64 mem;
+      W64 tlb;
+    } memory;
+    W64 dependency;
+    struct structural { // node: summable
+      W64 issueq;
+      W64 lsq;
+      W64 physregs;
+    } structural;
+    W64 fence;
+    W64 other;
+  } cpistack;
+
   struct branchpred {
     W64 predictions;
     W64 updates;
@@ -18,6 +18,7 @@
 #define INSIDE_OOOCORE
 #include <ooocore.h>
 #include <stats.h>
+#include <ripprof.h>
 
 #ifndef ENABLE_CHECKS
 #undef assert
@@ -464,7 +465,10 @@ int ReorderBufferEntry::issue() {
       bool cond = bit(bptype, log2(BRANCH_HINT_COND));
       bool indir = bit(bptype, log2(BRANCH_HINT_INDIRECT));
       bool ret = bit(bptype, log2(BRANCH_HINT_RET));
-        
+
+      // Counted in the RIP profile at commit, so annulled branches are excluded
+      branch_mispredicted |= mispredicted;
+
       if unlikely (mispredicted) {
         per_context_ooocore_stats_update(threadid, branchpred.cond[MISPRED] += cond);
         per_context_ooocore_stats_update(threadid, branchpred.indir[MISPRED] += (indir & !ret));
@@ -518,6 +522,7 @@ int ReorderBufferEntry::issue() {
         // commit like it was predicted perfectly in the first place.
         //
         thread.reset_fetch_unit(realrip);
+        thread.refill_reason = REFILL_REASON_MISPREDICT;
         per_context_ooocore_stats_update(threadid, issue.result.branch_mispredict++);
 
         return -1;
@@ -1476,6 +1481,13 @@ int ReorderBufferEntry::probecache(Waddr addr, LoadStoreQueueEntry* sfra) {
 
     per_context_ooocore_stats_update(threadid, dcache.load.issue.complete++);
     per_context_dcache_stats_update(threadid, load.hit.L1++);
+
+    RIPProfileEntry* prof = ripprof(uop.rip.rip);
+    if unlikely (prof) {
+      prof->loads++;
+      prof->load_latency += LOADLAT;
+    }
+
     return ISSUE_COMPLETED;
   }
 
@@ -1495,9 +1507,19 @@ int ReorderBufferEntry::probecache(Waddr addr, LoadStoreQueueEntry* sfra) {
 
   SFR dummysfr;
   setzero(dummysfr);
-  lfrqslot = core.caches.issueload_slowpath(physaddr, dummysfr, lsi);
+  bool L2hit = 0;
+  lfrqslot = core.caches.issueload_slowpath(physaddr, dummysfr, lsi, L2hit);
   assert(lfrqslot >= 0);
 
+  load_miss_cycle = sim_cycle;
+  load_miss_level = (L2hit) ? 2 : 3;
+  RIPProfileEntry* prof = ripprof(uop.rip.rip);
+  if unlikely (prof) {
+    prof->loads++;
+    prof->L1_misses++;
+    prof->L2_misses += (!L2hit);
+  }
+
   if unlikely (config.event_log_enabled) event = core.eventlog.add_load_store(EVENT_LOAD_MISS, this, sfra, addr);
 
   return ISSUE_COMPLETED;
@@ -1751,6 +1773,9 @@ void ReorderBufferEntry::loadwakeup() {
     // Actually wake up the load
     if unlikely (config.event_log_enabled) getcore().eventlog.add_load_store(EVENT_LOAD_WAKEUP, this);
 
+    RIPProfileEntry* prof = ripprof(uop.rip.rip);
+    if unlikely (prof) prof->load_latency += (sim_cycle - load_miss_cycle);
+
     physreg->flags &= ~FLAG_WAIT;
     physreg->complete();
     
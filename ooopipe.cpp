@@ -18,6 +18,7 @@
 #define INSIDE_OOOCORE
 #include <ooocore.h>
 #include <stats.h>
+#include <ripprof.h>
 
 #ifndef ENABLE_CHECKS
 #undef assert
@@ -119,6 +120,7 @@ void ThreadContext::flush_pipeline() {
 
   core.caches.complete(threadid);
   annul_fetchq();
+  refill_reason = REFILL_REASON_FLUSH;
 
   foreach_forward(ROB, i) {
     ReorderBufferEntry& rob = ROB[i];
@@ -194,6 +196,10 @@ void ThreadContext::reset_fetch_unit(W64 realrip) {
   fetchrip.update(ctx);
   stall_frontend = 0;
   waiting_for_icache_fill = 0;
+  uop_cache_miss_delay = 0;
+  lcp_stall_delay = 0;
+  lcp_stall_rip = limits<W64>::max;
+  current_uop_cache_window = 0;
   fetchq.reset();
   current_basic_block_transop_index = 0;
   unaligned_ldst_buf.reset();
@@ -361,11 +367,6 @@ static void print_fetch_bb_address_ringbuf(ostream& os) {
   }
 }
 
-int OutOfOrderCore::hash_unaligned_predictor_slot(const RIPVirtPhysBase& rvp) {
-  W32 h = rvp.rip ^ rvp.mfnlo;
-  return lowbits(h, log2(UNALIGNED_PREDICTOR_SIZE));
-}
-
 bool OutOfOrderCore::get_unaligned_hint(const RIPVirtPhysBase& rvp) const {
   int slot = hash_unaligned_predictor_slot(rvp);
   return unaligned_predictor[slot];
@@ -408,6 +409,22 @@ bool ThreadContext::fetch() {
     return true;
   }
 
+  if unlikely (uop_cache_miss_delay) {
+    uop_cache_miss_delay--;
+    per_context_ooocore_stats_update(threadid, fetch.stop.uop_cache_miss++);
+    return true;
+  }
+
+  if unlikely (lcp_stall_delay) {
+    lcp_stall_delay--;
+    per_context_ooocore_stats_update(threadid, fetch.stop.lcp_stall++);
+    return true;
+  }
+
+  int legacy_uops = 0;
+  W64 predecode_window = limits<W64>::max;
+  int predecoded_insns = 0;
+
   while ((fetchcount < FETCH_WIDTH) && (taken_branch_count == 0)) {
     if unlikely (!fetchq.remaining()) {
       if unlikely (config.event_log_enabled) {
@@ -472,8 +489,17 @@ bool ThreadContext::fetch() {
     Waddr physaddr = fetchrip;
 #endif
 
+    if unlikely (config.uop_cache && (!current_basic_block->invalidblock)) {
+      if unlikely (!access_uop_cache(physaddr, legacy_uops)) break;
+    }
+
+    if unlikely (config.predecode_model && (!uop_cache_hit) && (!current_basic_block->invalidblock) && unaligned_ldst_buf.empty()) {
+      const TransOp& nextuop = current_basic_block->transops[current_basic_block_transop_index];
+      if unlikely (!predecode(physaddr, nextuop, predecode_window, predecoded_insns)) break;
+    }
+
     W64 req_icache_block = floor(physaddr, ICACHE_FETCH_GRANULARITY);
-    if ((!current_basic_block->invalidblock) && (req_icache_block != current_icache_block)) {
+    if ((!current_basic_block->invalidblock) && (!uop_cache_hit) && (req_icache_block != current_icache_block)) {
       bool hit = core.caches.probe_icache(fetchrip, physaddr);
       hit |= config.perfect_cache;
       if unlikely (!hit) {
@@ -548,6 +574,15 @@ bool ThreadContext::fetch() {
 
     per_context_ooocore_stats_update(threadid, fetch.uops++);
 
+    if unlikely (config.uop_cache) {
+      if likely (uop_cache_hit) {
+        per_context_ooocore_stats_update(threadid, fetch.uopcache.uops_from_cache++);
+      } else {
+        legacy_uops++;
+        fill_uop_cache();
+      }
+    }
+
     Waddr predrip = 0;
     bool redirectrip = false;
 
@@ -625,6 +660,97 @@ bool ThreadContext::fetch() {
   return true;
 }
 
+//
+// Look up the uop cache when fetch enters a new window of x86 code.
+// Returns false if fetch must stop for this cycle, either because the
+// window missed and the legacy decoders must start up, or because the
+// legacy decoders have already delivered all the uops they can.
+//
+bool ThreadContext::access_uop_cache(Waddr physaddr, int legacy_uops) {
+  OutOfOrderCore& core = getcore();
+  W64 window = floor(physaddr, UOP_CACHE_WINDOW_SIZE);
+
+  if likely (window == current_uop_cache_window) {
+    if likely (uop_cache_hit | (legacy_uops < LEGACY_DECODE_WIDTH)) return true;
+    per_context_ooocore_stats_update(threadid, fetch.stop.decode_width++);
+    return false;
+  }
+
+  current_uop_cache_window = window;
+  uop_cache_hit = (core.uopcache.probe(window) != null);
+
+  if likely (uop_cache_hit) {
+    per_context_ooocore_stats_update(threadid, fetch.uopcache.hits++);
+    return true;
+  }
+
+  if unlikely (config.event_log_enabled) {
+    OutOfOrderCoreEvent* event = core.eventlog.add(EVENT_FETCH_UOPCACHE_MISS, fetchrip);
+    event->threadid = threadid;
+    event->uuid = fetch_uuid;
+  }
+
+  //
+  // Allocate the line now: the legacy decoders fill it in as they
+  // deliver uops, so the window hits the next time we fetch from it.
+  //
+  core.uopcache.select(window)->reset();
+  uop_cache_miss_delay = UOP_CACHE_MISS_PENALTY;
+  per_context_ooocore_stats_update(threadid, fetch.uopcache.misses++);
+  per_context_ooocore_stats_update(threadid, fetch.stop.uop_cache_miss++);
+  return false;
+}
+
+//
+// Predecoder model (-predecode-model): returns false if the x86 insn
+// starting with transop cannot be predecoded this cycle, either because
+// it lies in a different fetch window than the ones already predecoded
+// this cycle, the predecoder is out of width, or it just hit a length
+// changing prefix stall.
+//
+bool ThreadContext::predecode(Waddr physaddr, const TransOp& transop, W64& window, int& insns) {
+  if likely (!transop.som) return true;
+
+  W64 req_window = floor(physaddr, ICACHE_FETCH_GRANULARITY);
+
+  if unlikely ((insns >= PREDECODE_WIDTH) | ((insns > 0) & (req_window != window))) {
+    per_context_ooocore_stats_update(threadid, fetch.stop.predecode_width++);
+    return false;
+  }
+
+  if unlikely (transop.lcp && (fetchrip.rip != lcp_stall_rip)) {
+    // Stall now, then let this insn through when fetch resumes
+    lcp_stall_rip = fetchrip.rip;
+    lcp_stall_delay = LCP_STALL_CYCLES - 1;
+    per_context_ooocore_stats_update(threadid, fetch.stop.lcp_stall++);
+    return false;
+  }
+
+  lcp_stall_rip = limits<W64>::max;
+  window = req_window;
+  insns++;
+  return true;
+}
+
+//
+// Add a uop delivered by the legacy decoders to the current window's line
+//
+void ThreadContext::fill_uop_cache() {
+  OutOfOrderCore& core = getcore();
+  per_context_ooocore_stats_update(threadid, fetch.uopcache.uops_from_decoders++);
+
+  // Another thread may have evicted the line since we allocated it
+  UopCacheLine* line = core.uopcache.probe(current_uop_cache_window);
+  if unlikely (!line) return;
+
+  line->uops++;
+
+  if unlikely (line->uops > UOP_CACHE_MAX_UOPS_PER_WINDOW) {
+    core.uopcache.invalidate(current_uop_cache_window);
+    per_context_ooocore_stats_update(threadid, fetch.uopcache.uncacheable++);
+  }
+}
+
 BasicBlock* ThreadContext::fetch_or_translate_basic_block(const RIPVirtPhys& rvp) {
   time_this_scope(ctdecode);
 
@@ -675,6 +801,7 @@ void ThreadContext::rename() {
   time_this_scope(ctrename);
 
   int prepcount = 0;
+  rename_stall = RENAME_STALL_NONE;
 
   while (prepcount < FRONTEND_WIDTH) {
     if unlikely (fetchq.empty()) {
@@ -720,6 +847,7 @@ void ThreadContext::rename() {
         }
       }
       per_context_ooocore_stats_update(threadid, frontend.status.physregs_full++);
+      rename_stall = RENAME_STALL_PHYSREGS;
       break;
     }
 
@@ -730,17 +858,20 @@ void ThreadContext::rename() {
     if unlikely (ld && (loads_in_flight >= LDQ_SIZE)) {
       if unlikely (config.event_log_enabled) { if likely (!prepcount) core.eventlog.add(EVENT_RENAME_LDQ_FULL)->threadid = threadid; }
       per_context_ooocore_stats_update(threadid, frontend.status.ldq_full++);
+      rename_stall = RENAME_STALL_LSQ;
       break;
     }
 
     if unlikely (st && (stores_in_flight >= STQ_SIZE)) {
       if unlikely (config.event_log_enabled) { if likely (!prepcount) core.eventlog.add(EVENT_RENAME_STQ_FULL)->threadid = threadid; }
       per_context_ooocore_stats_update(threadid, frontend.status.stq_full++);
+      rename_stall = RENAME_STALL_LSQ;
       break;
     }
 
     if unlikely ((ld|st) && (!LSQ.remaining())) {
       if unlikely (config.event_log_enabled) { if likely (!prepcount) core.eventlog.add(EVENT_RENAME_MEMQ_FULL)->threadid = threadid; }
+      rename_stall = RENAME_STALL_LSQ;
       break;
     }
 
@@ -749,6 +880,7 @@ void ThreadContext::rename() {
     FetchBufferEntry& transop = *fetchq.dequeue();
     ReorderBufferEntry& rob = *ROB.alloc();
     PhysicalRegister* physreg = null;
+    refill_reason = REFILL_REASON_NONE;
 
     LoadStoreQueueEntry* lsqp = (ld|st) ? LSQ.alloc() : null;
     LoadStoreQueueEntry& lsq = *lsqp;
@@ -1533,6 +1665,7 @@ int ThreadContext::commit() {
   // not ready to commit or has an exception.
   //
   int rc = COMMIT_RESULT_OK;
+  int commitcount_before = core.commitcount;
 
   foreach_forward(ROB, i) {
     ReorderBufferEntry& rob = ROB[i];
@@ -1547,12 +1680,112 @@ int ThreadContext::commit() {
     }
   }
 
+  //
+  // Charge the cycle to whichever uop is blocking the head of the ROB
+  //
+  if unlikely (ripprof.enabled() && (rc == COMMIT_RESULT_NONE) && (core.commitcount == commitcount_before) && (!ROB.empty())) {
+    RIPProfileEntry* prof = ripprof(ROB.peekhead()->uop.rip.rip);
+    prof->commit_stall_cycles++;
+  }
+
   assert(core.commitcount < lengthof(stats.ooocore.commit.width));
   stats.ooocore.commit.width[core.commitcount]++;
 
+  account_lost_commit_slots(rc, core.commitcount - commitcount_before);
+
   return rc;
 }
 
+//
+// Charge every commit slot left unused this cycle to a single cause,
+// based on the state of the oldest uop that could not commit. Slots
+// lost while the ROB is empty are charged to the reason it drained.
+//
+void ThreadContext::account_lost_commit_slots(int rc, int committed) {
+  int lost = COMMIT_WIDTH - committed;
+  per_context_ooocore_stats_update(threadid, cpistack.committed += committed);
+
+  if likely (!lost) return;
+
+  if unlikely (ROB.empty()) {
+    if (refill_reason == REFILL_REASON_MISPREDICT) {
+      per_context_ooocore_stats_update(threadid, cpistack.branch_mispredict += lost);
+    } else if (refill_reason == REFILL_REASON_FLUSH) {
+      per_context_ooocore_stats_update(threadid, cpistack.other += lost);
+    } else if (waiting_for_icache_fill) {
+      per_context_ooocore_stats_update(threadid, cpistack.frontend.icache_miss += lost);
+    } else if (uop_cache_miss_delay | lcp_stall_delay) {
+      per_context_ooocore_stats_update(threadid, cpistack.frontend.decode += lost);
+    } else {
+      per_context_ooocore_stats_update(threadid, cpistack.frontend.fetch += lost);
+    }
+    return;
+  }
+
+  //
+  // Some other thread used up the commit width, or commit stopped
+  // for an exception, barrier, SMC or interlock rather than because
+  // a uop was not yet ready:
+  //
+  if unlikely (core.commitcount >= COMMIT_WIDTH) {
+    per_context_ooocore_stats_update(threadid, cpistack.other += lost);
+    return;
+  }
+
+  if unlikely (rc != COMMIT_RESULT_NONE) {
+    if (rc == COMMIT_RESULT_BARRIER) {
+      per_context_ooocore_stats_update(threadid, cpistack.fence += lost);
+    } else {
+      per_context_ooocore_stats_update(threadid, cpistack.other += lost);
+    }
+    return;
+  }
+
+  //
+  // Find the first uop in the head x86 instruction that is not ready
+  // to commit: the whole macro-op commits atomically, so that uop is
+  // what is really blocking commit.
+  //
+  ReorderBufferEntry* blocker = null;
+
+  foreach_forward(ROB, i) {
+    ReorderBufferEntry& rob = ROB[i];
+    if (!rob.ready_to_commit()) { blocker = &rob; break; }
+    if (rob.uop.eom) break;
+  }
+
+  if unlikely (!blocker) {
+    // All uops ready but commit refused (e.g. memory interlock held by another VCPU)
+    per_context_ooocore_stats_update(threadid, cpistack.other += lost);
+    return;
+  }
+
+  const StateList* state = blocker->current_state_list;
+  bool ld = isload(blocker->uop.opcode);
+
+  if (state == &rob_cache_miss_list) {
+    if (blocker->load_miss_level == 2) {
+      per_context_ooocore_stats_update(threadid, cpistack.memory.L2 += lost);
+    } else {
+      per_context_ooocore_stats_update(threadid, cpistack.memory.mem += lost);
+    }
+  } else if (state == &rob_tlb_miss_list) {
+    per_context_ooocore_stats_update(threadid, cpistack.memory.tlb += lost);
+  } else if ((state == &rob_memory_fence_list) | (blocker->uop.opcode == OP_mf)) {
+    per_context_ooocore_stats_update(threadid, cpistack.fence += lost);
+  } else if ((state == &rob_frontend_list) | (state == &rob_ready_to_dispatch_list)) {
+    per_context_ooocore_stats_update(threadid, cpistack.structural.issueq += lost);
+  } else if (ld && blocker->load_store_second_phase && (state == &rob_issued_list[blocker->cluster])) {
+    per_context_ooocore_stats_update(threadid, cpistack.memory.L1 += lost);
+  } else if (rename_stall == RENAME_STALL_LSQ) {
+    per_context_ooocore_stats_update(threadid, cpistack.structural.lsq += lost);
+  } else if (rename_stall == RENAME_STALL_PHYSREGS) {
+    per_context_ooocore_stats_update(threadid, cpistack.structural.physregs += lost);
+  } else {
+    per_context_ooocore_stats_update(threadid, cpistack.dependency += lost);
+  }
+}
+
 void ThreadContext::flush_mem_lock_release_list(int start) {
   for (int i = start; i < queued_mem_lock_release_count; i++) {
     W64 lockaddr = queued_mem_lock_release_list[i];
@@ -2009,14 +2242,23 @@ int ReorderBufferEntry::commit() {
 
     thread.branchpred.update(uop.predinfo, end_of_branch_x86_insn, ctx.commitarf[REG_rip]);
     per_context_ooocore_stats_update(threadid, branchpred.updates++);
+
+    RIPProfileEntry* prof = ripprof(uop.rip.rip);
+    if unlikely (prof) {
+      prof->branches++;
+      prof->mispredicts += branch_mispredicted;
+    }
   }
 
   if likely (uop.eom) {
-    total_user_insns_committed++;
-    per_context_ooocore_stats_update(threadid, commit.insns++);
-    thread.total_insns_committed++;
+    // A fused cmp/test + jcc uop retires two x86 insns
+    int insns = 1 + uop.fused;
+    total_user_insns_committed += insns;
+    per_context_ooocore_stats_update(threadid, commit.insns += insns);
+    per_context_ooocore_stats_update(threadid, commit.fused += uop.fused);
+    thread.total_insns_committed += insns;
 
-    stats.summary.insns++;
+    stats.summary.insns += insns;
   }
 
   stats.summary.uops++;
@@ -2050,41 +2292,3 @@ int ReorderBufferEntry::commit() {
   per_context_ooocore_stats_update(threadid, commit.result.ok++);
   return COMMIT_RESULT_OK;
 }
-
-namespace OutOfOrderModel {
-  const byte archdest_is_visible[TRANSREG_COUNT] = {
-    // Integer registers
-    1, 1, 1, 1, 1, 1, 1, 1,
-    1, 1, 1, 1, 1, 1, 1, 1,
-    // SSE registers, low 64 bits
-    1, 1, 1, 1, 1, 1, 1, 1,
-    1, 1, 1, 1, 1, 1, 1, 1,
-    // SSE registers, high 64 bits
-    1, 1, 1, 1, 1, 1, 1, 1,
-    1, 1, 1, 1, 1, 1, 1, 1,
-    // x87 FP / MMX / special
-    1, 1, 1, 0, 0, 0, 0, 0,
-    0, 0, 0, 0, 0, 0, 0, 0,
-    // The following are ONLY used during the translation and renaming process:
-    0, 0, 0, 0, 0, 0, 0, 0,
-    0, 0, 0, 0, 0, 0, 0, 0,
-  };
-
-  const byte archdest_can_commit[TRANSREG_COUNT] = {
-    // Integer registers
-    1, 1, 1, 1, 1, 1, 1, 1,
-    1, 1, 1, 1, 1, 1, 1, 1,
-    // SSE registers, low 64 bits
-    1, 1, 1, 1, 1, 1, 1, 1,
-    1, 1, 1, 1, 1, 1, 1, 1,
-    // SSE registers, high 64 bits
-    1, 1, 1, 1, 1, 1, 1, 1,
-    1, 1, 1, 1, 1, 1, 1, 1,
-    // x87 FP / MMX / special
-    1, 1, 1, 1, 1, 1, 1, 1,
-    1, 1, 1, 1, 1, 1, 1, 0,
-    // The following are ONLY used during the translation and renaming process:
-    1, 1, 1, 1, 1, 1, 1, 1,
-    1, 1, 1, 1, 1, 1, 1, 1,
-  };
-};
@@ -0,0 +1,420 @@
+//
+// PTLsim: Cycle Accurate x86-64 Simulator
+// Trace Driven Cache Simulator
+//
+// Copyright 2008 Matt T. Yourst <yourst@yourst.com>
+//
+// Replays a memory trace written by ptlsim -memtrace through the
+// cache hierarchy, without simulating any core at all.
+//
+// The "hierarchy" model uses the same CacheSubsystem::CacheHierarchy
+// as the out of order core, so its geometry is fixed at compile time
+// by dcache.h. Misses either fill instantly (the default) or, with
+// -timing, block until the miss buffer has delivered the line, using
+// the latencies in dcache.h.
+//
+// The "lru" model is a tag-only L1D/L1I/L2 hierarchy with LRU
+// replacement whose sizes, associativity and latencies are all set
+// on the command line, for sweeping many configurations over the
+// same trace.
+//
+// The "mrc" model needs only one pass to print the LRU miss ratio
+// curves of the loads and stores for every cache size and set count
+// (see stackdist.h), using the -line-size option.
+//
+
+#include <globals.h>
+#include <ptlsim.h>
+#include <dcache.h>
+#include <stats.h>
+#include <memtrace.h>
+#include <stackdist.h>
+
+using namespace CacheSubsystem;
+
+struct PTLcachesimConfig {
+  stringbuf model;
+  bool timing;
+  W64 limit;
+
+  W64 line_size;
+  W64 l1d_size;
+  W64 l1d_ways;
+  W64 l1i_size;
+  W64 l1i_ways;
+  W64 l2_size;
+  W64 l2_ways;
+
+  W64 l1_latency;
+  W64 l2_latency;
+  W64 mem_latency;
+
+  void reset();
+};
+
+void PTLcachesimConfig::reset() {
+  model.reset();
+  model << "hierarchy";
+  timing = 0;
+  limit = infinity;
+
+  line_size = 64;
+  l1d_size = 16384;
+  l1d_ways = 4;
+  l1i_size = 32768;
+  l1i_ways = 4;
+  l2_size = 262144;
+  l2_ways = 16;
+
+  l1_latency = 2;
+  l2_latency = 6;
+  mem_latency = 140;
+}
+
+PTLcachesimConfig cachesimconfig;
+ConfigurationParser<PTLcachesimConfig> cachesimconfigparser;
+
+template <>
+void ConfigurationParser<PTLcachesimConfig>::setup() {
+  section("Cache Model");
+  add(model,                            "model",                     "Cache model: 'hierarchy' (PTLsim's CacheHierarchy), 'lru' (configurable tag-only LRU caches) or 'mrc' (LRU miss ratio curves)");
+  add(timing,                           "timing",                    "hierarchy model: block on each miss until the miss buffer delivers the line, and count cycles");
+  add(limit,                            "limit",                     "Stop after replaying this many accesses");
+
+  section("LRU Model Geometry");
+  add(line_size,                        "line-size",                 "Line size in bytes (all levels; also used by the mrc model)");
+  add(l1d_size,                         "l1d-size",                  "L1 data cache size in bytes");
+  add(l1d_ways,                         "l1d-ways",                  "L1 data cache associativity");
+  add(l1i_size,                         "l1i-size",                  "L1 instruction cache size in bytes");
+  add(l1i_ways,                         "l1i-ways",                  "L1 instruction cache associativity");
+  add(l2_size,                          "l2-size",                   "Unified L2 cache size in bytes");
+  add(l2_ways,                          "l2-ways",                   "Unified L2 cache associativity");
+
+  section("LRU Model Latencies");
+  add(l1_latency,                       "l1-latency",                "L1 hit latency in cycles");
+  add(l2_latency,                       "l2-latency",                "L2 hit latency in cycles");
+  add(mem_latency,                      "mem-latency",               "Main memory latency in cycles");
+};
+
+enum { LEVEL_L1, LEVEL_L2, LEVEL_L3, LEVEL_MEM, LEVEL_COUNT };
+
+static const char* level_names[LEVEL_COUNT] = {"L1", "L2", "L3", "mem"};
+
+struct CacheSimulatorStats {
+  W64 accesses[MEMTRACE_TYPE_COUNT];
+  W64 hits[MEMTRACE_TYPE_COUNT][LEVEL_COUNT];
+  W64 cycles;
+
+  void reset() { setzero(*this); }
+};
+
+CacheSimulatorStats simstats;
+
+//
+// Replay through the real CacheHierarchy
+//
+struct HierarchyCacheModel {
+  CacheHierarchy caches;
+
+  HierarchyCacheModel() { caches.reset(); }
+
+  // Find where the line is before the access changes anything
+  int level_of(W64 physaddr) {
+    if (caches.L2.probe(physaddr)) return LEVEL_L2;
+#ifdef ENABLE_L3_CACHE
+    if (caches.L3.probe(physaddr)) return LEVEL_L3;
+#endif
+    return LEVEL_MEM;
+  }
+
+  // Fill a missing line everywhere without waiting for the miss buffer
+  void fill(W64 physaddr, bool icache) {
+#ifdef ENABLE_L3_CACHE
+    caches.L3.validate(physaddr);
+#endif
+    caches.L2.validate(physaddr);
+    if (icache) caches.L1I.validate(physaddr, bitvec<L1I_LINE_SIZE>().setall());
+    else caches.L1.validate(physaddr, bitvec<L1_LINE_SIZE>().setall());
+  }
+
+  // Run the clock until every outstanding miss has been delivered
+  void drain() {
+    while ((!caches.missbuf.freemap.allset()) | (!caches.lfrq.freemap.allset())) {
+      sim_cycle++;
+      caches.clock();
+    }
+  }
+
+  void access(const MemoryTraceRecord& rec, bool timing) {
+    W64 addr = rec.physaddr;
+    int level = LEVEL_L1;
+
+    switch (rec.type) {
+    case MEMTRACE_LOAD: {
+      if unlikely (!caches.probe_cache_and_sfr(addr, null, rec.sizeshift)) {
+        level = level_of(addr);
+        if (timing) {
+          SFR sfr;
+          setzero(sfr);
+          LoadStoreInfo lsi = 0;
+          lsi.threadid = 0;
+          lsi.sizeshift = rec.sizeshift;
+          caches.issueload_slowpath(addr, sfr, lsi);
+        } else {
+          fill(addr, false);
+        }
+      }
+      break;
+    }
+    case MEMTRACE_STORE: {
+      if unlikely (!caches.L1.probe(addr)) level = level_of(addr);
+      if (timing) {
+        SFR sfr;
+        setzero(sfr);
+        sfr.physaddr = addr >> 3;
+        sfr.bytemask = bitmask(1 << rec.sizeshift) << lowbits(addr, 3);
+        caches.commitstore(sfr, 0, false);
+      } else if unlikely (level != LEVEL_L1) {
+        fill(addr, false);
+      }
+      break;
+    }
+    case MEMTRACE_FETCH: {
+      if unlikely (!caches.probe_icache(rec.virtaddr, addr)) {
+        level = level_of(addr);
+        if (timing) caches.initiate_icache_miss(addr, 0xffff, 0);
+        else fill(addr, true);
+      }
+      break;
+    }
+    }
+
+    simstats.hits[rec.type][level]++;
+
+    if (timing) {
+      sim_cycle++;
+      caches.clock();
+      drain();
+    }
+  }
+};
+
+//
+// Runtime configurable tag-only set associative cache with true LRU
+//
+struct LRUCache {
+  W64* tags;
+  W64* lru;
+  int sets;
+  int ways;
+  int setshift;
+  int lineshift;
+  W64 clock;
+
+  LRUCache() { tags = null; lru = null; }
+
+  bool init(const char* name, W64 size, W64 ways, W64 linesize) {
+    W64 sets = (ways && linesize) ? size / (ways * linesize) : 0;
+
+    if unlikely ((!sets) | (linesize & (linesize-1)) | (sets & (sets-1))) {
+      cerr << "ptlcachesim: invalid ", name, " geometry (", size, " bytes, ", ways, " ways, ", linesize, " byte lines)", endl;
+      return false;
+    }
+
+    this->ways = ways;
+    this->sets = sets;
+    this->setshift = lsbindex(sets);
+    this->lineshift = lsbindex(linesize);
+
+    tags = new W64[sets * ways];
+    lru = new W64[sets * ways];
+    foreach (i, sets * ways) {
+      tags[i] = limits<W64>::max;
+      lru[i] = 0;
+    }
+    clock = 0;
+    return true;
+  }
+
+  // Returns true on a hit; on a miss, replaces the least recently used way
+  bool access(W64 addr) {
+    W64 tag = addr >> lineshift;
+    int base = lowbits(tag, setshift) * ways;
+    int victim = base;
+    clock++;
+
+    foreach (i, ways) {
+      int way = base + i;
+      if likely (tags[way] == tag) {
+        lru[way] = clock;
+        return true;
+      }
+      if (lru[way] < lru[victim]) victim = way;
+    }
+
+    tags[victim] = tag;
+    lru[victim] = clock;
+    return false;
+  }
+};
+
+struct LRUCacheModel {
+  LRUCache L1D;
+  LRUCache L1I;
+  LRUCache L2;
+
+  bool init(const PTLcachesimConfig& c) {
+    return (L1D.init("L1D", c.l1d_size, c.l1d_ways, c.line_size) &&
+            L1I.init("L1I", c.l1i_size, c.l1i_ways, c.line_size) &&
+            L2.init("L2", c.l2_size, c.l2_ways, c.line_size));
+  }
+
+  void access(const MemoryTraceRecord& rec, const PTLcachesimConfig& c) {
+    LRUCache& L1 = (rec.type == MEMTRACE_FETCH) ? L1I : L1D;
+    int level = LEVEL_L1;
+    W64 latency = c.l1_latency;
+
+    if unlikely (!L1.access(rec.physaddr)) {
+      bool L2hit = L2.access(rec.physaddr);
+      level = (L2hit) ? LEVEL_L2 : LEVEL_MEM;
+      latency += c.l2_latency + ((L2hit) ? 0 : c.mem_latency);
+    }
+
+    simstats.hits[rec.type][level]++;
+    simstats.cycles += latency;
+  }
+};
+
+void printbanner() {
+  cerr << "//  ", endl;
+  cerr << "//  PTLcachesim: PTLsim trace driven cache simulator", endl;
+  cerr << "//  Copyright 2008 Matt T. Yourst <yourst@yourst.com>", endl;
+  cerr << "//  ", endl;
+  cerr << endl;
+}
+
+void print_stats(ostream& os) {
+  W64 total = 0;
+  foreach (t, MEMTRACE_TYPE_COUNT) total += simstats.accesses[t];
+
+  os << total, " accesses", endl;
+
+  foreach (t, MEMTRACE_TYPE_COUNT) {
+    W64 n = simstats.accesses[t];
+    if (!n) continue;
+    os << "  ", padstring(memtrace_type_names[t], -6), " ", intstring(n, 14), endl;
+    foreach (level, LEVEL_COUNT) {
+      W64 hits = simstats.hits[t][level];
+      if ((!hits) & (level != LEVEL_L1)) continue;
+      os << "    hit in ", padstring(level_names[level], -4), intstring(hits, 14), "  (",
+        floatstring(percent(hits, n), 0, 2), "%)", endl;
+    }
+  }
+
+  if (simstats.cycles) {
+    os << simstats.cycles, " cycles (", floatstring((total) ? ((double)simstats.cycles / (double)total) : 0, 0, 2), " cycles per access)", endl;
+  }
+}
+
+//
+// Miss ratios from the stack distance histograms
+//
+void print_miss_ratio_curves(ostream& os) {
+  const StackDistanceStats& sd = stats.stackdist;
+  W64 total = sd.accesses;
+
+  os << total, " data accesses, ", cachesimconfig.line_size, " byte lines", endl, endl;
+  if (!total) return;
+
+  os << "Fully associative LRU:", endl;
+  os << "  ", padstring("lines", 10), padstring("bytes", 14), padstring("miss ratio", 12), endl;
+
+  W64 hits = 0;
+  foreach (k, STACK_DISTANCE_BUCKETS-1) {
+    hits += sd.fullyassoc[k];
+    W64 lines = 1ULL << k;
+    os << "  ", intstring(lines, 10), intstring(lines * cachesimconfig.line_size, 14), "  ",
+      floatstring(1.0 - ((double)hits / (double)total), 0, 6), endl;
+  }
+
+  os << endl, "Set associative LRU (miss ratio by sets and ways):", endl;
+  os << "  ", padstring("sets", 8);
+  for (int ways = 1; ways <= STACK_DISTANCE_MAX_WAYS; ways *= 2) os << intstring(ways, 10);
+  os << endl;
+
+  const W64* histogram = (const W64*)&sd.setassoc;
+
+  foreach (i, STACK_DISTANCE_SET_COUNTS) {
+    os << "  ", intstring(STACK_DISTANCE_MIN_SETS << i, 8);
+    W64 hits = 0;
+    int w = 0;
+    for (int ways = 1; ways <= STACK_DISTANCE_MAX_WAYS; ways *= 2) {
+      while (w < ways) hits += histogram[w++];
+      os << "  ", floatstring(1.0 - ((double)hits / (double)total), 0, 6);
+    }
+    os << endl;
+    histogram += STACK_DISTANCE_MAX_WAYS+1;
+  }
+}
+
+int main(int argc, char* argv[]) {
+  cachesimconfigparser.setup();
+  cachesimconfig.reset();
+
+  argc--; argv++;
+
+  int n = cachesimconfigparser.parse(cachesimconfig, argc, argv);
+
+  if (n < 0) {
+    printbanner();
+    cerr << "Syntax is:", endl;
+    cerr << "  ptlcachesim [-options] memtrace", endl, endl;
+    cachesimconfigparser.printusage(cerr, cachesimconfig);
+    return 1;
+  }
+
+  bool lru = strequal(cachesimconfig.model, "lru");
+  bool mrc = strequal(cachesimconfig.model, "mrc");
+
+  if unlikely ((!lru) && (!mrc) && (!strequal(cachesimconfig.model, "hierarchy"))) {
+    cerr << "ptlcachesim: unknown cache model '", cachesimconfig.model, "'", endl;
+    return 1;
+  }
+
+  MemoryTraceReader reader;
+  if (!reader.open(argv[n])) return 2;
+
+  HierarchyCacheModel* hierarchy = null;
+  LRUCacheModel* lrumodel = null;
+
+  if (lru) {
+    lrumodel = new LRUCacheModel();
+    if (!lrumodel->init(cachesimconfig)) return 1;
+  } else if (mrc) {
+    if (!stackdist.open(cachesimconfig.line_size)) return 1;
+  } else {
+    hierarchy = new HierarchyCacheModel();
+  }
+
+  simstats.reset();
+  sim_cycle = 0;
+
+  MemoryTraceRecord rec;
+  W64 count = 0;
+
+  while ((count < cachesimconfig.limit) && reader.next(rec)) {
+    simstats.accesses[rec.type]++;
+    if (lru) lrumodel->access(rec, cachesimconfig);
+    else if (mrc) { if (rec.type != MEMTRACE_FETCH) stackdist.access(rec.physaddr); }
+    else hierarchy->access(rec, cachesimconfig.timing);
+    count++;
+  }
+
+  if (hierarchy && cachesimconfig.timing) simstats.cycles = sim_cycle;
+
+  cout << "Memory trace ", argv[n], " (", cachesimconfig.model, " model):", endl;
+  if (mrc) print_miss_ratio_curves(cout); else print_stats(cout);
+
+  cout.flush();
+  return 0;
+}
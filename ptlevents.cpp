@@ -0,0 +1,238 @@
+//
+// PTLsim: Cycle Accurate x86-64 Simulator
+// Event Stream Decoder
+//
+// Copyright 2008 Matt T. Yourst <yourst@yourst.com>
+//
+// Decodes the binary event stream written by ptlsim -event-stream,
+// filters it and prints the events in the same text format used
+// when the event log ring buffer is flushed to the logfile.
+//
+
+#include <globals.h>
+#include <ptlsim.h>
+#include <datastore.h>
+#include <logic.h>
+#include <branchpred.h>
+#include <dcache.h>
+
+//
+// As ooocore.cpp does in ptlsim, this object defines the tables
+// declared in ooocore.h (fu_names and friends) for oooevents.cpp.
+//
+#define INSIDE_OOOCORE
+#define DECLARE_STRUCTURES
+#include <ooocore.h>
+#include <seqcore.h>
+#include <eventstream.h>
+
+struct PTLeventsConfig {
+  W64 start_cycle;
+  W64 end_cycle;
+  W64 threadid;
+  W64 rip;
+  W64 uuid;
+  bool print_info;
+
+  void reset();
+};
+
+void PTLeventsConfig::reset() {
+  start_cycle = 0;
+  end_cycle = infinity;
+  threadid = infinity;
+  rip = infinity;
+  uuid = infinity;
+  print_info = 0;
+}
+
+PTLeventsConfig eventsconfig;
+ConfigurationParser<PTLeventsConfig> eventsconfigparser;
+
+template <>
+void ConfigurationParser<PTLeventsConfig>::setup() {
+  section("Filters");
+  add(start_cycle,                      "start",                     "Only print events at or after this cycle");
+  add(end_cycle,                        "end",                       "Only print events at or before this cycle");
+  add(threadid,                         "thread",                    "Only print events for this thread (ooo) or VCPU (seq)");
+  add(rip,                              "rip",                       "Only print events for uops at this RIP");
+  add(uuid,                             "uuid",                      "Only print events for the uop with this uuid");
+
+  section("Miscellaneous");
+  add(print_info,                       "info",                      "Print block and compression statistics instead of events");
+};
+
+struct EventStreamSymbol {
+  W64 value;
+  const char* name;
+};
+
+dynarray<EventStreamSymbol> symbols;
+
+//
+// Assist functions have different addresses in every PTLsim build, so the
+// simulator writes its assist table into the stream and we resolve them here.
+//
+int assist_index(assist_func_t assist) {
+  foreach (i, symbols.length) {
+    if (symbols.data[i].value == (W64)assist) return i;
+  }
+  return -1;
+}
+
+const char* assist_name(assist_func_t assist) {
+  int i = assist_index(assist);
+  return (i >= 0) ? symbols.data[i].name : "unknown";
+}
+
+static void add_symbols(const byte* p, const EventStreamBlockHeader& block) {
+  const byte* end = p + block.rawsize;
+
+  foreach (i, block.count) {
+    if unlikely ((p + sizeof(W64)) >= end) break;
+    EventStreamSymbol sym;
+    sym.value = *(const W64*)p;
+    p += sizeof(W64);
+    sym.name = strdup((const char*)p);
+    p += strlen(sym.name) + 1;
+    symbols.push(sym);
+  }
+}
+
+static inline bool filter(W64 cycle, W64 threadid, W64 rip, W64 uuid) {
+  if (cycle < eventsconfig.start_cycle) return false;
+  if (cycle > eventsconfig.end_cycle) return false;
+  if ((eventsconfig.threadid != infinity) && (threadid != eventsconfig.threadid)) return false;
+  if ((eventsconfig.rip != infinity) && (rip != eventsconfig.rip)) return false;
+  if ((eventsconfig.uuid != infinity) && (uuid != eventsconfig.uuid)) return false;
+  return true;
+}
+
+static W64 last_cycle = limits<W64>::max;
+
+static void print_ooo_events(ostream& os, const OutOfOrderModel::OutOfOrderCoreEvent* events, int count) {
+  foreach (i, count) {
+    const OutOfOrderModel::OutOfOrderCoreEvent* p = &events[i];
+    if unlikely (p->type == OutOfOrderModel::EVENT_INVALID) continue;
+    if (!filter(p->cycle, p->threadid, p->rip.rip, p->uuid)) continue;
+
+    if unlikely (p->cycle != last_cycle) {
+      last_cycle = p->cycle;
+      os << "Cycle ", last_cycle, ":", endl;
+    }
+
+    p->print(os);
+  }
+}
+
+static void print_seq_events(ostream& os, const SequentialCoreEvent* events, int count) {
+  foreach (i, count) {
+    const SequentialCoreEvent* p = &events[i];
+    if unlikely (p->type == EVENT_INVALID) continue;
+    if (!filter(p->cycle, p->coreid, p->rip, p->uuid)) continue;
+
+    if (p->type == EVENT_EXECUTE_BB) {
+      foreach (i, 24) os << "--------";
+      os << endl;
+    }
+
+    if unlikely (p->cycle != last_cycle) {
+      last_cycle = p->cycle;
+      os << "Cycle ", last_cycle, ":", endl;
+    }
+
+    p->print(os);
+  }
+}
+
+static const char* block_type_names[EVENT_STREAM_BLOCK_COUNT] = {"invalid", "ooocore", "seqcore", "symbols"};
+
+void printbanner() {
+  cerr << "//  ", endl;
+  cerr << "//  PTLevents: PTLsim event stream decoder", endl;
+  cerr << "//  Copyright 2008 Matt T. Yourst <yourst@yourst.com>", endl;
+  cerr << "//  ", endl;
+  cerr << endl;
+}
+
+int main(int argc, char* argv[]) {
+  eventsconfigparser.setup();
+  eventsconfig.reset();
+
+  argc--; argv++;
+
+  int n = eventsconfigparser.parse(eventsconfig, argc, argv);
+
+  if (n < 0) {
+    printbanner();
+    cerr << "Syntax is:", endl;
+    cerr << "  ptlevents [-options] eventstream", endl, endl;
+    eventsconfigparser.printusage(cerr, eventsconfig);
+    return 1;
+  }
+
+  EventStreamReader reader;
+  if (!reader.open(argv[n])) return 2;
+
+  W64 blocks = 0;
+  W64 records = 0;
+  W64 rawbytes = 0;
+  W64 storedbytes = 0;
+  W64 typecounts[EVENT_STREAM_BLOCK_COUNT];
+  setzero(typecounts);
+
+  if (!eventsconfig.print_info) cout << "#-------- Start of event log --------", endl;
+
+  EventStreamBlockHeader block;
+
+  for (;;) {
+    const byte* p = reader.next(block);
+    if (!p) break;
+
+    blocks++;
+    rawbytes += block.rawsize;
+    storedbytes += block.storedsize + sizeof(block);
+
+    switch (block.type) {
+    case EVENT_STREAM_BLOCK_SYMBOLS:
+      add_symbols(p, block);
+      break;
+    case EVENT_STREAM_BLOCK_OOOCORE:
+      if unlikely (block.recordsize != sizeof(OutOfOrderModel::OutOfOrderCoreEvent)) {
+        cerr << "ptlevents: record size ", block.recordsize, " does not match this build (", sizeof(OutOfOrderModel::OutOfOrderCoreEvent), " bytes)", endl;
+        return 3;
+      }
+      records += block.count;
+      if (!eventsconfig.print_info) print_ooo_events(cout, (const OutOfOrderModel::OutOfOrderCoreEvent*)p, block.count);
+      break;
+    case EVENT_STREAM_BLOCK_SEQCORE:
+      if unlikely (block.recordsize != sizeof(SequentialCoreEvent)) {
+        cerr << "ptlevents: record size ", block.recordsize, " does not match this build (", sizeof(SequentialCoreEvent), " bytes)", endl;
+        return 3;
+      }
+      records += block.count;
+      if (!eventsconfig.print_info) print_seq_events(cout, (const SequentialCoreEvent*)p, block.count);
+      break;
+    default:
+      cerr << "ptlevents: skipping block of unknown type ", block.type, endl;
+      break;
+    }
+
+    if (block.type < lengthof(typecounts)) typecounts[block.type] += block.count;
+  }
+
+  if (eventsconfig.print_info) {
+    cout << "Event stream ", argv[n], ":", endl;
+    cout << "  ", records, " events in ", blocks, " blocks", endl;
+    foreach (i, lengthof(typecounts)) {
+      if (typecounts[i]) cout << "    ", padstring(block_type_names[i], -10), " ", intstring(typecounts[i], 12), endl;
+    }
+    cout << "  ", rawbytes, " bytes uncompressed, ", storedbytes, " bytes in file (",
+      floatstring((storedbytes) ? ((double)rawbytes / (double)storedbytes) : 0, 0, 2), "x compression)", endl;
+  } else {
+    cout << "#-------- End of event log --------", endl;
+  }
+
+  cout.flush();
+  return 0;
+}
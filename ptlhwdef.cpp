@@ -185,6 +185,20 @@ const OpcodeInfo opinfo[OP_MAX_OPCODE] = {
   {"vsad",           OPCLASS_VEC_ALU,       opAB }, // sum of absolute differences
   {"vpack.us",       OPCLASS_VEC_ALU,       opAB }, // pack larger to smaller (unsigned saturation)
   {"vpack.ss",       OPCLASS_VEC_ALU,       opAB }, // pack larger to smaller (signed saturation)
+  {"vabs",           OPCLASS_VEC_ALU,       opB  }, // vector absolute value
+  {"vsign",          OPCLASS_VEC_ALU,       opAB }, // negate, zero or keep each element of <ra> by the sign of <rb>
+  {"vhadd",          OPCLASS_VEC_ALU,       opAB }, // horizontal add of adjacent pairs (<ra> pairs in low half, <rb> pairs in high half)
+  {"vhsub",          OPCLASS_VEC_ALU,       opAB }, // horizontal subtract of adjacent pairs
+  {"vhadd.ss",       OPCLASS_VEC_ALU,       opAB }, // horizontal add with signed saturation
+  {"vhsub.ss",       OPCLASS_VEC_ALU,       opAB }, // horizontal subtract with signed saturation
+  {"vmaddubs",       OPCLASS_VEC_ALU,       opAB }, // multiply unsigned by signed bytes and add adjacent pairs (signed saturation)
+  {"vmulhrs",        OPCLASS_VEC_ALU,       opAB }, // multiply and keep rounded high bits (signed)
+  {"vshufb",         OPCLASS_VEC_ALU,       opABC}, // each byte of <rc> selects a byte of <rb>:<ra> (or zero)
+  {"vsel",           OPCLASS_VEC_ALU,       opABC}, // select elements of <rb> where the element of <rc> is negative, else <ra>
+  {"vtest",          OPCLASS_VEC_ALU,       opAB }, // set ZF if <ra> is zero and CF if <rb> is zero
+  {"vminpos",        OPCLASS_VEC_ALU,       opAB }, // minimum unsigned word of <rb>:<ra> and its index
+  {"vmpsad",         OPCLASS_VEC_ALU,       opAB }, // sums of absolute differences of 4 byte windows of <ra> against <rb>
+  {"fround",         OPCLASS_FP_CONVERTFP,  opAB }, // round <rb> to integral (uop.cond is the mode; high single from <ra>)
 };
 
 const char* exception_names[EXCEPTION_COUNT] = {
@@ -425,6 +439,7 @@ stringbuf& operator <<(stringbuf& sb, const TransOpBase& op) {
   if ((ld|st) && (op.cachelevel > 0)) sbname << ".L", (char)('1' + op.cachelevel);
   if ((ld|st) && (op.locked)) sbname << ((ld) ? ".acq" : ".rel");
   if (op.internal) sbname << ".p";
+  if (op.vec128) sbname << ".128";
   if (op.eom) sbname << ".", (op.any_flags_in_insn ? "+" : "-");
 
   sb << padstring((char*)sbname, -12), " ", arch_reg_names[op.rd];
@@ -510,25 +525,106 @@ void BasicBlock::reset(const RIPVirtPhys& rip) {
 }
 
 //
-// This is explicitly defined instead of just using a
-// destructor since we do some fancy dynamic resizing
-// in the clone() method that c++ will croak on.
+// Cloned basic blocks come from a pool of size classes, each holding
+// up to a multiple of BB_POOL_GRANULARITY uops, with the synthops
+// array co-allocated right after the uops. BasicBlock::free() puts a
+// block back on its class's free list for the next clone of a similar
+// size, so the basic block cache churn caused by self modifying code
+// (and JITs) doesn't keep going back to ptl_mm_alloc() and ptl_mm_free().
+// Once freed, the block is *gone* and cannot be accessed ever again,
+// even if it is still in scope; only call free() on clone()d blocks.
+// The free lists are emptied when the memory manager asks the decoder
+// to reclaim.
 //
-// Once you call this, the basic block is *gone* and
-// cannot be accessed ever again, even if it is still
-// in scope. Don't call this with non-cloned() blocks.
+// The counters live here rather than in the global stats tree, since
+// this file is also linked into the tools; the decoder copies them
+// into stats.decoder.bbpool.
 //
+static const int BB_POOL_GRANULARITY = 8;
+static const int BB_POOL_CLASSES = (MAX_BB_UOPS*2 + BB_POOL_GRANULARITY-1) / BB_POOL_GRANULARITY;
+static const int BB_POOL_MAX_FREE_PER_CLASS = 1024;
+
+struct BasicBlockPool {
+  BasicBlock* freelist[BB_POOL_CLASSES];
+  int freecount[BB_POOL_CLASSES];
+
+  static size_t bytes_for_capacity(int capacity) {
+    return sizeof(BasicBlockBase) + (capacity * (sizeof(TransOp) + sizeof(uopimpl_func_t)));
+  }
+
+  BasicBlock* alloc(int count) {
+    int sizeclass = (max(count, 1) - 1) / BB_POOL_GRANULARITY;
+    BasicBlock* bb = freelist[sizeclass];
+
+    if likely (bb) {
+      freelist[sizeclass] = *(BasicBlock**)bb;
+      freecount[sizeclass]--;
+      bbpool_stats.reuses++;
+    } else {
+      bb = (BasicBlock*)malloc(bytes_for_capacity((sizeclass + 1) * BB_POOL_GRANULARITY));
+      bbpool_stats.allocs++;
+    }
+
+    bbpool_stats.free_blocks = total_free();
+    return bb;
+  }
+
+  void free(BasicBlock* bb, int capacity) {
+    assert(capacity);
+    int sizeclass = (capacity / BB_POOL_GRANULARITY) - 1;
+
+    if unlikely (freecount[sizeclass] >= BB_POOL_MAX_FREE_PER_CLASS) {
+      ::free(bb);
+      bbpool_stats.frees++;
+      return;
+    }
+
+    *(BasicBlock**)bb = freelist[sizeclass];
+    freelist[sizeclass] = bb;
+    freecount[sizeclass]++;
+    bbpool_stats.recycled++;
+    bbpool_stats.free_blocks = total_free();
+  }
+
+  void trim() {
+    foreach (i, BB_POOL_CLASSES) {
+      while (freelist[i]) {
+        BasicBlock* bb = freelist[i];
+        freelist[i] = *(BasicBlock**)bb;
+        ::free(bb);
+        bbpool_stats.trimmed++;
+      }
+      freecount[i] = 0;
+    }
+    bbpool_stats.free_blocks = 0;
+  }
+
+  W64 total_free() const {
+    W64 n = 0;
+    foreach (i, BB_POOL_CLASSES) n += freecount[i];
+    return n;
+  }
+};
+
+BasicBlockPool bbpool;
+BasicBlockPoolStats bbpool_stats;
+
+void trim_basic_block_pool() {
+  bbpool.trim();
+}
+
 void BasicBlock::free() {
-  if (synthops) delete[] synthops;
+  if (synthops && (synthops != inline_synthops())) delete[] synthops;
   synthops = null;
-  ::free(this);
+  bbpool.free(this, capacity);
 }
 
 BasicBlock* BasicBlock::clone() {
-  BasicBlock* bb = (BasicBlock*)malloc(sizeof(BasicBlockBase) + (count * sizeof(TransOp)));
+  BasicBlock* bb = bbpool.alloc(count);
 
   memcpy(bb, this, sizeof(BasicBlockBase));
 
+  bb->capacity = ceil(max((int)count, 1), BB_POOL_GRANULARITY);
   bb->synthops = null;
   // hashlink, mfnlo_loc, mfnhi_loc are always updated after cloning
   bb->hashlink.reset();
@@ -292,6 +292,12 @@ struct IssueState {
       W64 ripseq;
     } brreg;
 
+    // 128-bit vector uops (TransOp::vec128)
+    struct {
+      W64 lo;
+      W64 hi;
+    } vreg;
+
     SFR st;
   };
 };
@@ -833,6 +839,24 @@ struct ContextBase {
 #else
   // Always running in userspace version:
   byte running;
+
+  //
+  // Software TLB in front of the shadow page attribute tables in
+  // AddressSpace (kernel.h): direct mapped by virtual page number,
+  // it remembers pages recently found readable or writable, and
+  // pages already marked dirty for self modifying code detection.
+  // Flushed whenever the address space attributes change.
+  //
+  static const int SOFT_TLB_SIZE = 64;
+  W64 soft_tlb_read[SOFT_TLB_SIZE];
+  W64 soft_tlb_write[SOFT_TLB_SIZE];
+  W64 soft_tlb_dirty[SOFT_TLB_SIZE];
+
+  void flush_soft_tlb() {
+    memset(soft_tlb_read, 0xff, sizeof(soft_tlb_read));
+    memset(soft_tlb_write, 0xff, sizeof(soft_tlb_write));
+    memset(soft_tlb_dirty, 0xff, sizeof(soft_tlb_dirty));
+  }
 #endif
 
   inline void reset() {
@@ -840,6 +864,8 @@ struct ContextBase {
 #ifdef PTLSIM_HYPERVISOR
     setzero(cached_pte_virt);
     setzero(cached_pte);
+#else
+    flush_soft_tlb();
 #endif
 
     exception = 0;
@@ -1161,6 +1187,20 @@ enum {
   OP_vsad,
   OP_vpack_us,
   OP_vpack_ss,
+  OP_vabs,
+  OP_vsign,
+  OP_vhadd,
+  OP_vhsub,
+  OP_vhadd_ss,
+  OP_vhsub_ss,
+  OP_vmaddubs,
+  OP_vmulhrs,
+  OP_vshufb,
+  OP_vsel,
+  OP_vtest,
+  OP_vminpos,
+  OP_vmpsad,
+  OP_fround,
   OP_MAX_OPCODE,
 };
 
@@ -1324,7 +1364,9 @@ struct TransOpBase {
   // Index in basic block
   byte bbindex;
   // Misc info (terminal writer of targets in this insn, etc)
-  byte final_insn_in_bb:1, final_arch_in_insn:1, final_flags_in_insn:1, any_flags_in_insn:1, pad:3, marked:1;
+  // (vec128: rd, ra and rb name the low halves of 128-bit register pairs like xmml0/xmmh0)
+  // (lcp: the x86 insn has a length changing prefix, from the predecoder)
+  byte final_insn_in_bb:1, final_arch_in_insn:1, final_flags_in_insn:1, any_flags_in_insn:1, fused:1, vec128:1, lcp:1, marked:1;
   // Immediates
   W64s rbimm;
   W64s rcimm;
@@ -1362,6 +1404,14 @@ struct BasicBlock;
 
 typedef void (*uopimpl_func_t)(IssueState& state, W64 ra, W64 rb, W64 rc, W16 raflags, W16 rbflags, W16 rcflags);
 
+//
+// 128-bit vector uops read each operand as two adjacent 64-bit
+// registers (ra[0] = low half, ra[1] = high half) and return the
+// result in state.vreg. They are stored in BasicBlock::synthops
+// cast to uopimpl_func_t.
+//
+typedef void (*uopimpl_vec128_func_t)(IssueState& state, const W64* ra, const W64* rb);
+
 
 //
 // List of all BBs on a physical page (for SMC invalidation)
@@ -1472,6 +1522,7 @@ struct BasicBlockBase {
   W16 tagcount;
   W16 memcount;
   W16 storecount;
+  W16 capacity; // uops (and synthops) allocated in a pooled clone, 0 if not cloned
   byte type:4, repblock:1, invalidblock:1, call:1, ret:1;
   byte marked:1, mfence:1, x87:1, sse:1, nondeterministic:1, brtype:3;
   W64 usedregs;
@@ -1502,8 +1553,24 @@ struct BasicBlock: public BasicBlockBase {
   BasicBlock* clone();
   void free();
   void use(W64 counter) { lastused = counter; };
+
+  // Synthops array co-allocated after the uops of a pooled clone
+  uopimpl_func_t* inline_synthops() { return (capacity) ? (uopimpl_func_t*)&transops[capacity] : null; }
 };
 
+struct BasicBlockPoolStats {
+  W64 allocs;
+  W64 reuses;
+  W64 recycled;
+  W64 frees;
+  W64 trimmed;
+  W64 free_blocks;
+};
+
+extern BasicBlockPoolStats bbpool_stats;
+
+void trim_basic_block_pool();
+
 ostream& operator <<(ostream& os, const BasicBlock& bb);
 
 //
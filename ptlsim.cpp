@@ -11,6 +11,12 @@
 #define CPT_STATS
 #include <stats.h>
 #undef CPT_STATS
+#include <ripprof.h>
+#include <simpoint.h>
+#include <memtrace.h>
+#include <stackdist.h>
+#include <eventstream.h>
+#include <decode.h>
 
 #include <elf.h>
 
@@ -46,6 +52,12 @@ void PTLsimConfig::reset() {
 
   quiet = 0;
   core_name = "ooo";
+  vec128_uops = 0;
+  optimize_uops = 1;
+  fuse_cmp_jcc = 0;
+  speculative_translate = 0;
+  cpuid_ecx_mask = 0xffffffff;
+  cpuid_edx_mask = 0xffffffff;
   log_filename = "ptlsim.log";
   loglevel = 0;
   start_log_at_iteration = 0;
@@ -57,10 +69,14 @@ void PTLsimConfig::reset() {
   mm_log_buffer_size = 16384;
   enable_inline_mm_logging = 0;
   enable_mm_validate = 0;
+  huge_pages = 0;
+  mm_profile_filename.reset();
 
   event_log_enabled = 0;
   event_log_ring_buffer_size = 32768;
   flush_event_log_every_cycle = 0;
+  event_stream_filename.reset();
+  event_stream_compress = 1;
   log_backwards_from_trigger_rip = INVALIDRIP;
   dump_state_now = 0;
   abort_at_end = 0;
@@ -69,7 +85,16 @@ void PTLsimConfig::reset() {
 
   stats_filename.reset();
   snapshot_cycles = infinity;
+  snapshot_keyframe = 0;
   snapshot_now.reset();
+  ripprof_filename.reset();
+  bbv_filename.reset();
+  bbv_interval = 100000000;
+  simpoints_filename.reset();
+  simpoint_checkpoint_prefix.reset();
+  memtrace_filename.reset();
+  stack_distance = 0;
+  stack_distance_line_size = 64;
 
 #ifndef PTLSIM_HYPERVISOR
   // Starting Point
@@ -77,6 +102,8 @@ void PTLsimConfig::reset() {
   include_dyn_linker = 1;
   trigger_mode = 0;
   pause_at_startup = 0;
+  save_checkpoint_filename.reset();
+  restore_checkpoint_filename.reset();
 #endif
 
   stop_at_user_insns = infinity;
@@ -111,6 +138,9 @@ void PTLsimConfig::reset() {
   validation_start_cycle = 0;
 
   perfect_cache = 0;
+  ooo_optimize_uops = 0;
+  uop_cache = 0;
+  predecode_model = 0;
 
   dumpcode_filename = "test.dat";
   dump_at_end = 0;
@@ -120,6 +150,11 @@ void PTLsimConfig::reset() {
 #ifndef PTLSIM_HYPERVISOR
   sequential_mode_insns = 0;
   exit_after_fullsim = 0;
+  fork_config_list.reset();
+  fork_max_jobs = 0;
+
+  syscall_record_filename.reset();
+  syscall_replay_filename.reset();
 #endif
 }
 
@@ -142,6 +177,12 @@ void ConfigurationParser<PTLsimConfig>::setup() {
   section("Simulation Control");
 
   add(core_name,                    "core",                 "Run using specified core (-core <corename>)");
+  add(vec128_uops,                  "vec128",               "Decode packed SSE instructions into single 128-bit vector uops (sequential core only)");
+  add(optimize_uops,                "optimize-uops",        "Optimize basic blocks for the sequential core (flag liveness, copy propagation, dead uop elimination)");
+  add(fuse_cmp_jcc,                 "fuse-cmp-jcc",         "Fuse cmp or test with a following conditional branch into a single br.sub or br.and uop");
+  add(speculative_translate,        "speculative-translate", "Translate the successors of each new basic block on a background thread");
+  add(cpuid_ecx_mask,               "cpuid-ecx-mask",       "Clear the CPUID level 1 %ecx feature bits (SSE3, SSSE3, ...) that are zero in this mask");
+  add(cpuid_edx_mask,               "cpuid-edx-mask",       "Clear the CPUID level 1 %edx feature bits (SSE, SSE2, ...) that are zero in this mask");
 
   section("General Logging Control");
   add(quiet,                        "quiet",                "Do not print PTLsim system information banner");
@@ -158,11 +199,15 @@ void ConfigurationParser<PTLsimConfig>::setup() {
   add(mm_log_buffer_size,           "mm-logbuf-size",       "Size of PTLsim memory manager log buffer (in events, not bytes)");
   add(enable_inline_mm_logging,     "mm-log-inline",        "Print every memory manager request in the main log file");
   add(enable_mm_validate,           "mm-validate",          "Validate every memory manager request against internal structures (slow)");
+  add(mm_profile_filename,          "mm-profile",           "Profile PTLsim heap usage by caller and write the heap profile to this file at every snapshot");
+  add(huge_pages,                   "huge-pages",           "Back the PTLsim heap and core structures with 2 MB host pages where possible (fewer host TLB misses)");
 
   section("Event Ring Buffer Logging Control");
   add(event_log_enabled,            "ringbuf",              "Log all core events to the ring buffer for backwards-in-time debugging");
   add(event_log_ring_buffer_size,   "ringbuf-size",         "Core event log ring buffer size: only save last <ringbuf> entries");
   add(flush_event_log_every_cycle,  "flush-events",         "Flush event log ring buffer to logfile after every cycle");
+  add(event_stream_filename,        "event-stream",         "Stream raw core events to this file instead of formatting them in the logfile (decode with ptlevents)");
+  add(event_stream_compress,        "event-stream-compress","Compress the event stream");
   add(log_backwards_from_trigger_rip,"ringbuf-trigger-rip", "Print event ring buffer when first uop in this rip is committed");
   add(log_trigger_virt_addr_start,   "ringbuf-trigger-virt-start", "Print event ring buffer when any virtual address in this range is touched");
   add(log_trigger_virt_addr_end,     "ringbuf-trigger-virt-end",   "Print event ring buffer when any virtual address in this range is touched");
@@ -170,7 +215,16 @@ void ConfigurationParser<PTLsimConfig>::setup() {
   section("Statistics Database");
   add(stats_filename,               "stats",                "Statistics data store hierarchy root");
   add(snapshot_cycles,              "snapshot-cycles",      "Take statistical snapshot and reset every <snapshot> cycles");
+  add(snapshot_keyframe,            "snapshot-keyframe",    "Store snapshots as deltas from the previous one, with a full copy every <n> snapshots (0 = always full)");
   add(snapshot_now,                 "snapshot-now",         "Take statistical snapshot immediately, using specified name");
+  add(ripprof_filename,             "ripprof",              "Write per-RIP mispredict and cache miss profile to this file at every snapshot");
+  add(bbv_filename,                 "bbv",                  "Write SimPoint basic block vectors (.bb format) from the sequential core to this file");
+  add(bbv_interval,                 "bbv-interval",         "Basic block vector interval size in user instructions");
+  add(simpoints_filename,           "simpoints",            "Read SimPoint simulation points (interval and cluster ID per line) from this file");
+  add(simpoint_checkpoint_prefix,   "simpoint-checkpoint",  "Checkpoint the user process to <prefix>.<clusterid> at the start of each simulation point");
+  add(memtrace_filename,            "memtrace",             "Write every load, store and fetch on the sequential core to this memory trace (for ptlcachesim)");
+  add(stack_distance,               "stack-distance",       "Collect LRU stack distance histograms (miss ratio curves) of sequential core data accesses");
+  add(stack_distance_line_size,     "stack-distance-line-size", "Cache line size in bytes for stack distance histograms");
 #ifndef PTLSIM_HYPERVISOR
   // Userspace only
   section("Start Point");
@@ -178,6 +232,8 @@ void ConfigurationParser<PTLsimConfig>::setup() {
   add(include_dyn_linker,           "excludeld",            "Exclude dynamic linker execution");
   add(trigger_mode,                 "trigger",              "Trigger mode: wait for user process to do simcall before entering PTL mode");
   add(pause_at_startup,             "pause-at-startup",     "Pause for N seconds after starting up (to allow debugger to attach)");
+  add(save_checkpoint_filename,     "save-checkpoint",      "Save a checkpoint of the user process to this file when first switching to simulation mode");
+  add(restore_checkpoint_filename,  "restore-checkpoint",   "Restore the user process from this checkpoint file and start simulating immediately");
 #endif
 
   section("Trace Stop Point");
@@ -217,6 +273,9 @@ void ConfigurationParser<PTLsimConfig>::setup() {
 
   section("Out of Order Core (ooocore)");
   add(perfect_cache,                "perfect-cache",        "Perfect cache performance: all loads and stores hit in L1");
+  add(ooo_optimize_uops,            "ooo-optimize-uops",    "Optimize basic blocks for the out of order core too (uop-optimizing frontend experiment)");
+  add(uop_cache,                    "uop-cache",            "Model a decoded uop cache in front of the legacy x86 decoders");
+  add(predecode_model,              "predecode-model",      "Model the x86 predecoder: fetch window and width limits and length changing prefix stalls");
 
   section("Miscellaneous");
   add(dumpcode_filename,            "dumpcode",             "Save page of user code at final rip to file <dumpcode>");
@@ -227,6 +286,12 @@ void ConfigurationParser<PTLsimConfig>::setup() {
   // Userspace only
   add(sequential_mode_insns,        "seq",                  "Run in sequential mode for <seq> instructions before switching to out of order");
   add(exit_after_fullsim,           "exitend",              "Kill the thread after full simulation completes rather than going native");
+  add(fork_config_list,             "fork-configs",         "Fork one child per line of options in this file when simulation starts, each simulating its own configuration");
+  add(fork_max_jobs,                "fork-jobs",            "Maximum number of -fork-configs children running at once (0 = no limit)");
+
+  section("Syscall Record and Replay");
+  add(syscall_record_filename,      "syscall-record",       "Record results and memory side effects of all forwarded syscalls to this file");
+  add(syscall_replay_filename,      "syscall-replay",       "Satisfy forwarded syscalls from this log (made by -syscall-record) without calling the host");
 #endif
 };
 
@@ -301,6 +366,13 @@ void print_usage(int argc, char** argv) {
 }
 
 stringbuf current_stats_filename;
+stringbuf current_ripprof_filename;
+stringbuf current_mm_profile_filename;
+ostream mm_profile_file;
+stringbuf current_bbv_filename;
+stringbuf current_simpoints_filename;
+stringbuf current_memtrace_filename;
+stringbuf current_event_stream_filename;
 stringbuf current_log_filename;
 stringbuf current_bbcache_dump_filename;
 
@@ -348,6 +420,18 @@ void capture_stats_snapshot(const char* name) {
 
   stats.snapshot_uuid = statswriter.next_uuid();
   statswriter.write(&stats, name);
+  ripprof.write(stats.snapshot_uuid, sim_cycle, name);
+
+  if unlikely (mm_profile_file) {
+    DataStoreNode* ds = new DataStoreNode("mm");
+    ptl_mm_capture_stats(*ds);
+    mm_profile_file << "Snapshot ", stats.snapshot_uuid;
+    if (name) mm_profile_file << " named ", name;
+    mm_profile_file << " at cycle ", sim_cycle, ":", endl;
+    ds->print(mm_profile_file);
+    mm_profile_file << endl, flush;
+    delete ds;
+  }
 }
 
 void flush_stats() {
@@ -371,16 +455,54 @@ bool handle_config_change(PTLsimConfig& config, int argc, char** argv) {
     // Can also use "-logfile /dev/fd/1" to send to stdout (or /dev/fd/2 for stderr):
     statswriter.open(config.stats_filename, &_binary_ptlsim_dst_start,
                      &_binary_ptlsim_dst_end - &_binary_ptlsim_dst_start,
-                     sizeof(PTLsimStats));
+                     sizeof(PTLsimStats), config.snapshot_keyframe);
     current_stats_filename = config.stats_filename;
   }
 
+  if (config.mm_profile_filename.set() && (config.mm_profile_filename != current_mm_profile_filename)) {
+    mm_profile_file.open(config.mm_profile_filename);
+    ptl_mm_set_profiling(true);
+    current_mm_profile_filename = config.mm_profile_filename;
+  }
+
+  if (config.ripprof_filename.set() && (config.ripprof_filename != current_ripprof_filename)) {
+    ripprof.open(config.ripprof_filename);
+    current_ripprof_filename = config.ripprof_filename;
+  }
+
+  if ((config.bbv_filename.set() || config.simpoints_filename.set()) &&
+      ((config.bbv_filename != current_bbv_filename) || (config.simpoints_filename != current_simpoints_filename))) {
+    // Simulation points are counted in the same intervals as the vectors
+    bbvprof.open((config.bbv_filename.set()) ? (char*)config.bbv_filename : null, config.bbv_interval);
+    if (config.simpoints_filename.set())
+      bbvprof.load_simpoints(config.simpoints_filename, (config.simpoint_checkpoint_prefix.set()) ? (char*)config.simpoint_checkpoint_prefix : null);
+    current_bbv_filename = config.bbv_filename;
+    current_simpoints_filename = config.simpoints_filename;
+  }
+
+  if (config.memtrace_filename.set() && (config.memtrace_filename != current_memtrace_filename)) {
+    memtrace.open(config.memtrace_filename);
+    current_memtrace_filename = config.memtrace_filename;
+  }
+
+  if (config.stack_distance && (!stackdist.enabled())) stackdist.open(config.stack_distance_line_size);
+
   logfile.setbuf(config.log_buffer_size);
 
   if ((config.loglevel > 0) & (config.start_log_at_rip == INVALIDRIP) & (config.start_log_at_iteration == infinity)) {
     config.start_log_at_iteration = 0;
   }
 
+  if (config.event_stream_filename.set() && (config.event_stream_filename != current_event_stream_filename)) {
+    if (eventstream.open(config.event_stream_filename, config.event_stream_compress)) {
+      // Assist addresses in the events are only meaningful for this build of PTLsim
+      foreach (i, ASSIST_COUNT) eventstream.add_symbol((W64)assistid_to_func[i], assist_names[i]);
+    }
+    current_event_stream_filename = config.event_stream_filename;
+  }
+
+  if (eventstream.enabled()) config.event_log_enabled = 1;
+
   // Force printing every cycle if loglevel >= 6:
   if (config.loglevel >= 6) {
     config.event_log_enabled = 1;
@@ -413,6 +535,11 @@ bool handle_config_change(PTLsimConfig& config, int argc, char** argv) {
   ptl_mm_set_logging(config.mm_logfile.set() ? (char*)(config.mm_logfile) : null, config.mm_log_buffer_size, config.enable_inline_mm_logging);
   ptl_mm_set_validate(config.enable_mm_validate);
 
+  if unlikely (!ptl_mm_set_huge_pages(config.huge_pages)) {
+    logfile << "Warning: -huge-pages is not supported in this build; ignored", endl;
+    config.huge_pages = 0;
+  }
+
 #ifdef __x86_64__
   config.start_log_at_rip = signext64(config.start_log_at_rip, 48);
   config.log_backwards_from_trigger_rip = signext64(config.log_backwards_from_trigger_rip, 48);
@@ -463,6 +590,7 @@ void PTLsimMachine::update_stats(PTLsimStats& stats) { return; }
 void PTLsimMachine::dump_state(ostream& os) { return; }
 void PTLsimMachine::flush_tlb(Context& ctx) { return; }
 void PTLsimMachine::flush_tlb_virt(Context& ctx, Waddr virtaddr) { return; }
+void PTLsimMachine::invalidate_code_page(Waddr mfn) { return; }
 
 void PTLsimMachine::addmachine(const char* name, PTLsimMachine* machine) {
   if unlikely (!machinetable) {
@@ -471,6 +599,18 @@ void PTLsimMachine::addmachine(const char* name, PTLsimMachine* machine) {
   machinetable->add(name, machine);
 }
 
+//
+// The basic block cache has discarded the code on page <mfn>: tell
+// every core model (not just the current one), since each may cache
+// decoded code from that page in its own structures.
+//
+void PTLsimMachine::invalidate_code_page_all(Waddr mfn) {
+  if unlikely (!machinetable) return;
+  Hashtable<const char*, PTLsimMachine*, 1>::Iterator iter(machinetable);
+  KeyValuePair<const char*, PTLsimMachine*>* kvp;
+  while (kvp = iter.next()) kvp->value->invalidate_code_page(mfn);
+}
+
 PTLsimMachine* PTLsimMachine::getmachine(const char* name) {
   if unlikely (!machinetable) return null;
   PTLsimMachine** p = machinetable->get(name);
@@ -542,7 +682,166 @@ void update_progress() {
   }
 }
 
+#ifndef PTLSIM_HYPERVISOR
+//
+// Design space exploration: rather than restarting the program and
+// fast forwarding it once per configuration, fork one child for each
+// line of options in the -fork-configs list file. The children share
+// the fast forwarded address space copy-on-write, apply their options
+// on top of the current configuration, and simulate independently.
+//
+// Unless a variant line sets its own -stats or -logfile, child N writes
+// to <stats>.N and <logfile>.N. Other output files (-ripprof, -bbv,
+// -event-stream and so on) are closed before forking: variants that
+// want them must name their own files.
+//
+// Returns in each child, with the variant's options applied. The
+// parent never returns: it collects the exit status of every child
+// and then exits, with a non-zero status if any child failed.
+//
+static void fork_config_variants() {
+  dynarray<char*> variants;
+  stringbuf listarg;
+  listarg << "@", config.fork_config_list;
+  expand_command_list(variants, listarg);
+
+  if (!variants.length) {
+    logfile << "No configurations found in fork list '", config.fork_config_list, "'", endl;
+    cerr << "ptlsim: no configurations found in fork list '", config.fork_config_list, "'", endl;
+    return;
+  }
+
+  int maxjobs = (config.fork_max_jobs) ? config.fork_max_jobs : variants.length;
+
+  logfile << "Forking ", variants.length, " configuration variants (", maxjobs, " at once) at ", total_user_insns_committed, " user commits", endl;
+  cerr << "Forking ", variants.length, " configuration variants (", maxjobs, " at once)", endl, flush;
+
+  //
+  // Write out the fast forward statistics, then close every output
+  // stream, so the children never flush or seek shared descriptors
+  //
+  capture_stats_snapshot("fork");
+  statswriter.close();
+  ripprof.close();
+  mm_profile_file.close();
+  bbvprof.close();
+  memtrace.close();
+  eventstream.close();
+  logfile.flush();
+  cerr.flush();
+
+  current_stats_filename.reset();
+  current_ripprof_filename.reset();
+  current_mm_profile_filename.reset();
+  current_bbv_filename.reset();
+  current_simpoints_filename.reset();
+  current_memtrace_filename.reset();
+  current_event_stream_filename.reset();
+
+  dynarray<int> pids;
+  int next = 0;
+  int running = 0;
+  int failures = 0;
+
+  while ((next < variants.length) | (running > 0)) {
+    if ((next < variants.length) & (running < maxjobs)) {
+      int pid = sys_fork();
+
+      if (!pid) {
+        // Child: apply the variant's options on top of the current ones
+        stringbuf basestats;
+        stringbuf baselog;
+        basestats << config.stats_filename;
+        baselog << config.log_filename;
+
+        configparser.parse(config, variants[next]);
+
+        if (config.stats_filename.set() && (config.stats_filename == basestats)) {
+          config.stats_filename.reset();
+          config.stats_filename << basestats, ".", next;
+        }
+
+        if (config.log_filename.set() && (config.log_filename == baselog)) {
+          config.log_filename.reset();
+          config.log_filename << baselog, ".", next;
+        }
+
+        handle_config_change(config);
+
+        logfile << "Variant ", next, " (pid ", sys_getpid(), ") running with options '", variants[next], "'", endl;
+        return;
+      }
+
+      if (pid < 0) {
+        logfile << "Cannot fork variant ", next, " (rc ", pid, ")", endl;
+        failures++;
+      } else {
+        running++;
+      }
+
+      pids.push(pid);
+      next++;
+      continue;
+    }
+
+    int status;
+    int pid = sys_wait4(-1, &status, 0, null);
+    if (pid < 0) break;
+
+    int n = 0;
+    while ((n < pids.length) && (pids[n] != pid)) n++;
+    if (n == pids.length) continue;
+
+    running--;
+    failures += (!(WIFEXITED(status) && (WEXITSTATUS(status) == 0)));
+
+    logfile << "Variant ", n, " (pid ", pid, ", options '", variants[n], "') ";
+    if (WIFEXITED(status))
+      logfile << "exited with status ", WEXITSTATUS(status), endl;
+    else logfile << "was killed by signal ", WTERMSIG(status), endl;
+    logfile.flush();
+  }
+
+  logfile << "All ", variants.length, " variants finished: ", failures, " failed", endl;
+  cerr << "ptlsim: all ", variants.length, " variants finished: ", failures, " failed", endl, flush;
+
+  logfile.close();
+  sys_exit((failures) ? 1 : 0);
+}
+#endif
+
 bool simulate(const char* machinename) {
+#ifndef PTLSIM_HYPERVISOR
+  //
+  // Fast forward to the region of interest on the sequential core
+  //
+  if unlikely (config.sequential_mode_insns && (!strequal(machinename, "seq"))) {
+    W64 stop_at_user_insns = config.stop_at_user_insns;
+    config.stop_at_user_insns = min(stop_at_user_insns, total_user_insns_committed + config.sequential_mode_insns);
+    config.sequential_mode_insns = 0;
+
+    // Fork only once the shared fast forward prefix is done (below, in this call)
+    stringbuf fork_config_list;
+    if (config.fork_config_list.set()) fork_config_list = config.fork_config_list;
+    config.fork_config_list.reset();
+
+    logfile << "Fast forwarding to ", config.stop_at_user_insns, " user commits in sequential mode", endl;
+    simulate("seq");
+    capture_stats_snapshot("fastforward");
+
+    config.stop_at_user_insns = stop_at_user_insns;
+    if (fork_config_list.set()) config.fork_config_list = fork_config_list;
+    if (total_user_insns_committed >= config.stop_at_user_insns) return 0;
+  }
+
+  if unlikely (config.fork_config_list.set()) {
+    fork_config_variants();
+    config.fork_config_list.reset();
+    // A variant may have selected a different core
+    machinename = config.core_name;
+  }
+#endif
+
   PTLsimMachine* machine = PTLsimMachine::getmachine(machinename);
 
   if (!machine) {
@@ -560,6 +859,23 @@ bool simulate(const char* machinename) {
     machine->initialized = 1;
   }
 
+  //
+  // Only the sequential core executes 128-bit vector uops, and the
+  // uop optimizer is set separately for the sequential and out of order
+  // cores, so any basic blocks decoded for the other mode must go when
+  // switching. The same goes for blocks decoded before -fuse-cmp-jcc
+  // was changed.
+  //
+  bool seq = strequal(machinename, "seq");
+  bool vec128 = config.vec128_uops && seq;
+  bool optimize = (seq) ? config.optimize_uops : config.ooo_optimize_uops;
+  if unlikely ((vec128 != decode_vec128_uops) | (optimize != decode_optimize_uops) | (config.fuse_cmp_jcc != decode_fuse_cmp_jcc)) {
+    bbcache.flush();
+    decode_vec128_uops = vec128;
+    decode_optimize_uops = optimize;
+    decode_fuse_cmp_jcc = config.fuse_cmp_jcc;
+  }
+
   logfile << "Switching to simulation core '", machinename, "'...", endl, flush;
   cerr <<  "Switching to simulation core '", machinename, "'...", endl, flush;
   logfile << "Stopping after ", config.stop_at_user_insns, " commits", endl, flush;
@@ -616,6 +932,12 @@ void shutdown_subsystems() {
   //
   shutdown_uops();
   shutdown_decode();
+  ripprof.close();
+  mm_profile_file.close();
+  bbvprof.close();
+  memtrace.close();
+  stackdist.close();
+  eventstream.close();
   ptl_mm_flush_logging();
 }
 
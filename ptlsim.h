@@ -27,6 +27,17 @@ extern W64 total_user_insns_committed;
 
 void user_process_terminated(int rc);
 
+//
+// Host helper threads, identified by current_thread_id() as
+// MAX_CONTEXTS and up. Only userspace PTLsim on x86-64 has
+// them: elsewhere start_helper_thread() always fails (-1).
+//
+typedef void (*helper_thread_func_t)(void* arg);
+int start_helper_thread(helper_thread_func_t func, void* arg, Waddr stacksize);
+bool helper_thread_running(int id);
+void helper_thread_wait(volatile W32& word, W32 value);
+void helper_thread_wake(volatile W32& word);
+
 ostream& print_user_context(ostream& os, const UserContext& ctx, int width = 4);
 
 static const int MAX_TRANSOP_BUFFER_SIZE = 4;
@@ -43,6 +54,8 @@ struct PTLsimMachine {
   virtual void dump_state(ostream& os);
   virtual void flush_tlb(Context& ctx);
   virtual void flush_tlb_virt(Context& ctx, Waddr virtaddr);
+  virtual void invalidate_code_page(Waddr mfn);
+  static void invalidate_code_page_all(Waddr mfn);
   static void addmachine(const char* name, PTLsimMachine* machine);
   static PTLsimMachine* getmachine(const char* name);
   static PTLsimMachine* getcurrent();
@@ -110,6 +123,7 @@ void init_uops();
 void shutdown_uops();
 uopimpl_func_t get_synthcode_for_uop(int op, int size, bool setflags, int cond, int extshift, bool except, bool internal);
 uopimpl_func_t get_synthcode_for_cond_branch(int opcode, int cond, int size, bool except);
+uopimpl_vec128_func_t get_synthcode_for_vec128_uop(int op, int size, int cond);
 void synth_uops_for_bb(BasicBlock& bb);
 struct PTLsimStats;
 void print_banner(ostream& os, const PTLsimStats& stats, int argc = 0, char** argv = null);
@@ -139,6 +153,12 @@ struct PTLsimConfig {
 #endif
 
   stringbuf core_name;
+  bool vec128_uops;
+  bool optimize_uops;
+  bool fuse_cmp_jcc;
+  bool speculative_translate;
+  W64 cpuid_ecx_mask;
+  W64 cpuid_edx_mask;
 
   // Logging
   bool quiet;
@@ -153,11 +173,15 @@ struct PTLsimConfig {
   W64 mm_log_buffer_size;
   bool enable_inline_mm_logging;
   bool enable_mm_validate;
+  bool huge_pages;
+  stringbuf mm_profile_filename;
 
   // Event Logging
   bool event_log_enabled;
   W64 event_log_ring_buffer_size;
   bool flush_event_log_every_cycle;
+  stringbuf event_stream_filename;
+  bool event_stream_compress;
   W64 log_backwards_from_trigger_rip;
   bool dump_state_now;
   bool abort_at_end;
@@ -168,7 +192,16 @@ struct PTLsimConfig {
   // Statistics Database
   stringbuf stats_filename;
   W64 snapshot_cycles;
+  W64 snapshot_keyframe;
   stringbuf snapshot_now;
+  stringbuf ripprof_filename;
+  stringbuf bbv_filename;
+  W64 bbv_interval;
+  stringbuf simpoints_filename;
+  stringbuf simpoint_checkpoint_prefix;
+  stringbuf memtrace_filename;
+  bool stack_distance;
+  W64 stack_distance_line_size;
 
 #ifndef PTLSIM_HYPERVISOR
   // Starting Point
@@ -176,6 +209,8 @@ struct PTLsimConfig {
   bool include_dyn_linker;
   bool trigger_mode;
   W64 pause_at_startup;
+  stringbuf save_checkpoint_filename;
+  stringbuf restore_checkpoint_filename;
 #endif
 
   // Stopping Point
@@ -213,6 +248,9 @@ struct PTLsimConfig {
 
   // Out of order core features
   bool perfect_cache;
+  bool ooo_optimize_uops;
+  bool uop_cache;
+  bool predecode_model;
 
   // Other info
   stringbuf dumpcode_filename;
@@ -224,6 +262,12 @@ struct PTLsimConfig {
   // Simulation Mode
   W64 sequential_mode_insns;
   bool exit_after_fullsim;
+  stringbuf fork_config_list;
+  W64 fork_max_jobs;
+
+  // Syscall Record and Replay
+  stringbuf syscall_record_filename;
+  stringbuf syscall_replay_filename;
 #endif
   void reset();
 };
@@ -9,6 +9,8 @@
 #include <datastore.h>
 #define PTLSIM_PUBLIC_ONLY
 #include <ptlhwdef.h>
+#include <ripprof.h>
+#include <elf.h>
 
 struct PTLstatsConfig {
   stringbuf mode_subtree;
@@ -17,9 +19,13 @@ struct PTLstatsConfig {
   stringbuf mode_collect;
   stringbuf mode_collect_sum;
   stringbuf mode_collect_average;
+  stringbuf mode_collect_weighted;
   stringbuf mode_table;
   stringbuf mode_slice;
   stringbuf mode_slice_graph;
+  stringbuf mode_hotspots;
+  stringbuf mode_cpistack;
+  stringbuf mode_export;
 
   stringbuf table_row_names;
   stringbuf table_col_names;
@@ -57,9 +63,19 @@ struct PTLstatsConfig {
   
   bool invert_gains;
 
+  W64 hotspots_top;
+  stringbuf elf_filename;
+
+  stringbuf simpoint_weights_filename;
+
   bool print_datastore_info;
   bool print_template;
 
+  bool export_csv;
+  bool export_delta;
+
+  W64 jobs;
+
   void reset();
 };
 
@@ -70,9 +86,13 @@ void PTLstatsConfig::reset() {
   mode_collect.reset();
   mode_collect_sum.reset();
   mode_collect_average.reset();
+  mode_collect_weighted.reset();
   mode_table.reset();
   mode_slice.reset();
   mode_slice_graph.reset();
+  mode_hotspots.reset();
+  mode_cpistack.reset();
+  mode_export.reset();
 
   table_row_names.reset();
   table_col_names.reset();
@@ -110,8 +130,18 @@ void PTLstatsConfig::reset() {
 
   invert_gains = 0;
 
+  hotspots_top = 25;
+  elf_filename.reset();
+
+  simpoint_weights_filename.reset();
+
   print_datastore_info = 0;
   print_template = 0;
+
+  export_csv = 0;
+  export_delta = 0;
+
+  jobs = 1;
 }
 
 PTLstatsConfig config;
@@ -124,11 +154,15 @@ void ConfigurationParser<PTLstatsConfig>::setup() {
   add(mode_collect,                     "collect",                   "Collect specific statistic from multiple data stores");
   add(mode_collect_sum,                 "collectsum",                "Sum of same tree in all data stores");
   add(mode_collect_average,             "collectaverage",            "Average of same tree in all data stores");
+  add(mode_collect_weighted,            "collectweighted",           "Average of same tree in all data stores for one interval, weighted by -simpoint-weights");
   add(mode_histogram,                   "histogram",                 "Histogram of specific node (specify path to node)");
   add(mode_bargraph,                    "bargraph",                  "Bargraph of one node across multiple data stores");
   add(mode_table,                       "table",                     "Table of one node across multiple data stores");
   add(mode_slice,                       "slice",                     "Slice of every snapshot, in list format");
   add(mode_slice_graph,                 "slice-graph",               "Slice of every snapshot, in line graph format");
+  add(mode_cpistack,                    "cpistack",                  "CPI stack of ooocore per-context node (e.g. ooocore.total or ooocore.vcpu0)");
+  add(mode_hotspots,                    "hotspots",                  "Top RIPs in a -ripprof profile file, ranked by (mispredicts, l1miss, l2miss, latency, stall)");
+  add(mode_export,                      "export",                    "Export every counter in every snapshot to the specified columnar (or -export-csv) file");
 
   section("Table or Graph");
   add(table_row_names,                  "rows",                      "Row names (comma separated)");
@@ -166,9 +200,21 @@ void ConfigurationParser<PTLstatsConfig>::setup() {
   add(histogram_thresh,                 "histogram-thresh",          "Histogram threshold (1.0 = print nothing, 0.0 = everything)");
   add(show_stars_in_histogram,          "nostars",                   "Don't show stars (***) in histogram");
 
+  section("Hot Spot Options");
+  add(hotspots_top,                     "top",                       "Number of RIPs to list in the hot spot report");
+  add(elf_filename,                     "elf",                       "ELF executable to take symbol names from");
+
+  section("Export Options");
+  add(export_csv,                       "export-csv",                "Export as CSV (one row per snapshot) rather than columnar format");
+  add(export_delta,                     "export-delta",              "Store integer columns as differences from the previous snapshot");
+
+  section("SimPoint Options");
+  add(simpoint_weights_filename,        "simpoint-weights",          "SimPoint weights file (weight and cluster ID per line); data stores are given in cluster ID order");
+
   section("Miscellaneous");
   add(print_datastore_info,             "info",                      "Print information about the data store file");
   add(print_template,                   "template",                  "Print template in C++ struct format");
+  add(jobs,                             "jobs",                      "Load data store files on this many worker processes (-collect*, -table, -bargraph)");
 };
 
 struct RGBAColor {
@@ -669,44 +715,166 @@ void printbanner() {
   cerr << endl;
 }
 
-DataStoreNode* collect_into_supernode(int argc, char** argv, char* path, const char* deltastart = null, const char* deltaend = "final") {
-  DataStoreNode* supernode = new DataStoreNode("super");
+//
+// Load count data stores by calling load(i, context) for each i,
+// returning the resulting subtrees in results[i] (or false if any
+// load fails).
+//
+// With -jobs N, the files are split round robin across N forked
+// worker processes, each of which serializes its subtrees into a
+// pipe in file order. The parent reads them back in file order too,
+// so the output never depends on which worker finishes first.
+//
+typedef DataStoreNode* (*stats_file_loader_t)(int i, void* context);
 
-  StatsFileReader reader;
+bool load_stats_files(int count, stats_file_loader_t load, void* context, dynarray<DataStoreNode*>& results) {
+  results.resize(count);
+  results.fill(null);
 
-  foreach (i, argc) {
-    char* filename = argv[i];
-    DataStoreNode* endbase;
-    DataStoreNode* end;
-    DataStoreNode* startbase;
-    DataStoreNode* start;
+  int jobs = min((int)config.jobs, count);
 
-    if (!reader.open(filename)) {
-      cerr << "ptlstats: Cannot open '", filename, "'", endl, endl;
-      return null;
+  if (jobs <= 1) {
+    foreach (i, count) {
+      results[i] = load(i, context);
+      if (!results[i]) return false;
     }
+    return true;
+  }
 
-    // Can't have slashes in tree pathnames
-    int filenamelen = strlen(filename);
-    foreach (i, filenamelen) { if (filename[i] == '/') filename[i] = ':'; }
+  // Don't let the children flush our buffered output a second time
+  cout.flush();
+  cerr.flush();
 
-    DataStoreNode* dsbase = (deltastart) ? reader.getdelta(deltaend, deltastart) : reader.get(deltaend);
+  dynarray<int> pids;
+  dynarray<idstream*> streams;
 
-    if (!dsbase) {
-      cerr << "ptlstats: Error: cannot find ending snapshot '", deltaend, "' or starting snapshot '", deltastart, "'", endl;
-      reader.close();
-      return null;
+  foreach (w, jobs) {
+    int fds[2];
+    if (sys_pipe(fds) < 0) {
+      cerr << "ptlstats: Cannot create pipe for worker ", w, endl;
+      jobs = w;
+      break;
     }
 
-    DataStoreNode* ds = null;
+    int pid = sys_fork();
 
-    if (!(ds = dsbase->searchpath(path))) {
-      cerr << "ptlstats: Error: cannot find subtree '", path, "'", endl;
-      delete dsbase;
-      reader.close();
-      return null;
+    if (!pid) {
+      sys_close(fds[0]);
+      odstream os(fds[1]);
+
+      for (int i = w; i < count; i += jobs) {
+        DataStoreNode* ds = load(i, context);
+        W32 ok = (ds != null);
+        os << ok;
+        if (!ok) break;
+        ds->write(os);
+      }
+
+      os.close();
+      cerr.flush();
+      sys_exit(0);
     }
 
+    sys_close(fds[1]);
+
+    if (pid < 0) {
+      cerr << "ptlstats: Cannot fork worker ", w, " (rc ", pid, ")", endl;
+      sys_close(fds[0]);
+      jobs = w;
+      break;
+    }
+
+    pids.push(pid);
+    streams.push(new idstream(fds[0]));
+  }
+
+  bool ok = (jobs > 0);
+
+  if (ok) {
+    foreach (i, count) {
+      idstream& is = *streams[i % jobs];
+      W32 loaded = 0;
+      is >> loaded;
+      if ((!is) | (!loaded)) { ok = false; break; }
+      results[i] = new DataStoreNode(is);
+    }
+  }
+
+  foreach (w, streams.length) {
+    streams[w]->close();
+    delete streams[w];
+  }
+
+  foreach (w, pids.length) {
+    int status;
+    sys_wait4(pids[w], &status, 0, null);
+  }
+
+  if (!ok) {
+    foreach (i, count) { if (results[i]) delete results[i]; }
+    results.fill(null);
+  }
+
+  return ok;
+}
+
+struct CollectContext {
+  char** argv;
+  char* path;
+  const char* deltastart;
+  const char* deltaend;
+};
+
+static DataStoreNode* collect_one(int i, void* context) {
+  CollectContext& ctx = *(CollectContext*)context;
+  char* filename = ctx.argv[i];
+
+  StatsFileReader reader;
+
+  if (!reader.open(filename)) {
+    cerr << "ptlstats: Cannot open '", filename, "'", endl, endl;
+    return null;
+  }
+
+  DataStoreNode* dsbase = (ctx.deltastart) ? reader.getdelta(ctx.deltaend, ctx.deltastart, ctx.path) : reader.get(ctx.deltaend, ctx.path);
+  reader.close();
+
+  if (!dsbase) {
+    cerr << "ptlstats: Error: cannot find ending snapshot '", ctx.deltaend, "' or starting snapshot '", ctx.deltastart, "'", endl;
+    return null;
+  }
+
+  DataStoreNode* ds = null;
+
+  if (!(ds = dsbase->searchpath(ctx.path))) {
+    cerr << "ptlstats: Error: cannot find subtree '", ctx.path, "'", endl;
+    delete dsbase;
+    return null;
+  }
+
+  return ds;
+}
+
+DataStoreNode* collect_into_supernode(int argc, char** argv, char* path, const char* deltastart = null, const char* deltaend = "final") {
+  CollectContext ctx;
+  ctx.argv = argv;
+  ctx.path = path;
+  ctx.deltastart = deltastart;
+  ctx.deltaend = deltaend;
+
+  dynarray<DataStoreNode*> subtrees;
+  if (!load_stats_files(argc, collect_one, &ctx, subtrees)) return null;
+
+  DataStoreNode* supernode = new DataStoreNode("super");
+
+  foreach (i, argc) {
+    char* filename = argv[i];
+
+    // Can't have slashes in tree pathnames
+    int filenamelen = strlen(filename);
+    foreach (j, filenamelen) { if (filename[j] == '/') filename[j] = ':'; }
+
+    DataStoreNode* ds = subtrees[i];
     ds->rename(filename);
     supernode->add(ds);
   }
@@ -714,6 +882,67 @@ DataStoreNode* collect_into_supernode(int argc, char** argv, char* path, const c
   return supernode;
 }
 
+//
+// Read a SimPoint weights file ("<weight> <clusterid>" per line)
+// into an array indexed by cluster ID
+//
+bool read_simpoint_weights(const char* filename, dynarray<double>& weights) {
+  istream is(filename);
+  if (!is) {
+    cerr << "ptlstats: Cannot open SimPoint weights file '", filename, "'", endl;
+    return false;
+  }
+
+  stringbuf line;
+  weights.clear();
+
+  for (;;) {
+    line.reset();
+    is >> line;
+    if (!is) break;
+
+    double weight;
+    int cluster;
+    if (sscanf(line, "%lf %d", &weight, &cluster) != 2) continue;
+    if (cluster < 0) continue;
+
+    while (weights.length <= cluster) weights.push(0.0);
+    weights[cluster] = weight;
+  }
+
+  return true;
+}
+
+//
+// Combine the same subtree from the stats of each simulation point
+// into the estimated statistics of one average interval: stores[i]
+// is the data store for cluster i, weighted by the fraction of all
+// intervals in that cluster. The weights sum to 1, so whole-run
+// totals are these values times the number of intervals. Integer
+// counters are rounded down after scaling.
+//
+DataStoreNode* collect_weighted(int argc, char** argv, char* path, const char* weightsfile, const char* deltastart, const char* deltaend) {
+  dynarray<double> weights;
+  if (!read_simpoint_weights(weightsfile, weights)) return null;
+
+  if ((!argc) | (argc != weights.length)) {
+    cerr << "ptlstats: Error: weights file '", weightsfile, "' has ", weights.length, " clusters but ", argc, " data stores were given", endl;
+    return null;
+  }
+
+  DataStoreNode* supernode = collect_into_supernode(argc, argv, path, deltastart, deltaend);
+  if (!supernode) return null;
+
+  // collect_into_supernode() names each subtree after its (mangled) filename
+  DataStoreNode* weighted = supernode->search(argv[0])->map(ScaleOperator(weights[0]));
+  for (int i = 1; i < argc; i++) weighted->addscaled(*supernode->search(argv[i]), weights[i]);
+
+  delete supernode;
+
+  weighted->rename(path);
+  return weighted;
+}
+
 class TableCreator {
 public:
   ostream& os;
@@ -812,6 +1041,51 @@ public:
 
 enum { TABLE_TYPE_TEXT, TABLE_TYPE_LATEX, TABLE_TYPE_HTML };
 
+struct CaptureTableContext {
+  dynarray<char*>* rowlist;
+  dynarray<char*>* collist;
+  char* statname;
+};
+
+static DataStoreNode* capture_table_cell(int i, void* context) {
+  CaptureTableContext& ctx = *(CaptureTableContext*)context;
+  int row = i / ctx.collist->size();
+  int col = i % ctx.collist->size();
+
+  const char* findarray[2] = {"%row", "%col"};
+  const char* replarray[2];
+  replarray[0] = (*ctx.rowlist)[row];
+  replarray[1] = (*ctx.collist)[col];
+
+  stringbuf filename;
+  stringsubst(filename, config.table_row_col_pattern, findarray, replarray, 2);
+
+  StatsFileReader reader;
+
+  if (!reader.open(filename)) {
+    cerr << "ptlstats: Cannot open '", filename, "' for row ", row, ", col ", col, endl, endl, flush;
+    return null;
+  }
+
+  DataStoreNode* dsbase = reader.get(config.snapshot, ctx.statname);
+  reader.close();
+
+  if (!dsbase) {
+    cerr << "ptlstats: Cannot open snapshot '", config.snapshot, "' in '", filename, "' for row ", row, ", col ", col, endl, endl, flush;
+    return null;
+  }
+
+  // A missing statistic is only a warning: hand back an empty node (valued 0)
+  DataStoreNode* ds = dsbase->searchpath(ctx.statname);
+  if (!ds) {
+    cerr << "ptlstats: Warning: cannot find subtree '", ctx.statname, "' for row ", row, ", col ", col, endl;
+    delete dsbase;
+    return new DataStoreNode("missing");
+  }
+
+  return ds;
+}
+
 bool capture_table(dynarray<char*>& rowlist, dynarray<char*>& collist, dynarray<double>& sum_of_all_rows, dynarray< dynarray<double> >& data,
                    char* statname, char* rownames, char* colnames, char* row_col_pattern) {
   rowlist.tokenize(rownames, ",");
@@ -825,47 +1099,24 @@ bool capture_table(dynarray<char*>& rowlist, dynarray<char*>& collist, dynarray<
   //
   // Collect data
   //
-  const char* findarray[2] = {"%row", "%col"};
+  CaptureTableContext ctx;
+  ctx.rowlist = &rowlist;
+  ctx.collist = &collist;
+  ctx.statname = statname;
 
-  StatsFileReader reader;
+  dynarray<DataStoreNode*> cells;
+  if (!load_stats_files(rowlist.size() * collist.size(), capture_table_cell, &ctx, cells)) return false;
 
   for (int row = 0; row < rowlist.size(); row++) {
     data[row].resize(collist.size());
 
     for (int col = 0; col < collist.size(); col++) {
-      stringbuf filename;
-
-      const char* replarray[2];
-      replarray[0] = rowlist[row];
-      replarray[1] = collist[col];
-      stringsubst(filename, config.table_row_col_pattern, findarray, replarray, 2);
-
-      if (!reader.open(filename)) {
-        cerr << "ptlstats: Cannot open '", filename, "' for row ", row, ", col ", col, endl, endl, flush;
-        return false;
-      }
-
-      DataStoreNode* ds = reader.get(config.snapshot);
-      if (!ds) {
-        cerr << "ptlstats: Cannot open snapshot '", config.snapshot, "' in '", filename, "' for row ", row, ", col ", col, endl, endl, flush;
-        reader.close();
-        return false;
-      }
-
-      ds = ds->searchpath(statname);
-
-      double value;
-      if (ds) {
-        value = *ds;
-        sum_of_all_rows[col] += value;
-      } else { 
-        cerr << "ptlstats: Warning: cannot find subtree '", statname, "' for row ", row, ", col ", col, endl;
-        value = 0;
-      }
+      DataStoreNode* ds = cells[row * collist.size() + col];
 
+      double value = *ds;
+      sum_of_all_rows[col] += value;
       data[row][col] = value;
-
-      reader.close();
+      delete ds;
     }
   }
 
@@ -1103,6 +1354,582 @@ void create_grouped_bargraph(ostream& os, char* statname, char* rownames, char*
   svg.exitlayer();
 }
 
+//
+// ELF symbol table, used to annotate RIPs in the hot spot report
+//
+struct ELFSymbol {
+  W64 addr;
+  W64 size;
+  const char* name;
+};
+
+static int compare_elf_symbols(const void* a, const void* b) {
+  W64 aa = ((const ELFSymbol*)a)->addr;
+  W64 bb = ((const ELFSymbol*)b)->addr;
+  return (aa < bb) ? -1 : (aa > bb) ? +1 : 0;
+}
+
+struct ELFSymbolTable {
+  dynarray<ELFSymbol> symbols;
+  char* strings;
+
+  ELFSymbolTable() { strings = null; }
+  ~ELFSymbolTable() { if (strings) delete[] strings; }
+
+  template <typename Ehdr, typename Shdr, typename Sym>
+  bool load_symbols(idstream& is, const char* filename);
+
+  bool load(const char* filename);
+  const ELFSymbol* lookup(W64 rip) const;
+};
+
+template <typename Ehdr, typename Shdr, typename Sym>
+bool ELFSymbolTable::load_symbols(idstream& is, const char* filename) {
+  Ehdr ehdr;
+  is.seek(0);
+  is >> ehdr;
+  if ((!is) | (ehdr.e_shentsize != sizeof(Shdr))) return false;
+
+  Shdr* shdrs = new Shdr[ehdr.e_shnum];
+  is.seek(ehdr.e_shoff);
+  is.read(shdrs, ehdr.e_shnum * sizeof(Shdr));
+
+  //
+  // Prefer the full symbol table; fall back to the dynamic
+  // symbols if the executable has been stripped.
+  //
+  int symsec = -1;
+  foreach (i, ehdr.e_shnum) {
+    if (shdrs[i].sh_type == SHT_SYMTAB) { symsec = i; break; }
+    if ((shdrs[i].sh_type == SHT_DYNSYM) & (symsec < 0)) symsec = i;
+  }
+
+  if (symsec < 0) {
+    cerr << "ptlstats: Warning: '", filename, "' has no symbol table", endl;
+    delete[] shdrs;
+    return false;
+  }
+
+  const Shdr& symhdr = shdrs[symsec];
+  const Shdr& strhdr = shdrs[symhdr.sh_link];
+
+  strings = new char[strhdr.sh_size + 1];
+  is.seek(strhdr.sh_offset);
+  is.read(strings, strhdr.sh_size);
+  strings[strhdr.sh_size] = 0;
+
+  int count = symhdr.sh_size / sizeof(Sym);
+  Sym* syms = new Sym[count];
+  is.seek(symhdr.sh_offset);
+  is.read(syms, count * sizeof(Sym));
+
+  foreach (i, count) {
+    const Sym& sym = syms[i];
+    int type = sym.st_info & 0xf;
+    if (((type != STT_FUNC) & (type != STT_OBJECT)) | (!sym.st_value) | (sym.st_name >= strhdr.sh_size)) continue;
+    ELFSymbol& s = symbols.push();
+    s.addr = sym.st_value;
+    s.size = sym.st_size;
+    s.name = strings + sym.st_name;
+  }
+
+  qsort(symbols.data, symbols.length, sizeof(ELFSymbol), compare_elf_symbols);
+
+  delete[] syms;
+  delete[] shdrs;
+  return true;
+}
+
+bool ELFSymbolTable::load(const char* filename) {
+  idstream is(filename);
+  if (!is) {
+    cerr << "ptlstats: Error: cannot open ELF file '", filename, "'", endl;
+    return false;
+  }
+
+  unsigned char ident[EI_NIDENT];
+  is.read(ident, sizeof(ident));
+
+  if ((!is) | (memcmp(ident, ELFMAG, SELFMAG) != 0)) {
+    cerr << "ptlstats: Error: '", filename, "' is not an ELF file", endl;
+    return false;
+  }
+
+  return (ident[EI_CLASS] == ELFCLASS64) ?
+    load_symbols<Elf64_Ehdr, Elf64_Shdr, Elf64_Sym>(is, filename) :
+    load_symbols<Elf32_Ehdr, Elf32_Shdr, Elf32_Sym>(is, filename);
+}
+
+const ELFSymbol* ELFSymbolTable::lookup(W64 rip) const {
+  int lower = 0;
+  int upper = symbols.length - 1;
+  const ELFSymbol* best = null;
+
+  while (lower <= upper) {
+    int mid = (lower + upper) / 2;
+    const ELFSymbol& sym = symbols.data[mid];
+    if (sym.addr <= rip) {
+      best = &sym;
+      lower = mid + 1;
+    } else {
+      upper = mid - 1;
+    }
+  }
+
+  if (!best) return null;
+  if (best->size && (rip >= (best->addr + best->size))) return null;
+  return best;
+}
+
+//
+// Hot spot report from a -ripprof per-RIP profile file
+//
+static int hotspot_sort_metric;
+
+static int compare_hotspots(const void* a, const void* b) {
+  W64 aa = ripprof_metric_value(*(const RIPProfileEntry*)a, hotspot_sort_metric);
+  W64 bb = ripprof_metric_value(*(const RIPProfileEntry*)b, hotspot_sort_metric);
+  // Descending order, with ties broken by ascending rip for deterministic output
+  if (aa != bb) return (aa > bb) ? -1 : +1;
+  W64 ra = ((const RIPProfileEntry*)a)->rip;
+  W64 rb = ((const RIPProfileEntry*)b)->rip;
+  return (ra < rb) ? -1 : (ra > rb) ? +1 : 0;
+}
+
+int print_hotspots(ostream& os, const char* filename, const char* metricname, const char* snapshot, int top, const char* elf_filename) {
+  int metric = -1;
+  foreach (i, RIPPROF_METRIC_COUNT) {
+    if (strequal(metricname, ripprof_metric_names[i])) { metric = i; break; }
+  }
+
+  if (metric < 0) {
+    cerr << "ptlstats: Error: unknown hot spot metric '", metricname, "' (must be one of";
+    foreach (i, RIPPROF_METRIC_COUNT) cerr << ' ', ripprof_metric_names[i];
+    cerr << ")", endl;
+    return 1;
+  }
+
+  idstream is(filename);
+  if (!is) {
+    cerr << "ptlstats: Cannot open '", filename, "'", endl, endl;
+    return 2;
+  }
+
+  //
+  // Find the requested snapshot (by name or uuid); the final
+  // snapshot in the file is used if it was not named.
+  //
+  char* p;
+  W64 uuid = (snapshot) ? strtoull(snapshot, &p, 0) : 0;
+  bool by_uuid = (snapshot && (*snapshot) && (!*p));
+
+  RIPProfileHeader header;
+  W64 offset = 0;
+  W64 found_offset = 0;
+  bool found = 0;
+  RIPProfileHeader found_header;
+
+  for (;;) {
+    is.seek(offset);
+    is >> header;
+    if (!is) break;
+
+    if (header.magic != RIPProfileHeader::MAGIC) {
+      cerr << "ptlstats: Error: '", filename, "' is not a RIP profile file or is corrupted at offset ", offset, endl;
+      return 2;
+    }
+
+    bool match = (by_uuid) ? (header.snapshot_uuid == uuid) : ((!snapshot) || strequal(header.snapshot_name, snapshot));
+    if (match | ((!found) & (!by_uuid) & (!snapshot))) {
+      found = 1;
+      found_offset = offset;
+      found_header = header;
+    }
+
+    offset += sizeof(RIPProfileHeader) + (header.count * sizeof(RIPProfileEntry));
+  }
+
+  if (!found) {
+    if (offset == 0) {
+      cerr << "ptlstats: Error: '", filename, "' contains no profile snapshots", endl;
+      return 2;
+    }
+    // The final snapshot may not have been taken (e.g. killed run): use the last one
+    if (snapshot && (!strequal(snapshot, "final"))) {
+      cerr << "ptlstats: Cannot find snapshot '", snapshot, "'", endl;
+      return 2;
+    }
+    return print_hotspots(os, filename, metricname, null, top, elf_filename);
+  }
+
+  RIPProfileEntry* entries = new RIPProfileEntry[found_header.count];
+  is.seek(found_offset + sizeof(RIPProfileHeader));
+  is.read(entries, found_header.count * sizeof(RIPProfileEntry));
+
+  hotspot_sort_metric = metric;
+  qsort(entries, found_header.count, sizeof(RIPProfileEntry), compare_hotspots);
+
+  ELFSymbolTable symtab;
+  if (elf_filename) symtab.load(elf_filename);
+
+  W64 total = 0;
+  foreach (i, found_header.count) total += ripprof_metric_value(entries[i], metric);
+
+  os << "Hot spots by ", ripprof_metric_names[metric], " in snapshot ", found_header.snapshot_uuid;
+  if (found_header.snapshot_name[0]) os << " ('", found_header.snapshot_name, "')";
+  os << " at cycle ", found_header.cycle, ": ", found_header.count, " RIPs profiled, ",
+    found_header.evictions, " evicted", endl, endl;
+
+  os << padstring("RIP", -16), "  ", padstring("Percent", 7), " ", padstring("Mispred", 10), " ", padstring("Branches", 10), " ",
+    padstring("L1miss", 10), " ", padstring("L2miss", 10), " ", padstring("Loads", 10), " ", padstring("AvgLat", 7), " ",
+    padstring("Stalls", 10), "  Symbol", endl;
+
+  int n = min(top, (int)found_header.count);
+
+  foreach (i, n) {
+    const RIPProfileEntry& e = entries[i];
+    W64 value = ripprof_metric_value(e, metric);
+    if (!value) break;
+
+    os << hexstring(e.rip, 64), "  ", floatstring(percent(value, total), 6, 1), "% ", 
+      intstring(e.mispredicts, 10), " ", intstring(e.branches, 10), " ",
+      intstring(e.L1_misses, 10), " ", intstring(e.L2_misses, 10), " ", intstring(e.loads, 10), " ",
+      floatstring((e.loads) ? (double(e.load_latency) / double(e.loads)) : 0.0, 7, 1), " ",
+      intstring(e.commit_stall_cycles, 10), "  ";
+
+    const ELFSymbol* sym = symtab.lookup(e.rip);
+    if (sym) os << sym->name, "+", (e.rip - sym->addr);
+    os << endl;
+  }
+
+  delete[] entries;
+  return 0;
+}
+
+//
+// Top-down CPI stack: every commit slot is charged to one of
+// these leaves of the <context>.cpistack node
+//
+static const char* cpistack_components[] = {
+  "committed",
+  "frontend.icache_miss",
+  "frontend.decode",
+  "frontend.fetch",
+  "branch_mispredict",
+  "memory.L1",
+  "memory.L2",
+  "memory.mem",
+  "memory.tlb",
+  "dependency",
+  "structural.issueq",
+  "structural.lsq",
+  "structural.physregs",
+  "fence",
+  "other",
+};
+
+int print_cpi_stack(ostream& os, DataStoreNode* root, const char* path) {
+  DataStoreNode* context = root->searchpath(path);
+  if (!context) {
+    cerr << "ptlstats: Error: cannot find subtree '", path, "'", endl;
+    return 1;
+  }
+
+  DataStoreNode* cpistack = context->search("cpistack");
+  DataStoreNode* insnsnode = context->searchpath("commit.insns");
+  // The core's commit width histogram has one slot per commit width from 0 up
+  DataStoreNode* widthnode = (context->parent) ? context->parent->searchpath("commit.width") : null;
+
+  if ((!cpistack) | (!insnsnode) | (!widthnode) | (widthnode->count < 2)) {
+    cerr << "ptlstats: Error: '", path, "' is not a per-context ooocore statistics node with a cpistack subtree", endl;
+    return 1;
+  }
+
+  W64 slots[lengthof(cpistack_components)];
+  W64 totalslots = 0;
+
+  foreach (i, lengthof(cpistack_components)) {
+    DataStoreNode* ds = cpistack->searchpath(cpistack_components[i]);
+    slots[i] = (ds) ? W64(*ds) : 0;
+    totalslots += slots[i];
+  }
+
+  //
+  // Every cycle charges all commit slots of each context, so the
+  // slots give the cycles this context ran for. For the total node
+  // this sums the cycles of all contexts, matching its summed insns.
+  //
+  W64 insns = W64(*insnsnode);
+  W64 cycles = totalslots / (widthnode->count - 1);
+  double cpi = (insns) ? (double(cycles) / double(insns)) : 0.0;
+
+  os << "CPI stack for ", path, ": ", insns, " insns in ", cycles, " cycles, CPI ", floatstring(cpi, 0, 3), endl, endl;
+  os << padstring("Component", -24), " ", padstring("Slots", 16), " ", padstring("Percent", 8), " ", padstring("CPI", 8), endl;
+
+  foreach (i, lengthof(cpistack_components)) {
+    double fraction = (totalslots) ? (double(slots[i]) / double(totalslots)) : 0.0;
+    os << padstring(cpistack_components[i], -24), " ", intstring(slots[i], 16), " ",
+      floatstring(fraction * 100.0, 7, config.percent_digits), "% ", floatstring(fraction * cpi, 8, 3), endl;
+  }
+
+  return 0;
+}
+
+//
+// Export every counter in every snapshot as a time series.
+//
+// The template is walked once to build the column schema: each
+// integer or float word in a raw stats record becomes one column,
+// named by its path ("summary.cycles", "dcache.load.hits.L1") with
+// array slots named by label or index ("fetch.width.3"). Strings
+// are skipped. Every snapshot record is then read in order (so delta
+// encoded stats files are decoded in a single sequential pass).
+//
+// Columnar format (all fields little endian):
+//
+//   StatsColumnFileHeader
+//   byte types[column_count]          EXPORT_COLUMN_INT or EXPORT_COLUMN_FLOAT
+//   char names[]                      column_count column names, then row_count
+//                                     snapshot names ("" if unnamed), NUL terminated
+//   W64 data[column_count][row_count] at data_offset (8 byte aligned)
+//
+// Each column is contiguous, so it can be mapped straight into an
+// array. With -export-delta, row i of an integer column holds the
+// difference from row i-1 (row 0 holds the value itself), so the
+// series is its cumulative sum; float columns are always stored as is.
+//
+// With -export-csv, the output has one line per snapshot instead:
+// the snapshot number and name followed by every column.
+//
+struct StatsColumnFileHeader {
+  W64 magic;
+  W64 column_count;
+  W64 row_count;
+  W64 flags;
+  W64 types_offset;
+  W64 names_offset;
+  W64 data_offset;
+
+  static const W64 MAGIC = 0x31306c6f434c5450ULL; // 'PTLCol01'
+  static const W64 FLAG_DELTA = (1 << 0);
+};
+
+enum { EXPORT_COLUMN_INT, EXPORT_COLUMN_FLOAT };
+
+struct ExportSchema {
+  dynarray<W64> offsets; // word offset of each column in a raw record
+  dynarray<byte> types;
+  dynarray<char*> names;
+
+  void add(const char* name, W64 offset, int type) {
+    names.push(strdup(name));
+    offsets.push(offset);
+    types.push(type);
+  }
+
+  ~ExportSchema() {
+    foreach (i, names.length) free(names[i]);
+  }
+};
+
+static void build_export_schema(ExportSchema& schema, const DataStoreNodeTemplate& node, const char* path, W64& offset) {
+  switch (node.type) {
+  case DataStoreNodeTemplate::DS_NODE_TYPE_NULL: {
+    foreach (i, node.subnodes.length) {
+      stringbuf subpath;
+      if (*path) subpath << path, ".";
+      subpath << node.subnodes[i]->name;
+      build_export_schema(schema, *node.subnodes[i], subpath, offset);
+    }
+    break;
+  }
+  case DataStoreNodeTemplate::DS_NODE_TYPE_INT:
+  case DataStoreNodeTemplate::DS_NODE_TYPE_FLOAT: {
+    int type = (node.type == DataStoreNodeTemplate::DS_NODE_TYPE_INT) ? EXPORT_COLUMN_INT : EXPORT_COLUMN_FLOAT;
+    if (node.count == 1) {
+      schema.add(path, offset, type);
+    } else {
+      foreach (i, node.count) {
+        stringbuf slotpath;
+        slotpath << path, ".";
+        if (node.labels) slotpath << node.labels[i]; else slotpath << i;
+        schema.add(slotpath, offset + i, type);
+      }
+    }
+    offset += node.count;
+    break;
+  }
+  case DataStoreNodeTemplate::DS_NODE_TYPE_STRING: {
+    offset += (node.count * node.limit) / 8;
+    break;
+  }
+  }
+}
+
+static void print_csv_field(ostream& os, const char* s) {
+  if (!strpbrk(s, ",\"\n")) {
+    os << s;
+    return;
+  }
+
+  os << '"';
+  for (const char* p = s; *p; p++) {
+    if (*p == '"') os << '"';
+    os << *p;
+  }
+  os << '"';
+}
+
+int export_snapshots(const char* filename, const char* outfilename, bool csv, bool delta) {
+  StatsFileReader reader;
+
+  if (!reader.open(filename)) {
+    cerr << "ptlstats: Cannot open '", filename, "'", endl, endl;
+    return 2;
+  }
+
+  ExportSchema schema;
+  W64 words = 0;
+  build_export_schema(schema, *reader.dst, "", words);
+
+  if ((words * 8) != reader.header.record_size) {
+    cerr << "ptlstats: Error: template covers ", (words * 8), " bytes but records are ", reader.header.record_size, " bytes", endl;
+    return 2;
+  }
+
+  W64 columns = schema.names.length;
+  W64 rows = reader.header.record_count;
+
+  // Snapshot names by uuid
+  const char** rownames = new const char* [rows];
+  foreach (i, rows) rownames[i] = "";
+
+  Hashtable<const char*, W64, 256>::Iterator iter(reader.name_to_uuid);
+  KeyValuePair<const char*, W64>* kvp;
+  while (kvp = iter.next()) {
+    if (kvp->value < rows) rownames[kvp->value] = kvp->key;
+  }
+
+  W64* record = new W64[words];
+  int rc = 0;
+
+  if (csv) {
+    ostream os(outfilename);
+    if (!os) {
+      cerr << "ptlstats: Cannot open '", outfilename, "' for writing", endl;
+      rc = 2;
+    }
+
+    if (!rc) {
+      os << "snapshot,name";
+      foreach (col, columns) {
+        os << ',';
+        print_csv_field(os, schema.names[col]);
+      }
+      os << endl;
+
+      foreach (row, rows) {
+        if (!reader.read(row, (byte*)record)) {
+          cerr << "ptlstats: Error: cannot read snapshot ", row, endl;
+          rc = 2;
+          break;
+        }
+
+        os << row, ',';
+        print_csv_field(os, rownames[row]);
+        foreach (col, columns) {
+          W64 v = record[schema.offsets[col]];
+          if (schema.types[col] == EXPORT_COLUMN_INT)
+            os << ',', (W64s)v;
+          else os << ',', floatstring(*(double*)&v, 0, 9);
+        }
+        os << endl;
+      }
+
+      os.close();
+    }
+  } else {
+    odstream os(outfilename);
+    if (!os) {
+      cerr << "ptlstats: Cannot open '", outfilename, "' for writing", endl;
+      rc = 2;
+    }
+
+    if (!rc) {
+      StatsColumnFileHeader header;
+      setzero(header);
+      header.magic = StatsColumnFileHeader::MAGIC;
+      header.column_count = columns;
+      header.row_count = rows;
+      header.flags = (delta) ? StatsColumnFileHeader::FLAG_DELTA : 0;
+      os << header;
+
+      header.types_offset = os.where();
+      os.write(schema.types.data, columns);
+
+      header.names_offset = os.where();
+      foreach (col, columns) os.write(schema.names[col], strlen(schema.names[col]) + 1);
+      foreach (row, rows) os.write(rownames[row], strlen(rownames[row]) + 1);
+
+      W64 zero = 0;
+      os.write(&zero, ceil(os.where(), 8) - os.where());
+      header.data_offset = os.where();
+
+      //
+      // Transpose blocks of rows (up to 64 MB at a time) into their
+      // columns, then append each column's slice at its own offset.
+      //
+      W64 blockrows = clipto((W64)((1 << 26) / max(columns * 8, (W64)1)), (W64)1, max(rows, (W64)1));
+      W64* block = new W64[columns * blockrows];
+      W64* prev = new W64[columns];
+      foreach (col, columns) prev[col] = 0;
+
+      for (W64 base = 0; base < rows; base += blockrows) {
+        W64 n = min(blockrows, rows - base);
+
+        foreach (r, n) {
+          if (!reader.read(base + r, (byte*)record)) {
+            cerr << "ptlstats: Error: cannot read snapshot ", base + r, endl;
+            rc = 2;
+            break;
+          }
+
+          foreach (col, columns) {
+            W64 v = record[schema.offsets[col]];
+            if (delta && (schema.types[col] == EXPORT_COLUMN_INT)) {
+              block[col * blockrows + r] = v - prev[col];
+              prev[col] = v;
+            } else {
+              block[col * blockrows + r] = v;
+            }
+          }
+        }
+
+        if (rc) break;
+
+        foreach (col, columns) {
+          os.seek(header.data_offset + ((col * rows) + base) * sizeof(W64));
+          os.write(block + (col * blockrows), n * sizeof(W64));
+        }
+      }
+
+      delete[] block;
+      delete[] prev;
+
+      os.seek(0);
+      os << header;
+      os.close();
+    }
+  }
+
+  if (!rc) cerr << "ptlstats: Exported ", columns, " columns by ", rows, " snapshots to '", outfilename, "'", endl;
+
+  delete[] record;
+  delete[] rownames;
+  reader.close();
+  return rc;
+}
+
 int main(int argc, char* argv[]) {
   configparser.setup();
   config.reset();
@@ -1161,13 +1988,18 @@ int main(int argc, char* argv[]) {
     }
     reader.dst->generate_struct_def(cout);
     reader.close();
+  } else if (config.mode_export.set()) {
+    return export_snapshots(filename, config.mode_export, config.export_csv, config.export_delta);
+  } else if (config.mode_hotspots.set()) {
+    return print_hotspots(cout, filename, config.mode_hotspots, snapshot, config.hotspots_top,
+                          (config.elf_filename.set()) ? (char*)config.elf_filename : null);
   } else if (config.mode_histogram.set()) {
     if (!reader.open(filename)) {
       cerr << "ptlstats: Cannot open '", filename, "'", endl, endl;
       return 2;
     }
 
-    DataStoreNode* ds = reader.get(config.snapshot);
+    DataStoreNode* ds = reader.get(config.snapshot, config.mode_histogram);
     if (!ds) {
       cerr << "ptlstats: Cannot find snapshot '", config.snapshot, "'", endl;
       return 2;
@@ -1213,6 +2045,16 @@ int main(int argc, char* argv[]) {
     avgnode->rename(config.mode_collect_average);
     avgnode->print(cout, printinfo);
     delete supernode;
+  } else if (config.mode_collect_weighted.set()) {
+    if (!config.simpoint_weights_filename.set()) {
+      cerr << "ptlstats: Error: must specify -simpoint-weights for the collectweighted mode", endl;
+      return 1;
+    }
+    argv += n; argc -= n;
+    DataStoreNode* weighted = collect_weighted(argc, argv, config.mode_collect_weighted, config.simpoint_weights_filename, subtract_branch, snapshot);
+    if (!weighted) return -1;
+    weighted->print(cout, printinfo);
+    delete weighted;
   } else if (config.mode_table.set()) {
     if ((!config.table_row_names.set()) | (!config.table_col_names.set())) {
       cerr << "ptlstats: Error: must specify both -rows and -cols options for the table mode", endl;
@@ -1261,6 +2103,11 @@ int main(int argc, char* argv[]) {
       cout << endl;
     }
 
+    // Only reconstruct the columns (and the cycle count) from each snapshot
+    stringbuf slicepaths;
+    foreach (i, colnames.length) slicepaths << colnames[i], ",";
+    slicepaths << "summary.cycles";
+
     double* xpoints = new double[reader.header.record_count];
     double** ypoints = new double*[colnames.length];
 
@@ -1272,7 +2119,7 @@ int main(int argc, char* argv[]) {
 
     foreach (i, reader.header.record_count) {
       bool do_subtract = ((!config.slice_cumulative) && (i > 0));
-      DataStoreNode* dsroot = (do_subtract) ? reader.getdelta(i, i-1) : reader.get(i);
+      DataStoreNode* dsroot = (do_subtract) ? reader.getdelta(i, i-1, slicepaths) : reader.get(i, slicepaths);
 
       if (!graphing) cout << intstring(i, 16);
 
@@ -1351,9 +2198,12 @@ int main(int argc, char* argv[]) {
       return 2;
     }
 
+    // The CPI stack needs several subtrees, so only prune the tree for -subtree
+    const char* subtree = (config.mode_subtree.set() && (!config.mode_cpistack.set())) ? (const char*)config.mode_subtree : null;
+
     DataStoreNode* ds;
     if (subtract_branch) {
-      ds = reader.getdelta(snapshot, subtract_branch);
+      ds = reader.getdelta(snapshot, subtract_branch, subtree);
       if (!ds) {
         cerr << "ptlstats: Cannot get delta between '", subtract_branch,
                 "' and '", snapshot, "'", endl, endl;
@@ -1361,7 +2211,7 @@ int main(int argc, char* argv[]) {
         return 1;
       }
     } else {
-      ds = reader.get(snapshot);
+      ds = reader.get(snapshot, subtree);
       if (!ds) {
         cerr << "ptlstats: Cannot get snapshot '", snapshot, "'", endl, endl;
         reader.close();
@@ -1369,6 +2219,12 @@ int main(int argc, char* argv[]) {
       }
     }
 
+    if (config.mode_cpistack.set()) {
+      int rc = print_cpi_stack(cout, ds, config.mode_cpistack);
+      delete ds;
+      return rc;
+    }
+
     if (config.mode_subtree) {
       ds = ds->searchpath(config.mode_subtree);
 
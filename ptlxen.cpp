@@ -288,6 +288,13 @@ int current_vcpuid() {
   return vcpuid;
 }
 
+int current_thread_id() { return current_vcpuid(); }
+
+int start_helper_thread(helper_thread_func_t func, void* arg, Waddr stacksize) { return -1; }
+bool helper_thread_running(int id) { return false; }
+void helper_thread_wait(volatile W32& word, W32 value) { }
+void helper_thread_wake(volatile W32& word) { }
+
 W64 early_boot_log_seqid = 0;
 
 void early_boot_log(const void* data, int length) {
@@ -82,6 +82,9 @@ typedef unsigned long pte_t;
 // Maximum VCPUs per domain allowed by Xen:
 #define MAX_CONTEXTS 32 // up to 32 VCPUs per domain
 
+// Everything runs on the per-VCPU stacks: there are no helper threads
+#define MAX_THREADS MAX_CONTEXTS
+
 #define PTLSIM_CTX_PAGE_PFN 37
 #define PTLSIM_CTX_PAGE_VIRT_BASE (PTLSIM_VIRT_BASE + (PTLSIM_CTX_PAGE_PFN * 4096))
 #define PTLSIM_CTX_PAGE_COUNT MAX_CONTEXTS
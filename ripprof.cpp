@@ -0,0 +1,75 @@
+//
+// PTLsim: Cycle Accurate x86-64 Simulator
+// Per-RIP Branch Mispredict and Cache Miss Profiler
+//
+// Copyright 2008 Matt T. Yourst <yourst@yourst.com>
+//
+
+#include <globals.h>
+#include <superstl.h>
+#include <ptlsim.h>
+#include <ripprof.h>
+
+const char* ripprof_metric_names[RIPPROF_METRIC_COUNT] = {
+  "mispredicts", "l1miss", "l2miss", "latency", "stall",
+};
+
+RIPProfiler ripprof;
+W64 RIPProfileStatsCollector::evictions;
+
+bool RIPProfiler::open(const char* filename) {
+  close();
+
+  os.open(filename);
+  if unlikely (!os) {
+    cerr << "RIPProfiler: cannot open '", filename, "' for writing", endl;
+    return false;
+  }
+
+  table = new table_t();
+  RIPProfileStatsCollector::evictions = 0;
+  return true;
+}
+
+void RIPProfiler::close() {
+  if (os) os.close();
+  if (table) delete table;
+  table = null;
+}
+
+void RIPProfiler::reset() {
+  if (table) table->reset();
+  RIPProfileStatsCollector::evictions = 0;
+}
+
+void RIPProfiler::write(W64 uuid, W64 cycle, const char* name) {
+  if unlikely ((!table) | (!os)) return;
+
+  RIPProfileHeader header;
+  setzero(header);
+  header.magic = RIPProfileHeader::MAGIC;
+  header.snapshot_uuid = uuid;
+  header.cycle = cycle;
+  header.evictions = RIPProfileStatsCollector::evictions;
+  if (name) strncpy(header.snapshot_name, name, sizeof(header.snapshot_name)-1);
+
+  foreach (set, SETCOUNT) {
+    table_t::Set& s = table->sets[set];
+    foreach (way, WAYCOUNT) {
+      if (s.tags.tags[way] != s.tags.INVALID) header.count++;
+    }
+  }
+
+  os << header;
+
+  foreach (set, SETCOUNT) {
+    table_t::Set& s = table->sets[set];
+    foreach (way, WAYCOUNT) {
+      if (s.tags.tags[way] == s.tags.INVALID) continue;
+      const RIPProfileEntry& e = s.data[way];
+      os.write(&e, sizeof(RIPProfileEntry));
+    }
+  }
+
+  os.flush();
+}
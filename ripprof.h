@@ -0,0 +1,139 @@
+// -*- c++ -*-
+//
+// PTLsim: Cycle Accurate x86-64 Simulator
+// Per-RIP Branch Mispredict and Cache Miss Profiler
+//
+// Copyright 2008 Matt T. Yourst <yourst@yourst.com>
+//
+
+#ifndef _RIPPROF_H_
+#define _RIPPROF_H_
+
+#include <globals.h>
+#include <superstl.h>
+
+//
+// The aggregate ooocore and dcache statistics only tell us how many
+// mispredicts and misses occurred, not which instructions caused them.
+// The RIP profiler keeps a bounded set associative table of counters
+// keyed by the x86 RIP of each uop, and appends the table contents to
+// the profile file every time a stats snapshot is taken. The ptlstats
+// -hotspots mode then ranks the RIPs by any of the counters.
+//
+// File format (repeated once per snapshot):
+//
+//   RIPProfileHeader
+//   RIPProfileEntry[header.count]
+//
+// Entries are written for every RIP currently resident in the table;
+// RIPs evicted by more recent ones lose their counts (the header records
+// how many evictions occurred so the table size can be increased).
+// Counters are cumulative from the start of the run, exactly like the
+// snapshot records in the stats data store.
+//
+
+struct RIPProfileEntry {
+  W64 rip;
+  W64 branches;
+  W64 mispredicts;
+  W64 loads;
+  W64 load_latency; // total cycles from issue until the load data arrived
+  W64 L1_misses;
+  W64 L2_misses;
+  W64 commit_stall_cycles; // cycles this RIP blocked commit at the head of the ROB
+
+  void reset() { setzero(*this); rip = 0xffffffffffffffffULL; }
+  RIPProfileEntry() { reset(); }
+};
+
+struct RIPProfileHeader {
+  W64 magic;
+  W64 snapshot_uuid;
+  W64 cycle;
+  W64 count;
+  W64 evictions;
+  char snapshot_name[64];
+
+  static const W64 MAGIC = 0x31306670724c5450ULL; // 'PTLrpf01'
+};
+
+enum {
+  RIPPROF_METRIC_MISPREDICTS,
+  RIPPROF_METRIC_L1_MISSES,
+  RIPPROF_METRIC_L2_MISSES,
+  RIPPROF_METRIC_LOAD_LATENCY,
+  RIPPROF_METRIC_COMMIT_STALLS,
+  RIPPROF_METRIC_COUNT,
+};
+
+extern const char* ripprof_metric_names[RIPPROF_METRIC_COUNT];
+
+static inline W64 ripprof_metric_value(const RIPProfileEntry& e, int metric) {
+  switch (metric) {
+  case RIPPROF_METRIC_MISPREDICTS: return e.mispredicts;
+  case RIPPROF_METRIC_L1_MISSES: return e.L1_misses;
+  case RIPPROF_METRIC_L2_MISSES: return e.L2_misses;
+  case RIPPROF_METRIC_LOAD_LATENCY: return e.load_latency;
+  case RIPPROF_METRIC_COMMIT_STALLS: return e.commit_stall_cycles;
+  default: return 0;
+  }
+}
+
+#ifndef PTLSIM_PUBLIC_ONLY
+#include <logic.h>
+
+struct RIPProfileLine: public RIPProfileEntry {
+  ostream& print(ostream& os, W64 tag) const {
+    os << "mispredicts ", mispredicts, "/", branches, ", loads ", loads, ", L1 misses ", L1_misses,
+      ", L2 misses ", L2_misses, ", stalls ", commit_stall_cycles;
+    return os;
+  }
+};
+
+struct RIPProfileStatsCollector: public NullAssociativeArrayStatisticsCollector<W64, RIPProfileLine> {
+  static W64 evictions;
+
+  static void replaced(RIPProfileLine& elem, W64 oldtag, W64 newtag, int way) {
+    evictions++;
+    elem.reset();
+  }
+
+  static void inserted(RIPProfileLine& elem, W64 newtag, int way) {
+    elem.reset();
+  }
+};
+
+struct RIPProfiler {
+  static const int SETCOUNT = 2048;
+  static const int WAYCOUNT = 8;
+
+  typedef AssociativeArray<W64, RIPProfileLine, SETCOUNT, WAYCOUNT, 1, RIPProfileStatsCollector> table_t;
+
+  table_t* table;
+  odstream os;
+
+  RIPProfiler() { table = null; }
+
+  bool open(const char* filename);
+  void close();
+  void reset();
+
+  //
+  // Returns null if profiling is disabled, so callers can write
+  // "if unlikely (e = ripprof(rip)) e->counter++;"
+  //
+  RIPProfileEntry* operator ()(W64 rip) {
+    if likely (!table) return null;
+    RIPProfileLine* line = table->select(rip);
+    line->rip = rip;
+    return line;
+  }
+
+  void write(W64 uuid, W64 cycle, const char* name);
+  bool enabled() const { return (table != null); }
+};
+
+extern RIPProfiler ripprof;
+#endif // PTLSIM_PUBLIC_ONLY
+
+#endif // _RIPPROF_H_
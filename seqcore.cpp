@@ -12,6 +12,10 @@
 #include <dcache.h>
 #include <datastore.h>
 #include <stats.h>
+#include <eventstream.h>
+#include <simpoint.h>
+#include <memtrace.h>
+#include <stackdist.h>
 
 // With these disabled, simulation is faster
 #define ENABLE_CHECKS
@@ -237,166 +241,6 @@ W64 TransactionalMemory<N, setcount>::storeimpl(W64 physaddr, W64 data, byte byt
   return rc;
 }
 
-enum {
-  EVENT_INVALID = 0,
-  EVENT_TRANSLATE,
-  EVENT_EXECUTE_BB,
-  EVENT_ISSUE,
-  EVENT_BRANCH,
-  EVENT_LOAD,
-  EVENT_STORE,
-  EVENT_LOAD_STORE_UNALIGNED,
-  EVENT_LOAD_ANNUL,
-  EVENT_SKIPBLOCK,
-  EVENT_ALIGNMENT_FIXUP,
-  EVENT_PTE_UPDATE,
-  EVENT_ASSIST,
-  EVENT_SMC,
-  EVENT_COUNT,
-};
-
-//
-// Event that gets written to the trace buffer
-//
-// In the interest of minimizing space, the cycle counters
-// and uuids are only 32-bits; in practice wraparound is
-// not likely to be a problem.
-//
-struct SequentialCoreEvent {
-  W32 cycle;
-  W32 uuid;
-  W64 rip;
-  W32 eomid;
-  byte type;
-  byte coreid;
-  byte threadid;
-  byte uopid;
-  TransOp uop;
-
-  union {
-    struct {
-      IssueState state;
-    } issue;
-    struct {
-      SFR sfr;
-      W64 virtaddr;
-      W64 origaddr;
-      W64 pteused;
-      W32 pfec;
-    } loadstore;
-    struct {
-      int uopindex;
-    } alignfixup;
-    struct {
-      W64 chk_recovery_rip;
-      byte bytes_in_current_insn;
-    } skipblock;
-    struct {
-      W64 virtaddr;
-      W64 pteupdate;
-    } pteupdate;
-    struct {
-      RIPVirtPhysBase rvp;
-      void* bb;
-      byte bbcount;
-    } bb;
-    struct {
-      W64 rip;
-      W64 ptl_pip;
-      W64 next_rip;
-      W64 real_target_rip;
-      W16 id;
-    } assist;
-  };
-
-  ostream& print(ostream& os) const;
-};
-
-PrintOperator(SequentialCoreEvent);
-
-ostream& SequentialCoreEvent::print(ostream& os) const {
-  if (uuid > 0)
-    os << intstring(uuid, 20);
-  else os << padstring("-", 20);
-  os << " c", coreid, " t", threadid, " ";
-
-  bool st = isstore(uop.opcode);
-  bool ld = isload(uop.opcode);
-  bool br = isbranch(uop.opcode);
-  stringbuf sb;
-  sb << uop;
-
-  //os << "[type ", type, "]", flush;
-
-  switch (type) {
-  case EVENT_ISSUE:
-  case EVENT_BRANCH: {
-    stringbuf rdstr;
-    print_value_and_flags(rdstr, issue.state.reg.rddata, issue.state.reg.rdflags);
-    os << ((issue.state.reg.rdflags & FLAG_INV)
-           ? ((br) ? "brxcpt" : "except")
-           : ((br) ? "branch" : "issue "));
-    os << " rip ", (void*)rip, ":", intstring(uopid, -2), "  ", padstring(sb, -60), " ", rdstr;
-    break;
-  }
-  case EVENT_LOAD:
-  case EVENT_STORE: {
-    os << ((loadstore.sfr.invalid)
-           ? ((st) ? "stxcpt" : "ldxcpt")
-           : ((st) ? "store " : "load  "));
-    os << " rip ", (void*)rip, ":", intstring(uopid, -2), "  ", padstring(sb, -60), " ", loadstore.sfr,
-      " (virt 0x", hexstring(loadstore.virtaddr, 48), ")";
-    if (loadstore.origaddr != loadstore.virtaddr) os << " (orig 0x", hexstring(loadstore.origaddr, 48), ")";
-    if (loadstore.sfr.invalid) os << " (PFEC ", PageFaultErrorCode(loadstore.pfec), ", PTE ", Level1PTE(loadstore.pteused), ")";
-    break;
-  }
-  case EVENT_LOAD_ANNUL: {
-    os << "ldanul", " rip ", (void*)rip, ":", intstring(uopid, -2), "  ", padstring(sb, -60), " ", loadstore.sfr,
-      " (virt 0x", hexstring(loadstore.virtaddr, 48), ")";
-    if (loadstore.origaddr != loadstore.virtaddr) os << " (orig 0x", hexstring(loadstore.origaddr, 48), ")";
-    os << " was annulled (high unaligned load)";
-    break;
-  }
-  case EVENT_LOAD_STORE_UNALIGNED: {
-    os << ((st) ? "stalgn" : "ldalgn");
-    os << " rip ", (void*)rip, ":", intstring(uopid, -2), "  ", padstring(sb, -60),
-      " virt 0x", hexstring(loadstore.virtaddr, 48), " (size ", (1<<uop.size), ")";
-    break;
-  }
-  case EVENT_SKIPBLOCK: {
-    os << "skip   rip ", (void*)rip, ":", intstring(uopid, -2), "  ", padstring(sb, -60), ": advance by ",
-      skipblock.bytes_in_current_insn,  " bytes to ", (void*)skipblock.chk_recovery_rip;
-    break;
-  }
-  case EVENT_ALIGNMENT_FIXUP: {
-    os << "algnfx", " rip ", rip, ":", intstring(uopid, -2), " ", padstring(sb, -60),
-      " set unaligned bit for uop index ", alignfixup.uopindex;
-    break;
-  }
-  case EVENT_TRANSLATE: {
-    os << "xlate  rip ", (void*)rip, " (rvp ", bb.rvp, "): BB of ", bb.bbcount, " uops";
-    break;
-  }
-  case EVENT_EXECUTE_BB: {
-    os << "execbb rip ", (void*)rip, " (rvp ", bb.rvp, "): BB of ", bb.bbcount, " uops";
-    break;
-  }
-  case EVENT_PTE_UPDATE: {
-    os << "pteupd 0x", hexstring(pteupdate.virtaddr, 48), ": ", PTEUpdate(pteupdate.pteupdate);
-    break;
-  }
-  default: {
-    os << "Unknown event type ", type, endl;
-    break;
-  }
-  }
-
-  if (uop.eom) os << " [EOM #", eomid, "]";  
-  os << endl;
-
-  return os;
-}
-
 struct SequentialCoreEventLog {
   SequentialCoreEvent* start;
   SequentialCoreEvent* end;
@@ -411,7 +255,7 @@ struct SequentialCoreEventLog {
   SequentialCoreEvent* add() {
     if unlikely (tail >= end) {
       tail = start;
-      if likely ((config.loglevel >= 6) || config.flush_event_log_every_cycle) flush();
+      if likely ((config.loglevel >= 6) || config.flush_event_log_every_cycle || eventstream.enabled()) flush();
     }
     SequentialCoreEvent* event = tail;
     tail++;
@@ -470,6 +314,12 @@ void SequentialCoreEventLog::reset() {
 }
 
 void SequentialCoreEventLog::flush(bool only_to_tail) {
+  if unlikely (eventstream.enabled()) {
+    eventstream.write(EVENT_STREAM_BLOCK_SEQCORE, start, (only_to_tail) ? (tail - start) : (end - start), sizeof(SequentialCoreEvent));
+    tail = start;
+    return;
+  }
+
   if unlikely (!logfile) return;
   if unlikely (!logfile->ok()) return;
   print(*logfile, only_to_tail);
@@ -746,6 +596,9 @@ struct SequentialCore {
     //
     state.physaddr = (annul) ? INVALID_PHYSADDR : (physaddr >> 3);
 
+    if unlikely (memtrace.enabled() && (!annul)) memtrace.add(MEMTRACE_STORE, rip, addr, physaddr, sizeshift);
+    if unlikely (stackdist.enabled() && (!annul)) stackdist.access(physaddr);
+
     bool ready;
     byte bytemask;
 
@@ -817,6 +670,9 @@ struct SequentialCore {
 
     state.physaddr = (annul) ? 0xffffffffffffffffULL : (physaddr >> 3);
 
+    if unlikely (memtrace.enabled() && (!annul)) memtrace.add(MEMTRACE_LOAD, rip, addr, physaddr, sizeshift);
+    if unlikely (stackdist.enabled() && (!annul)) stackdist.access(physaddr);
+
     W64 data = 0;
     if likely (!annul) {
       if unlikely (cmtrec) {
@@ -1163,6 +1019,12 @@ struct SequentialCore {
         fetch_user_insns_fetched++;
         // Update the span of bytes to watch for SMC:
         rvp.update(ctx, uop.bytes);
+
+        if unlikely (memtrace.enabled()) {
+          RIPVirtPhys insnrvp(arf[REG_rip]);
+          insnrvp.update(ctx, uop.bytes);
+          memtrace.add(MEMTRACE_FETCH, arf[REG_rip], arf[REG_rip], (insnrvp.mfnlo << 12) + lowbits(arf[REG_rip], 12), 0);
+        }
         //
         // Save the flags at the start of this x86 insn in
         // case an ALU uop inside the macro-op updates the
@@ -1283,6 +1145,15 @@ struct SequentialCore {
 
         bb->predcount += (uop.opcode == OP_jmp) ? (state.reg.rddata == bb->lasttarget) : (state.reg.rddata == uop.riptaken);
         bb->lasttarget = state.reg.rddata;
+      } else if unlikely (uop.vec128) {
+        // 128-bit vector uops read both halves of each register pair directly
+        assert((void*)synthop);
+        ((uopimpl_vec128_func_t)synthop)(state, &arf[uop.ra], &arf[uop.rb]);
+
+        if unlikely (config.event_log_enabled) {
+          SequentialCoreEvent* event = eventlog.add(EVENT_ISSUE, ctx.vcpuid, uop, rip, current_uop_in_macro_op, current_uuid, total_user_insns_committed);
+          event->issue.state = state;
+        }
       } else {
         assert((void*)synthop);
         synthop(state, radata, rbdata, rcdata, raflags, rbflags, rcflags);
@@ -1335,6 +1206,11 @@ struct SequentialCore {
           Waddr mfn = (sfr.physaddr << 3) >> 12;
           smc_setdirty(mfn); // why is this being passed zero?
         }
+      } else if unlikely (uop.vec128) {
+        arf[uop.rd+0] = state.vreg.lo;
+        arf[uop.rd+1] = state.vreg.hi;
+        arflags[uop.rd+0] = 0;
+        arflags[uop.rd+1] = 0;
       } else if likely (uop.rd != REG_zero) {
         arf[uop.rd] = state.reg.rddata;
         arflags[uop.rd] = state.reg.rdflags;
@@ -1393,10 +1269,12 @@ struct SequentialCore {
         }
       }
 
-      seq_total_user_insns_committed += uop.eom;
-      total_user_insns_committed += uop.eom && (!suppress_total_user_insn_count_updates_in_seqcore);
-      user_insns += uop.eom;
-      stats.summary.insns += uop.eom;
+      // A fused cmp/test + jcc uop retires two x86 insns
+      int insns = (uop.eom) ? (1 + uop.fused) : 0;
+      seq_total_user_insns_committed += insns;
+      total_user_insns_committed += (!suppress_total_user_insn_count_updates_in_seqcore) ? insns : 0;
+      user_insns += insns;
+      stats.summary.insns += insns;
       stats.summary.uops++;
 
       current_uuid++;
@@ -1425,7 +1303,18 @@ struct SequentialCore {
 
     bool exiting = 0;
 
+    if unlikely (bbvprof.enabled()) {
+      if unlikely (bbvprof.simpoint_due() >= 0) {
+        core_to_external_state(ctx);
+        bbvprof.checkpoint();
+      }
+    }
+
+    W64 user_insns_at_start = seq_total_user_insns_committed;
+
     int result = execute(current_basic_block, (config.stop_at_user_insns - total_user_insns_committed));
+
+    if unlikely (bbvprof.enabled()) bbvprof.add(rip, seq_total_user_insns_committed - user_insns_at_start);
     
     switch (result) {
     case SEQEXEC_OK:
@@ -1655,6 +1544,8 @@ struct SequentialMachine: public PTLsimMachine {
 
     logfile << "Exiting sequential mode at ", total_user_insns_committed, " commits, ", total_uops_committed, " uops and ", iterations, " iterations (cycles)", endl;
 
+    if unlikely (eventstream.enabled()) eventlog.flush(true);
+
     if (logable(1)) {
       dump_state(logfile);
     }
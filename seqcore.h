@@ -62,4 +62,84 @@ int execute_sequential(Context& ctx, CommitRecord* cmtrec = null, W64 bbcount =
 
 extern W64 suppress_total_user_insn_count_updates_in_seqcore;
 
+//
+// Sequential core event log record types
+//
+enum {
+  EVENT_INVALID = 0,
+  EVENT_TRANSLATE,
+  EVENT_EXECUTE_BB,
+  EVENT_ISSUE,
+  EVENT_BRANCH,
+  EVENT_LOAD,
+  EVENT_STORE,
+  EVENT_LOAD_STORE_UNALIGNED,
+  EVENT_LOAD_ANNUL,
+  EVENT_SKIPBLOCK,
+  EVENT_ALIGNMENT_FIXUP,
+  EVENT_PTE_UPDATE,
+  EVENT_ASSIST,
+  EVENT_SMC,
+  EVENT_COUNT,
+};
+
+//
+// Event that gets written to the trace buffer
+//
+// In the interest of minimizing space, the cycle counters
+// and uuids are only 32-bits; in practice wraparound is
+// not likely to be a problem.
+//
+struct SequentialCoreEvent {
+  W32 cycle;
+  W32 uuid;
+  W64 rip;
+  W32 eomid;
+  byte type;
+  byte coreid;
+  byte threadid;
+  byte uopid;
+  TransOp uop;
+
+  union {
+    struct {
+      IssueState state;
+    } issue;
+    struct {
+      SFR sfr;
+      W64 virtaddr;
+      W64 origaddr;
+      W64 pteused;
+      W32 pfec;
+    } loadstore;
+    struct {
+      int uopindex;
+    } alignfixup;
+    struct {
+      W64 chk_recovery_rip;
+      byte bytes_in_current_insn;
+    } skipblock;
+    struct {
+      W64 virtaddr;
+      W64 pteupdate;
+    } pteupdate;
+    struct {
+      RIPVirtPhysBase rvp;
+      void* bb;
+      byte bbcount;
+    } bb;
+    struct {
+      W64 rip;
+      W64 ptl_pip;
+      W64 next_rip;
+      W64 real_target_rip;
+      W16 id;
+    } assist;
+  };
+
+  ostream& print(ostream& os) const;
+};
+
+PrintOperator(SequentialCoreEvent);
+
 #endif // _SEQCORE_H_
@@ -0,0 +1,97 @@
+//
+// PTLsim: Cycle Accurate x86-64 Simulator
+// Sequential Core Simulator
+// Event Log Formatting
+//
+// Copyright 2003-2008 Matt T. Yourst <yourst@yourst.com>
+//
+// Kept separate from seqcore.cpp so the ptlevents tool
+// can decode binary event streams offline.
+//
+
+#include <globals.h>
+#include <ptlsim.h>
+#include <seqcore.h>
+
+ostream& SequentialCoreEvent::print(ostream& os) const {
+  if (uuid > 0)
+    os << intstring(uuid, 20);
+  else os << padstring("-", 20);
+  os << " c", coreid, " t", threadid, " ";
+
+  bool st = isstore(uop.opcode);
+  bool ld = isload(uop.opcode);
+  bool br = isbranch(uop.opcode);
+  stringbuf sb;
+  sb << uop;
+
+  //os << "[type ", type, "]", flush;
+
+  switch (type) {
+  case EVENT_ISSUE:
+  case EVENT_BRANCH: {
+    stringbuf rdstr;
+    print_value_and_flags(rdstr, issue.state.reg.rddata, issue.state.reg.rdflags);
+    os << ((issue.state.reg.rdflags & FLAG_INV)
+           ? ((br) ? "brxcpt" : "except")
+           : ((br) ? "branch" : "issue "));
+    os << " rip ", (void*)rip, ":", intstring(uopid, -2), "  ", padstring(sb, -60), " ", rdstr;
+    break;
+  }
+  case EVENT_LOAD:
+  case EVENT_STORE: {
+    os << ((loadstore.sfr.invalid)
+           ? ((st) ? "stxcpt" : "ldxcpt")
+           : ((st) ? "store " : "load  "));
+    os << " rip ", (void*)rip, ":", intstring(uopid, -2), "  ", padstring(sb, -60), " ", loadstore.sfr,
+      " (virt 0x", hexstring(loadstore.virtaddr, 48), ")";
+    if (loadstore.origaddr != loadstore.virtaddr) os << " (orig 0x", hexstring(loadstore.origaddr, 48), ")";
+    if (loadstore.sfr.invalid) os << " (PFEC ", PageFaultErrorCode(loadstore.pfec), ", PTE ", Level1PTE(loadstore.pteused), ")";
+    break;
+  }
+  case EVENT_LOAD_ANNUL: {
+    os << "ldanul", " rip ", (void*)rip, ":", intstring(uopid, -2), "  ", padstring(sb, -60), " ", loadstore.sfr,
+      " (virt 0x", hexstring(loadstore.virtaddr, 48), ")";
+    if (loadstore.origaddr != loadstore.virtaddr) os << " (orig 0x", hexstring(loadstore.origaddr, 48), ")";
+    os << " was annulled (high unaligned load)";
+    break;
+  }
+  case EVENT_LOAD_STORE_UNALIGNED: {
+    os << ((st) ? "stalgn" : "ldalgn");
+    os << " rip ", (void*)rip, ":", intstring(uopid, -2), "  ", padstring(sb, -60),
+      " virt 0x", hexstring(loadstore.virtaddr, 48), " (size ", (1<<uop.size), ")";
+    break;
+  }
+  case EVENT_SKIPBLOCK: {
+    os << "skip   rip ", (void*)rip, ":", intstring(uopid, -2), "  ", padstring(sb, -60), ": advance by ",
+      skipblock.bytes_in_current_insn,  " bytes to ", (void*)skipblock.chk_recovery_rip;
+    break;
+  }
+  case EVENT_ALIGNMENT_FIXUP: {
+    os << "algnfx", " rip ", rip, ":", intstring(uopid, -2), " ", padstring(sb, -60),
+      " set unaligned bit for uop index ", alignfixup.uopindex;
+    break;
+  }
+  case EVENT_TRANSLATE: {
+    os << "xlate  rip ", (void*)rip, " (rvp ", bb.rvp, "): BB of ", bb.bbcount, " uops";
+    break;
+  }
+  case EVENT_EXECUTE_BB: {
+    os << "execbb rip ", (void*)rip, " (rvp ", bb.rvp, "): BB of ", bb.bbcount, " uops";
+    break;
+  }
+  case EVENT_PTE_UPDATE: {
+    os << "pteupd 0x", hexstring(pteupdate.virtaddr, 48), ": ", PTEUpdate(pteupdate.pteupdate);
+    break;
+  }
+  default: {
+    os << "Unknown event type ", type, endl;
+    break;
+  }
+  }
+
+  if (uop.eom) os << " [EOM #", eomid, "]";  
+  os << endl;
+
+  return os;
+}
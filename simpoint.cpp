@@ -0,0 +1,144 @@
+//
+// PTLsim: Cycle Accurate x86-64 Simulator
+// SimPoint Basic Block Vector Profiler
+//
+// Copyright 2008 Matt T. Yourst <yourst@yourst.com>
+//
+
+#include <globals.h>
+#include <superstl.h>
+#include <ptlsim.h>
+#include <simpoint.h>
+#ifndef PTLSIM_HYPERVISOR
+#include <checkpoint.h>
+#endif
+
+BasicBlockVectorProfiler bbvprof;
+
+bool BasicBlockVectorProfiler::open(const char* filename, W64 interval_size) {
+  close();
+
+  if unlikely (!interval_size) {
+    logfile << "BasicBlockVectorProfiler: interval size must be non-zero", endl;
+    return false;
+  }
+
+  if (filename) {
+    os.open(filename);
+    if unlikely (!os) {
+      logfile << "BasicBlockVectorProfiler: cannot open '", filename, "' for writing", endl;
+      return false;
+    }
+  }
+
+  this->interval_size = interval_size;
+  interval = 0;
+  insns_in_interval = 0;
+  next_bb_id = 1;
+  return true;
+}
+
+struct SimulationPointComparator {
+  int operator ()(const SimulationPoint& a, const SimulationPoint& b) const {
+    return (a.interval < b.interval) ? -1 : (a.interval > b.interval) ? +1 : 0;
+  }
+};
+
+//
+// SimPoint writes one "<interval> <clusterid>" line per cluster
+//
+bool BasicBlockVectorProfiler::load_simpoints(const char* filename, const char* checkpoint_prefix) {
+  istream is(filename);
+  if unlikely (!is) {
+    logfile << "BasicBlockVectorProfiler: cannot open simulation points file '", filename, "'", endl;
+    return false;
+  }
+
+  simpoints.clear();
+  stringbuf line;
+
+  for (;;) {
+    line.reset();
+    is >> line;
+    if (!is) break;
+
+    unsigned long long interval;
+    int cluster;
+    if (sscanf(line, "%llu %d", &interval, &cluster) != 2) continue;
+
+    SimulationPoint sp;
+    sp.interval = interval;
+    sp.cluster = cluster;
+    simpoints.push(sp);
+  }
+
+  sort(simpoints.data, simpoints.length, SimulationPointComparator());
+
+  next_simpoint = 0;
+  this->checkpoint_prefix.reset();
+  if (checkpoint_prefix) this->checkpoint_prefix << checkpoint_prefix;
+
+  logfile << "BasicBlockVectorProfiler: loaded ", simpoints.length, " simulation points from ", filename, endl;
+  return true;
+}
+
+void BasicBlockVectorProfiler::close() {
+  if (os) {
+    // Partial intervals are still useful to SimPoint
+    if (insns_in_interval) flush();
+    os.close();
+  }
+
+  table.clear_and_free();
+  touched.clear();
+  simpoints.clear();
+  interval_size = 0;
+}
+
+//
+// Write the current interval's vector and start the next interval
+//
+void BasicBlockVectorProfiler::flush() {
+  if likely (os) {
+    os << "T";
+    foreach (i, touched.length) {
+      BasicBlockVectorEntry* e = touched.data[i];
+      os << ":", e->id, ":", e->insns, " ";
+    }
+    os << endl;
+  }
+
+  foreach (i, touched.length) touched.data[i]->insns = 0;
+  touched.clear();
+
+  insns_in_interval = 0;
+  interval++;
+}
+
+//
+// Checkpoint the user process at the start of a chosen interval.
+// The caller must have already written the core state back to ctx.
+//
+void BasicBlockVectorProfiler::checkpoint() {
+  int cluster = simpoint_due();
+  if unlikely (cluster < 0) return;
+
+  // Each interval belongs to a single cluster, but skip any duplicate entries
+  while ((next_simpoint < simpoints.length) && (simpoints.data[next_simpoint].interval == interval)) next_simpoint++;
+
+  logfile << "BasicBlockVectorProfiler: reached simulation point for cluster ", cluster, " at interval ", interval,
+    " (", total_user_insns_committed, " user instructions)", endl;
+
+  if (!checkpoint_prefix.set()) return;
+
+#ifdef PTLSIM_HYPERVISOR
+  logfile << "BasicBlockVectorProfiler: checkpoints are not supported in full system mode", endl;
+#else
+  stringbuf filename;
+  filename << checkpoint_prefix, ".", cluster;
+
+  if (!save_checkpoint(filename)) {
+    cerr << "ptlsim: cannot save simulation point checkpoint to ", filename, endl, superstl::flush;
+  }
+#endif
+}
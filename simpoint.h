@@ -0,0 +1,147 @@
+// -*- c++ -*-
+//
+// PTLsim: Cycle Accurate x86-64 Simulator
+// SimPoint Basic Block Vector Profiler
+//
+// Copyright 2008 Matt T. Yourst <yourst@yourst.com>
+//
+
+#ifndef _SIMPOINT_H_
+#define _SIMPOINT_H_
+
+#include <globals.h>
+#include <superstl.h>
+
+//
+// Simulating a whole benchmark on the out of order core takes days.
+// SimPoint instead clusters fixed size instruction intervals by the
+// basic blocks they execute, and picks one representative interval
+// (the simulation point) per cluster, with a weight equal to the
+// fraction of all intervals in that cluster.
+//
+// Workflow:
+//
+// 1. Run the whole program on the sequential core with -bbv <file>:
+//    every -bbv-interval user instructions, one line of the form
+//
+//      T:<bbid>:<insns> :<bbid>:<insns> ...
+//
+//    is appended, listing the number of user instructions executed in
+//    each basic block during that interval (the standard SimPoint .bb
+//    format; basic block IDs start at 1 in order of first execution).
+//
+// 2. Run "simpoint -loadFVFile <file> -saveSimpoints <file>.simpoints
+//    -saveSimpointWeights <file>.weights ...".
+//
+// 3. Run the sequential core again with -simpoints <file>.simpoints
+//    and -simpoint-checkpoint <prefix>: when the start of each chosen
+//    interval is reached, the user process is checkpointed to the file
+//    <prefix>.<clusterid>.
+//
+// 4. Simulate each checkpoint with -restore-checkpoint <prefix>.<clusterid>
+//    and -stopinsns <interval>, writing the stats to one file per cluster.
+//
+// 5. Combine the per-cluster results with "ptlstats -collectweighted <subtree>
+//    -simpoint-weights <file>.weights" followed by the stats files listed
+//    in cluster ID order. This gives the weighted average of a single
+//    interval; multiply by the number of intervals for whole-run totals.
+//
+// Interval boundaries fall on basic block boundaries, so each interval
+// is up to one basic block longer than -bbv-interval instructions.
+//
+
+#ifndef PTLSIM_PUBLIC_ONLY
+
+struct BasicBlockVectorEntry {
+  selflistlink hashlink;
+  W64 rip;
+  W64 insns;   // user instructions executed in the current interval
+  W32 id;
+};
+
+struct BasicBlockVectorLinkManager {
+  static inline BasicBlockVectorEntry* objof(selflistlink* link) {
+    return baseof(BasicBlockVectorEntry, hashlink, link);
+  }
+
+  static inline W64& keyof(BasicBlockVectorEntry* obj) {
+    return obj->rip;
+  }
+
+  static inline selflistlink* linkof(BasicBlockVectorEntry* obj) {
+    return &obj->hashlink;
+  }
+};
+
+struct SimulationPoint {
+  W64 interval;
+  int cluster;
+};
+
+struct BasicBlockVectorProfiler {
+  typedef SelfHashtable<W64, BasicBlockVectorEntry, 16384, BasicBlockVectorLinkManager> table_t;
+
+  table_t table;
+  dynarray<BasicBlockVectorEntry*> touched;
+  ostream os;
+
+  W64 interval_size;
+  W64 interval;
+  W64 insns_in_interval;
+  W32 next_bb_id;
+
+  dynarray<SimulationPoint> simpoints;
+  int next_simpoint;
+  stringbuf checkpoint_prefix;
+
+  BasicBlockVectorProfiler() { interval_size = 0; interval = 0; insns_in_interval = 0; next_bb_id = 1; next_simpoint = 0; }
+
+  bool open(const char* filename, W64 interval_size);
+  bool load_simpoints(const char* filename, const char* checkpoint_prefix);
+  void close();
+
+  bool enabled() const { return (interval_size != 0); }
+
+  //
+  // Returns the cluster ID if the interval about to start
+  // is a simulation point to checkpoint, otherwise -1.
+  // Points whose interval has already gone by (e.g. if the
+  // profile started mid-run) are skipped.
+  //
+  int simpoint_due() {
+    if likely (insns_in_interval != 0) return -1;
+    while ((next_simpoint < simpoints.length) && (simpoints.data[next_simpoint].interval < interval)) next_simpoint++;
+    if unlikely (next_simpoint >= simpoints.length) return -1;
+    return (simpoints.data[next_simpoint].interval == interval) ? simpoints.data[next_simpoint].cluster : -1;
+  }
+
+  void checkpoint();
+
+  void add(W64 rip, W64 insns) {
+    if unlikely (!insns) return;
+
+    BasicBlockVectorEntry* e = table.get(rip);
+
+    if unlikely (!e) {
+      e = new BasicBlockVectorEntry();
+      e->rip = rip;
+      e->insns = 0;
+      e->id = next_bb_id++;
+      table.add(e);
+    }
+
+    if (!e->insns) touched.push(e);
+    e->insns += insns;
+    insns_in_interval += insns;
+
+    if unlikely (insns_in_interval >= interval_size) flush();
+  }
+
+  void flush();
+};
+
+extern BasicBlockVectorProfiler bbvprof;
+
+#endif // PTLSIM_PUBLIC_ONLY
+
+#endif // _SIMPOINT_H_
@@ -0,0 +1,128 @@
+//
+// PTLsim: Cycle Accurate x86-64 Simulator
+// LRU Stack Distance Profiler
+//
+// Copyright 2008 Matt T. Yourst <yourst@yourst.com>
+//
+
+#include <globals.h>
+#include <superstl.h>
+#include <ptlsim.h>
+#include <stats.h>
+#include <stackdist.h>
+
+StackDistanceProfiler stackdist;
+
+bool StackDistanceProfiler::open(int linesize) {
+  close();
+
+  if unlikely ((linesize <= 0) | (linesize & (linesize-1))) {
+    logfile << "StackDistanceProfiler: line size ", linesize, " is not a power of two", endl;
+    return false;
+  }
+
+  lineshift = lsbindex(linesize);
+
+  tree = new W32[TREE_SIZE];
+  foreach (i, TREE_SIZE) tree[i] = 0;
+  now = 0;
+
+  // Stacks for 16, 32, ... 16384 sets, all packed into one array
+  int sets = STACK_DISTANCE_MIN_SETS * ((1 << STACK_DISTANCE_SET_COUNTS) - 1);
+  stacks = new W64[sets * STACK_DISTANCE_MAX_WAYS];
+  foreach (i, sets * STACK_DISTANCE_MAX_WAYS) stacks[i] = limits<W64>::max;
+
+  return true;
+}
+
+void StackDistanceProfiler::close() {
+  table.clear_and_free();
+  if (tree) delete[] tree;
+  if (stacks) delete[] stacks;
+  tree = null;
+  stacks = null;
+  now = 0;
+}
+
+void StackDistanceProfiler::fully_associative(W64 line) {
+  stats.stackdist.accesses++;
+
+  if unlikely (now >= (TREE_SIZE-1)) compact();
+
+  StackDistanceEntry* e = table.get(line);
+
+  if unlikely (!e) {
+    stats.stackdist.fullyassoc[STACK_DISTANCE_BUCKETS-1]++;
+    e = new StackDistanceEntry();
+    e->line = line;
+    table.add(e);
+  } else {
+    // Number of distinct lines touched since the last access to this one
+    W32 depth = prefix(now) - prefix(e->timestamp);
+    int slot = (depth) ? (msbindex(depth) + 1) : 0;
+    stats.stackdist.fullyassoc[min(slot, STACK_DISTANCE_BUCKETS-2)]++;
+    update(e->timestamp, -1);
+  }
+
+  now++;
+  update(now, +1);
+  e->timestamp = now;
+}
+
+void StackDistanceProfiler::set_associative(W64 line) {
+  // The setsN histograms are laid out back to back in the stats tree
+  W64* histogram = (W64*)&stats.stackdist.setassoc;
+  W64* stack = stacks;
+
+  foreach (i, STACK_DISTANCE_SET_COUNTS) {
+    int sets = STACK_DISTANCE_MIN_SETS << i;
+    W64* set = stack + (line & (sets-1)) * STACK_DISTANCE_MAX_WAYS;
+
+    int way = 0;
+    while ((way < STACK_DISTANCE_MAX_WAYS) && (set[way] != line)) way++;
+
+    histogram[way]++;
+
+    // Move to the MRU position (dropping the LRU line on a miss)
+    int shift = min(way, STACK_DISTANCE_MAX_WAYS-1);
+    for (int j = shift; j > 0; j--) set[j] = set[j-1];
+    set[0] = line;
+
+    histogram += STACK_DISTANCE_MAX_WAYS+1;
+    stack += sets * STACK_DISTANCE_MAX_WAYS;
+  }
+}
+
+struct StackDistanceEntryComparator {
+  int operator ()(StackDistanceEntry* a, StackDistanceEntry* b) const {
+    return (a->timestamp < b->timestamp) ? -1 : (a->timestamp > b->timestamp) ? +1 : 0;
+  }
+};
+
+//
+// Renumber the live timestamps from 1 in access order. If more lines
+// are live than half the tree, forget the least recently used ones:
+// their next accesses count as cold misses, which is exact for any
+// cache up to TREE_SIZE/2 lines.
+//
+void StackDistanceProfiler::compact() {
+  dynarray<StackDistanceEntry*> entries;
+  table.getentries(entries);
+  sort(entries.data, entries.length, StackDistanceEntryComparator());
+
+  int drop = max((int)entries.length - (TREE_SIZE / 2), 0);
+
+  foreach (i, drop) {
+    table.remove(entries.data[i]);
+    delete entries.data[i];
+  }
+
+  foreach (i, TREE_SIZE) tree[i] = 0;
+  now = 0;
+
+  for (int i = drop; i < entries.length; i++) {
+    now++;
+    entries.data[i]->timestamp = now;
+    update(now, +1);
+  }
+}
@@ -0,0 +1,105 @@
+// -*- c++ -*-
+//
+// PTLsim: Cycle Accurate x86-64 Simulator
+// LRU Stack Distance Profiler
+//
+// Copyright 2008 Matt T. Yourst <yourst@yourst.com>
+//
+
+#ifndef _STACKDIST_H_
+#define _STACKDIST_H_
+
+#include <globals.h>
+#include <superstl.h>
+
+//
+// With -stack-distance, every data access on the sequential core
+// (or every load and store in a trace given to ptlcachesim -model mrc)
+// is looked up in LRU stacks of cache lines (Mattson et al, 1970).
+// An access at stack depth d hits in every LRU cache with more than
+// d lines (or ways), so a single pass yields the miss ratio curve for
+// every cache size at once:
+//
+// stackdist/fullyassoc is the histogram for fully associative caches:
+// slot 0 counts accesses to the most recently used line; slot k > 0
+// counts accesses at a depth of 2^(k-1) to 2^k - 1 lines, i.e. hits
+// in caches of 2^k lines but not of 2^(k-1) lines. The last slot
+// counts first touches and lines too old to track. The hit ratio of
+// a 2^k line cache is therefore the cumulative sum up to slot k
+// (see ptlstats -histogram stackdist/fullyassoc -cumulative-histogram).
+//
+// stackdist/setassoc/setsN holds the same thing for caches with N
+// sets (set index = line address mod N), where slot w counts hits
+// at way w of the set's LRU stack. A cache of N sets and A ways hits
+// on the sum of slots 0 to A-1; the last slot counts misses in every
+// cache with up to STACK_DISTANCE_MAX_WAYS ways.
+//
+// The fully associative stack is kept as a Fenwick tree over access
+// timestamps (marking the latest access to each line), so each access
+// costs O(log n) rather than O(depth) like a linked LRU stack.
+//
+
+struct StackDistanceEntry {
+  selflistlink hashlink;
+  W64 line;
+  W32 timestamp;
+};
+
+struct StackDistanceLinkManager {
+  static inline StackDistanceEntry* objof(selflistlink* link) {
+    return baseof(StackDistanceEntry, hashlink, link);
+  }
+
+  static inline W64& keyof(StackDistanceEntry* obj) {
+    return obj->line;
+  }
+
+  static inline selflistlink* linkof(StackDistanceEntry* obj) {
+    return &obj->hashlink;
+  }
+};
+
+struct StackDistanceProfiler {
+  typedef SelfHashtable<W64, StackDistanceEntry, 65536, StackDistanceLinkManager> table_t;
+
+  // Timestamps are renumbered once they reach the end of the tree
+  static const int TREE_SIZE = (1 << 22);
+
+  table_t table;
+  W32* tree;
+  W32 now;
+  W64* stacks;
+  int lineshift;
+
+  StackDistanceProfiler() { tree = null; stacks = null; now = 0; lineshift = 0; }
+
+  bool open(int linesize);
+  void close();
+
+  bool enabled() const { return (tree != null); }
+
+  void access(W64 physaddr) {
+    W64 line = physaddr >> lineshift;
+    fully_associative(line);
+    set_associative(line);
+  }
+
+protected:
+  void fully_associative(W64 line);
+  void set_associative(W64 line);
+  void compact();
+
+  void update(W32 i, int delta) {
+    for (; i < TREE_SIZE; i += (i & -i)) tree[i] += delta;
+  }
+
+  W32 prefix(W32 i) const {
+    W32 sum = 0;
+    for (; i; i -= (i & -i)) sum += tree[i];
+    return sum;
+  }
+};
+
+extern StackDistanceProfiler stackdist;
+
+#endif // _STACKDIST_H_
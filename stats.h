@@ -52,6 +52,34 @@ struct EventsInMode { // rootnode: summable
   W64 idle;
 };
 
+//
+// LRU stack distance histograms of data accesses (see stackdist.h)
+//
+static const int STACK_DISTANCE_BUCKETS = 23;         // fully associative caches of 1 to 2^21 lines, plus cold misses
+static const int STACK_DISTANCE_MAX_WAYS = 32;
+static const int STACK_DISTANCE_MIN_SETS = 16;
+static const int STACK_DISTANCE_SET_COUNTS = 11;      // 16 to 16384 sets
+
+struct StackDistanceStats { // rootnode:
+  W64 accesses;
+  W64 fullyassoc[STACK_DISTANCE_BUCKETS]; // histo: 0, STACK_DISTANCE_BUCKETS-1, 1
+
+  // One histogram per set count: the profiler indexes these as a single array
+  struct setassoc {
+    W64 sets16[STACK_DISTANCE_MAX_WAYS+1]; // histo: 0, STACK_DISTANCE_MAX_WAYS, 1
+    W64 sets32[STACK_DISTANCE_MAX_WAYS+1]; // histo: 0, STACK_DISTANCE_MAX_WAYS, 1
+    W64 sets64[STACK_DISTANCE_MAX_WAYS+1]; // histo: 0, STACK_DISTANCE_MAX_WAYS, 1
+    W64 sets128[STACK_DISTANCE_MAX_WAYS+1]; // histo: 0, STACK_DISTANCE_MAX_WAYS, 1
+    W64 sets256[STACK_DISTANCE_MAX_WAYS+1]; // histo: 0, STACK_DISTANCE_MAX_WAYS, 1
+    W64 sets512[STACK_DISTANCE_MAX_WAYS+1]; // histo: 0, STACK_DISTANCE_MAX_WAYS, 1
+    W64 sets1024[STACK_DISTANCE_MAX_WAYS+1]; // histo: 0, STACK_DISTANCE_MAX_WAYS, 1
+    W64 sets2048[STACK_DISTANCE_MAX_WAYS+1]; // histo: 0, STACK_DISTANCE_MAX_WAYS, 1
+    W64 sets4096[STACK_DISTANCE_MAX_WAYS+1]; // histo: 0, STACK_DISTANCE_MAX_WAYS, 1
+    W64 sets8192[STACK_DISTANCE_MAX_WAYS+1]; // histo: 0, STACK_DISTANCE_MAX_WAYS, 1
+    W64 sets16384[STACK_DISTANCE_MAX_WAYS+1]; // histo: 0, STACK_DISTANCE_MAX_WAYS, 1
+  } setassoc;
+};
+
 struct PTLsimStats { // rootnode:
   W64 snapshot_uuid;
   char snapshot_name[64];
@@ -140,11 +168,56 @@ struct PTLsimStats { // rootnode:
       W64 invalidates[INVALIDATE_REASON_COUNT]; // label: invalidate_reason_names
     } pagecache;
 
+    // Macro-op fusion of cmp or test with the following jcc
+    struct fusion { // node: summable
+      W64 cmp_jcc;
+      W64 test_jcc;
+      W64 not_fused;
+    } fusion;
+
+    // Basic block uop optimizer (decode-opt.cpp)
+    struct optimizer { // node: summable
+      W64 blocks;
+      W64 uops_in;
+      W64 uops_out;
+      W64 copies_propagated;
+      W64 flag_sets_pruned;
+      W64 dead_uops;
+    } optimizer;
+
+    // Table driven predecoder
+    struct predecode { // node: summable
+      W64 windows;
+      W64 insns;
+      W64 lcp;
+      W64 mismatches;
+    } predecode;
+
+    // Background translation of successor blocks (-speculative-translate)
+    struct speculation { // node: summable
+      W64 queued;
+      W64 published;
+      W64 waited;
+      W64 cancelled;
+      W64 discarded;
+    } speculation;
+
+    // Pooled basic block clones (BasicBlock::clone() and free())
+    struct bbpool {
+      W64 allocs;
+      W64 reuses;
+      W64 recycled;
+      W64 frees;
+      W64 trimmed;
+      W64 free_blocks;
+    } bbpool;
+
     W64 reclaim_rounds;
   } decoder;
 
   OutOfOrderCoreStats ooocore;
   DataCacheStats dcache;
+  StackDistanceStats stackdist;
 
 
   struct external {
@@ -160,4 +233,7 @@ struct PTLsimStats { // rootnode:
 
 extern struct PTLsimStats stats;
 
+// Decodes on the background translation thread (-speculative-translate)
+extern struct PTLsimStats::decoder speculative_decoder_stats;
+
 #endif // _STATS_H_
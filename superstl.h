@@ -26,6 +26,8 @@
 #define FMT_LARGE	  64 /* use 'ABCDEF' instead of 'abcdef' */
 
 int current_vcpuid();
+// VCPU threads first, then any host helper threads
+int current_thread_id();
 
 extern bool force_synchronous_streams;
 
@@ -3712,13 +3714,14 @@ namespace superstl {
   //
   // Mutex with recursive locking
   //
-  // acquire(vcpuid) can be called multiple times
-  // with the same vcpuid, but if the vcpuid
+  // acquire() can be called multiple times by the
+  // same thread (as given by current_thread_id(),
+  // so a VCPU or a host helper thread), but if it
   // does not match locking_vcpuid, the function
   // spins until the lock can be acquired.
   //
-  // release(vcpuid) unlocks the mutex. The current
-  // vcpuid must equal locking_vcpu.
+  // release() unlocks the mutex. The current
+  // thread must equal locking_vcpuid.
   //
   struct RecursiveMutex {
     W16s locking_vcpuid;
@@ -3732,7 +3735,7 @@ namespace superstl {
     }
 
     bool acquire() {
-      W16s current = current_vcpuid();
+      W16s current = current_thread_id();
       bool acquired;
       bool recursive;
 
@@ -3753,7 +3756,7 @@ namespace superstl {
     }
 
     void release() {
-      W16s current = current_vcpuid();
+      W16s current = current_thread_id();
       assert(locking_vcpuid == current);
       assert(counter > 0);
 
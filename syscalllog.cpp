@@ -0,0 +1,510 @@
+//
+// PTLsim: Cycle Accurate x86-64 Simulator
+// System Call Record and Replay
+//
+// Copyright 2008 Matt T. Yourst <yourst@yourst.com>
+//
+
+#include <globals.h>
+#include <superstl.h>
+#include <ptlsim.h>
+#include <kernel.h>
+#include <syscalllog.h>
+
+SyscallLog syscalllog;
+
+// Based on /usr/include/asm-x86_64/unistd.h:
+#define __NR_64bit_read 0
+#define __NR_64bit_open 2
+#define __NR_64bit_close 3
+#define __NR_64bit_stat 4
+#define __NR_64bit_fstat 5
+#define __NR_64bit_lstat 6
+#define __NR_64bit_poll 7
+#define __NR_64bit_rt_sigprocmask 14
+#define __NR_64bit_pread64 17
+#define __NR_64bit_readv 19
+#define __NR_64bit_pipe 22
+#define __NR_64bit_select 23
+#define __NR_64bit_dup 32
+#define __NR_64bit_dup2 33
+#define __NR_64bit_nanosleep 35
+#define __NR_64bit_getitimer 36
+#define __NR_64bit_setitimer 38
+#define __NR_64bit_socket 41
+#define __NR_64bit_accept 43
+#define __NR_64bit_recvfrom 45
+#define __NR_64bit_getsockname 51
+#define __NR_64bit_getpeername 52
+#define __NR_64bit_socketpair 53
+#define __NR_64bit_getsockopt 55
+#define __NR_64bit_wait4 61
+#define __NR_64bit_uname 63
+#define __NR_64bit_fcntl 72
+#define __NR_64bit_getdents 78
+#define __NR_64bit_getcwd 79
+#define __NR_64bit_creat 85
+#define __NR_64bit_readlink 89
+#define __NR_64bit_gettimeofday 96
+#define __NR_64bit_getrlimit 97
+#define __NR_64bit_getrusage 98
+#define __NR_64bit_sysinfo 99
+#define __NR_64bit_times 100
+#define __NR_64bit_getgroups 115
+#define __NR_64bit_getresuid 118
+#define __NR_64bit_getresgid 120
+#define __NR_64bit_sigaltstack 131
+#define __NR_64bit_statfs 137
+#define __NR_64bit_fstatfs 138
+#define __NR_64bit_time 201
+#define __NR_64bit_sched_getaffinity 204
+#define __NR_64bit_epoll_create 213
+#define __NR_64bit_getdents64 217
+#define __NR_64bit_clock_gettime 228
+#define __NR_64bit_clock_getres 229
+#define __NR_64bit_epoll_wait 232
+#define __NR_64bit_inotify_init 253
+#define __NR_64bit_openat 257
+#define __NR_64bit_signalfd 282
+#define __NR_64bit_timerfd_create 283
+#define __NR_64bit_eventfd 284
+#define __NR_64bit_accept4 288
+#define __NR_64bit_signalfd4 289
+#define __NR_64bit_eventfd2 290
+#define __NR_64bit_epoll_create1 291
+#define __NR_64bit_dup3 292
+#define __NR_64bit_pipe2 293
+#define __NR_64bit_inotify_init1 294
+
+// Based on /usr/include/asm-i386/unistd.h:
+#define __NR_32bit_read 3
+#define __NR_32bit_open 5
+#define __NR_32bit_close 6
+#define __NR_32bit_waitpid 7
+#define __NR_32bit_creat 8
+#define __NR_32bit_time 13
+#define __NR_32bit_dup 41
+#define __NR_32bit_pipe 42
+#define __NR_32bit_times 43
+#define __NR_32bit_fcntl 55
+#define __NR_32bit_dup2 63
+#define __NR_32bit_getrlimit 76
+#define __NR_32bit_getrusage 77
+#define __NR_32bit_gettimeofday 78
+#define __NR_32bit_readlink 85
+#define __NR_32bit_socketcall 102
+#define __NR_32bit_wait4 114
+#define __NR_32bit_sysinfo 116
+#define __NR_32bit_uname 122
+#define __NR_32bit_llseek 140
+#define __NR_32bit_getdents 141
+#define __NR_32bit_newselect 142
+#define __NR_32bit_readv 145
+#define __NR_32bit_nanosleep 162
+#define __NR_32bit_poll 168
+#define __NR_32bit_rt_sigprocmask 175
+#define __NR_32bit_pread64 180
+#define __NR_32bit_getcwd 183
+#define __NR_32bit_ugetrlimit 191
+#define __NR_32bit_stat64 195
+#define __NR_32bit_lstat64 196
+#define __NR_32bit_fstat64 197
+#define __NR_32bit_getdents64 220
+#define __NR_32bit_fcntl64 221
+#define __NR_32bit_epoll_create 254
+#define __NR_32bit_clock_gettime 265
+#define __NR_32bit_clock_getres 266
+#define __NR_32bit_statfs64 268
+#define __NR_32bit_fstatfs64 269
+#define __NR_32bit_inotify_init 291
+#define __NR_32bit_openat 295
+#define __NR_32bit_signalfd 321
+#define __NR_32bit_timerfd_create 322
+#define __NR_32bit_eventfd 323
+#define __NR_32bit_signalfd4 327
+#define __NR_32bit_eventfd2 328
+#define __NR_32bit_epoll_create1 329
+#define __NR_32bit_dup3 330
+#define __NR_32bit_pipe2 331
+#define __NR_32bit_inotify_init1 332
+
+// i386 socketcall() subcalls (from linux/net.h)
+#define SYS_SOCKET 1
+#define SYS_ACCEPT 5
+#define SYS_GETSOCKNAME 6
+#define SYS_GETPEERNAME 7
+#define SYS_SOCKETPAIR 8
+#define SYS_RECV 10
+#define SYS_RECVFROM 12
+#define SYS_GETSOCKOPT 15
+#define SYS_ACCEPT4 18
+
+// fcntl() commands that create a file descriptor
+#define FCNTL_F_DUPFD 0
+#define FCNTL_F_DUPFD_CLOEXEC 1030
+
+struct SyscallOutputBuffers {
+  SyscallLogBuffer bufs[SYSCALL_LOG_MAX_BUFFERS];
+  int count;
+
+  SyscallOutputBuffers() { count = 0; }
+
+  void add(W64 addr, W64 length) {
+    if ((!addr) | (!length)) return;
+    assert(count < SYSCALL_LOG_MAX_BUFFERS);
+    bufs[count].addr = addr;
+    bufs[count].length = length;
+    count++;
+  }
+};
+
+//
+// The kernel only writes the first <bytes> bytes of a readv() iovec
+// array: wordsize is 8 for x86-64 iovecs, 4 for i386 iovecs
+//
+static void add_iovecs(SyscallOutputBuffers& out, W64 iov, int iovcnt, W64 bytes, int wordsize) {
+  foreach (i, iovcnt) {
+    if (!bytes) break;
+    W64 base = (wordsize == 8) ? ((W64*)(Waddr)iov)[i*2 + 0] : ((W32*)(Waddr)iov)[i*2 + 0];
+    W64 len = (wordsize == 8) ? ((W64*)(Waddr)iov)[i*2 + 1] : ((W32*)(Waddr)iov)[i*2 + 1];
+    len = min(len, bytes);
+    if (out.count == SYSCALL_LOG_MAX_BUFFERS) {
+      logfile << "SyscallLog: readv() into more than ", SYSCALL_LOG_MAX_BUFFERS, " iovecs: only the first ones are logged", endl;
+      break;
+    }
+    out.add(base, len);
+    bytes -= len;
+  }
+}
+
+//
+// User memory each syscall writes on success. Syscalls not listed
+// here (e.g. most ioctls and fcntl(F_GETLK)) only return a result.
+//
+static void find_output_buffers(SyscallOutputBuffers& out, int abi, int syscallid, const W64* args, W64 result) {
+  W64 r = result;
+
+  if (abi == SYSCALL_ABI_64BIT) {
+    if ((W64s)result < 0) return;
+
+    switch (syscallid) {
+    case __NR_64bit_read: case __NR_64bit_pread64: case __NR_64bit_getdents: case __NR_64bit_getdents64:
+    case __NR_64bit_readlink:
+      out.add(args[1], r); break;
+    case __NR_64bit_getcwd:
+      out.add(args[0], r); break;
+    case __NR_64bit_readv:
+      add_iovecs(out, args[1], args[2], r, 8); break;
+    case __NR_64bit_stat: case __NR_64bit_fstat: case __NR_64bit_lstat:
+      out.add(args[1], 144); break;
+    case __NR_64bit_poll:
+      out.add(args[0], args[1] * 8); break;
+    case __NR_64bit_rt_sigprocmask:
+      out.add(args[2], args[3]); break;
+    case __NR_64bit_pipe: case __NR_64bit_pipe2:
+      out.add(args[0], 2*4); break;
+    case __NR_64bit_select: {
+      W64 setsize = ceil(args[0], 64) / 8;
+      out.add(args[1], setsize); out.add(args[2], setsize); out.add(args[3], setsize); out.add(args[4], 16);
+      break;
+    }
+    case __NR_64bit_nanosleep:
+      out.add(args[1], 16); break;
+    case __NR_64bit_getitimer:
+      out.add(args[1], 32); break;
+    case __NR_64bit_setitimer:
+      out.add(args[2], 32); break;
+    case __NR_64bit_recvfrom:
+      out.add(args[1], r);
+      if (args[5]) { out.add(args[4], *(W32*)(Waddr)args[5]); out.add(args[5], 4); }
+      break;
+    case __NR_64bit_getsockname: case __NR_64bit_getpeername:
+      if (args[2]) { out.add(args[1], *(W32*)(Waddr)args[2]); out.add(args[2], 4); }
+      break;
+    case __NR_64bit_socketpair:
+      out.add(args[3], 2*4); break;
+    case __NR_64bit_getsockopt:
+      if (args[4]) { out.add(args[3], *(W32*)(Waddr)args[4]); out.add(args[4], 4); }
+      break;
+    case __NR_64bit_wait4:
+      out.add(args[1], 4); out.add(args[3], 144); break;
+    case __NR_64bit_uname:
+      out.add(args[0], 6*65); break;
+    case __NR_64bit_gettimeofday:
+      out.add(args[0], 16); out.add(args[1], 8); break;
+    case __NR_64bit_getrlimit:
+      out.add(args[1], 16); break;
+    case __NR_64bit_getrusage:
+      out.add(args[1], 144); break;
+    case __NR_64bit_sysinfo:
+      out.add(args[0], 112); break;
+    case __NR_64bit_times:
+      out.add(args[0], 32); break;
+    case __NR_64bit_getgroups:
+      if (args[0]) out.add(args[1], r * 4);
+      break;
+    case __NR_64bit_getresuid: case __NR_64bit_getresgid:
+      out.add(args[0], 4); out.add(args[1], 4); out.add(args[2], 4); break;
+    case __NR_64bit_sigaltstack:
+      out.add(args[1], 24); break;
+    case __NR_64bit_statfs: case __NR_64bit_fstatfs:
+      out.add(args[1], 120); break;
+    case __NR_64bit_time:
+      out.add(args[0], 8); break;
+    case __NR_64bit_sched_getaffinity:
+      out.add(args[2], r); break;
+    case __NR_64bit_clock_gettime: case __NR_64bit_clock_getres:
+      out.add(args[1], 16); break;
+    case __NR_64bit_epoll_wait:
+      out.add(args[1], r * 12); break;
+    }
+  } else {
+    if ((W32s)result < 0) return;
+    r = LO32(result);
+
+    switch (syscallid) {
+    case __NR_32bit_read: case __NR_32bit_pread64: case __NR_32bit_getdents: case __NR_32bit_getdents64:
+    case __NR_32bit_readlink:
+      out.add(args[1], r); break;
+    case __NR_32bit_getcwd:
+      out.add(args[0], r); break;
+    case __NR_32bit_readv:
+      add_iovecs(out, args[1], args[2], r, 4); break;
+    case __NR_32bit_waitpid:
+      out.add(args[1], 4); break;
+    case __NR_32bit_wait4:
+      out.add(args[1], 4); out.add(args[3], 72); break;
+    case __NR_32bit_time:
+      out.add(args[0], 4); break;
+    case __NR_32bit_pipe: case __NR_32bit_pipe2:
+      out.add(args[0], 2*4); break;
+    case __NR_32bit_socketcall: {
+      // The real arguments are in an array of words in user memory
+      const W32* a = (const W32*)(Waddr)args[1];
+      switch (args[0]) {
+      case SYS_GETSOCKNAME: case SYS_GETPEERNAME:
+        if (a[2]) { out.add(a[1], *(W32*)(Waddr)a[2]); out.add(a[2], 4); }
+        break;
+      case SYS_SOCKETPAIR:
+        out.add(a[3], 2*4); break;
+      case SYS_RECV:
+        out.add(a[1], r); break;
+      case SYS_RECVFROM:
+        out.add(a[1], r);
+        if (a[5]) { out.add(a[4], *(W32*)(Waddr)a[5]); out.add(a[5], 4); }
+        break;
+      case SYS_GETSOCKOPT:
+        if (a[4]) { out.add(a[3], *(W32*)(Waddr)a[4]); out.add(a[4], 4); }
+        break;
+      }
+      break;
+    }
+    case __NR_32bit_times:
+      out.add(args[0], 16); break;
+    case __NR_32bit_getrlimit: case __NR_32bit_ugetrlimit:
+      out.add(args[1], 8); break;
+    case __NR_32bit_getrusage:
+      out.add(args[1], 72); break;
+    case __NR_32bit_gettimeofday:
+      out.add(args[0], 8); out.add(args[1], 8); break;
+    case __NR_32bit_sysinfo:
+      out.add(args[0], 64); break;
+    case __NR_32bit_uname:
+      out.add(args[0], 6*65); break;
+    case __NR_32bit_llseek:
+      out.add(args[3], 8); break;
+    case __NR_32bit_newselect: {
+      W64 setsize = ceil(args[0], 32) / 8;
+      out.add(args[1], setsize); out.add(args[2], setsize); out.add(args[3], setsize); out.add(args[4], 8);
+      break;
+    }
+    case __NR_32bit_nanosleep:
+      out.add(args[1], 8); break;
+    case __NR_32bit_poll:
+      out.add(args[0], args[1] * 8); break;
+    case __NR_32bit_rt_sigprocmask:
+      out.add(args[2], args[3]); break;
+    case __NR_32bit_stat64: case __NR_32bit_lstat64: case __NR_32bit_fstat64:
+      out.add(args[1], 96); break;
+    case __NR_32bit_clock_gettime: case __NR_32bit_clock_getres:
+      out.add(args[1], 8); break;
+    case __NR_32bit_statfs64: case __NR_32bit_fstatfs64:
+      out.add(args[2], args[1]); break;
+    }
+  }
+}
+
+//
+// Syscalls that create or close file descriptors still run for real when
+// replaying: later syscalls PTLsim always performs itself (mmap of a file)
+// name those descriptors, so the host's descriptor table has to match the
+// recorded one. The results must equal the logged ones, or replay stops.
+//
+bool SyscallLog::passthrough(int abi, int syscallid, const W64* args) {
+  if (abi == SYSCALL_ABI_64BIT) {
+    switch (syscallid) {
+    case __NR_64bit_open: case __NR_64bit_openat: case __NR_64bit_creat: case __NR_64bit_close:
+    case __NR_64bit_dup: case __NR_64bit_dup2: case __NR_64bit_dup3:
+    case __NR_64bit_pipe: case __NR_64bit_pipe2: case __NR_64bit_socket: case __NR_64bit_socketpair:
+    case __NR_64bit_accept: case __NR_64bit_accept4:
+    case __NR_64bit_epoll_create: case __NR_64bit_epoll_create1: case __NR_64bit_eventfd: case __NR_64bit_eventfd2:
+    case __NR_64bit_signalfd: case __NR_64bit_signalfd4: case __NR_64bit_timerfd_create:
+    case __NR_64bit_inotify_init: case __NR_64bit_inotify_init1:
+      return true;
+    case __NR_64bit_fcntl:
+      return ((args[1] == FCNTL_F_DUPFD) | (args[1] == FCNTL_F_DUPFD_CLOEXEC));
+    }
+  } else {
+    switch (syscallid) {
+    case __NR_32bit_open: case __NR_32bit_openat: case __NR_32bit_creat: case __NR_32bit_close:
+    case __NR_32bit_dup: case __NR_32bit_dup2: case __NR_32bit_dup3:
+    case __NR_32bit_pipe: case __NR_32bit_pipe2:
+    case __NR_32bit_epoll_create: case __NR_32bit_epoll_create1: case __NR_32bit_eventfd: case __NR_32bit_eventfd2:
+    case __NR_32bit_signalfd: case __NR_32bit_signalfd4: case __NR_32bit_timerfd_create:
+    case __NR_32bit_inotify_init: case __NR_32bit_inotify_init1:
+      return true;
+    case __NR_32bit_fcntl: case __NR_32bit_fcntl64:
+      return ((args[1] == FCNTL_F_DUPFD) | (args[1] == FCNTL_F_DUPFD_CLOEXEC));
+    case __NR_32bit_socketcall:
+      return ((args[0] == SYS_SOCKET) | (args[0] == SYS_ACCEPT) | (args[0] == SYS_SOCKETPAIR) | (args[0] == SYS_ACCEPT4));
+    }
+  }
+
+  return false;
+}
+
+static bool user_range_writable(W64 addr, W64 length) {
+  for (W64 page = floor(addr, PAGE_SIZE); page < addr + length; page += PAGE_SIZE) {
+    if (!asp.check((void*)(Waddr)page, PROT_WRITE)) return false;
+  }
+  return true;
+}
+
+bool SyscallLog::open_record(const char* filename) {
+  close();
+
+  os.open(filename);
+  if unlikely (!os) {
+    logfile << "SyscallLog: cannot open '", filename, "' for writing", endl;
+    return false;
+  }
+
+  SyscallLogHeader header;
+  setzero(header);
+  header.magic = SyscallLogHeader::MAGIC;
+  header.version = SyscallLogHeader::VERSION;
+  os << header;
+
+  seq = 0;
+  logfile << "SyscallLog: recording syscalls to ", filename, endl;
+  return true;
+}
+
+bool SyscallLog::open_replay(const char* filename) {
+  close();
+
+  if unlikely (!is.open(filename)) {
+    logfile << "SyscallLog: cannot open '", filename, "' for reading", endl;
+    return false;
+  }
+
+  SyscallLogHeader header;
+  if unlikely ((is.read(&header, sizeof(header)) != sizeof(header)) ||
+               (header.magic != SyscallLogHeader::MAGIC) || (header.version != SyscallLogHeader::VERSION)) {
+    logfile << "SyscallLog: '", filename, "' is not a syscall log (or has the wrong version)", endl;
+    is.close();
+    return false;
+  }
+
+  seq = 0;
+  logfile << "SyscallLog: replaying syscalls from ", filename, endl;
+  return true;
+}
+
+void SyscallLog::close() {
+  if (os) os.close();
+  is.close();
+}
+
+void SyscallLog::record(int abi, int syscallid, const W64* args, W64 result) {
+  SyscallOutputBuffers out;
+  find_output_buffers(out, abi, syscallid, args, result);
+
+  SyscallLogRecord rec;
+  rec.seq = seq++;
+  rec.syscallid = syscallid;
+  rec.abi = abi;
+  rec.bufcount = out.count;
+  foreach (i, 6) rec.args[i] = args[i];
+  rec.result = result;
+  os << rec;
+
+  foreach (i, out.count) {
+    os << out.bufs[i];
+    os.write((void*)(Waddr)out.bufs[i].addr, out.bufs[i].length);
+  }
+
+  // Make sure the log is complete even if the process is killed
+  os.flush();
+}
+
+static void replay_diverged(const char* reason, W64 seq, int abi, int syscallid) {
+  logfile << "SyscallLog: replay diverged at syscall ", seq, " (#", syscallid, ", ", ((abi == SYSCALL_ABI_64BIT) ? "64-bit" : "32-bit"),
+    ", rip ", (void*)(Waddr)ctx.commitarf[REG_rip], "): ", reason, endl, flush;
+  cerr << "ptlsim: syscall replay diverged at syscall ", seq, ": ", reason, " (see log file for details)", endl, flush;
+  logfile.close();
+  sys_exit(1);
+}
+
+void SyscallLog::next_record(SyscallLogRecord& rec, int abi, int syscallid) {
+  if unlikely (is.read(&rec, sizeof(rec)) != sizeof(rec)) replay_diverged("end of log", seq, abi, syscallid);
+
+  if unlikely ((rec.abi != abi) | (rec.syscallid != syscallid)) {
+    logfile << "SyscallLog: log has syscall #", rec.syscallid, " (", ((rec.abi == SYSCALL_ABI_64BIT) ? "64-bit" : "32-bit"), ") here", endl;
+    replay_diverged("different syscall", seq, abi, syscallid);
+  }
+}
+
+void SyscallLog::replay_passthrough(int abi, int syscallid, const W64* args, W64 result) {
+  SyscallLogRecord rec;
+  next_record(rec, abi, syscallid);
+
+  if unlikely (rec.result != result) {
+    logfile << "SyscallLog: result was ", (W64s)rec.result, " when recorded but is now ", (W64s)result, endl;
+    replay_diverged("different file descriptor result", seq, abi, syscallid);
+  }
+
+  // Descriptors returned through memory (pipe, socketpair) must match too
+  foreach (i, rec.bufcount) {
+    SyscallLogBuffer buf;
+    byte logged[16];
+    if unlikely (is.read(&buf, sizeof(buf)) != sizeof(buf)) replay_diverged("truncated log", seq, abi, syscallid);
+    if unlikely (buf.length > sizeof(logged)) replay_diverged("unexpected output buffer", seq, abi, syscallid);
+    if unlikely (is.read(logged, buf.length) != buf.length) replay_diverged("truncated log", seq, abi, syscallid);
+    if unlikely (memcmp(logged, (void*)(Waddr)buf.addr, buf.length)) replay_diverged("different file descriptors returned", seq, abi, syscallid);
+  }
+
+  seq++;
+}
+
+W64 SyscallLog::replay(int abi, int syscallid, const W64* args) {
+  SyscallLogRecord rec;
+  next_record(rec, abi, syscallid);
+
+  // Pointers may legitimately differ (e.g. a different environment size), so just note it
+  foreach (i, 6) {
+    if unlikely (rec.args[i] != args[i]) {
+      logfile << "SyscallLog: warning: syscall ", seq, " arg ", i+1, " was ", (void*)(Waddr)rec.args[i], " when recorded but is now ", (void*)(Waddr)args[i], endl;
+    }
+  }
+
+  foreach (i, rec.bufcount) {
+    SyscallLogBuffer buf;
+    if unlikely (is.read(&buf, sizeof(buf)) != sizeof(buf)) replay_diverged("truncated log", seq, abi, syscallid);
+    if unlikely (!user_range_writable(buf.addr, buf.length)) replay_diverged("output buffer not writable", seq, abi, syscallid);
+    if unlikely (is.read((void*)(Waddr)buf.addr, buf.length) != buf.length) replay_diverged("truncated log", seq, abi, syscallid);
+  }
+
+  seq++;
+  return rec.result;
+}
@@ -0,0 +1,114 @@
+// -*- c++ -*-
+//
+// PTLsim: Cycle Accurate x86-64 Simulator
+// System Call Record and Replay
+//
+// Copyright 2008 Matt T. Yourst <yourst@yourst.com>
+//
+
+#ifndef _SYSCALLLOG_H_
+#define _SYSCALLLOG_H_
+
+#include <globals.h>
+#include <superstl.h>
+
+//
+// Syscalls forwarded to the host return different results from one
+// run to the next (gettimeofday, reads from pipes and sockets, and so
+// on), so two runs with different core configurations can take
+// different paths through the program. With -syscall-record, every
+// forwarded syscall is logged together with its result and the user
+// memory it wrote; with -syscall-replay, those syscalls are satisfied
+// from the log instead and never reach the host.
+//
+// Syscalls that change the address space or the simulated context
+// (mmap, munmap, mprotect, brk, mremap, arch_prctl, set_thread_area,
+// exit) are never logged: PTLsim always performs them itself, so the
+// replayed process must map the same files at the same addresses.
+// Since file mappings name file descriptors, syscalls that create or
+// close descriptors (open, close, dup, pipe, socket and so on) are
+// logged but also run for real when replaying, and replay stops if
+// they return different descriptors than when recorded. The record
+// and replay runs therefore need the same PTLsim output files open.
+// Only syscalls made in simulation mode are logged, so the record and
+// replay runs must switch to native mode at the same points (or not
+// at all, e.g. with -exitend). Processes created by fork or clone are
+// not replayed.
+//
+// File format:
+//
+//   SyscallLogHeader
+//   { SyscallLogRecord, { SyscallLogBuffer, byte data[buffer.length] }[record.bufcount] }*
+//
+
+struct SyscallLogHeader {
+  W64 magic;
+  W32 version;
+  W32 reserved;
+
+  static const W64 MAGIC = 0x31307379534c5450ULL; // 'PTLSys01'
+  static const W32 VERSION = 1;
+};
+
+enum {
+  SYSCALL_ABI_64BIT = 0,  // x86-64 syscall numbers and structures
+  SYSCALL_ABI_32BIT = 1,  // i386 syscall numbers and structures
+};
+
+struct SyscallLogRecord {
+  W64 seq;
+  W32 syscallid;
+  W16 abi;
+  W16 bufcount;
+  W64 args[6];
+  W64 result;
+};
+
+struct SyscallLogBuffer {
+  W64 addr;
+  W64 length;
+};
+
+// Most user memory buffers any single syscall can write (e.g. select)
+static const int SYSCALL_LOG_MAX_BUFFERS = 8;
+
+struct SyscallLog {
+  odstream os;
+  idstream is;
+  W64 seq;
+
+  SyscallLog() { seq = 0; }
+
+  bool open_record(const char* filename);
+  bool open_replay(const char* filename);
+  void close();
+
+  bool recording() const { return os.ok(); }
+  bool replaying() const { return is.filehandle() >= 0; }
+
+  //
+  // Log a syscall the host has just completed
+  //
+  void record(int abi, int syscallid, const W64* args, W64 result);
+
+  //
+  // Return the result of the next logged syscall and copy its memory
+  // side effects into the user process. Aborts if the process asks
+  // for a different syscall than the one that was recorded.
+  //
+  W64 replay(int abi, int syscallid, const W64* args);
+
+  //
+  // Syscalls that must run on the host even when replaying; the
+  // caller then checks the host's result with replay_passthrough()
+  //
+  static bool passthrough(int abi, int syscallid, const W64* args);
+  void replay_passthrough(int abi, int syscallid, const W64* args, W64 result);
+
+protected:
+  void next_record(SyscallLogRecord& rec, int abi, int syscallid);
+};
+
+extern SyscallLog syscalllog;
+
+#endif // _SYSCALLLOG_H_
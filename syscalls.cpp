@@ -52,6 +52,7 @@ declare_syscall0(__NR_munlockall, int, sys_munlockall);
 
 declare_syscall3(__NR_open, int, sys_open, const char*, pathname, int, flags, int, mode);
 declare_syscall1(__NR_close, int, sys_close, int, fd);
+declare_syscall2(__NR_dup2, int, sys_dup2, int, oldfd, int, newfd);
 declare_syscall3(__NR_read, ssize_t, sys_read, int, fd, void*, buf, size_t, count);
 declare_syscall3(__NR_write, ssize_t, sys_write, int, fd, const void*, buf, size_t, count);
 declare_syscall1(__NR_unlink, int, sys_unlink, const char*, pathname);
@@ -60,6 +61,7 @@ declare_syscall2(__NR_rename, int, sys_rename, const char*, oldpath, const char*
 declare_syscall1(__NR_exit, void, sys_exit, int, code);
 declare_syscall1(__NR_brk, void*, sys_brk, void*, p);
 declare_syscall0(__NR_fork, pid_t, sys_fork);
+declare_syscall1(__NR_pipe, int, sys_pipe, int*, fds);
 declare_syscall3(__NR_execve, int, sys_execve, const char*, filename, const char**, argv, const char**, envp);
 
 declare_syscall0(__NR_getpid, pid_t, sys_getpid);
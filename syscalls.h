@@ -14,6 +14,7 @@
 extern "C" {
   int sys_open(const char* pathname, int flags, int mode);
   int sys_close(int fd);
+  int sys_dup2(int oldfd, int newfd);
   ssize_t sys_read(int fd, void* buf, size_t count);
   ssize_t sys_write(int fd, const void* buf, size_t count);
   ssize_t sys_fdatasync(int fd);
@@ -32,6 +33,7 @@ extern "C" {
   int sys_munlockall(void);
   
   pid_t sys_fork();
+  int sys_pipe(int* fds);
   int sys_execve(const char* filename, const char** argv, const char** envp);
   
   pid_t sys_gettid();
@@ -71,6 +73,7 @@ extern "C" {
   W64 sys_ptrace(int request, pid_t pid, W64 addr, W64 data);
 #else
   int sys_get_thread_area(struct user_desc *u_info);
+  int sys_set_thread_area(struct user_desc *u_info);
   W32 sys_ptrace(int request, pid_t pid, W32 addr, W32 data);
 #endif
 };
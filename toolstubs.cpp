@@ -0,0 +1,22 @@
+//
+// PTLsim: Cycle Accurate x86-64 Simulator
+// Simulator Globals for the Standalone Tools
+//
+// Copyright 2008 Matt T. Yourst <yourst@yourst.com>
+//
+// The objects ptlevents and ptlcachesim share with ptlsim (dcache.o,
+// oooevents.o, seqevents.o) refer to these globals, which ptlsim.cpp
+// normally defines. The tools link this object instead.
+//
+
+#include <globals.h>
+#include <ptlsim.h>
+#include <dcache.h>
+#include <stats.h>
+
+ostream logfile;
+W64 sim_cycle;
+W64 iterations;
+bool logenable;
+PTLsimConfig config;
+PTLsimStats stats;
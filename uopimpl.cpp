@@ -1142,6 +1142,64 @@ uopimpl_func_t implmap_fcmp[8][4] = {
   {&x86_op_fcmp7<OP_fcmp, 0>, &x86_op_fcmp7<OP_fcmp, 1>, &x86_op_fcmp7<OP_fcmp, 2>, &x86_op_fcmp7<OP_fcmp, 3>}
 };
 
+//
+// fround (roundss, roundps, roundsd, roundpd): round <rb> to an integral
+// value. The mode (uop.cond) is 0 = nearest even, 1 = down, 2 = up,
+// 3 = toward zero, or 4-7 to use the MXCSR rounding control. For the
+// scalar single datatype, the high 32 bits come from <ra>.
+//
+template <int mode>
+static inline double round_to_integral(double x) {
+  // Anything this large is already integral (NaNs and infinities pass through too)
+  if (!((x < 4503599627370496.0) & (x > -4503599627370496.0))) return x;
+  int rc = (mode & 4) ? bits(x86_get_mxcsr(), 13, 2) : mode;
+  W64s i = (W64s)x;
+  double t = (double)i;
+  double f = x - t;
+
+  switch (rc) {
+  case 0:
+    if ((f > 0.5) | ((f == 0.5) & (i & 1))) t += 1.0;
+    if ((f < -0.5) | ((f == -0.5) & (i & 1))) t -= 1.0;
+    break;
+  case 1:
+    if (f < 0) t -= 1.0; break;
+  case 2:
+    if (f > 0) t += 1.0; break;
+  }
+
+  // A zero result keeps the sign of the input
+  if (t == 0) { SSEType z; z.d = x; z.w64 &= (1ULL << 63); return z.d; }
+  return t;
+}
+
+template <int datatype, int mode>
+void uop_impl_fround(IssueState& state, W64 ra, W64 rb, W64 rc, W16 raflags, W16 rbflags, W16 rcflags) {
+  SSEType a(ra), b(rb), d;
+  if (datatype == 0) {
+    d.f.lo = round_to_integral<mode>(b.f.lo);
+    d.w32.hi = a.w32.hi;
+  } else if (datatype == 1) {
+    d.f.lo = round_to_integral<mode>(b.f.lo);
+    d.f.hi = round_to_integral<mode>(b.f.hi);
+  } else {
+    d.d = round_to_integral<mode>(b.d);
+  }
+  state.reg.rddata = d;
+  state.reg.rdflags = 0;
+}
+
+uopimpl_func_t implmap_fround[8][4] = {
+  {&uop_impl_fround<0, 0>, &uop_impl_fround<1, 0>, &uop_impl_fround<2, 0>, &uop_impl_fround<3, 0>},
+  {&uop_impl_fround<0, 1>, &uop_impl_fround<1, 1>, &uop_impl_fround<2, 1>, &uop_impl_fround<3, 1>},
+  {&uop_impl_fround<0, 2>, &uop_impl_fround<1, 2>, &uop_impl_fround<2, 2>, &uop_impl_fround<3, 2>},
+  {&uop_impl_fround<0, 3>, &uop_impl_fround<1, 3>, &uop_impl_fround<2, 3>, &uop_impl_fround<3, 3>},
+  {&uop_impl_fround<0, 4>, &uop_impl_fround<1, 4>, &uop_impl_fround<2, 4>, &uop_impl_fround<3, 4>},
+  {&uop_impl_fround<0, 5>, &uop_impl_fround<1, 5>, &uop_impl_fround<2, 5>, &uop_impl_fround<3, 5>},
+  {&uop_impl_fround<0, 6>, &uop_impl_fround<1, 6>, &uop_impl_fround<2, 6>, &uop_impl_fround<3, 6>},
+  {&uop_impl_fround<0, 7>, &uop_impl_fround<1, 7>, &uop_impl_fround<2, 7>, &uop_impl_fround<3, 7>}
+};
+
 template <int comptype>
 void uop_impl_fcmpcc(IssueState& state, W64 ra, W64 rb, W64 rc, W16 raflags, W16 rbflags, W16 rcflags) {
   W64 rd;
@@ -1343,12 +1401,13 @@ make_x86_vecop_named_sizes(vsar,    nop,     psraw,   psrad,  nop,   sizes(0,1,1
 
 make_x86_vecop_named_sizes(vavg,    pavgb,   pavgw,   nop,    nop,   sizes(1,1,0,0));
 // cmpv dealt with later
-make_x86_vecop_named_sizes(vmin,    pminub,  nop,     nop,    nop,   sizes(1,0,0,0));
-make_x86_vecop_named_sizes(vmax,    pmaxub,  nop,     nop,    nop,   sizes(1,0,0,0));
-make_x86_vecop_named_sizes(vmin_s,  nop,     pminsw,  nop,    nop,   sizes(0,1,0,0));
-make_x86_vecop_named_sizes(vmax_s,  nop,     pmaxsw,  nop,    nop,   sizes(0,1,0,0));
+// The remaining sizes of min, max and mull (SSE4.1) are done lane-wise later
+make_x86_vecop2_named_sizes(x86_op_vmin, pminub, nop, nop, nop, sizes(1,0,0,0), "");
+make_x86_vecop2_named_sizes(x86_op_vmax, pmaxub, nop, nop, nop, sizes(1,0,0,0), "");
+make_x86_vecop2_named_sizes(x86_op_vmin_s, nop, pminsw, nop, nop, sizes(0,1,0,0), "");
+make_x86_vecop2_named_sizes(x86_op_vmax_s, nop, pmaxsw, nop, nop, sizes(0,1,0,0), "");
 
-make_x86_vecop_named_sizes(vmull,   nop,    pmullw,   nop,    nop,   sizes(0,1,0,0));
+make_x86_vecop2_named_sizes(x86_op_vmull, nop, pmullw, nop, nop, sizes(0,1,0,0), "");
 make_x86_vecop_named_sizes(vmulh,   nop,    pmulhw,   nop,    nop,   sizes(0,1,0,0));
 make_x86_vecop_named_sizes(vmulhu,  nop,    pmulhuw,  nop,    nop,   sizes(0,1,0,0));
 
@@ -1387,9 +1446,114 @@ void name(IssueState& state, W64 ra, W64 rb, W64 rc, W16 raflags, W16 rbflags, W
   make_x86_pack_vecop2_named_sizes(x86_op_##name, name0, name1, name2, name3, sizemask, ""); \
   uopimpl_func_t implmap_##name[4] = {&x86_op_##name<OP_##name, 0>, &x86_op_##name<OP_##name, 1>, &x86_op_##name<OP_##name, 2>, &x86_op_##name<OP_##name, 3>}
 
-make_x86_pack_vecop_named_sizes(vpack_us, packuswb,nop,     nop,    nop, sizes(1,0,0,0));
+make_x86_pack_vecop2_named_sizes(x86_op_vpack_us, packuswb, nop, nop, nop, sizes(1,0,0,0), "");
 make_x86_pack_vecop_named_sizes(vpack_ss, packsswb,packssdw,nop,    nop, sizes(1,1,0,0));
 
+//
+// 128-bit vector uops: each operand is a pair of adjacent 64-bit
+// registers (not necessarily 16 byte aligned), so one host SSE
+// instruction does the work of both halves.
+//
+#define make_vec128op(name, opcode, extra) \
+void name(IssueState& state, const W64* ra, const W64* rb) { \
+  vec16b va, vb; \
+  asm("movdqu %[ra],%[va]; movdqu %[rb],%[vb]; " #opcode " " extra "%[vb],%[va]; movdqu %[va],%[rd];" \
+      : [rd] "=m" (state.vreg), [va] "=&x" (va), [vb] "=&x" (vb) \
+      : [ra] "m" (*(const vec16b*)ra), [rb] "m" (*(const vec16b*)rb)); \
+}
+
+// Fills unsupported slots: the decoder splits those into two 64-bit uops
+#define vec128_op_none_0 null
+#define vec128_op_none_1 null
+#define vec128_op_none_2 null
+#define vec128_op_none_3 null
+
+#define make_vec128op_named_sizes(name, name0, name1, name2, name3) \
+  uopimpl_vec128_func_t vec128map_##name[4] = {vec128_op_##name0, vec128_op_##name1, vec128_op_##name2, vec128_op_##name3}
+
+#define make_vec128op_insn(insn) make_vec128op(vec128_op_##insn, insn, "")
+
+make_vec128op_insn(paddb); make_vec128op_insn(paddw); make_vec128op_insn(paddd); make_vec128op_insn(paddq);
+make_vec128op_insn(psubb); make_vec128op_insn(psubw); make_vec128op_insn(psubd); make_vec128op_insn(psubq);
+make_vec128op_insn(paddusb); make_vec128op_insn(paddusw); make_vec128op_insn(psubusb); make_vec128op_insn(psubusw);
+make_vec128op_insn(paddsb); make_vec128op_insn(paddsw); make_vec128op_insn(psubsb); make_vec128op_insn(psubsw);
+make_vec128op_insn(psllw); make_vec128op_insn(pslld); make_vec128op_insn(psllq);
+make_vec128op_insn(psrlw); make_vec128op_insn(psrld); make_vec128op_insn(psrlq);
+make_vec128op_insn(psraw); make_vec128op_insn(psrad);
+make_vec128op_insn(pavgb); make_vec128op_insn(pavgw);
+make_vec128op_insn(pminub); make_vec128op_insn(pmaxub); make_vec128op_insn(pminsw); make_vec128op_insn(pmaxsw);
+make_vec128op_insn(pmullw); make_vec128op_insn(pmulhw); make_vec128op_insn(pmulhuw);
+make_vec128op_insn(pmaddwd); make_vec128op_insn(psadbw);
+make_vec128op_insn(pand); make_vec128op_insn(por); make_vec128op_insn(pxor); make_vec128op_insn(pandn);
+
+make_vec128op_named_sizes(vadd,    paddb,   paddw,   paddd,  paddq);
+make_vec128op_named_sizes(vsub,    psubb,   psubw,   psubd,  psubq);
+make_vec128op_named_sizes(vadd_us, paddusb, paddusw, none_2, none_3);
+make_vec128op_named_sizes(vsub_us, psubusb, psubusw, none_2, none_3);
+make_vec128op_named_sizes(vadd_ss, paddsb,  paddsw,  none_2, none_3);
+make_vec128op_named_sizes(vsub_ss, psubsb,  psubsw,  none_2, none_3);
+make_vec128op_named_sizes(vshl,    none_0,  psllw,   pslld,  psllq);
+make_vec128op_named_sizes(vshr,    none_0,  psrlw,   psrld,  psrlq);
+make_vec128op_named_sizes(vsar,    none_0,  psraw,   psrad,  none_3);
+make_vec128op_named_sizes(vavg,    pavgb,   pavgw,   none_2, none_3);
+make_vec128op_named_sizes(vmin,    pminub,  none_1,  none_2, none_3);
+make_vec128op_named_sizes(vmax,    pmaxub,  none_1,  none_2, none_3);
+make_vec128op_named_sizes(vmin_s,  none_0,  pminsw,  none_2, none_3);
+make_vec128op_named_sizes(vmax_s,  none_0,  pmaxsw,  none_2, none_3);
+make_vec128op_named_sizes(vmull,   none_0,  pmullw,  none_2, none_3);
+make_vec128op_named_sizes(vmulh,   none_0,  pmulhw,  none_2, none_3);
+make_vec128op_named_sizes(vmulhu,  none_0,  pmulhuw, none_2, none_3);
+make_vec128op_named_sizes(vmaddp,  none_0,  pmaddwd, none_2, none_3);
+make_vec128op_named_sizes(vsad,    none_0,  psadbw,  none_2, none_3);
+
+// Logical ops are bitwise, so only the 64-bit size (3) is used
+make_vec128op_named_sizes(and,     none_0,  none_1,  none_2, pand);
+make_vec128op_named_sizes(or,      none_0,  none_1,  none_2, por);
+make_vec128op_named_sizes(xor,     none_0,  none_1,  none_2, pxor);
+make_vec128op_named_sizes(andnot,  none_0,  none_1,  none_2, pandn);
+
+//
+// Packed floating point: size 1 = packed single (ps), 3 = packed double (pd)
+//
+#define make_vec128_floatop(name, opcode, extra) \
+  make_vec128op(vec128_op_##name##_ps, opcode##ps, extra); \
+  make_vec128op(vec128_op_##name##_pd, opcode##pd, extra)
+
+#define make_vec128_floatop_alltypes(name, opcode) \
+  make_vec128_floatop(name, opcode, ""); \
+  uopimpl_vec128_func_t vec128map_##name[4] = {null, &vec128_op_##name##_ps, null, &vec128_op_##name##_pd}
+
+make_vec128_floatop_alltypes(fadd, add);
+make_vec128_floatop_alltypes(fsub, sub);
+make_vec128_floatop_alltypes(fmul, mul);
+make_vec128_floatop_alltypes(fdiv, div);
+make_vec128_floatop_alltypes(fsqrt, sqrt);
+make_vec128_floatop_alltypes(fmin, min);
+make_vec128_floatop_alltypes(fmax, max);
+
+make_vec128op(vec128_op_frcp_ps, rcpps, "");
+make_vec128op(vec128_op_frsqrt_ps, rsqrtps, "");
+uopimpl_vec128_func_t vec128map_frcp[4] = {null, &vec128_op_frcp_ps, null, null};
+uopimpl_vec128_func_t vec128map_frsqrt[4] = {null, &vec128_op_frsqrt_ps, null, null};
+
+make_vec128_floatop(fcmp0, cmp, "$0,");
+make_vec128_floatop(fcmp1, cmp, "$1,");
+make_vec128_floatop(fcmp2, cmp, "$2,");
+make_vec128_floatop(fcmp3, cmp, "$3,");
+make_vec128_floatop(fcmp4, cmp, "$4,");
+make_vec128_floatop(fcmp5, cmp, "$5,");
+make_vec128_floatop(fcmp6, cmp, "$6,");
+make_vec128_floatop(fcmp7, cmp, "$7,");
+
+#define vec128map_fcmp_cond(cond) {null, &vec128_op_fcmp##cond##_ps, null, &vec128_op_fcmp##cond##_pd}
+
+uopimpl_vec128_func_t vec128map_fcmp[8][4] = {
+  vec128map_fcmp_cond(0), vec128map_fcmp_cond(1), vec128map_fcmp_cond(2), vec128map_fcmp_cond(3),
+  vec128map_fcmp_cond(4), vec128map_fcmp_cond(5), vec128map_fcmp_cond(6), vec128map_fcmp_cond(7),
+};
+
+#undef vec128map_fcmp_cond
+
 //
 // btv (bit test vector):
 //
@@ -1507,6 +1671,221 @@ uopimpl_func_t implmap_vcmp[16][4] = {
 };
 
 #undef makecond
+
+//
+// Lane-wise vector uops (mostly SSSE3 and SSE4.1). These are computed
+// one element at a time in C, since the host may predate the SSE
+// instructions that would otherwise do the work.
+//
+template <int sizeshift>
+static inline W64 vlane(W64 v, int i) {
+  return bits(v, i * (8 << sizeshift), (8 << sizeshift));
+}
+
+template <int sizeshift>
+static inline W64s vlane_s(W64 v, int i) {
+  return signext64(vlane<sizeshift>(v, i), (8 << sizeshift));
+}
+
+template <int sizeshift>
+static inline W64 vlane_put(W64 v, int i, W64 x) {
+  return v | (lowbits(x, (8 << sizeshift)) << (i * (8 << sizeshift)));
+}
+
+template <int sizeshift>
+static inline W64s vsat_s(W64s x) {
+  // Computed unsigned so the 64-bit lane bounds do not overflow
+  W64s hi = W64s((W64(1) << ((8 << sizeshift)-1)) - 1);
+  W64s lo = -hi - 1;
+  return (x < lo) ? lo : (x > hi) ? hi : x;
+}
+
+template <int sizeshift>
+static inline W64 vsat_u(W64s x) {
+  W64s hi = (1LL << (8 << sizeshift)) - 1;
+  return (x < 0) ? 0 : (x > hi) ? hi : x;
+}
+
+#define lanesof(sizeshift) (1 << (3-(sizeshift)))
+
+// vmin, vmax, vmin.s, vmax.s
+template <int sizeshift, bool sign, bool max>
+void uop_impl_vminmax(IssueState& state, W64 ra, W64 rb, W64 rc, W16 raflags, W16 rbflags, W16 rcflags) {
+  W64 rd = 0;
+  foreach (i, lanesof(sizeshift)) {
+    bool less = (sign) ? (vlane_s<sizeshift>(ra, i) < vlane_s<sizeshift>(rb, i)) : (vlane<sizeshift>(ra, i) < vlane<sizeshift>(rb, i));
+    rd = vlane_put<sizeshift>(rd, i, (less ^ max) ? vlane<sizeshift>(ra, i) : vlane<sizeshift>(rb, i));
+  }
+  state.reg.rddata = rd;
+  state.reg.rdflags = 0;
+}
+
+uopimpl_func_t implmap_vmin[4] = {&x86_op_vmin<OP_vmin, 0>, &uop_impl_vminmax<1, 0, 0>, &uop_impl_vminmax<2, 0, 0>, &uop_impl_vminmax<3, 0, 0>};
+uopimpl_func_t implmap_vmax[4] = {&x86_op_vmax<OP_vmax, 0>, &uop_impl_vminmax<1, 0, 1>, &uop_impl_vminmax<2, 0, 1>, &uop_impl_vminmax<3, 0, 1>};
+uopimpl_func_t implmap_vmin_s[4] = {&uop_impl_vminmax<0, 1, 0>, &x86_op_vmin_s<OP_vmin_s, 1>, &uop_impl_vminmax<2, 1, 0>, &uop_impl_vminmax<3, 1, 0>};
+uopimpl_func_t implmap_vmax_s[4] = {&uop_impl_vminmax<0, 1, 1>, &x86_op_vmax_s<OP_vmax_s, 1>, &uop_impl_vminmax<2, 1, 1>, &uop_impl_vminmax<3, 1, 1>};
+
+// vmull (pmulld)
+template <int sizeshift>
+void uop_impl_vmull(IssueState& state, W64 ra, W64 rb, W64 rc, W16 raflags, W16 rbflags, W16 rcflags) {
+  W64 rd = 0;
+  foreach (i, lanesof(sizeshift)) rd = vlane_put<sizeshift>(rd, i, vlane<sizeshift>(ra, i) * vlane<sizeshift>(rb, i));
+  state.reg.rddata = rd;
+  state.reg.rdflags = 0;
+}
+
+uopimpl_func_t implmap_vmull[4] = {&x86_op_nop<OP_vmull, 0>, &x86_op_vmull<OP_vmull, 1>, &uop_impl_vmull<2>, &uop_impl_vmull<3>};
+
+// vpack.us (packusdw): pack the elements of <ra> then <rb> into elements of size uop.size
+template <int sizeshift>
+void uop_impl_vpack_us(IssueState& state, W64 ra, W64 rb, W64 rc, W16 raflags, W16 rbflags, W16 rcflags) {
+  W64 rd = 0;
+  int n = lanesof(sizeshift+1);
+  foreach (i, n) {
+    rd = vlane_put<sizeshift>(rd, i, vsat_u<sizeshift>(vlane_s<sizeshift+1>(ra, i)));
+    rd = vlane_put<sizeshift>(rd, n + i, vsat_u<sizeshift>(vlane_s<sizeshift+1>(rb, i)));
+  }
+  state.reg.rddata = rd;
+  state.reg.rdflags = 0;
+}
+
+uopimpl_func_t implmap_vpack_us[4] = {&x86_op_vpack_us<OP_vpack_us, 0>, &uop_impl_vpack_us<1>, &x86_op_nop<OP_vpack_us, 2>, &x86_op_nop<OP_vpack_us, 3>};
+
+// vabs (pabsX): absolute value of each element in <rb>
+template <int sizeshift>
+void uop_impl_vabs(IssueState& state, W64 ra, W64 rb, W64 rc, W16 raflags, W16 rbflags, W16 rcflags) {
+  W64 rd = 0;
+  foreach (i, lanesof(sizeshift)) {
+    W64s x = vlane_s<sizeshift>(rb, i);
+    rd = vlane_put<sizeshift>(rd, i, (x < 0) ? -x : x);
+  }
+  state.reg.rddata = rd;
+  state.reg.rdflags = 0;
+}
+
+uopimpl_func_t implmap_vabs[4] = {&uop_impl_vabs<0>, &uop_impl_vabs<1>, &uop_impl_vabs<2>, &uop_impl_vabs<3>};
+
+// vsign (psignX): negate, zero or keep each element in <ra> by the sign of <rb>
+template <int sizeshift>
+void uop_impl_vsign(IssueState& state, W64 ra, W64 rb, W64 rc, W16 raflags, W16 rbflags, W16 rcflags) {
+  W64 rd = 0;
+  foreach (i, lanesof(sizeshift)) {
+    W64s a = vlane_s<sizeshift>(ra, i);
+    W64s b = vlane_s<sizeshift>(rb, i);
+    rd = vlane_put<sizeshift>(rd, i, (b < 0) ? -a : (b == 0) ? 0 : a);
+  }
+  state.reg.rddata = rd;
+  state.reg.rdflags = 0;
+}
+
+uopimpl_func_t implmap_vsign[4] = {&uop_impl_vsign<0>, &uop_impl_vsign<1>, &uop_impl_vsign<2>, &uop_impl_vsign<3>};
+
+//
+// vhadd, vhsub, vhadd.ss, vhsub.ss (phaddX, phsubX): the low half of
+// the result combines adjacent pairs of elements in <ra>; the high
+// half does the same for <rb>.
+//
+template <int sizeshift, bool sub, bool sat>
+void uop_impl_vhaddsub(IssueState& state, W64 ra, W64 rb, W64 rc, W16 raflags, W16 rbflags, W16 rcflags) {
+  W64 rd = 0;
+  int n = lanesof(sizeshift) / 2;
+  foreach (i, n) {
+    W64s a = (sub) ? (vlane_s<sizeshift>(ra, 2*i) - vlane_s<sizeshift>(ra, 2*i+1)) : (vlane_s<sizeshift>(ra, 2*i) + vlane_s<sizeshift>(ra, 2*i+1));
+    W64s b = (sub) ? (vlane_s<sizeshift>(rb, 2*i) - vlane_s<sizeshift>(rb, 2*i+1)) : (vlane_s<sizeshift>(rb, 2*i) + vlane_s<sizeshift>(rb, 2*i+1));
+    rd = vlane_put<sizeshift>(rd, i, (sat) ? vsat_s<sizeshift>(a) : a);
+    rd = vlane_put<sizeshift>(rd, n + i, (sat) ? vsat_s<sizeshift>(b) : b);
+  }
+  state.reg.rddata = rd;
+  state.reg.rdflags = 0;
+}
+
+uopimpl_func_t implmap_vhadd[4] = {&uop_impl_vhaddsub<0, 0, 0>, &uop_impl_vhaddsub<1, 0, 0>, &uop_impl_vhaddsub<2, 0, 0>, &uop_impl_vhaddsub<3, 0, 0>};
+uopimpl_func_t implmap_vhsub[4] = {&uop_impl_vhaddsub<0, 1, 0>, &uop_impl_vhaddsub<1, 1, 0>, &uop_impl_vhaddsub<2, 1, 0>, &uop_impl_vhaddsub<3, 1, 0>};
+uopimpl_func_t implmap_vhadd_ss[4] = {&x86_op_nop<OP_vhadd_ss, 0>, &uop_impl_vhaddsub<1, 0, 1>, &x86_op_nop<OP_vhadd_ss, 2>, &x86_op_nop<OP_vhadd_ss, 3>};
+uopimpl_func_t implmap_vhsub_ss[4] = {&x86_op_nop<OP_vhsub_ss, 0>, &uop_impl_vhaddsub<1, 1, 1>, &x86_op_nop<OP_vhsub_ss, 2>, &x86_op_nop<OP_vhsub_ss, 3>};
+
+// vmaddubs (pmaddubsw): unsigned bytes in <ra> times signed bytes in <rb>, adjacent pairs summed with signed saturation
+void uop_impl_vmaddubs(IssueState& state, W64 ra, W64 rb, W64 rc, W16 raflags, W16 rbflags, W16 rcflags) {
+  W64 rd = 0;
+  foreach (i, 4) {
+    W64s x = (vlane<0>(ra, 2*i) * vlane_s<0>(rb, 2*i)) + (vlane<0>(ra, 2*i+1) * vlane_s<0>(rb, 2*i+1));
+    rd = vlane_put<1>(rd, i, vsat_s<1>(x));
+  }
+  state.reg.rddata = rd;
+  state.reg.rdflags = 0;
+}
+
+// vmulhrs (pmulhrsw): high half of signed 16-bit product, rounded
+void uop_impl_vmulhrs(IssueState& state, W64 ra, W64 rb, W64 rc, W16 raflags, W16 rbflags, W16 rcflags) {
+  W64 rd = 0;
+  foreach (i, 4) {
+    W64s x = vlane_s<1>(ra, i) * vlane_s<1>(rb, i);
+    rd = vlane_put<1>(rd, i, ((x >> 14) + 1) >> 1);
+  }
+  state.reg.rddata = rd;
+  state.reg.rdflags = 0;
+}
+
+//
+// vshufb (pshufb): each byte of <rc> selects a byte from the 16 byte
+// table <rb>:<ra>, or zero if its high bit is set
+//
+void uop_impl_vshufb(IssueState& state, W64 ra, W64 rb, W64 rc, W16 raflags, W16 rbflags, W16 rcflags) {
+  W64 rd = 0;
+  foreach (i, 8) {
+    int sel = vlane<0>(rc, i);
+    W64 x = (sel & 0x80) ? 0 : vlane<0>((sel & 8) ? rb : ra, sel & 7);
+    rd = vlane_put<0>(rd, i, x);
+  }
+  state.reg.rddata = rd;
+  state.reg.rdflags = 0;
+}
+
+// vsel (pblendvb, blendvps, blendvpd): each element is taken from <rb> if the sign bit of that element in <rc> is set, otherwise from <ra>
+template <int sizeshift>
+void uop_impl_vsel(IssueState& state, W64 ra, W64 rb, W64 rc, W16 raflags, W16 rbflags, W16 rcflags) {
+  W64 rd = 0;
+  foreach (i, lanesof(sizeshift)) rd = vlane_put<sizeshift>(rd, i, (vlane_s<sizeshift>(rc, i) < 0) ? vlane<sizeshift>(rb, i) : vlane<sizeshift>(ra, i));
+  state.reg.rddata = rd;
+  state.reg.rdflags = 0;
+}
+
+uopimpl_func_t implmap_vsel[4] = {&uop_impl_vsel<0>, &uop_impl_vsel<1>, &uop_impl_vsel<2>, &uop_impl_vsel<3>};
+
+// vtest (ptest): ZF = (<ra> == 0), CF = (<rb> == 0), all other flags cleared
+void uop_impl_vtest(IssueState& state, W64 ra, W64 rb, W64 rc, W16 raflags, W16 rbflags, W16 rcflags) {
+  state.reg.rddata = 0;
+  state.reg.rdflags = ((ra == 0) ? FLAG_ZF : 0) | ((rb == 0) ? FLAG_CF : 0);
+}
+
+// vminpos (phminposuw): minimum unsigned word of <rb>:<ra> in bits 15:0 and the index of its first occurrence in bits 18:16
+void uop_impl_vminpos(IssueState& state, W64 ra, W64 rb, W64 rc, W16 raflags, W16 rbflags, W16 rcflags) {
+  W64 minval = vlane<1>(ra, 0);
+  int index = 0;
+  foreach (i, 8) {
+    W64 x = vlane<1>((i < 4) ? ra : rb, i & 3);
+    if (x < minval) { minval = x; index = i; }
+  }
+  state.reg.rddata = minval | (index << 16);
+  state.reg.rdflags = 0;
+}
+
+// vmpsad (mpsadbw): word i is the sum of absolute differences between bytes i to i+3 of <ra> and the low 4 bytes of <rb>
+void uop_impl_vmpsad(IssueState& state, W64 ra, W64 rb, W64 rc, W16 raflags, W16 rbflags, W16 rcflags) {
+  W64 rd = 0;
+  foreach (i, 4) {
+    W64 sum = 0;
+    foreach (j, 4) {
+      W64s diff = (W64s)vlane<0>(ra, i + j) - (W64s)vlane<0>(rb, j);
+      sum += (diff < 0) ? -diff : diff;
+    }
+    rd = vlane_put<1>(rd, i, sum);
+  }
+  state.reg.rddata = rd;
+  state.reg.rdflags = 0;
+}
+
+#undef lanesof
 #undef sizes
 
 uopimpl_func_t get_synthcode_for_uop(int op, int size, bool setflags, int cond, int extshift, bool except, bool internal) {
@@ -1697,6 +2076,8 @@ uopimpl_func_t get_synthcode_for_uop(int op, int size, bool setflags, int cond,
     func = implmap_fmax[size]; break;
   case OP_fcmp:
     func = implmap_fcmp[cond][size]; break;
+  case OP_fround:
+    func = implmap_fround[cond][size]; break;
   case OP_fcmpcc:
     func = implmap_fcmpcc[cond][size]; break;
 
@@ -1783,6 +2164,32 @@ uopimpl_func_t get_synthcode_for_uop(int op, int size, bool setflags, int cond,
     func = implmap_vpack_us[size]; break;
   case OP_vpack_ss:
     func = implmap_vpack_ss[size]; break;
+  case OP_vabs:
+    func = implmap_vabs[size]; break;
+  case OP_vsign:
+    func = implmap_vsign[size]; break;
+  case OP_vhadd:
+    func = implmap_vhadd[size]; break;
+  case OP_vhsub:
+    func = implmap_vhsub[size]; break;
+  case OP_vhadd_ss:
+    func = implmap_vhadd_ss[size]; break;
+  case OP_vhsub_ss:
+    func = implmap_vhsub_ss[size]; break;
+  case OP_vmaddubs:
+    func = uop_impl_vmaddubs; break;
+  case OP_vmulhrs:
+    func = uop_impl_vmulhrs; break;
+  case OP_vshufb:
+    func = uop_impl_vshufb; break;
+  case OP_vsel:
+    func = implmap_vsel[size]; break;
+  case OP_vtest:
+    func = uop_impl_vtest; break;
+  case OP_vminpos:
+    func = uop_impl_vminpos; break;
+  case OP_vmpsad:
+    func = uop_impl_vmpsad; break;
   default:
     logfile << "Unknown uop opcode ", op, flush, " (", nameof(op), ")", endl, flush;
     assert(false);
@@ -1790,11 +2197,94 @@ uopimpl_func_t get_synthcode_for_uop(int op, int size, bool setflags, int cond,
   return func;
 }
 
+//
+// Returns null if there is no 128-bit version of the uop, in which
+// case the decoder must split it into 64-bit halves as usual
+//
+uopimpl_vec128_func_t get_synthcode_for_vec128_uop(int op, int size, int cond) {
+  switch (op) {
+  case OP_and:
+    return vec128map_and[size];
+  case OP_or:
+    return vec128map_or[size];
+  case OP_xor:
+    return vec128map_xor[size];
+  case OP_andnot:
+    return vec128map_andnot[size];
+  case OP_vadd:
+    return vec128map_vadd[size];
+  case OP_vsub:
+    return vec128map_vsub[size];
+  case OP_vadd_us:
+    return vec128map_vadd_us[size];
+  case OP_vsub_us:
+    return vec128map_vsub_us[size];
+  case OP_vadd_ss:
+    return vec128map_vadd_ss[size];
+  case OP_vsub_ss:
+    return vec128map_vsub_ss[size];
+  case OP_vshl:
+    return vec128map_vshl[size];
+  case OP_vshr:
+    return vec128map_vshr[size];
+  case OP_vsar:
+    return vec128map_vsar[size];
+  case OP_vavg:
+    return vec128map_vavg[size];
+  case OP_vmin:
+    return vec128map_vmin[size];
+  case OP_vmax:
+    return vec128map_vmax[size];
+  case OP_vmin_s:
+    return vec128map_vmin_s[size];
+  case OP_vmax_s:
+    return vec128map_vmax_s[size];
+  case OP_vmull:
+    return vec128map_vmull[size];
+  case OP_vmulh:
+    return vec128map_vmulh[size];
+  case OP_vmulhu:
+    return vec128map_vmulhu[size];
+  case OP_vmaddp:
+    return vec128map_vmaddp[size];
+  case OP_vsad:
+    return vec128map_vsad[size];
+  case OP_fadd:
+    return vec128map_fadd[size];
+  case OP_fsub:
+    return vec128map_fsub[size];
+  case OP_fmul:
+    return vec128map_fmul[size];
+  case OP_fdiv:
+    return vec128map_fdiv[size];
+  case OP_fsqrt:
+    return vec128map_fsqrt[size];
+  case OP_frcp:
+    return vec128map_frcp[size];
+  case OP_frsqrt:
+    return vec128map_frsqrt[size];
+  case OP_fmin:
+    return vec128map_fmin[size];
+  case OP_fmax:
+    return vec128map_fmax[size];
+  case OP_fcmp:
+    return vec128map_fcmp[cond & 7][size];
+  }
+
+  return null;
+}
+
 void synth_uops_for_bb(BasicBlock& bb) {
-  bb.synthops = new uopimpl_func_t[bb.count];
+  bb.synthops = (bb.capacity) ? bb.inline_synthops() : new uopimpl_func_t[bb.count];
   foreach (i, bb.count) {
     const TransOp& transop = bb.transops[i];
-    uopimpl_func_t func = get_synthcode_for_uop(transop.opcode, transop.size, transop.setflags, transop.cond, transop.extshift, 0, transop.internal);
+    uopimpl_func_t func;
+    if unlikely (transop.vec128) {
+      func = (uopimpl_func_t)get_synthcode_for_vec128_uop(transop.opcode, transop.size, transop.cond);
+      assert(func);
+    } else {
+      func = get_synthcode_for_uop(transop.opcode, transop.size, transop.setflags, transop.cond, transop.extshift, 0, transop.internal);
+    }
     bb.synthops[i] = func;
   }
 }